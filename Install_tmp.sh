@@ -25,9 +25,17 @@ action () {
 # all package files with no dependencies
 
 for file in *.cpp *.h; do
-  action $file
+  case $file in
+    *_omp.cpp|*_omp.h) ;;
+    *) action $file ;;
+  esac
 done
 
+# OpenMP styles need the USER-OMP package
+
+action pair_lj_off_omp.cpp thr_omp.h
+action pair_lj_off_omp.h thr_omp.h
+
 # edit 2 Makefile.package files to include/exclude package info
 
 if (test $1 = 1) then
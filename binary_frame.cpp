@@ -0,0 +1,61 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#include <string.h>
+#include <stdint.h>
+#include "binary_frame.h"
+
+using namespace LAMMPS_NS;
+
+/* ----------------------------------------------------------------------
+   write file header, names longer than 31 chars are truncated
+------------------------------------------------------------------------- */
+
+void LAMMPS_NS::binary_frame_header(FILE *fp, const char *id, int ncols,
+                                    char **names)
+{
+  char magic[8] = {'G','L','E','F','R','A','M','E'};
+  int32_t head[4];
+  head[0] = 1;
+  head[1] = 0x01020304;
+  head[2] = ncols;
+  head[3] = 64 + BINARY_FRAME_NAMELEN*ncols;
+  int32_t reserved[2] = {0,0};
+  char name[BINARY_FRAME_NAMELEN];
+
+  fwrite(magic,sizeof(char),8,fp);
+  fwrite(head,sizeof(int32_t),4,fp);
+  memset(name,0,BINARY_FRAME_NAMELEN);
+  if (id) strncpy(name,id,BINARY_FRAME_NAMELEN-1);
+  fwrite(name,sizeof(char),BINARY_FRAME_NAMELEN,fp);
+  fwrite(reserved,sizeof(int32_t),2,fp);
+  for (int i = 0; i < ncols; i++) {
+    memset(name,0,BINARY_FRAME_NAMELEN);
+    if (names && names[i]) strncpy(name,names[i],BINARY_FRAME_NAMELEN-1);
+    fwrite(name,sizeof(char),BINARY_FRAME_NAMELEN,fp);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   append one frame of nrows x ncols values (row-major)
+------------------------------------------------------------------------- */
+
+void LAMMPS_NS::binary_frame_write(FILE *fp, bigint ntimestep, int nrows,
+                                   int ncols, const double *data)
+{
+  int64_t head[2];
+  head[0] = ntimestep;
+  head[1] = nrows;
+  fwrite(head,sizeof(int64_t),2,fp);
+  fwrite(data,sizeof(double),(size_t) nrows*ncols,fp);
+}
@@ -0,0 +1,51 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Self-describing binary frame files, written by the correlation fixes
+   and fix ave/time with "output binary". All fields in host byte order,
+   the endian field lets a reader detect a foreign byte order
+   (tools/binary_frame.py).
+
+   header:  char    magic[8]      "GLEFRAME"
+            int32   version       1
+            int32   endian        0x01020304
+            int32   ncols
+            int32   header_size   64 + 32*ncols bytes
+            char    id[32]        fix ID
+            int32   reserved[2]
+            char    names[ncols][32]
+   frame:   int64   timestep
+            int64   nrows
+            double  data[nrows][ncols]
+
+   every field is 8-byte aligned, so frames can be mapped without copying
+------------------------------------------------------------------------- */
+
+#ifndef LMP_BINARY_FRAME_H
+#define LMP_BINARY_FRAME_H
+
+#include <stdio.h>
+#include "lmptype.h"
+
+namespace LAMMPS_NS {
+
+#define BINARY_FRAME_NAMELEN 32
+
+void binary_frame_header(FILE *fp, const char *id, int ncols, char **names);
+void binary_frame_write(FILE *fp, bigint ntimestep, int nrows, int ncols,
+                        const double *data);
+
+}
+
+#endif
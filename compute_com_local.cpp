@@ -23,6 +23,7 @@
 #include "memory.h"
 #include "atom.h"
 #include "domain.h"
+#include "comm.h"
 
 using namespace LAMMPS_NS;
 
@@ -50,6 +51,32 @@ ComputeCOMLocal::ComputeCOMLocal(LAMMPS *lmp, int narg, char **arg) :
   r2 = radius*radius;
   jgroup = group->find(arg[5]);
   jgroupbit = group->bitmask[jgroup];
+
+  // optional args
+
+  bin_flag = 0;
+  int iarg = 6;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"bin") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal compute com_local command");
+      if (strcmp(arg[iarg+1],"yes") == 0) bin_flag = 1;
+      else if (strcmp(arg[iarg+1],"no") == 0) bin_flag = 0;
+      else error->all(FLERR,"Illegal compute com_local command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal compute com_local command");
+  }
+  if (bin_flag && mode != SINGLE)
+    error->all(FLERR,"Compute com_local bin requires mode single");
+  if (bin_flag && domain->triclinic)
+    error->all(FLERR,"Compute com_local bin does not support triclinic boxes");
+  if (bin_flag) comm_forward = 1;
+
+  indices_group = NULL;
+  maxgroup = 0;
+  cindex = NULL;
+  maxcenter = 0;
+  binhead = binnext = NULL;
+  maxbin = maxnext = 0;
   
   if (mode == GROUPSHAPE && radius > neighbor->cutneighmax) {
     error->all(FLERR,"Radius larger then maximum neighbor cutoff!\n");
@@ -94,6 +121,10 @@ ComputeCOMLocal::~ComputeCOMLocal()
   memory->destroy(com_glo);
   memory->destroy(count_loc);
   memory->destroy(count_glo);
+  memory->destroy(indices_group);
+  memory->destroy(cindex);
+  memory->destroy(binhead);
+  memory->destroy(binnext);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -108,6 +139,12 @@ void ComputeCOMLocal::init()
     neighbor->requests[irequest]->half = 0;
     neighbor->requests[irequest]->full = 1;
   }
+  // owned atoms drift up to skin/2 out of the subdomain between
+  // reneighborings, the ghosts must still cover radius around them
+
+  if (bin_flag && radius + neighbor->skin >
+      MAX(neighbor->cutneighmax,comm->cutghostuser))
+    error->all(FLERR,"Compute com_local bin radius larger than ghost cutoff");
 }
 
 /* ---------------------------------------------------------------------- */
@@ -118,7 +155,6 @@ void ComputeCOMLocal::compute_vector()
   int i,j;
   double massone;
   double xtmp, ytmp, ztmp, delx, dely, delz, rsq;
-  int *indices_group;
   int nlocal = atom->nlocal;
   int *mask = atom->mask;
   double **x = atom->x;
@@ -130,13 +166,13 @@ void ComputeCOMLocal::compute_vector()
   // determine group members (dynamically)
   if (mode == SINGLE) {
     ngroup_loc = ngroup_scan = 0;
-    memory->grow(indices_group,ngroup_loc,"com_local/atom:indices_group");
+    if (atom->nmax > maxgroup) {
+      maxgroup = atom->nmax;
+      memory->destroy(indices_group);
+      memory->create(indices_group,maxgroup,"com_local/atom:indices_group");
+    }
     for (i=0; i<nlocal; i++) {
-      if(mask[i] & groupbit) {
-	ngroup_loc++;
-	memory->grow(indices_group,ngroup_loc,"com_local/atom:indices_group");
-	indices_group[ngroup_loc-1]=i;
-      }
+      if(mask[i] & groupbit) indices_group[ngroup_loc++]=i;
     }
     MPI_Exscan(&ngroup_loc,&ngroup_scan,1,MPI_INT, MPI_SUM, world);
   } else {
@@ -153,13 +189,16 @@ void ComputeCOMLocal::compute_vector()
     count_glo[i] = 0.0;
   }
   // determine center of mass of the particles
+  // binned: centers are taken from the ghosts, no gather needed
   if (mode == SINGLE) {
-    for (i=0; i< ngroup_loc; i++) {
-      pos_group_loc[3*(i+ngroup_scan)]=x[indices_group[i]][0];
-      pos_group_loc[3*(i+ngroup_scan)+1]=x[indices_group[i]][1];
-      pos_group_loc[3*(i+ngroup_scan)+2]=x[indices_group[i]][2];
+    if (!bin_flag) {
+      for (i=0; i< ngroup_loc; i++) {
+        pos_group_loc[3*(i+ngroup_scan)]=x[indices_group[i]][0];
+        pos_group_loc[3*(i+ngroup_scan)+1]=x[indices_group[i]][1];
+        pos_group_loc[3*(i+ngroup_scan)+2]=x[indices_group[i]][2];
+      }
+      MPI_Allreduce(pos_group_loc, pos_group_glo, 3*ngroup_glo, MPI_DOUBLE, MPI_SUM, world);
     }
-    MPI_Allreduce(pos_group_loc, pos_group_glo, 3*ngroup_glo, MPI_DOUBLE, MPI_SUM, world);
   } else {
     double xcm[3];
     double masstotal = group->mass(igroup);
@@ -246,6 +285,8 @@ void ComputeCOMLocal::compute_vector()
       }
     }
     
+  } else if (bin_flag) {
+    compute_binned();
   } else {
     for (j = 0; j < nlocal; j++) {
       if (mask[j] & jgroupbit) {
@@ -285,7 +326,122 @@ void ComputeCOMLocal::compute_vector()
     }
   }
   
-  if (mode == SINGLE) memory->destroy(indices_group);
-  
-  
+}
+
+/* ----------------------------------------------------------------------
+   local COM of all centers by a cell lookup, O(N) instead of O(N*M)
+   centers are the local group atoms and their ghost images, so neither
+   the center positions have to be gathered nor the minimum image taken
+   the output index of each center is sent to its ghosts by forward comm
+------------------------------------------------------------------------- */
+
+void ComputeCOMLocal::compute_binned()
+{
+  int i,j,ib,ix,iy,iz,jx,jy,jz;
+  double massone,delx,dely,delz,rsq;
+  int nlocal = atom->nlocal;
+  int nall = nlocal + atom->nghost;
+  int *mask = atom->mask;
+  double **x = atom->x;
+  int *type = atom->type;
+  double *rmass = atom->rmass;
+  double *mass = atom->mass;
+
+  // output index of the centers, ghosts get it from their owner
+
+  if (atom->nmax > maxcenter) {
+    maxcenter = atom->nmax;
+    memory->destroy(cindex);
+    memory->create(cindex,maxcenter,"com_local/atom:cindex");
+  }
+  for (i=0; i<nlocal; i++) cindex[i] = -1.0;
+  for (i=0; i<ngroup_loc; i++) cindex[indices_group[i]] = ngroup_scan + i;
+  comm->forward_comm_compute(this);
+
+  // bins of edge >= radius over the subdomain extended by radius + skin,
+  // owned atoms may have moved up to skin/2 outside since reneighboring
+
+  double *sublo = domain->sublo;
+  double *subhi = domain->subhi;
+  double pad = radius + neighbor->skin;
+  int nbin[3];
+  for (int d=0; d<3; d++) {
+    binlo[d] = sublo[d] - pad;
+    double len = subhi[d] - sublo[d] + 2.0*pad;
+    nbin[d] = static_cast<int> (len/radius);
+    if (nbin[d] < 1) nbin[d] = 1;
+    bininv[d] = nbin[d]/len;
+  }
+  nbinx = nbin[0];
+  nbiny = nbin[1];
+  nbinz = nbin[2];
+  int nbins = nbinx*nbiny*nbinz;
+  if (nbins > maxbin) {
+    maxbin = nbins;
+    memory->destroy(binhead);
+    memory->create(binhead,maxbin,"com_local/atom:binhead");
+  }
+  if (nall > maxnext) {
+    maxnext = atom->nmax;
+    memory->destroy(binnext);
+    memory->create(binnext,maxnext,"com_local/atom:binnext");
+  }
+  for (ib=0; ib<nbins; ib++) binhead[ib] = -1;
+
+  for (i=0; i<nall; i++) {
+    if (!(mask[i] & groupbit) || cindex[i] < 0.0) continue;
+    ix = static_cast<int> ((x[i][0]-binlo[0])*bininv[0]);
+    iy = static_cast<int> ((x[i][1]-binlo[1])*bininv[1]);
+    iz = static_cast<int> ((x[i][2]-binlo[2])*bininv[2]);
+    if (ix < 0 || ix >= nbinx || iy < 0 || iy >= nbiny || iz < 0 || iz >= nbinz) continue;
+    ib = (iz*nbiny + iy)*nbinx + ix;
+    binnext[i] = binhead[ib];
+    binhead[ib] = i;
+  }
+
+  // loop over my j atoms and the centers in the 27 surrounding bins
+
+  for (j=0; j<nlocal; j++) {
+    if (!(mask[j] & jgroupbit)) continue;
+    if (rmass) massone = rmass[j];
+    else massone = mass[type[j]];
+    jx = static_cast<int> ((x[j][0]-binlo[0])*bininv[0]);
+    jy = static_cast<int> ((x[j][1]-binlo[1])*bininv[1]);
+    jz = static_cast<int> ((x[j][2]-binlo[2])*bininv[2]);
+    for (iz = MAX(jz-1,0); iz <= MIN(jz+1,nbinz-1); iz++)
+      for (iy = MAX(jy-1,0); iy <= MIN(jy+1,nbiny-1); iy++)
+        for (ix = MAX(jx-1,0); ix <= MIN(jx+1,nbinx-1); ix++)
+          for (i = binhead[(iz*nbiny + iy)*nbinx + ix]; i >= 0; i = binnext[i]) {
+            delx = x[j][0] - x[i][0];
+            dely = x[j][1] - x[i][1];
+            delz = x[j][2] - x[i][2];
+            rsq = delx*delx + dely*dely + delz*delz;
+            if (rsq < r2) { // particle j is in the neighbourhood of center i -> contribution to local com
+              int ic = static_cast<int> (cindex[i]);
+              count_loc[ic] += massone;
+              com_loc[4*ic] += delx * massone;
+              com_loc[4*ic+1] += dely * massone;
+              com_loc[4*ic+2] += delz * massone;
+            }
+          }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+int ComputeCOMLocal::pack_forward_comm(int n, int *list, double *buf,
+                                       int pbc_flag, int *pbc)
+{
+  int m = 0;
+  for (int i = 0; i < n; i++) buf[m++] = cindex[list[i]];
+  return m;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void ComputeCOMLocal::unpack_forward_comm(int n, int first, double *buf)
+{
+  int m = 0;
+  int last = first + n;
+  for (int i = first; i < last; i++) cindex[i] = buf[m++];
 }
@@ -30,6 +30,8 @@ class ComputeCOMLocal : public Compute {
   ~ComputeCOMLocal();
   void init();
   void compute_vector();
+  int pack_forward_comm(int, int *, double *, int, int *);
+  void unpack_forward_comm(int, int, double *);
 
  private:
    int mode;
@@ -48,6 +50,18 @@ class ComputeCOMLocal : public Compute {
   NeighList *list;
   
   int ngroup_loc, ngroup_glo,ngroup_scan;
+  int *indices_group;
+  int maxgroup;
+
+  // binned lookup of the centers (local and ghost group atoms)
+  int bin_flag;
+  int maxcenter;
+  double *cindex;              // per-atom output index of a center, -1 if none
+  int nbinx,nbiny,nbinz;
+  double binlo[3],bininv[3];
+  int *binhead,*binnext;
+  int maxbin,maxnext;
+  void compute_binned();
 };
 
 }
@@ -57,6 +71,19 @@ class ComputeCOMLocal : public Compute {
 
 /* ERROR/WARNING messages:
 
+E: Compute com_local bin requires mode single
+
+Binning is only used for the centers of single atoms.
+
+E: Compute com_local bin radius larger than ghost cutoff
+
+Centers are taken from the ghost atoms, so the radius plus the neighbor
+skin must not exceed the ghost cutoff.
+
+E: Compute com_local bin does not support triclinic boxes
+
+Self-explanatory.
+
 E: Illegal ... command
 
 Self-explanatory.  Check the input script syntax and compare to the
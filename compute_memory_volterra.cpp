@@ -33,10 +33,16 @@
 #include "atom.h"
 #include "comm.h"
 #include "fix_ave_correlate_peratom.h"
+#include "math_const.h"
 
 using namespace LAMMPS_NS;
+using namespace MathConst;
 
 enum{PERATOM,PERGROUP, GROUP};
+enum{DIRECT,FFT};
+
+// blocks up to this size are solved directly in the recursive solver
+#define VOLTERRA_BLOCK 64
 
 /* ---------------------------------------------------------------------- */
 
@@ -66,9 +72,16 @@ ComputeMemoryVolterra::ComputeMemoryVolterra(LAMMPS * lmp, int narg, char **arg)
   
   // read in optional parameter
   memory_switch = PERATOM;
+  solver = DIRECT;
   int iarg = 6;
   while (iarg < narg) {
-    if (strcmp(arg[iarg],"switch") == 0) {
+    if (strcmp(arg[iarg],"solver") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal compute memory/volterra command");
+      if (strcmp(arg[iarg+1],"direct") == 0) solver = DIRECT;
+      else if (strcmp(arg[iarg+1],"fft") == 0) solver = FFT;
+      else error->all(FLERR,"Illegal compute memory/volterra command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"switch") == 0) {
       if (iarg+2 > narg) error->all(FLERR,"Illegal compute memory/volterra command");
       if (strcmp(arg[iarg+1],"peratom") == 0) memory_switch = PERATOM;
       else if (strcmp(arg[iarg+1],"pergroup") == 0) memory_switch = PERGROUP;
@@ -204,6 +217,19 @@ ComputeMemoryVolterra::ComputeMemoryVolterra(LAMMPS * lmp, int narg, char **arg)
   for (i = 0; i<nrepeat; i++)
     for (j = 0; j<nmem; j++)
       array[i][j]=0;
+  // work arrays of the solver, FFT buffers hold the largest block convolution
+  memory->create(kernel,nrepeat,"memory/volterra:kernel");
+  memory->create(conv,nrepeat,"memory/volterra:conv");
+  memory->create(gfac,nrepeat,"memory/volterra:gfac");
+  memory->create(rhs,nrepeat,"memory/volterra:rhs");
+  memory->create(denum,nrepeat,"memory/volterra:denum");
+  fft_a = fft_b = NULL;
+  if (solver == FFT) {
+    int nfft = 1;
+    while (nfft < 2*nrepeat) nfft *= 2;
+    fft_a = new std::complex<double>[nfft];
+    fft_b = new std::complex<double>[nfft];
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -215,6 +241,13 @@ ComputeMemoryVolterra::~ComputeMemoryVolterra()
   if (modify->nfix) modify->delete_fix(id_fix);
   delete [] id_fix;
   memory->destroy(array);
+  memory->destroy(kernel);
+  memory->destroy(conv);
+  memory->destroy(gfac);
+  memory->destroy(rhs);
+  memory->destroy(denum);
+  delete [] fft_a;
+  delete [] fft_b;
   
 }
 
@@ -236,53 +269,169 @@ void ComputeMemoryVolterra::init()
 
 void ComputeMemoryVolterra::compute_array()
 {
-  if (me==0) {
   double **corr;
   int i,j;
+  int nprocs;
+  MPI_Comm_size(world,&nprocs);
   memory->create(corr,nrepeat,ncorr,"memory/volterra:corr");
-  // calculate correlation first
+
+  // calculate correlation first, the fix reduces the result onto proc 0
   fix->end_of_step();
-  //read in correlation function of the invoked fix
-  //mask tells where to find the correct correlations
-  double mask[] = {0,3,15,1,4,16,2,5,17,6,9,18,7,10,19,11,14,20};
-  for (i = 0; i<nrepeat; i++)
-    for (j = 0; j<ncorr; j++){
-      corr[i][j]=fix->compute_array(i, mask[j]+2);
-      //printf("corr[i][j]=%f\n",corr[i][j]);
-    }
+  if (me==0) {
+    //read in correlation function of the invoked fix
+    //mask tells where to find the correct correlations
+    double mask[] = {0,3,15,1,4,16,2,5,17,6,9,18,7,10,19,11,14,20};
+    for (i = 0; i<nrepeat; i++)
+      for (j = 0; j<ncorr; j++){
+        corr[i][j]=fix->compute_array(i, mask[j]+2);
+        //printf("corr[i][j]=%f\n",corr[i][j]);
+      }
+  }
+  MPI_Bcast(&corr[0][0],nrepeat*ncorr,MPI_DOUBLE,0,world);
+
   // use correlation function to calculate memory
-  for (j = 0; j<nmem; j++){
+  // kernel components are solved round-robin on the procs and summed up afterwards
+  for (i = 0; i<nrepeat; i++)
+    for (j = 0; j<nmem; j++)
+      array[i][j] = 0.0;
+
+  for (j = me; j<nmem; j+=nprocs){
     //printf("mass=%f\n",mass);
-    array[0][j]=corr[0][3*j+2]/corr[0][3*j]/mass/mass;
-    
-    for(i = 1; i<nrepeat; i++){
+    kernel[0]=corr[0][3*j+2]/corr[0][3*j]/mass/mass;
+
+    // discretized Volterra equation for i >= 1:
+    // K(i)*denum(i) = rhs(i) - sum_{ip=1}^{i-1} gfac(i-ip)*K(ip)
+    for(i = 0; i<nrepeat; i++){
       //denum = C(0)+dt*C'(i)
-      double denum = mass*mass*corr[0][3*j]+0.5*mass*update->dt*nevery_corr*corr[i][3*j+1];
-      //num = C''(i)-dt*sum(C'(i-ip)*k(ip))
-      double num = corr[i][3*j+2];
-      num -= 0.5*mass*corr[i][3*j+1]*array[0][j]*update->dt*nevery_corr;
-      int ip;
-      for(ip = 1; ip<i; ip++){
-	num -= mass*update->dt*nevery_corr*corr[i-ip][3*j+1]*array[ip][j];
-      }
-      //printf("num=%f, denum=%f\n",num,denum);
-      array[i][j]=num/denum;
+      denum[i] = mass*mass*corr[0][3*j]+0.5*mass*update->dt*nevery_corr*corr[i][3*j+1];
+      //rhs = C''(i)-dt*C'(i)*k(0)/2
+      rhs[i] = corr[i][3*j+2];
+      rhs[i] -= 0.5*mass*corr[i][3*j+1]*kernel[0]*update->dt*nevery_corr;
+      gfac[i] = mass*update->dt*nevery_corr*corr[i][3*j+1];
+      conv[i] = 0.0;
     }
-  }
-  for (j = 0; j<nmem; j++){
+
+    if (solver == FFT) solve_block(1,nrepeat);
+    else solve_direct();
+
     for(i = 0; i<nrepeat; i++){
-      array[i][j] *= mass*mass*corr[0][3*j];
+      array[i][j] = kernel[i]*mass*mass*corr[0][3*j];
       //printf("array[i][j]=%f\n",array[i][j]);
     }
   }
-    
+  MPI_Allreduce(MPI_IN_PLACE,&array[0][0],nrepeat*nmem,MPI_DOUBLE,MPI_SUM,world);
+
   memory->destroy(corr);
-  } else {
-    int i,j;
-    for (j = 0; j<nmem; j++){
-      for(i = 0; i<nrepeat; i++){
-	array[i][j] = 0;
+}
+
+/* ----------------------------------------------------------------------
+   extract the time resolution of the kernel (in timesteps)
+------------------------------------------------------------------------- */
+
+void *ComputeMemoryVolterra::extract(const char *str, int &dim)
+{
+  dim = 0;
+  if (strcmp(str,"nevery") == 0) return &nevery_corr;
+  return NULL;
+}
+
+/* ----------------------------------------------------------------------
+   forward substitution of the lower triangular system, O(nrepeat^2)
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterra::solve_direct()
+{
+  for (int i = 1; i<nrepeat; i++){
+    double num = rhs[i];
+    for (int ip = 1; ip<i; ip++) num -= gfac[i-ip]*kernel[ip];
+    kernel[i] = num/denum[i];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   solve for K(lo..hi-1), conv already holds the contributions of K(<lo)
+   recursive halving: the lower half is solved first, then its contribution
+   to the upper half is added by one FFT convolution (Toeplitz structure
+   of the memory integral), cost O(n log^2 n) instead of O(n^2)
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterra::solve_block(int lo, int hi)
+{
+  if (hi - lo <= VOLTERRA_BLOCK) {
+    for (int i = lo; i<hi; i++){
+      double num = rhs[i] - conv[i];
+      for (int ip = lo; ip<i; ip++) num -= gfac[i-ip]*kernel[ip];
+      kernel[i] = num/denum[i];
+    }
+    return;
+  }
+
+  int mid = (lo+hi)/2;
+  solve_block(lo,mid);
+  convolve_block(lo,mid,hi);
+  solve_block(mid,hi);
+}
+
+/* ----------------------------------------------------------------------
+   conv(i) += sum_{ip=lo}^{mid-1} gfac(i-ip)*K(ip) for i = mid..hi-1
+   K and gfac are real, so both are packed into one complex FFT
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterra::convolve_block(int lo, int mid, int hi)
+{
+  int x,k;
+  int na = mid-lo;
+  int nb = hi-lo;
+  int nfft = 1;
+  while (nfft < na+nb-1) nfft *= 2;
+
+  for (x = 0; x<nfft; x++) {
+    double a = (x<na) ? kernel[lo+x] : 0.0;
+    double b = (x<nb) ? gfac[x] : 0.0;
+    fft_a[x] = std::complex<double>(a,b);
+  }
+  fft(fft_a,nfft,-1);
+
+  // unpack the spectra of both real sequences and multiply
+  for (k = 0; k<nfft; k++) {
+    std::complex<double> zk = fft_a[k];
+    std::complex<double> zn = std::conj(fft_a[(nfft-k) & (nfft-1)]);
+    std::complex<double> fa = 0.5*(zk+zn);
+    std::complex<double> fb = std::complex<double>(0.0,-0.5)*(zk-zn);
+    fft_b[k] = fa*fb;
+  }
+  fft(fft_b,nfft,1);
+
+  for (int i = mid; i<hi; i++) conv[i] += fft_b[i-lo].real()/nfft;
+}
+
+/* ----------------------------------------------------------------------
+   in-place radix-2 complex FFT, n must be a power of 2
+   sign = -1 forward, +1 backward (unnormalized)
+------------------------------------------------------------------------- */
+
+void ComputeMemoryVolterra::fft(std::complex<double> *data, int n, int sign)
+{
+  int i,j,k,len;
+
+  for (i = 1, j = 0; i<n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i<j) std::swap(data[i],data[j]);
+  }
+
+  for (len = 2; len<=n; len <<= 1) {
+    int half = len >> 1;
+    double ang = sign*MY_2PI/len;
+    for (k = 0; k<half; k++) {
+      std::complex<double> w = std::polar(1.0,ang*k);
+      for (i = k; i<n; i += len) {
+        std::complex<double> u = data[i];
+        std::complex<double> v = data[i+half]*w;
+        data[i] = u+v;
+        data[i+half] = u-v;
       }
     }
   }
-}
\ No newline at end of file
+}
@@ -21,6 +21,7 @@ ComputeStyle(memory/volterra,ComputeMemoryVolterra)
 #define LMP_COMPUTE_MEMORY_VOLTERRA_H
 
 #include "compute.h"
+#include <complex>
 
 namespace LAMMPS_NS {
 
@@ -30,6 +31,7 @@ class ComputeMemoryVolterra : public Compute {
   ~ComputeMemoryVolterra();
   void init();
   void compute_array();
+  void *extract(const char *, int &);
   
  protected:
   char *id_fix;
@@ -47,6 +49,16 @@ class ComputeMemoryVolterra : public Compute {
   int ncorr,nmem;
   
   double mass;
+
+  // Volterra solver
+  int solver;                  // DIRECT: O(nrepeat^2), FFT: blocked O(nrepeat log^2 nrepeat)
+  double *kernel,*conv,*gfac,*rhs,*denum;
+  std::complex<double> *fft_a,*fft_b;
+
+  void solve_direct();
+  void solve_block(int, int);
+  void convolve_block(int, int, int);
+  void fft(std::complex<double> *, int, int);
 };
 
 }
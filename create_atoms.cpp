@@ -45,6 +45,7 @@ using namespace MathConst;
 #define EPSILON 1.0e-6
 #define LB_FACTOR 1.1
 #define PI 3.1415926
+#define BINMAX 8000000    // max bins of the overlap cell list
 #define DIV_ROUND_CLOSEST(n, d) ((((n) < 0) ^ ((d) < 0)) ? (((n) - (d)/2)/(d)) : (((n) + (d)/2)/(d)))
 
 enum{BOX,REGION,SINGLE,RANDOM, SINGLESPHERE};
@@ -145,6 +146,9 @@ void CreateAtoms::command(int narg, char **arg)
   quatone[0] = quatone[1] = quatone[2] = 0.0;
   subsetflag = NONE;
   int subsetseed;
+  overlapflag = 0;
+  maxtry = 10;
+  poissonflag = 0;
 
   nbasis = domain->lattice->nbasis;
   basistype = new int[nbasis];
@@ -241,6 +245,23 @@ void CreateAtoms::command(int narg, char **arg)
       if (nsubset <= 0 || subsetseed <= 0)
         error->all(FLERR,"Illegal create_atoms command");
       iarg += 3;
+    } else if (strcmp(arg[iarg],"overlap") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal create_atoms command");
+      overlap = utils::numeric(FLERR,arg[iarg+1],false,lmp);
+      if (overlap <= 0.0) error->all(FLERR,"Illegal create_atoms command");
+      overlapflag = 1;
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"maxtry") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal create_atoms command");
+      maxtry = utils::inumeric(FLERR,arg[iarg+1],false,lmp);
+      if (maxtry <= 0) error->all(FLERR,"Illegal create_atoms command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"poisson") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal create_atoms command");
+      if (strcmp(arg[iarg+1],"yes") == 0) poissonflag = 1;
+      else if (strcmp(arg[iarg+1],"no") == 0) poissonflag = 0;
+      else error->all(FLERR,"Illegal create_atoms command");
+      iarg += 2;
     } else error->all(FLERR,"Illegal create_atoms command");
   }
 
@@ -254,6 +275,16 @@ void CreateAtoms::command(int narg, char **arg)
     if (seed <= 0) error->all(FLERR,"Illegal create_atoms command");
   }
 
+  if (overlapflag || poissonflag) {
+    if (style != RANDOM || mode != ATOM)
+      error->all(FLERR,"Create_atoms overlap requires style random "
+                 "without molecules");
+    if (domain->triclinic)
+      error->all(FLERR,"Create_atoms overlap requires an orthogonal box");
+    if (poissonflag && !overlapflag)
+      error->all(FLERR,"Create_atoms poisson requires the overlap keyword");
+  }
+
   // error check and further setup for mode = MOLECULE
 
   ranmol = nullptr;
@@ -749,7 +780,14 @@ void CreateAtoms::add_random()
   if (xlo > xhi || ylo > yhi || zlo > zhi)
     error->all(FLERR,"No overlap of box and region for create_atoms");
 
+  // with overlap, the atoms in my subbox are collected and inserted
+  // afterwards with rejection, positions stay the same for all procs
+
   int valid;
+  int npending = 0;
+  double **pending = nullptr;
+  if (overlapflag) memory->create(pending,MAX(nrandom,1),3,"create_atoms:pending");
+
   for (int i = 0; i < nrandom; i++) {
     while (1) {
       xone[0] = xlo + random->uniform() * (xhi-xlo);
@@ -778,18 +816,370 @@ void CreateAtoms::add_random()
     if (coord[0] >= sublo[0] && coord[0] < subhi[0] &&
         coord[1] >= sublo[1] && coord[1] < subhi[1] &&
         coord[2] >= sublo[2] && coord[2] < subhi[2]) {
-      if (mode == ATOM) atom->avec->create_atom(ntype,xone);
+      if (overlapflag) {
+        pending[npending][0] = xone[0];
+        pending[npending][1] = xone[1];
+        pending[npending][2] = xone[2];
+        npending++;
+      } else if (mode == ATOM) atom->avec->create_atom(ntype,xone);
       else if (quatone[0] == 0 && quatone[1] == 0 && quatone[2] == 0)
         add_molecule(xone);
       else add_molecule(xone, quatone);
     }
   }
 
+  if (overlapflag) {
+    double lo[3] = {xlo,ylo,zlo};
+    double hi[3] = {xhi,yhi,zhi};
+    add_random_overlap(npending,pending,lo,hi);
+    memory->destroy(pending);
+  }
+
   // clean-up
 
   delete random;
 }
 
+/* ----------------------------------------------------------------------
+   insert my pending random atoms, rejecting those closer than overlap
+     to an existing or a new atom
+   each subbox is split into 2x2x2 octants, octants of one color on
+     different procs are at least overlap apart, so all procs insert into
+     one color at a time without talking, then share the new atoms near
+     their subbox faces
+   a rejected atom is retried at up to maxtry uniform positions in its
+     octant, poisson yes then fills the octant by Bridson's algorithm
+------------------------------------------------------------------------- */
+
+void CreateAtoms::add_random_overlap(int npending, double **pending,
+                                     double *bboxlo, double *bboxhi)
+{
+  int i,k,m,c,dim;
+  int dimension = domain->dimension;
+  int ncolor = (dimension == 3) ? 8 : 4;
+
+  for (dim = 0; dim < dimension; dim++)
+    if (subhi[dim]-sublo[dim] < 2.0*overlap)
+      error->all(FLERR,"Create_atoms overlap distance is too large "
+                 "for the subdomains");
+
+  RanMars *ranover = new RanMars(lmp,seed+me);
+  overlap_setup();
+
+  // existing atoms, owned ones and images near my subbox from all procs
+
+  double **x = atom->x;
+  for (i = 0; i < atom->nlocal; i++) overlap_add(x[i]);
+  overlap_share(0,npts);
+
+  double mid[3];
+  for (dim = 0; dim < 3; dim++) mid[dim] = 0.5*(sublo[dim]+subhi[dim]);
+
+  int nskip = 0;
+  int *active = nullptr;
+  int nactive,maxactive = 0;
+  double olo[3],ohi[3],xnew[3];
+
+  for (c = 0; c < ncolor; c++) {
+    int first = npts;
+
+    // octant of color c, clipped to the bounding box of the insertion
+
+    int empty = 0;
+    for (dim = 0; dim < 3; dim++) {
+      olo[dim] = (c >> dim & 1) ? mid[dim] : sublo[dim];
+      ohi[dim] = (c >> dim & 1) ? subhi[dim] : mid[dim];
+      if (dim == 2 && dimension == 2) {
+        olo[dim] = sublo[dim];
+        ohi[dim] = subhi[dim];
+      }
+      olo[dim] = MAX(olo[dim],bboxlo[dim]);
+      ohi[dim] = MIN(ohi[dim],bboxhi[dim]);
+      if (olo[dim] > ohi[dim]) empty = 1;
+    }
+
+    for (i = 0; i < npending; i++) {
+      if (overlap_color(pending[i],mid) != c) continue;
+      xnew[0] = pending[i][0];
+      xnew[1] = pending[i][1];
+      xnew[2] = pending[i][2];
+      int ok = overlap_free(xnew);
+      for (k = 0; !ok && k < maxtry; k++) {
+        for (dim = 0; dim < 3; dim++)
+          xnew[dim] = olo[dim] + ranover->uniform()*(ohi[dim]-olo[dim]);
+        if (dimension == 2) xnew[2] = pending[i][2];
+        ok = overlap_valid(xnew,olo,ohi) && overlap_free(xnew);
+      }
+      if (ok) {
+        atom->avec->create_atom(ntype,xnew);
+        overlap_add(xnew);
+      } else nskip++;
+    }
+
+    // Bridson fill: candidates in the shell [overlap,2*overlap] around
+    // an active atom, an atom without a free candidate is retired
+
+    if (poissonflag && !empty) {
+      if (npts == first) {
+        for (k = 0; k < maxtry; k++) {
+          for (dim = 0; dim < 3; dim++)
+            xnew[dim] = olo[dim] + ranover->uniform()*(ohi[dim]-olo[dim]);
+          if (dimension == 2) xnew[2] = 0.5*(bboxlo[2]+bboxhi[2]);
+          if (overlap_valid(xnew,olo,ohi) && overlap_free(xnew)) {
+            atom->avec->create_atom(ntype,xnew);
+            overlap_add(xnew);
+            break;
+          }
+        }
+      }
+
+      nactive = npts - first;
+      if (nactive > maxactive) {
+        maxactive = nactive;
+        memory->destroy(active);
+        memory->create(active,maxactive,"create_atoms:active");
+      }
+      for (m = 0; m < nactive; m++) active[m] = first + m;
+
+      while (nactive) {
+        m = static_cast<int> (ranover->uniform()*nactive);
+        if (m == nactive) m--;
+        double *center = binpts[active[m]];
+        int found = 0;
+        for (k = 0; k < maxtry; k++) {
+          double r = overlap*(1.0 + ranover->uniform());
+          double dir[3];
+          if (dimension == 3) {
+            double cth = 2.0*ranover->uniform() - 1.0;
+            double sth = sqrt(1.0 - cth*cth);
+            double phi = 2.0*MY_PI*ranover->uniform();
+            dir[0] = sth*cos(phi);
+            dir[1] = sth*sin(phi);
+            dir[2] = cth;
+          } else {
+            double phi = 2.0*MY_PI*ranover->uniform();
+            dir[0] = cos(phi);
+            dir[1] = sin(phi);
+            dir[2] = 0.0;
+          }
+          for (dim = 0; dim < 3; dim++) xnew[dim] = center[dim] + r*dir[dim];
+          if (overlap_valid(xnew,olo,ohi) && overlap_free(xnew)) {
+            atom->avec->create_atom(ntype,xnew);
+            overlap_add(xnew);
+            if (nactive == maxactive) {
+              maxactive += maxactive/2 + 16;
+              memory->grow(active,maxactive,"create_atoms:active");
+            }
+            active[nactive++] = npts-1;
+            found = 1;
+            break;
+          }
+        }
+        if (!found) active[m] = active[--nactive];
+      }
+    }
+
+    overlap_share(first,npts);
+  }
+
+  // report atoms that found no free position
+
+  int nskipall;
+  MPI_Allreduce(&nskip,&nskipall,1,MPI_INT,MPI_SUM,world);
+  if (nskipall && me == 0) {
+    char str[128];
+    snprintf(str,128,"Create_atoms overlap: %d of %d random atoms "
+             "not inserted after %d tries",nskipall,nrandom,maxtry);
+    error->warning(FLERR,str);
+  }
+
+  delete ranover;
+  memory->destroy(active);
+  memory->destroy(binhead);
+  memory->destroy(binnext);
+  memory->destroy(binpts);
+}
+
+/* ----------------------------------------------------------------------
+   octant color of a point in my subbox
+------------------------------------------------------------------------- */
+
+int CreateAtoms::overlap_color(double *x, double *mid)
+{
+  int c = 0;
+  if (x[0] >= mid[0]) c |= 1;
+  if (x[1] >= mid[1]) c |= 2;
+  if (domain->dimension == 3 && x[2] >= mid[2]) c |= 4;
+  return c;
+}
+
+/* ----------------------------------------------------------------------
+   check a trial position against the octant, region and variable
+------------------------------------------------------------------------- */
+
+int CreateAtoms::overlap_valid(double *x, double *olo, double *ohi)
+{
+  int dimension = domain->dimension;
+  for (int dim = 0; dim < dimension; dim++)
+    if (x[dim] < olo[dim] || x[dim] >= ohi[dim]) return 0;
+  if (nregion >= 0 && domain->regions[nregion]->match(x[0],x[1],x[2]) == 0)
+    return 0;
+  if (varflag && vartest(x) == 0) return 0;
+  return 1;
+}
+
+/* ----------------------------------------------------------------------
+   cell list over my subbox extended by overlap, bins are at least
+     overlap wide so a check visits the 27 neighbor bins
+------------------------------------------------------------------------- */
+
+void CreateAtoms::overlap_setup()
+{
+  double binsize = overlap;
+  bigint nbins;
+  while (1) {
+    nbins = 1;
+    for (int dim = 0; dim < 3; dim++) {
+      binlo[dim] = sublo[dim] - overlap;
+      double extent = subhi[dim] - sublo[dim] + 2.0*overlap;
+      nbin[dim] = MAX(static_cast<int> (extent/binsize),1);
+      bininv[dim] = nbin[dim]/extent;
+      nbins *= nbin[dim];
+    }
+    if (nbins <= BINMAX) break;
+    binsize *= 2.0;
+  }
+
+  memory->create(binhead,nbins,"create_atoms:binhead");
+  for (int m = 0; m < nbins; m++) binhead[m] = -1;
+  npts = maxpts = 0;
+  binnext = nullptr;
+  binpts = nullptr;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int CreateAtoms::overlap_bin(double *x, int *ib)
+{
+  for (int dim = 0; dim < 3; dim++) {
+    ib[dim] = static_cast<int> ((x[dim]-binlo[dim])*bininv[dim]);
+    ib[dim] = MAX(ib[dim],0);
+    ib[dim] = MIN(ib[dim],nbin[dim]-1);
+  }
+  return (ib[2]*nbin[1] + ib[1])*nbin[0] + ib[0];
+}
+
+/* ---------------------------------------------------------------------- */
+
+void CreateAtoms::overlap_add(double *x)
+{
+  if (npts == maxpts) {
+    maxpts += maxpts/2 + 1024;
+    memory->grow(binnext,maxpts,"create_atoms:binnext");
+    memory->grow(binpts,maxpts,3,"create_atoms:binpts");
+  }
+  int ib[3];
+  int m = overlap_bin(x,ib);
+  binpts[npts][0] = x[0];
+  binpts[npts][1] = x[1];
+  binpts[npts][2] = x[2];
+  binnext[npts] = binhead[m];
+  binhead[m] = npts++;
+}
+
+/* ----------------------------------------------------------------------
+   return 1 if no point of the cell list is closer than overlap
+------------------------------------------------------------------------- */
+
+int CreateAtoms::overlap_free(double *x)
+{
+  int ib[3];
+  overlap_bin(x,ib);
+  double cutsq = overlap*overlap;
+
+  int zlo = MAX(ib[2]-1,0), zhi = MIN(ib[2]+1,nbin[2]-1);
+  int ylo = MAX(ib[1]-1,0), yhi = MIN(ib[1]+1,nbin[1]-1);
+  int xlo = MAX(ib[0]-1,0), xhi = MIN(ib[0]+1,nbin[0]-1);
+  for (int iz = zlo; iz <= zhi; iz++)
+    for (int iy = ylo; iy <= yhi; iy++)
+      for (int ix = xlo; ix <= xhi; ix++)
+        for (int j = binhead[(iz*nbin[1] + iy)*nbin[0] + ix]; j >= 0;
+             j = binnext[j]) {
+          double delx = x[0] - binpts[j][0];
+          double dely = x[1] - binpts[j][1];
+          double delz = x[2] - binpts[j][2];
+          if (delx*delx + dely*dely + delz*delz < cutsq) return 0;
+        }
+  return 1;
+}
+
+/* ----------------------------------------------------------------------
+   send my points first to last-1 that lie within overlap of my subbox
+     faces to all procs, add the received ones and their periodic images
+     that fall into my extended subbox
+------------------------------------------------------------------------- */
+
+void CreateAtoms::overlap_share(int first, int last)
+{
+  int i,j,dim;
+  int nsend = 0;
+  double *sendbuf = nullptr;
+  memory->create(sendbuf,3*MAX(last-first,1),"create_atoms:sendbuf");
+  for (i = first; i < last; i++) {
+    int near = 0;
+    for (dim = 0; dim < domain->dimension; dim++)
+      if (binpts[i][dim] < sublo[dim]+overlap ||
+          binpts[i][dim] >= subhi[dim]-overlap) near = 1;
+    if (!near) continue;
+    sendbuf[3*nsend] = binpts[i][0];
+    sendbuf[3*nsend+1] = binpts[i][1];
+    sendbuf[3*nsend+2] = binpts[i][2];
+    nsend++;
+  }
+
+  int *recvcounts = new int[nprocs];
+  int *displs = new int[nprocs];
+  int nsend3 = 3*nsend;
+  MPI_Allgather(&nsend3,1,MPI_INT,recvcounts,1,MPI_INT,world);
+  int nrecv3 = 0;
+  for (i = 0; i < nprocs; i++) {
+    displs[i] = nrecv3;
+    nrecv3 += recvcounts[i];
+  }
+  double *recvbuf = nullptr;
+  memory->create(recvbuf,MAX(nrecv3,1),"create_atoms:recvbuf");
+  MPI_Allgatherv(sendbuf,nsend3,MPI_DOUBLE,recvbuf,recvcounts,displs,
+                 MPI_DOUBLE,world);
+
+  int periodic[3] = {domain->xperiodic,domain->yperiodic,
+                     domain->dimension == 3 ? domain->zperiodic : 0};
+  double *prd = domain->prd;
+  double y[3];
+
+  for (int proc = 0; proc < nprocs; proc++) {
+    for (j = displs[proc]; j < displs[proc]+recvcounts[proc]; j += 3) {
+      for (int sz = -periodic[2]; sz <= periodic[2]; sz++)
+        for (int sy = -periodic[1]; sy <= periodic[1]; sy++)
+          for (int sx = -periodic[0]; sx <= periodic[0]; sx++) {
+            if (proc == me && sx == 0 && sy == 0 && sz == 0) continue;
+            y[0] = recvbuf[j] + sx*prd[0];
+            y[1] = recvbuf[j+1] + sy*prd[1];
+            y[2] = recvbuf[j+2] + sz*prd[2];
+            int inside = 1;
+            for (dim = 0; dim < 3; dim++)
+              if (y[dim] < sublo[dim]-overlap || y[dim] >= subhi[dim]+overlap)
+                inside = 0;
+            if (inside) overlap_add(y);
+          }
+    }
+  }
+
+  delete [] recvcounts;
+  delete [] displs;
+  memory->destroy(sendbuf);
+  memory->destroy(recvbuf);
+}
+
 /* ----------------------------------------------------------------------
    add many atoms by looping over lattice
 ------------------------------------------------------------------------- */
@@ -59,9 +59,26 @@ class CreateAtoms : protected Pointers {
   int triclinic;
   double sublo[3],subhi[3];   // epsilon-extended proc sub-box for adding atoms
 
+  int overlapflag,maxtry,poissonflag;
+  double overlap;             // min distance of a random atom to all others
+
+  int nbin[3];                // cell list of overlap rejection
+  double binlo[3],bininv[3];
+  int *binhead,*binnext;
+  double **binpts;
+  int npts,maxpts;
+
   void add_single();
     void add_singlesphere();
   void add_random();
+  void add_random_overlap(int, double **, double *, double *);
+  int overlap_color(double *, double *);
+  int overlap_valid(double *, double *, double *);
+  void overlap_setup();
+  int overlap_bin(double *, int *);
+  void overlap_add(double *);
+  int overlap_free(double *);
+  void overlap_share(int, int);
   void add_lattice();
   void loop_lattice(int);
   void add_molecule(double *, double * = nullptr);
@@ -176,4 +193,28 @@ W: Specifying an 'subset' value of '0' is equivalent to no 'subset' keyword
 
 Self-explanatory.
 
+E: Create_atoms overlap requires style random without molecules
+
+The overlap, maxtry and poisson keywords only apply to single atoms
+inserted at random positions.
+
+E: Create_atoms overlap requires an orthogonal box
+
+Self-explanatory.
+
+E: Create_atoms poisson requires the overlap keyword
+
+Poisson-disk filling needs the minimum distance set by overlap.
+
+E: Create_atoms overlap distance is too large for the subdomains
+
+Every subdomain must be at least twice the overlap distance wide, so
+that the octants inserted at the same time on different procs cannot
+interact.  Use fewer processors or a smaller distance.
+
+W: Create_atoms overlap: %d of %d random atoms not inserted after %d tries
+
+No position at least the overlap distance away from all other atoms was
+found for these atoms.  Increase maxtry or lower the density.
+
 */
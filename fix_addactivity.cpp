@@ -11,13 +11,13 @@
    See the README file in the top-level LAMMPS directory.
 ------------------------------------------------------------------------- */
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include "fix_addactivity.h"
 #include "atom.h"
 #include "atom_masks.h"
 #include "accelerator_kokkos.h"
-#include "random_mars.h"
 #include "update.h"
 #include "modify.h"
 #include "domain.h"
@@ -28,9 +28,12 @@
 #include "memory.h"
 #include "error.h"
 #include "force.h"
+#include "comm.h"
+#include "random_counter.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
+using namespace RandomCounter;
 
 enum{ABP};
 
@@ -56,7 +59,7 @@ FixAddActivity::FixAddActivity(LAMMPS *lmp, int narg, char **arg) :
       if (iarg+4 > narg) error->all(FLERR,"Illegal fix addactivity command");
       style = ABP;
       Fact = utils::numeric(FLERR,arg[iarg+2],false,lmp);
-      D = utils::numeric(FLERR,arg[iarg+2],false,lmp);
+      D = utils::numeric(FLERR,arg[iarg+3],false,lmp);
     } else error->all(FLERR,"Illegal fix addactivity command");
     iarg += 4;
   } else error->all(FLERR,"Illegal fix addactivity command");
@@ -64,10 +67,12 @@ FixAddActivity::FixAddActivity(LAMMPS *lmp, int narg, char **arg) :
   // optional args
   
   // seed for random numbers
-  int seed = utils::inumeric(FLERR,arg[iarg],false,lmp);
+  seed = utils::inumeric(FLERR,arg[iarg],false,lmp);
   iarg++;
 
   nevery = 1;
+  rotate_flag = 0;
+  last_rotate = -1;
 
   while (iarg < narg) {
     if (strcmp(arg[iarg],"every") == 0) {
@@ -75,14 +80,16 @@ FixAddActivity::FixAddActivity(LAMMPS *lmp, int narg, char **arg) :
       nevery = atoi(arg[iarg+1]);
       if (nevery <= 0) error->all(FLERR,"Illegal fix addactivity command");
       iarg += 2;
+    } else if (strcmp(arg[iarg],"rotate") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix addactivity command");
+      if (strcmp(arg[iarg+1],"yes") == 0) rotate_flag = 1;
+      else if (strcmp(arg[iarg+1],"no") == 0) rotate_flag = 0;
+      else error->all(FLERR,"Illegal fix addactivity command");
+      iarg += 2;
     } else error->all(FLERR,"Illegal fix addactivity command");
   }
-  
-  // initialize Marsaglia RNG with processor-unique seed
-  random = new RanMars(lmp,seed + comm->me);
-  
-  memory->create(sforce,maxatom,4,"addactivity:sforce");
 
+  if (seed <= 0) error->all(FLERR,"Illegal fix addactivity command");
 }
 
 /* ---------------------------------------------------------------------- */
@@ -114,83 +121,103 @@ void FixAddActivity::init()
 
 void FixAddActivity::setup(int vflag)
 {
-  post_force(vflag);
+  add_activity(0);
 }
 
 /* ---------------------------------------------------------------------- */
 
 void FixAddActivity::min_setup(int vflag)
 {
-  post_force(vflag);
+  add_activity(0);
 }
 
-/* ---------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------
+   mu is rotated at most once per step and only during dynamics, setup
+   and minimization only add the force, they would reuse the noise of
+   the step
+------------------------------------------------------------------------- */
 
 void FixAddActivity::post_force(int vflag)
 {
-  double **x = atom->x;
+  int rotate = 0;
+  if (rotate_flag && update->ntimestep != last_rotate) {
+    rotate = 1;
+    last_rotate = update->ntimestep;
+  }
+  add_activity(rotate);
+}
+
+/* ----------------------------------------------------------------------
+   active force along mu, rotational noise, with rotate != 0 the noise
+   rotates mu instead of setting omega
+------------------------------------------------------------------------- */
+
+void FixAddActivity::add_activity(int rotate)
+{
   double **f = atom->f;
   double **mu = atom-> mu;
   double *rad = atom-> radius;
   double **omega = atom->omega;
   int *mask = atom->mask;
-  imageint *image = atom->image;
+  tagint *tag = atom->tag;
   int nlocal = atom->nlocal;
 
   if (update->ntimestep % nevery) return;
-  
-  // reallocate sforce array if necessary
-
-  if (atom->nmax > maxatom) {
-    maxatom = atom->nmax;
-    memory->destroy(sforce);
-    memory->create(sforce,maxatom,4,"addactivity:sforce");
-  }
-
-  // set force vector
-  
-  if (style == ABP) {
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-	sforce[i][0] = Fact*mu[i][0];
-	sforce[i][1] = Fact*mu[i][1];
-	sforce[i][2] = Fact*mu[i][2];
-      }
+  if (style != ABP) return;
+
+  // angular velocity w = sqrt(2 D_r/dt)*\zeta(t) with D_r = 3/4 D/r^2
+  // -> amplitude is fnoise/r, with rotate the noise acts over nevery steps
+
+  double dtrot = update->dt;
+  if (rotate_flag) dtrot *= nevery;
+  double fnoise = sqrt(2.0*0.75*D/dtrot);
+  uint64_t stepkey = step_key(stream_key(id),seed,update->ntimestep);
+
+  // one pass: active force along mu, rotational noise, optionally rotate mu
+
+  int i;
+#if defined(_OPENMP)
+#pragma omp parallel for private(i) default(none) shared(f,mu,rad,omega,mask,tag,nlocal,fnoise,dtrot,stepkey,rotate) schedule(static)
+#endif
+  for (i = 0; i < nlocal; i++) {
+    if (!(mask[i] & groupbit)) continue;
+
+    f[i][0] += Fact*mu[i][0];
+    f[i][1] += Fact*mu[i][1];
+    f[i][2] += Fact*mu[i][2];
+    if (rotate_flag && !rotate) continue;
+
+    double g[3];
+    gaussian3(atom_key(stepkey,tag[i]),g);
+    double amp = fnoise/rad[i];
+    double w0 = amp*g[0];
+    double w1 = amp*g[1];
+    double w2 = amp*g[2];
+
+    if (!rotate_flag) {
+      omega[i][0] = w0;
+      omega[i][1] = w1;
+      omega[i][2] = w2;
+      continue;
     }
-  }
-  
-  // add force
 
-  for (int i = 0; i < nlocal; i++) {
-    if (mask[i] & groupbit) {
-      f[i][0] += sforce[i][0];
-      f[i][1] += sforce[i][1];
-      f[i][2] += sforce[i][2];
-    }
-  }
-  
-  // set angular velocity w = sqrt(3D_r)*\zeta(t) (projected on velocity of jth particle)
-  double eta0, eta1, eta2;
-  for (int i = 0; i < nlocal; i++) {
-    if (mask[i] & groupbit) {
-      //printf("%f\n",rad[i]);
-      double Dr = 3.0/4.0*D*1/(rad[i]*rad[i]);
-      Fnoise = sqrt(2.0*Dr/update->dt);
-      //eta0 = Fnoise * random->gaussian();
-      //eta1 = Fnoise * random->gaussian();
-      //eta2 = Fnoise * random->gaussian();
-      omega[i][0] = Fnoise * random->gaussian();
-      omega[i][1] = Fnoise * random->gaussian();
-      omega[i][2] = Fnoise * random->gaussian();
-    }
+    // rotate mu by the angle |w| dt around w (Rodrigues), keeps |mu|
+    double wlen = sqrt(w0*w0 + w1*w1 + w2*w2);
+    if (wlen == 0.0) continue;
+    double k0 = w0/wlen, k1 = w1/wlen, k2 = w2/wlen;
+    double ang = wlen*dtrot;
+    double ca = cos(ang), sa = sin(ang);
+    double m0 = mu[i][0], m1 = mu[i][1], m2 = mu[i][2];
+    double kdotm = (k0*m0 + k1*m1 + k2*m2)*(1.0-ca);
+    mu[i][0] = m0*ca + (k1*m2 - k2*m1)*sa + k0*kdotm;
+    mu[i][1] = m1*ca + (k2*m0 - k0*m2)*sa + k1*kdotm;
+    mu[i][2] = m2*ca + (k0*m1 - k1*m0)*sa + k2*kdotm;
   }
-  
-  
 }
 
 /* ---------------------------------------------------------------------- */
 
 void FixAddActivity::min_post_force(int vflag)
 {
-  post_force(vflag);
+  add_activity(0);
 }
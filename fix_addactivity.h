@@ -39,11 +39,12 @@ class FixAddActivity : public Fix {
   int style;
   double Fact, D;
   
-  int nevery, maxatom;
-  class RanMars *random;
-  
-  double Fnoise;
-  double **sforce;
+  int nevery;
+  int seed;
+  int rotate_flag;   // 1 = rotate mu here, 0 = only set omega for the integrator
+  bigint last_rotate; // last step mu was rotated on
+
+  void add_activity(int);
 };
 
 }
@@ -34,6 +34,7 @@
 #include "memory.h"
 #include "error.h"
 #include "force.h"
+#include "binary_frame.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -108,6 +109,8 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
   startstep = 0;
   fp = NULL;
   overwrite = 0;
+  binary_flag = 0;
+  binary_buf = NULL;
   numcorrelators=20;
   p = 16;
   m = 2;
@@ -170,6 +173,13 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
     } else if (strcmp(arg[iarg],"overwrite") == 0) {
       overwrite = 1;
       iarg += 1;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix ave/correlate/long command");
+      iarg += 2;
     } else if (strcmp(arg[iarg],"title1") == 0) {
       if (iarg+2 > narg)
         error->all(FLERR,"Illegal fix ave/correlate/long command");
@@ -250,7 +260,7 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
   if (type == FULL) npair = nvalues*nvalues;
 
   // print file comment lines
-  if (fp && me == 0) {
+  if (fp && me == 0 && !binary_flag) {
     if (title1) fprintf(fp,"%s\n",title1);
     else fprintf(fp,"# Time-correlated data for fix %s\n",id);
     if (title2) fprintf(fp,"%s\n",title2);
@@ -284,42 +294,89 @@ FixAveCorrelateLong::FixAveCorrelateLong(LAMMPS * lmp, int narg, char **arg):
     filepos = ftell(fp);
   }
 
+  // binary file: column Time followed by value and error of every pair
+  if (fp && me == 0 && binary_flag) {
+    int ncols = 1 + 2*npair;
+    char **names = new char*[ncols];
+    for (int i = 0; i < ncols; i++) names[i] = new char[BINARY_FRAME_NAMELEN];
+    strcpy(names[0],"Time");
+    int c = 1;
+    for (int i = 0; i < nvalues; i++) {
+      int jlo = 0, jhi = nvalues;
+      if (type == AUTO) { jlo = i; jhi = i+1; }
+      else if (type == UPPER) jlo = i+1;
+      else if (type == LOWER) jhi = i;
+      else if (type == AUTOUPPER) jlo = i;
+      else if (type == AUTOLOWER) jhi = i+1;
+      for (int j = jlo; j < jhi; j++) {
+        snprintf(names[c++],BINARY_FRAME_NAMELEN,"%.13s*%.13s",arg[5+i],arg[5+j]);
+        snprintf(names[c++],BINARY_FRAME_NAMELEN,"%.12s*%.12s_err",arg[5+i],arg[5+j]);
+      }
+    }
+    binary_frame_header(fp,id,ncols,names);
+    filepos = ftell(fp);
+    for (int i = 0; i < ncols; i++) delete [] names[i];
+    delete [] names;
+    memory->create(binary_buf,length*ncols,"correlator:binary_buf");
+  }
+
   delete [] title1;
   delete [] title2;
 
+  // pairs (i,j) in the order of the output columns
+
+  memory->create(pairs,npair,2,"correlator:pairs");
+  int ipair = 0;
+  for (int i = 0; i < nvalues; i++) {
+    int jlo = 0, jhi = nvalues;
+    if (type == AUTO) { jlo = i; jhi = i+1; }
+    else if (type == UPPER) jlo = i+1;
+    else if (type == LOWER) jhi = i;
+    else if (type == AUTOUPPER) jlo = i;
+    else if (type == AUTOLOWER) jhi = i+1;
+    for (int j = jlo; j < jhi; j++) {
+      pairs[ipair][0] = i;
+      pairs[ipair++][1] = j;
+    }
+  }
+
   // allocate and initialize memory for calculated values and correlators
+  // all pairs of a (level,slot) or (level,lag) are contiguous, so every
+  // level is updated with a single loop over the pairs
+  // shift keeps the -2E10 fill of unused slots only for the restart file
 
   memory->create(values,nvalues,"correlator:values");
-  memory->create(shift,npair,numcorrelators,p,"correlator:shift");
-  memory->create(shift2,npair,numcorrelators,p,"correlator:shift2"); //NOT OPTMAL
-  memory->create(correlation,npair,numcorrelators,p,"correlator:correlation");
-  memory->create(dcorrelation,npair,numcorrelators,p,"correlator:dcorrelation");
-  memory->create(accumulator,npair,numcorrelators,"correlator:accumulator");
-  memory->create(accumulator2,npair,numcorrelators,"correlator:accumulator2"); // NOT OPTIMAL
-
-  memory->create(ncorrelation,numcorrelators,p,"correlator:ncorrelation");
+  memory->create(shift,length*npair,"correlator:shift");
+  memory->create(shift2,length*npair,"correlator:shift2");
+  memory->create(correlation,length*npair,"correlator:correlation");
+  memory->create(dcorrelation,length*npair,"correlator:dcorrelation");
+  memory->create(accumulator,numcorrelators*npair,"correlator:accumulator");
+  memory->create(accumulator2,numcorrelators*npair,"correlator:accumulator2");
+
+  memory->create(ncorrelation,length,"correlator:ncorrelation");
   memory->create(naccumulator,numcorrelators,"correlator:naccumulator");
   memory->create(insertindex,numcorrelators,"correlator:insertindex");
+  memory->create(nfill,numcorrelators,"correlator:nfill");
   memory->create(t,length,"correlator:t");
   memory->create(f,npair,length,"correlator:f");
   memory->create(df,npair,length,"correlator:df");
 
-  for (int i=0;i<npair;i++)
-    for (int j=0;j<numcorrelators;j++) {
-      for (int k=0;k<p;k++) {
-        shift[i][j][k]=-2E10;
-        shift2[i][j][k]=0.0;
-        correlation[i][j][k]=0.0;
-	dcorrelation[i][j][k]=0.0;
-      }
-      accumulator[i][j]=0.0;
-      accumulator2[i][j]=0.0;
-    }
+  for (int i=0;i<length*npair;i++) {
+    shift[i]=-2E10;
+    shift2[i]=0.0;
+    correlation[i]=0.0;
+    dcorrelation[i]=0.0;
+  }
+  for (int i=0;i<numcorrelators*npair;i++) {
+    accumulator[i]=0.0;
+    accumulator2[i]=0.0;
+  }
 
+  for (int i=0;i<length;i++) ncorrelation[i]=0;
   for (int i=0;i<numcorrelators;i++) {
-    for (int j=0;j<p;j++) ncorrelation[i][j]=0;
     naccumulator[i]=0;
     insertindex[i]=0;
+    nfill[i]=0;
   }
 
   for (int i=0;i<length;i++) t[i]=0.0;
@@ -350,6 +407,7 @@ FixAveCorrelateLong::~FixAveCorrelateLong()
   for (int i = 0; i < nvalues; i++) delete [] ids[i];
   delete [] ids;
 
+  memory->destroy(pairs);
   memory->destroy(values);
   memory->destroy(shift);
   memory->destroy(shift2);
@@ -360,9 +418,11 @@ FixAveCorrelateLong::~FixAveCorrelateLong()
   memory->destroy(ncorrelation);
   memory->destroy(naccumulator);
   memory->destroy(insertindex);
+  memory->destroy(nfill);
   memory->destroy(t);
   memory->destroy(f);
   memory->destroy(df);
+  memory->destroy(binary_buf);
 
   if (fp && me == 0) fclose(fp);
 }
@@ -493,7 +553,24 @@ void FixAveCorrelateLong::end_of_step()
   // output result to file
   evaluate();
 
-  if (fp && me == 0) {
+  if (fp && me == 0 && binary_flag) {
+    if(overwrite) fseek(fp,filepos,SEEK_SET);
+    int ncols = 1 + 2*npair;
+    for (unsigned int i=0;i<npcorr;++i) {
+      double *row = &binary_buf[i*ncols];
+      row[0] = t[i]*update->dt;
+      for (unsigned int j=0;j<npair;++j) {
+        row[1+2*j] = f[j][i];
+        row[2+2*j] = df[j][i];
+      }
+    }
+    binary_frame_write(fp,ntimestep,npcorr,ncols,binary_buf);
+    fflush(fp);
+    if (overwrite) {
+      long fileend = ftell(fp);
+      if (fileend > 0) ftruncate(fileno(fp),fileend);
+    }
+  } else if (fp && me == 0) {
     if(overwrite) fseek(fp,filepos,SEEK_SET);
     fprintf(fp,"# Timestep: " BIGINT_FORMAT "\n", ntimestep);
     for (unsigned int i=0;i<npcorr;++i) {
@@ -519,11 +596,11 @@ void FixAveCorrelateLong::evaluate() {
 
   // First correlator
   for (unsigned int j=0;j<p;++j) {
-    if (ncorrelation[0][j] > 0) {
+    if (ncorrelation[j] > 0) {
       t[jm] = j;
       for (int i=0;i<npair;++i){
-	f[i][jm] = correlation[i][0][j]/ncorrelation[0][j];
-        df[i][jm] = dcorrelation[i][0][j]/ncorrelation[0][j];
+        f[i][jm] = correlation[j*npair+i]/ncorrelation[j];
+        df[i][jm] = dcorrelation[j*npair+i]/ncorrelation[j];
       }
       ++jm;
     }
@@ -532,12 +609,13 @@ void FixAveCorrelateLong::evaluate() {
   // Subsequent correlators
   for (int k=1;k<kmax;++k) {
     for (int j=dmin;j<p;++j) {
-      if (ncorrelation[k][j]>0) {
+      unsigned int kj = k*p+j;
+      if (ncorrelation[kj]>0) {
         t[jm] = j * pow((double)m, k);
         for (int i=0;i<npair;++i){
-          f[i][jm] = correlation[i][k][j] / ncorrelation[k][j];
-	  df[i][jm] = dcorrelation[i][k][j] / ncorrelation[k][j];
-	}
+          f[i][jm] = correlation[kj*npair+i] / ncorrelation[kj];
+          df[i][jm] = dcorrelation[kj*npair+i] / ncorrelation[kj];
+        }
         ++jm;
       }
     }
@@ -549,157 +627,87 @@ void FixAveCorrelateLong::evaluate() {
 
 /* ----------------------------------------------------------------------
    accumulate correlation data using more recently added values
+   the new sample of every pair enters correlator 0, a correlator passes
+   the block average on to the next one every m samples
 ------------------------------------------------------------------------- */
 
 void FixAveCorrelateLong::accumulate()
 {
-  int i,j,ipair;
-
-  //printf("DEBUG %i %i\n", nvalues, npair);
-
-  if (type == AUTO) {
-    for (i=0; i<nvalues;i++) add(i,values[i]);
-  } else if (type == UPPER) {
-    ipair = 0;
-    for (i=0;i<nvalues;i++)
-      for (j=i+1;j<nvalues;j++) add(ipair++,values[i],values[j]);
-  } else if (type == LOWER) {
-    ipair = 0;
-    for (i=0;i<nvalues;i++)
-      for (j=0;j<i;j++) add(ipair++,values[i],values[j]);
-  } else if (type == AUTOUPPER) {
-    ipair = 0;
-    for (i=0;i<nvalues;i++)
-      for (j=i;j<nvalues;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
-      }
-  } else if (type == AUTOLOWER) {
-    ipair = 0;
-    for (i=0;i<nvalues;i++)
-      for (j=0;j<=i;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
-      }
-  } else if (type == FULL) {
-    ipair = 0;
-    for (i=0;i<nvalues;i++)
-      for (j=0;j<nvalues;j++) {
-        if (i==j) add(ipair++,values[i]);
-        else add(ipair++,values[i],values[j]);
-      }
-  }
-}
+  int ipair;
+  double *a;
 
+  // auto pairs have identical A and B, so one kernel serves all types
 
-/* ----------------------------------------------------------------------
-   Add a scalar value to the autocorrelator k of pair i
-------------------------------------------------------------------------- */
-void FixAveCorrelateLong::add(const int i, const double w, const unsigned int k){
-  // If we exceed the correlator side, the value is discarded
-  if (k == numcorrelators) return;
-  if (k > kmax) kmax=k;
-
-  // Insert new value in shift array
-  shift[i][k][insertindex[k]] = w;
-
-  // Add to accumulator and, if needed, add to next correlator
-  accumulator[i][k] += w;
-  if (i==0) ++naccumulator[k];
-  if (naccumulator[k]==m) {
-    add(i,accumulator[i][k]/m, k+1);
-    accumulator[i][k]=0;
-    if (i==npair-1) naccumulator[k]=0;
+  a = &shift[insertindex[0]*npair];
+  double *b = &shift2[insertindex[0]*npair];
+  for (ipair=0;ipair<npair;ipair++) {
+    a[ipair] = values[pairs[ipair][0]];
+    b[ipair] = values[pairs[ipair][1]];
   }
 
-  // Calculate correlation function
-  unsigned int ind1=insertindex[k];
-  if (k==0) { // First correlator is different
-    int ind2=ind1;
-    for (unsigned int j=0;j<p;++j) {
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f\n",k,shift[i][k][ind1]*shift[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2]*shift[i][k][ind1]*shift[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
+  for (unsigned int k=0;k<numcorrelators;++k) {
+    if (k > kmax) kmax=k;
+    add(k);
+
+    // block average of the last correlator is discarded
+    if (naccumulator[k] < m) break;
+    naccumulator[k]=0;
+    double *acc = &accumulator[k*npair];
+    double *acc2 = &accumulator2[k*npair];
+    if (k+1 < numcorrelators) {
+      a = &shift[((k+1)*p + insertindex[k+1])*npair];
+      b = &shift2[((k+1)*p + insertindex[k+1])*npair];
+      for (ipair=0;ipair<npair;ipair++) {
+        a[ipair] = acc[ipair]/m;
+        b[ipair] = acc2[ipair]/m;
       }
-      --ind2;
-      if (ind2<0) ind2+=p;
     }
-  } else {
-    int ind2=ind1-dmin;
-    for (unsigned int j=dmin;j<p;++j) {
-      if (ind2<0) ind2+=p;
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f\n",k,shift[i][k][ind1]*shift[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift[i][k][ind2]*shift[i][k][ind1]*shift[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
+    for (ipair=0;ipair<npair;ipair++) {
+      acc[ipair] = 0.0;
+      acc2[ipair] = 0.0;
     }
   }
-
-  if (i==npair-1) {
-    ++insertindex[k];
-    if (insertindex[k]==p) insertindex[k]=0;
-  }
 }
 
 
 /* ----------------------------------------------------------------------
-   Add 2 scalar values to the cross-correlator k of pair i
+   Correlate the sample at the insert index of correlator k with all
+   valid earlier samples, for all pairs at once
 ------------------------------------------------------------------------- */
-void FixAveCorrelateLong::add(const int i, const double wA, const double wB,
-                        const unsigned int k) {
-  if (k == numcorrelators) return;
-  if (k > kmax) kmax=k;
-
-  shift[i][k][insertindex[k]] = wA;
-  shift2[i][k][insertindex[k]] = wB;
-
-  accumulator[i][k] += wA;
-  accumulator2[i][k] += wB;
-  if (i==0) ++naccumulator[k];
-  if (naccumulator[k]==m) {
-    add(i,accumulator[i][k]/m, accumulator2[i][k]/m,k+1);
-    accumulator[i][k]=0;
-    accumulator2[i][k]=0;
-    if (i==npair-1) naccumulator[k]=0;
+void FixAveCorrelateLong::add(const unsigned int k){
+  const int np = npair;
+  const unsigned int ind1 = insertindex[k];
+  const double * const a = &shift[(k*p + ind1)*np];
+  const double * const a2 = &shift2[(k*p + ind1)*np];
+
+  // Add to accumulator
+  double * const acc = &accumulator[k*np];
+  double * const acc2 = &accumulator2[k*np];
+  for (int i=0;i<np;++i) {
+    acc[i] += a[i];
+    acc2[i] += a2[i];
   }
+  ++naccumulator[k];
+  if (nfill[k] < p) ++nfill[k];
 
-  unsigned int ind1=insertindex[k];
-  if (k==0) {
-    int ind2=ind1;
-    for (unsigned int j=0;j<p;++j) {
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f %f\n",j,shift[i][k][ind1],shift2[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2]*shift[i][k][ind1]*shift2[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
-      if (ind2<0) ind2+=p;
-    }
-  }
-  else {
-    int ind2=ind1-dmin;
-    for (unsigned int j=dmin;j<p;++j) {
-      if (ind2<0) ind2+=p;
-      if (shift[i][k][ind2] > -1e10) {
-	//printf("%d %f %f\n",j,shift[i][k][ind1],shift2[i][k][ind2]);
-        correlation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2];
-	dcorrelation[i][k][j]+= shift[i][k][ind1]*shift2[i][k][ind2]*shift[i][k][ind1]*shift2[i][k][ind2];
-        if (i==0) ++ncorrelation[k][j];
-      }
-      --ind2;
+  // Calculate correlation function
+  // First correlator is different, the others start at dmin
+  unsigned int jlo = (k==0) ? 0 : dmin;
+  for (unsigned int j=jlo;j<nfill[k];++j) {
+    unsigned int ind2 = (ind1 + p - j) % p;
+    const double * const b = &shift2[(k*p + ind2)*np];
+    double * const c = &correlation[(k*p + j)*np];
+    double * const dc = &dcorrelation[(k*p + j)*np];
+    for (int i=0;i<np;++i) {
+      double prod = a[i]*b[i];
+      c[i] += prod;
+      dc[i] += prod*a[i]*b[i];
     }
+    ++ncorrelation[k*p+j];
   }
 
-  if (i==npair-1) {
-    ++insertindex[k];
-    if (insertindex[k]==p) insertindex[k]=0;
-  }
+  ++insertindex[k];
+  if (insertindex[k]==p) insertindex[k]=0;
 }
 
 
@@ -722,27 +730,31 @@ bigint FixAveCorrelateLong::nextvalid()
    memory_usage
 ------------------------------------------------------------------------- */
 double FixAveCorrelateLong::memory_usage() {
-  //    shift:            npair x numcorrelators x p
-  //    shift2:           npair x numcorrelators x p
-  //    correlation:      npair x numcorrelators x p
-  //    dcorrelation:      npair x numcorrelators x p
-  //    accumulator:      npair x numcorrelators
-  //    accumulator2:     npair x numcorrelators
+  //    shift:            numcorrelators x p x npair
+  //    shift2:           numcorrelators x p x npair
+  //    correlation:      numcorrelators x p x npair
+  //    dcorrelation:     numcorrelators x p x npair
+  //    accumulator:      numcorrelators x npair
+  //    accumulator2:     numcorrelators x npair
   //    ncorrelation:     numcorrelators x p
   //    naccumulator:     numcorrelators
   //    insertindex:      numcorrelators
+  //    nfill:            numcorrelators
   //    t:		numcorrelators x p
   //    f:		npair x numcorrelators x p
   //    df:		npair x numcorrelators x p
   double bytes = (6*npair*numcorrelators*p + 2*npair*numcorrelators
                   + numcorrelators*p)*sizeof(double)
     + numcorrelators*p*sizeof(unsigned long int)
-    + 2*numcorrelators*sizeof(unsigned int);
+    + 3*numcorrelators*sizeof(unsigned int)
+    + 2*npair*sizeof(int);
   return bytes;
 }
 
 /* ----------------------------------------------------------------------
    Write Restart data to restart file
+   the layout is the one of the nested [pair][level][slot] arrays, unused
+   slots of shift carry the -2E10 fill
 ------------------------------------------------------------------------- */
 // Save everything except t and f
 void FixAveCorrelateLong::write_restart(FILE *fp) {
@@ -761,16 +773,17 @@ void FixAveCorrelateLong::write_restart(FILE *fp) {
     for (int i=0;i<npair;i++)
       for (int j=0;j<numcorrelators;j++) {
         for (int k=0;k<p;k++) {
-          list[n++]=shift[i][j][k];
-          list[n++]=shift2[i][j][k];
-          list[n++]=correlation[i][j][k];
-	  list[n++]=dcorrelation[i][j][k];
+          int jk = (j*p+k)*npair+i;
+          list[n++]=shift[jk];
+          list[n++]=shift2[jk];
+          list[n++]=correlation[jk];
+          list[n++]=dcorrelation[jk];
         }
-        list[n++]=accumulator[i][j];
-        list[n++]=accumulator2[i][j];
+        list[n++]=accumulator[j*npair+i];
+        list[n++]=accumulator2[j*npair+i];
       }
     for (int i=0;i<numcorrelators;i++) {
-      for (int j=0;j<p;j++) list[n++]=ncorrelation[i][j];
+      for (int j=0;j<p;j++) list[n++]=ncorrelation[i*p+j];
       list[n++]=naccumulator[i];
       list[n++]=insertindex[i];
     }
@@ -785,6 +798,7 @@ void FixAveCorrelateLong::write_restart(FILE *fp) {
 
 /* ----------------------------------------------------------------------
    use state info from restart file to restart the Fix
+   auto pairs may have no shift2 in the file, it is a copy of shift
 ------------------------------------------------------------------------- */
 void FixAveCorrelateLong::restart(char *buf)
 {
@@ -804,18 +818,33 @@ void FixAveCorrelateLong::restart(char *buf)
   for (int i=0;i<npair;i++)
     for (int j=0;j<numcorrelators;j++) {
       for (int k=0;k<p;k++) {
-        shift[i][j][k] = list[n++];
-        shift2[i][j][k] = list[n++];
-        correlation[i][j][k] = list[n++];
-	dcorrelation[i][j][k] = list[n++];
+        int jk = (j*p+k)*npair+i;
+        shift[jk] = list[n++];
+        shift2[jk] = list[n++];
+        correlation[jk] = list[n++];
+        dcorrelation[jk] = list[n++];
+        if (pairs[i][0] == pairs[i][1]) shift2[jk] = shift[jk];
       }
-      accumulator[i][j] = list[n++];
-      accumulator2[i][j] = list[n++];
+      accumulator[j*npair+i] = list[n++];
+      accumulator2[j*npair+i] = list[n++];
+      if (pairs[i][0] == pairs[i][1])
+        accumulator2[j*npair+i] = accumulator[j*npair+i];
     }
   for (int i=0;i<numcorrelators;i++) {
     for (int j=0;j<p;j++)
-      ncorrelation[i][j] = static_cast<unsigned long int>(list[n++]);
+      ncorrelation[i*p+j] = static_cast<unsigned long int>(list[n++]);
     naccumulator[i] = static_cast<unsigned int> (list[n++]);
     insertindex[i] = static_cast<unsigned int> (list[n++]);
   }
+
+  // filled slots and the highest correlator reached follow from the fill,
+  // all pairs are filled in lockstep so pair 0 is representative
+
+  kmax = 0;
+  for (int k=0;k<numcorrelators;k++) {
+    nfill[k] = 0;
+    for (int j=0;j<p;j++)
+      if (shift[(k*p+j)*npair] > -1e10) ++nfill[k];
+    if (nfill[k]) kmax = k;
+  }
 }
@@ -44,14 +44,16 @@ class FixAveCorrelateLong : public Fix {
   unsigned int npcorr;
 
  private:
-  // NOT OPTIMAL: shift2 and accumulator2 only needed in cross-correlations
-  double ***shift, *** shift2;
-  double ***correlation;
-  double ***dcorrelation;
-  double **accumulator, **accumulator2;
-  unsigned long int **ncorrelation;
+  // flat arrays, all pairs of a [level][slot] or [level][lag] adjacent
+  // shift2 and accumulator2 hold the B value, equal to A for auto pairs
+  double *shift, *shift2;
+  double *correlation;
+  double *dcorrelation;
+  double *accumulator, *accumulator2;   // [level][pair]
+  unsigned long int *ncorrelation;      // [level][lag]
   unsigned int *naccumulator;
   unsigned int *insertindex;
+  unsigned int *nfill;                  // valid slots per level
 
   unsigned int numcorrelators; // Recommended 20
   unsigned int p; // Points per correlator (recommended 16)
@@ -70,8 +72,11 @@ class FixAveCorrelateLong : public Fix {
 
   int type,startstep,overwrite;
   long filepos;
+  int binary_flag;     // write binary frames (binary_frame.h) instead of text
+  double *binary_buf;
 
   int npair;           // number of correlation pairs to calculate
+  int **pairs;         // values (i,j) of each pair
   double *values;
   
   int bins;
@@ -81,8 +86,7 @@ class FixAveCorrelateLong : public Fix {
   void evaluate();
   bigint nextvalid();
 
-  void add(const int i, const double w, const unsigned int k = 0);
-  void add(const int i, const double wA, const double wB, const unsigned int k = 0);
+  void add(const unsigned int k);
 
 };
 
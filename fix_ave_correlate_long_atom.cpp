@@ -0,0 +1,891 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Per-atom variant of fix ave/correlate/long: every atom of the group
+   has its own multi-tau correlator of per-atom values, the correlations
+   are averaged over the atoms, f(tau) = < A_i(t) B_i(t+tau) >_{i,t}
+   see J. Chem. Phys. 133, 154103 (2010)
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fix_ave_correlate_long_atom.h"
+#include "atom.h"
+#include "update.h"
+#include "modify.h"
+#include "compute.h"
+#include "input.h"
+#include "variable.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "binary_frame.h"
+
+using namespace LAMMPS_NS;
+using namespace FixConst;
+
+enum{COMPUTE,FIX,VARIABLE};
+enum{AUTO,UPPER,LOWER,AUTOUPPER,AUTOLOWER,FULL};
+
+#define INVOKED_PERATOM 8
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateLongAtom::FixAveCorrelateLongAtom(LAMMPS * lmp, int narg, char **arg):
+  Fix (lmp, narg, arg)
+{
+  // At least nevery nfrez and one value are needed
+  if (narg < 6) error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+
+  MPI_Comm_rank(world,&me);
+
+  nevery = force->inumeric(FLERR,arg[3]);
+  nfreq = force->inumeric(FLERR,arg[4]);
+
+  restart_global = 1;
+  restart_peratom = 1;
+  global_freq = nfreq;
+
+  // parse values until one isn't recognized
+
+  which = new int[narg-5];
+  argindex = new int[narg-5];
+  ids = new char*[narg-5];
+  value2index = new int[narg-5];
+  nvalues = 0;
+
+  int iarg = 5;
+  while (iarg < narg) {
+    if (strncmp(arg[iarg],"c_",2) == 0 ||
+        strncmp(arg[iarg],"f_",2) == 0 ||
+        strncmp(arg[iarg],"v_",2) == 0) {
+      if (arg[iarg][0] == 'c') which[nvalues] = COMPUTE;
+      else if (arg[iarg][0] == 'f') which[nvalues] = FIX;
+      else if (arg[iarg][0] == 'v') which[nvalues] = VARIABLE;
+
+      int n = strlen(arg[iarg]);
+      char *suffix = new char[n];
+      strcpy(suffix,&arg[iarg][2]);
+
+      char *ptr = strchr(suffix,'[');
+      if (ptr) {
+        if (suffix[strlen(suffix)-1] != ']')
+          error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+        argindex[nvalues] = atoi(ptr+1);
+        *ptr = '\0';
+      } else argindex[nvalues] = 0;
+
+      n = strlen(suffix) + 1;
+      ids[nvalues] = new char[n];
+      strcpy(ids[nvalues],suffix);
+      delete [] suffix;
+
+      nvalues++;
+      iarg++;
+    } else break;
+  }
+  if (nvalues == 0) error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+
+  // optional args
+
+  type = AUTO;
+  startstep = 0;
+  fp = NULL;
+  overwrite = 0;
+  binary_flag = 0;
+  binary_buf = NULL;
+  numcorrelators=20;
+  p = 16;
+  m = 2;
+  char *title1 = NULL;
+  char *title2 = NULL;
+
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"type") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      if (strcmp(arg[iarg+1],"auto") == 0) type = AUTO;
+      else if (strcmp(arg[iarg+1],"upper") == 0) type = UPPER;
+      else if (strcmp(arg[iarg+1],"lower") == 0) type = LOWER;
+      else if (strcmp(arg[iarg+1],"auto/upper") == 0) type = AUTOUPPER;
+      else if (strcmp(arg[iarg+1],"auto/lower") == 0) type = AUTOLOWER;
+      else if (strcmp(arg[iarg+1],"full") == 0) type = FULL;
+      else error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"start") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      startstep = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"ncorr") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      numcorrelators = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"nlen") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      p = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"ncount") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      m = force->inumeric(FLERR,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"file") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      if (me == 0) {
+        fp = fopen(arg[iarg+1],"w");
+        if (fp == NULL) {
+          char str[128];
+          sprintf(str,"Cannot open fix ave/correlate/long/atom file %s",arg[iarg+1]);
+          error->one(FLERR,str);
+        }
+      }
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"overwrite") == 0) {
+      overwrite = 1;
+      iarg += 1;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"title1") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      delete [] title1;
+      int n = strlen(arg[iarg+1]) + 1;
+      title1 = new char[n];
+      strcpy(title1,arg[iarg+1]);
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"title2") == 0) {
+      if (iarg+2 > narg)
+        error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+      delete [] title2;
+      int n = strlen(arg[iarg+1]) + 1;
+      title2 = new char[n];
+      strcpy(title2,arg[iarg+1]);
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+  }
+
+  if (p == 0 || m == 0 || numcorrelators == 0)
+    error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+  if (p % m != 0) error->all(FLERR,"fix_correlator: p mod m must be 0");
+  dmin = p/m;
+  length = numcorrelators*p;
+  npcorr = 0;
+  kmax = 0;
+
+  // setup and error check
+  // for fix inputs, check that fix frequency is acceptable
+
+  if (nevery <= 0 || nfreq <= 0)
+    error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+  if (nfreq % nevery)
+    error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+
+  for (int i = 0; i < nvalues; i++) {
+    if (which[i] == COMPUTE) {
+      int icompute = modify->find_compute(ids[i]);
+      if (icompute < 0)
+        error->all(FLERR,"Compute ID for fix ave/correlate/long/atom does not exist");
+      if (modify->compute[icompute]->peratom_flag == 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom compute does not "
+                   "calculate per-atom values");
+      if (argindex[i] == 0 && modify->compute[icompute]->size_peratom_cols != 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom compute does not "
+                   "calculate a per-atom vector");
+      if (argindex[i] && modify->compute[icompute]->size_peratom_cols == 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom compute does not "
+                   "calculate a per-atom array");
+      if (argindex[i] && argindex[i] > modify->compute[icompute]->size_peratom_cols)
+        error->all(FLERR,"Fix ave/correlate/long/atom compute array "
+                   "is accessed out-of-range");
+
+    } else if (which[i] == FIX) {
+      int ifix = modify->find_fix(ids[i]);
+      if (ifix < 0)
+        error->all(FLERR,"Fix ID for fix ave/correlate/long/atom does not exist");
+      if (modify->fix[ifix]->peratom_flag == 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom fix does not "
+                   "calculate per-atom values");
+      if (argindex[i] == 0 && modify->fix[ifix]->size_peratom_cols != 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom fix does not "
+                   "calculate a per-atom vector");
+      if (argindex[i] && modify->fix[ifix]->size_peratom_cols == 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom fix does not "
+                   "calculate a per-atom array");
+      if (argindex[i] && argindex[i] > modify->fix[ifix]->size_peratom_cols)
+        error->all(FLERR,"Fix ave/correlate/long/atom fix array "
+                   "is accessed out-of-range");
+      if (nevery % modify->fix[ifix]->peratom_freq)
+        error->all(FLERR,"Fix for fix ave/correlate/long/atom "
+                   "not computed at compatible time");
+
+    } else if (which[i] == VARIABLE) {
+      int ivariable = input->variable->find(ids[i]);
+      if (ivariable < 0)
+        error->all(FLERR,"Variable name for fix ave/correlate/long/atom does not exist");
+      if (input->variable->atomstyle(ivariable) == 0)
+        error->all(FLERR,"Fix ave/correlate/long/atom variable "
+                   "is not atom-style variable");
+    }
+  }
+
+  // npair = # of correlation pairs to calculate
+  // pairs in the order of fix ave/correlate/long
+
+  if (type == AUTO) npair = nvalues;
+  if (type == UPPER || type == LOWER) npair = nvalues*(nvalues-1)/2;
+  if (type == AUTOUPPER || type == AUTOLOWER) npair = nvalues*(nvalues+1)/2;
+  if (type == FULL) npair = nvalues*nvalues;
+  if (npair == 0) error->all(FLERR,"Illegal fix ave/correlate/long/atom command");
+
+  memory->create(pairs,npair,2,"correlator/atom:pairs");
+  int ipair = 0;
+  for (int i = 0; i < nvalues; i++) {
+    int jlo = 0, jhi = nvalues;
+    if (type == AUTO) { jlo = i; jhi = i+1; }
+    else if (type == UPPER) jlo = i+1;
+    else if (type == LOWER) jhi = i;
+    else if (type == AUTOUPPER) jlo = i;
+    else if (type == AUTOLOWER) jhi = i+1;
+    for (int j = jlo; j < jhi; j++) {
+      pairs[ipair][0] = i;
+      pairs[ipair++][1] = j;
+    }
+  }
+
+  // print file comment lines
+  if (fp && me == 0 && !binary_flag) {
+    if (title1) fprintf(fp,"%s\n",title1);
+    else fprintf(fp,"# Time-correlated per-atom data for fix %s\n",id);
+    if (title2) fprintf(fp,"%s\n",title2);
+    else {
+      fprintf(fp,"# Time");
+      for (ipair = 0; ipair < npair; ipair++)
+        fprintf(fp," %s*%s",arg[5+pairs[ipair][0]],arg[5+pairs[ipair][1]]);
+      fprintf(fp,"\n");
+    }
+    filepos = ftell(fp);
+  }
+
+  // binary file: column Time followed by value and error of every pair
+  if (fp && me == 0 && binary_flag) {
+    int ncols = 1 + 2*npair;
+    char **names = new char*[ncols];
+    for (int i = 0; i < ncols; i++) names[i] = new char[BINARY_FRAME_NAMELEN];
+    strcpy(names[0],"Time");
+    int c = 1;
+    for (ipair = 0; ipair < npair; ipair++) {
+      int i = pairs[ipair][0];
+      int j = pairs[ipair][1];
+      snprintf(names[c++],BINARY_FRAME_NAMELEN,"%.13s*%.13s",arg[5+i],arg[5+j]);
+      snprintf(names[c++],BINARY_FRAME_NAMELEN,"%.12s*%.12s_err",arg[5+i],arg[5+j]);
+    }
+    binary_frame_header(fp,id,ncols,names);
+    filepos = ftell(fp);
+    for (int i = 0; i < ncols; i++) delete [] names[i];
+    delete [] names;
+    memory->create(binary_buf,length*ncols,"correlator/atom:binary_buf");
+  }
+
+  delete [] title1;
+  delete [] title2;
+
+  // allocate and initialize memory for the correlators
+  // the per-atom buffers migrate with the atoms, the sums stay on the proc
+
+  nshift = numcorrelators*p*nvalues;
+  naccum = numcorrelators*nvalues;
+  nmax = 0;
+  shift = NULL;
+  accumulator = NULL;
+  groupweight = NULL;
+  grow_arrays(atom->nmax);
+  atom->add_callback(0);
+  atom->add_callback(1);
+  maxexchange = nshift + naccum;
+
+  memory->create(correlation,length*npair,"correlator/atom:correlation");
+  memory->create(dcorrelation,length*npair,"correlator/atom:dcorrelation");
+  memory->create(ncorrelation,length,"correlator/atom:ncorrelation");
+  memory->create(correlation_all,length*npair,"correlator/atom:correlation_all");
+  memory->create(dcorrelation_all,length*npair,"correlator/atom:dcorrelation_all");
+  memory->create(ncorrelation_all,length,"correlator/atom:ncorrelation_all");
+  memory->create(naccumulator,numcorrelators,"correlator/atom:naccumulator");
+  memory->create(insertindex,numcorrelators,"correlator/atom:insertindex");
+  memory->create(nfill,numcorrelators,"correlator/atom:nfill");
+  memory->create(t,length,"correlator/atom:t");
+  memory->create(f,npair,length,"correlator/atom:f");
+  memory->create(df,npair,length,"correlator/atom:df");
+
+  for (int i = 0; i < length*npair; i++) correlation[i] = dcorrelation[i] = 0.0;
+  for (int i = 0; i < length; i++) ncorrelation[i] = 0.0;
+  for (int i = 0; i < numcorrelators; i++)
+    naccumulator[i] = insertindex[i] = nfill[i] = 0;
+
+  for (int i=0;i<length;i++) t[i]=0.0;
+  for (int i=0;i<npair;i++)
+    for (int j=0;j<length;j++) {
+      f[i][j]=0.0;
+      df[i][j]=0.0;
+    }
+
+  // nvalid = next step on which end_of_step does something
+  // add nvalid to all computes that store invocation times
+  // since don't know a priori which are invoked by this fix
+  // once in end_of_step() can set timestep for ones actually invoked
+
+  nvalid_last = -1;
+  nvalid = nextvalid();
+  modify->addstep_compute_all(nvalid);
+}
+
+/* ---------------------------------------------------------------------- */
+
+FixAveCorrelateLongAtom::~FixAveCorrelateLongAtom()
+{
+  atom->delete_callback(id,0);
+  atom->delete_callback(id,1);
+
+  delete [] which;
+  delete [] argindex;
+  delete [] value2index;
+  for (int i = 0; i < nvalues; i++) delete [] ids[i];
+  delete [] ids;
+
+  memory->destroy(pairs);
+  memory->destroy(shift);
+  memory->destroy(accumulator);
+  memory->destroy(groupweight);
+  memory->destroy(correlation);
+  memory->destroy(dcorrelation);
+  memory->destroy(ncorrelation);
+  memory->destroy(correlation_all);
+  memory->destroy(dcorrelation_all);
+  memory->destroy(ncorrelation_all);
+  memory->destroy(naccumulator);
+  memory->destroy(insertindex);
+  memory->destroy(nfill);
+  memory->destroy(t);
+  memory->destroy(f);
+  memory->destroy(df);
+  memory->destroy(binary_buf);
+
+  if (fp && me == 0) fclose(fp);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::setmask()
+{
+  int mask = 0;
+  mask |= END_OF_STEP;
+  return mask;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::init()
+{
+  // set current indices for all computes,fixes,variables
+
+  for (int i = 0; i < nvalues; i++) {
+    if (which[i] == COMPUTE) {
+      int icompute = modify->find_compute(ids[i]);
+      if (icompute < 0)
+        error->all(FLERR,"Compute ID for fix ave/correlate/long/atom does not exist");
+      value2index[i] = icompute;
+
+    } else if (which[i] == FIX) {
+      int ifix = modify->find_fix(ids[i]);
+      if (ifix < 0)
+        error->all(FLERR,"Fix ID for fix ave/correlate/long/atom does not exist");
+      value2index[i] = ifix;
+
+    } else if (which[i] == VARIABLE) {
+      int ivariable = input->variable->find(ids[i]);
+      if (ivariable < 0)
+        error->all(FLERR,"Variable name for fix ave/correlate/long/atom does not exist");
+      value2index[i] = ivariable;
+    }
+  }
+
+  // need to reset nvalid if nvalid < ntimestep b/c minimize was performed
+
+  if (nvalid < update->ntimestep) {
+    nvalid = nextvalid();
+    modify->addstep_compute_all(nvalid);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   only does something if nvalid = current timestep
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::setup(int vflag)
+{
+  end_of_step();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::end_of_step()
+{
+  int i,j,n;
+
+  // skip if not step which requires doing something
+  // error check if timestep was reset in an invalid manner
+
+  bigint ntimestep = update->ntimestep;
+  if (ntimestep < nvalid_last || ntimestep > nvalid)
+    error->all(FLERR,"Invalid timestep reset for fix ave/correlate/long/atom");
+  if (ntimestep != nvalid) return;
+  nvalid_last = nvalid;
+
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+
+  // the new sample goes straight into the insert slot of correlator 0
+  // compute/fix/variable may invoke computes so wrap with clear/add
+
+  modify->clearstep_compute();
+
+  unsigned int slot = insertindex[0];
+  for (i = 0; i < nvalues; i++) {
+    n = value2index[i];
+    double *row = shift[slot*nvalues + i];
+
+    if (which[i] == COMPUTE) {
+      Compute *compute = modify->compute[n];
+      if (!(compute->invoked_flag & INVOKED_PERATOM)) {
+        compute->compute_peratom();
+        compute->invoked_flag |= INVOKED_PERATOM;
+      }
+      if (argindex[i] == 0) {
+        double *vector = compute->vector_atom;
+        for (j = 0; j < nlocal; j++)
+          if (mask[j] & groupbit) row[j] = vector[j];
+      } else {
+        double **array = compute->array_atom;
+        int jcol = argindex[i]-1;
+        for (j = 0; j < nlocal; j++)
+          if (mask[j] & groupbit) row[j] = array[j][jcol];
+      }
+
+    // access fix fields, guaranteed to be ready
+
+    } else if (which[i] == FIX) {
+      if (argindex[i] == 0) {
+        double *vector = modify->fix[n]->vector_atom;
+        for (j = 0; j < nlocal; j++)
+          if (mask[j] & groupbit) row[j] = vector[j];
+      } else {
+        double **array = modify->fix[n]->array_atom;
+        int jcol = argindex[i]-1;
+        for (j = 0; j < nlocal; j++)
+          if (mask[j] & groupbit) row[j] = array[j][jcol];
+      }
+
+    // evaluate atom-style variable, zero for atoms outside the group
+
+    } else if (which[i] == VARIABLE)
+      input->variable->compute_atom(n,igroup,row,1,0);
+  }
+
+  for (j = 0; j < nlocal; j++)
+    groupweight[j] = (mask[j] & groupbit) ? 1.0 : 0.0;
+
+  nvalid += nevery;
+  modify->addstep_compute(nvalid);
+
+  // calculate all Cij() enabled by latest values
+
+  accumulate();
+  if (ntimestep % nfreq) return;
+
+  // output result to file
+  evaluate();
+
+  if (fp && me == 0 && binary_flag) {
+    if(overwrite) fseek(fp,filepos,SEEK_SET);
+    int ncols = 1 + 2*npair;
+    for (unsigned int i=0;i<npcorr;++i) {
+      double *row = &binary_buf[i*ncols];
+      row[0] = t[i]*nevery*update->dt;
+      for (unsigned int j=0;j<npair;++j) {
+        row[1+2*j] = f[j][i];
+        row[2+2*j] = df[j][i];
+      }
+    }
+    binary_frame_write(fp,ntimestep,npcorr,ncols,binary_buf);
+    fflush(fp);
+    if (overwrite) {
+      long fileend = ftell(fp);
+      if (fileend > 0) ftruncate(fileno(fp),fileend);
+    }
+  } else if (fp && me == 0) {
+    if(overwrite) fseek(fp,filepos,SEEK_SET);
+    fprintf(fp,"# Timestep: " BIGINT_FORMAT "\n", ntimestep);
+    for (unsigned int i=0;i<npcorr;++i) {
+      fprintf(fp, "%lg ", t[i]*nevery*update->dt);
+      for (unsigned int j=0;j<npair;++j) {
+        fprintf(fp, "%.15lg %lg ", f[j][i],df[j][i]);
+      }
+    fprintf(fp, "\n");
+    }
+    fflush(fp);
+    if (overwrite) {
+      long fileend = ftell(fp);
+      if (fileend > 0) ftruncate(fileno(fp),fileend);
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   sum the correlations of all procs and average them over the atoms
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::evaluate()
+{
+  MPI_Reduce(correlation,correlation_all,length*npair,MPI_DOUBLE,MPI_SUM,0,world);
+  MPI_Reduce(dcorrelation,dcorrelation_all,length*npair,MPI_DOUBLE,MPI_SUM,0,world);
+  MPI_Reduce(ncorrelation,ncorrelation_all,length,MPI_DOUBLE,MPI_SUM,0,world);
+  if (me) return;
+
+  unsigned int jm=0;
+
+  // First correlator, subsequent correlators start at dmin
+  for (unsigned int k=0;k<=kmax && k<numcorrelators;++k) {
+    unsigned int jlo = (k == 0) ? 0 : dmin;
+    for (unsigned int j=jlo;j<p;++j) {
+      double count = ncorrelation_all[k*p+j];
+      if (count > 0.0) {
+        t[jm] = j * pow((double)m, k);
+        double *c = &correlation_all[(k*p+j)*npair];
+        double *dc = &dcorrelation_all[(k*p+j)*npair];
+        for (int i=0;i<npair;++i) {
+          f[i][jm] = c[i]/count;
+          df[i][jm] = dc[i]/count;
+        }
+        ++jm;
+      }
+    }
+  }
+
+  npcorr = jm;
+}
+
+/* ----------------------------------------------------------------------
+   add the newest sample to correlator 0 and walk up the hierarchy as
+   long as a block average is complete, one pass over the atoms for
+   each correlator that is touched
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::accumulate()
+{
+  int nlocal = atom->nlocal;
+  unsigned int k,v,slot;
+  int i;
+
+  for (k = 0; k < numcorrelators; k++) {
+    if (k > kmax) kmax = k;
+    slot = insertindex[k];
+
+    // add to accumulator
+    for (v = 0; v < nvalues; v++) {
+      double *w = shift[(k*p + slot)*nvalues + v];
+      double *acc = accumulator[k*nvalues + v];
+      for (i = 0; i < nlocal; i++) acc[i] += w[i];
+    }
+    ++naccumulator[k];
+    if (nfill[k] < p) ++nfill[k];
+
+    correlate(k);
+
+    ++insertindex[k];
+    if (insertindex[k] == p) insertindex[k] = 0;
+
+    // block average complete: it is the new sample of the next correlator
+    if (naccumulator[k] < m) break;
+    naccumulator[k] = 0;
+    double minv = 1.0/m;
+    for (v = 0; v < nvalues; v++) {
+      double *acc = accumulator[k*nvalues + v];
+      if (k+1 < numcorrelators) {
+        double *w = shift[((k+1)*p + insertindex[k+1])*nvalues + v];
+        for (i = 0; i < nlocal; i++) w[i] = acc[i]*minv;
+      }
+      for (i = 0; i < nlocal; i++) acc[i] = 0.0;
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   correlate the newest sample of correlator k with its valid history,
+   all atoms of the group for every lag and pair
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::correlate(unsigned int k)
+{
+  int nlocal = atom->nlocal;
+  double *gw = groupweight;
+  unsigned int ind1 = insertindex[k];
+  unsigned int jlo = (k == 0) ? 0 : dmin;
+  double ngroup = 0.0;
+  int i;
+
+  for (i = 0; i < nlocal; i++) ngroup += gw[i];
+
+  for (unsigned int j = jlo; j < nfill[k]; j++) {
+    unsigned int ind2 = (ind1 + p - j) % p;
+    double *c = &correlation[(k*p+j)*npair];
+    double *dc = &dcorrelation[(k*p+j)*npair];
+    for (int ipair = 0; ipair < npair; ipair++) {
+      double *a = shift[(k*p + ind1)*nvalues + pairs[ipair][0]];
+      double *b = shift[(k*p + ind2)*nvalues + pairs[ipair][1]];
+      double sum = 0.0, sum2 = 0.0;
+      for (i = 0; i < nlocal; i++) {
+        double ab = gw[i]*a[i]*b[i];
+        sum += ab;
+        sum2 += ab*ab;
+      }
+      c[ipair] += sum;
+      dc[ipair] += sum2;
+    }
+    ncorrelation[k*p+j] += ngroup;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   nvalid = next step on which end_of_step does something
+   this step if multiple of nevery, else next multiple
+   startstep is lower bound
+------------------------------------------------------------------------- */
+
+bigint FixAveCorrelateLongAtom::nextvalid()
+{
+  bigint nvalid = update->ntimestep;
+  if (startstep > nvalid) nvalid = startstep;
+  if (nvalid % nevery) nvalid = (nvalid/nevery)*nevery + nevery;
+  return nvalid;
+}
+
+/* ----------------------------------------------------------------------
+   memory_usage
+------------------------------------------------------------------------- */
+
+double FixAveCorrelateLongAtom::memory_usage()
+{
+  //    shift, accumulator, weight:   (nshift + naccum + 1) x nmax
+  //    (d)correlation(_all):         4 x npair x numcorrelators x p
+  //    ncorrelation(_all), t:        3 x numcorrelators x p
+  //    f, df:                        2 x npair x numcorrelators x p
+  double bytes = (double) (nshift + naccum + 1) * nmax * sizeof(double);
+  bytes += (6.0*npair + 3.0) * length * sizeof(double);
+  bytes += 3.0*numcorrelators*sizeof(unsigned int);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based arrays
+   the atoms are the contiguous index, so the rows are copied over
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::grow_arrays(int nmax_new)
+{
+  double **shift_new,**accumulator_new;
+  int r,i;
+
+  memory->create(shift_new,nshift,nmax_new,"correlator/atom:shift");
+  memory->create(accumulator_new,naccum,nmax_new,"correlator/atom:accumulator");
+  int ncopy = MIN(nmax,nmax_new);
+  for (r = 0; r < nshift; r++) {
+    for (i = 0; i < ncopy; i++) shift_new[r][i] = shift[r][i];
+    for (i = ncopy; i < nmax_new; i++) shift_new[r][i] = 0.0;
+  }
+  for (r = 0; r < naccum; r++) {
+    for (i = 0; i < ncopy; i++) accumulator_new[r][i] = accumulator[r][i];
+    for (i = ncopy; i < nmax_new; i++) accumulator_new[r][i] = 0.0;
+  }
+  memory->destroy(shift);
+  memory->destroy(accumulator);
+  shift = shift_new;
+  accumulator = accumulator_new;
+
+  memory->grow(groupweight,nmax_new,"correlator/atom:groupweight");
+  for (i = ncopy; i < nmax_new; i++) groupweight[i] = 0.0;
+  nmax = nmax_new;
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based arrays
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::copy_arrays(int i, int j, int delflag)
+{
+  for (int r = 0; r < nshift; r++) shift[r][j] = shift[r][i];
+  for (int r = 0; r < naccum; r++) accumulator[r][j] = accumulator[r][i];
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based arrays for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::pack_exchange(int i, double *buf)
+{
+  int n = 0;
+  for (int r = 0; r < nshift; r++) buf[n++] = shift[r][i];
+  for (int r = 0; r < naccum; r++) buf[n++] = accumulator[r][i];
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based arrays from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::unpack_exchange(int nlocal, double *buf)
+{
+  int n = 0;
+  for (int r = 0; r < nshift; r++) shift[r][nlocal] = buf[n++];
+  for (int r = 0; r < naccum; r++) accumulator[r][nlocal] = buf[n++];
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   pack the correlator buffers of atom i for the restart file
+------------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::pack_restart(int i, double *buf)
+{
+  int n = 1;
+  for (int r = 0; r < nshift; r++) buf[n++] = shift[r][i];
+  for (int r = 0; r < naccum; r++) buf[n++] = accumulator[r][i];
+  buf[0] = n;
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   unpack the correlator buffers of atom nlocal from atom->extra
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::unpack_restart(int nlocal, int nth)
+{
+  double **extra = atom->extra;
+
+  // skip to Nth set of extra values
+
+  int n = 0;
+  for (int i = 0; i < nth; i++) n += static_cast<int> (extra[nlocal][n]);
+  n++;
+
+  for (int r = 0; r < nshift; r++) shift[r][nlocal] = extra[nlocal][n++];
+  for (int r = 0; r < naccum; r++) accumulator[r][nlocal] = extra[nlocal][n++];
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::maxsize_restart()
+{
+  return nshift + naccum + 1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixAveCorrelateLongAtom::size_restart(int nlocal)
+{
+  return nshift + naccum + 1;
+}
+
+/* ----------------------------------------------------------------------
+   Write Restart data to restart file
+   the sums of all procs are stored, a restarted run keeps them on proc 0
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::write_restart(FILE *fp)
+{
+  MPI_Reduce(correlation,correlation_all,length*npair,MPI_DOUBLE,MPI_SUM,0,world);
+  MPI_Reduce(dcorrelation,dcorrelation_all,length*npair,MPI_DOUBLE,MPI_SUM,0,world);
+  MPI_Reduce(ncorrelation,ncorrelation_all,length,MPI_DOUBLE,MPI_SUM,0,world);
+
+  if (me == 0) {
+    int nsize = 2*npair*length + length + 3*numcorrelators + 8;
+    int n=0;
+    double *list;
+    memory->create(list,nsize,"correlator/atom:list");
+    list[n++]=npair;
+    list[n++]=nvalues;
+    list[n++]=numcorrelators;
+    list[n++]=p;
+    list[n++]=m;
+    list[n++]=kmax;
+    list[n++]=nvalid;
+    list[n++]=nvalid_last;
+    for (int i=0;i<length*npair;i++) list[n++]=correlation_all[i];
+    for (int i=0;i<length*npair;i++) list[n++]=dcorrelation_all[i];
+    for (int i=0;i<length;i++) list[n++]=ncorrelation_all[i];
+    for (int i=0;i<numcorrelators;i++) {
+      list[n++]=naccumulator[i];
+      list[n++]=insertindex[i];
+      list[n++]=nfill[i];
+    }
+
+    int size = n*sizeof(double);
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(list,sizeof(double),n,fp);
+    memory->destroy(list);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   use state info from restart file to restart the Fix
+------------------------------------------------------------------------- */
+
+void FixAveCorrelateLongAtom::restart(char *buf)
+{
+  int n = 0;
+  double *list = (double *) buf;
+  int npairin = static_cast<int> (list[n++]);
+  int nvaluesin = static_cast<int> (list[n++]);
+  int numcorrelatorsin = static_cast<int> (list[n++]);
+  int pin = static_cast<int> (list[n++]);
+  int min = static_cast<int> (list[n++]);
+  kmax = static_cast<unsigned int> (list[n++]);
+  nvalid = static_cast<bigint> (list[n++]);
+  nvalid_last = static_cast<bigint> (list[n++]);
+
+  if ((npairin!=npair) || (nvaluesin!=nvalues) ||
+      (numcorrelatorsin!=numcorrelators) || (pin!=p) || (min!=m))
+    error->all(FLERR,"Fix ave/correlate/long/atom: restart and input data are different");
+
+  for (int i=0;i<length*npair;i++) correlation[i] = me ? 0.0 : list[n+i];
+  n += length*npair;
+  for (int i=0;i<length*npair;i++) dcorrelation[i] = me ? 0.0 : list[n+i];
+  n += length*npair;
+  for (int i=0;i<length;i++) ncorrelation[i] = me ? 0.0 : list[n+i];
+  n += length;
+  for (int i=0;i<numcorrelators;i++) {
+    naccumulator[i] = static_cast<unsigned int> (list[n++]);
+    insertindex[i] = static_cast<unsigned int> (list[n++]);
+    nfill[i] = static_cast<unsigned int> (list[n++]);
+  }
+}
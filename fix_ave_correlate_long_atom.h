@@ -0,0 +1,186 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+
+FixStyle(ave/correlate/long/atom,FixAveCorrelateLongAtom)
+
+#else
+
+#ifndef LMP_FIX_AVE_CORRELATE_LONG_ATOM_H
+#define LMP_FIX_AVE_CORRELATE_LONG_ATOM_H
+
+#include <stdio.h>
+#include "fix.h"
+
+namespace LAMMPS_NS {
+
+class FixAveCorrelateLongAtom : public Fix {
+ public:
+  FixAveCorrelateLongAtom(class LAMMPS *, int, char **);
+  ~FixAveCorrelateLongAtom();
+  int setmask();
+  void init();
+  void setup(int);
+  void end_of_step();
+
+  void write_restart(FILE *);
+  void restart(char *);
+  double memory_usage();
+
+  void grow_arrays(int);
+  void copy_arrays(int, int, int);
+  int pack_exchange(int, double *);
+  int unpack_exchange(int, double *);
+  int pack_restart(int, double *);
+  void unpack_restart(int, int);
+  int size_restart(int);
+  int maxsize_restart();
+
+  double *t; // Time steps for result arrays
+  double **f; // Result arrays
+  double **df; // Result arrays (error)
+  unsigned int npcorr;
+
+ private:
+  // per-atom multi-tau buffers, one row per (level,slot,value) and per
+  // (level,value), the atoms are the contiguous index of every row
+  double **shift;
+  double **accumulator;
+  double *groupweight;      // 1 for group atoms, 0 else, per sample
+  int nshift,naccum;        // rows of shift and accumulator
+  int nmax;
+
+  // sums over the atoms of this proc, [level][lag][pair], reduced at output
+  double *correlation;
+  double *dcorrelation;
+  double *ncorrelation;     // number of atom samples, [level][lag]
+  double *correlation_all;
+  double *dcorrelation_all;
+  double *ncorrelation_all;
+
+  unsigned int *naccumulator;
+  unsigned int *insertindex;
+  unsigned int *nfill;      // valid slots per level, replaces a sentinel
+
+  unsigned int numcorrelators; // Recommended 20
+  unsigned int p; // Points per correlator (recommended 16)
+  unsigned int m; // Num points for average (recommended 2; p mod m = 0)
+  unsigned int dmin; // Min distance between ponts for correlators k>0; dmin=p/m
+
+  unsigned int length; // Length of result arrays
+  unsigned int kmax; // Maximum correlator attained during simulation
+
+  int me,nvalues;
+  int nfreq;
+  bigint nvalid,nvalid_last;
+  int *which,*argindex,*value2index;
+  char **ids;
+  FILE *fp;
+
+  int type,startstep,overwrite;
+  long filepos;
+  int binary_flag;     // write binary frames (binary_frame.h) instead of text
+  double *binary_buf;
+
+  int npair;           // number of correlation pairs to calculate
+  int **pairs;         // values (i,j) of each pair
+
+  void accumulate();
+  void correlate(unsigned int);
+  void evaluate();
+  bigint nextvalid();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+E: Cannot open fix ave/correlate/long/atom file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+E: Compute ID for fix ave/correlate/long/atom does not exist
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom compute does not calculate per-atom values
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom compute does not calculate a per-atom vector
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom compute does not calculate a per-atom array
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom compute array is accessed out-of-range
+
+The index for the array is out of bounds.
+
+E: Fix ID for fix ave/correlate/long/atom does not exist
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom fix does not calculate per-atom values
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom fix does not calculate a per-atom vector
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom fix does not calculate a per-atom array
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom fix array is accessed out-of-range
+
+The index for the array is out of bounds.
+
+E: Fix for fix ave/correlate/long/atom not computed at compatible time
+
+Fixes generate their values on specific timesteps.  Fix
+ave/correlate/long/atom is requesting a value on a non-allowed timestep.
+
+E: Variable name for fix ave/correlate/long/atom does not exist
+
+Self-explanatory.
+
+E: Fix ave/correlate/long/atom variable is not atom-style variable
+
+Self-explanatory.
+
+E: Invalid timestep reset for fix ave/correlate/long/atom
+
+Resetting the timestep has invalidated the sequence of timesteps this
+fix needs to process.
+
+E: Fix ave/correlate/long/atom: restart and input data are different
+
+The correlator settings of the restart file do not match the fix
+command.
+
+*/
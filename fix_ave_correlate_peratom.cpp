@@ -35,7 +35,8 @@
 #include "force.h"
 #include "atom.h"
 #include "comm.h"
-#include <algorithm>    // std::find
+#include "binary_frame.h"
+#include <algorithm>    // std::find, std::sort
 #include <math.h>    // fabs
 
 using namespace LAMMPS_NS;
@@ -47,13 +48,16 @@ enum{AUTO,CROSS,AUTOCROSS,AUTOUPPER, UPPERCROSS, FULL};
 enum{PERATOM,PERGROUP, PERPAIR, PERGROUP_PERPAIR, GROUP,ATOM};
 enum{NOT_DEPENDENED,VAR_DEPENDENED,DIST_DEPENDENED};
 enum{SELFCOR,CROSSCOR,DIFFCOR};
+enum{SELFPAIRS,OTHERPAIRS,ALLPAIRS};
 
 #define INVOKED_SCALAR 1
 #define INVOKED_VECTOR 2
 #define INVOKED_ARRAY 4
 #define INVOKED_PERATOM 8
 
-//#define TIME_PARA
+#define DISTPAIRDELTA 16384
+#define LAGBLOCK 64
+#define ACCALIGN 8         // doubles per cache line
 
 /* ---------------------------------------------------------------------- */
 
@@ -135,6 +139,8 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
   overwrite = 0;
   v_counter = 0;
   cross_flag = CROSS;
+  binary_flag = 0;
+  binary_buf = NULL;
   char *title1 = NULL;
   char *title2 = NULL;
   char *title3 = NULL;
@@ -430,6 +436,12 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
 	iarg += nvalues-1;
     } else error->all(FLERR,"Illegal fix ave/correlate/peratom command");
       iarg += 2;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/correlate/peratom command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix ave/correlate/peratom command");
+      iarg += 2;
     } else if (strcmp(arg[iarg],"restart") == 0) {
       restart_global = 1;
       iarg += 1;
@@ -513,6 +525,14 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
   if (fluc_flag && variable_flag != DIST_DEPENDENED ) {
     error->all(FLERR,"Illegal fix ave/correlate/peratom command: fluctuations only for distance dependence");
   }
+  // with switch peratom every proc correlates the histories of its own atoms,
+  // pairs of atoms on different procs can therefore not be correlated
+  if (memory_switch == PERATOM && nprocs > 1) {
+    if (type == CROSS || type == AUTOCROSS || type == UPPERCROSS)
+      error->all(FLERR,"Illegal fix ave/correlate/peratom command: switch peratom with cross correlation requires a single proc");
+    if (variable_flag != NOT_DEPENDENED)
+      error->all(FLERR,"Illegal fix ave/correlate/peratom command: switch peratom with variable dependence requires a single proc");
+  }
   
 
   // check variables (for peratom/pergroup)
@@ -576,8 +596,29 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
   if (type == UPPERCROSS) npair = nvalues/3*(nvalues/3+1)/2;
   if (type == FULL) npair = nvalues*nvalues;
   printf("npair %d\n",npair);
+
+  // values (i,j) correlated in each column, in the order of the output
+  int incr_values = 1;
+  if (variable_flag == DIST_DEPENDENED) incr_values = 3;
+  memory->create(corr_values,npair,2,"ave/correlate/peratom:corr_values");
+  int ipair = 0;
+  for (i = 0; i < nvalues; i += incr_values) {
+    int jlo = i;
+    int jhi = i+1;
+    if (type == AUTOUPPER || type == UPPERCROSS || type == FULL) jhi = nvalues;
+    if (type == FULL) jlo = 0;
+    for (j = jlo; j < jhi && ipair < npair; j += incr_values) {
+      corr_values[ipair][0] = i;
+      corr_values[ipair++][1] = j;
+    }
+  }
+
+  // values from nvalues_group on are stored per pair
+  nvalues_group = nvalues;
+  if (memory_switch == PERPAIR) nvalues_group = 0;
+  if (memory_switch == PERGROUP_PERPAIR) nvalues_group = nvalues_pg;
   // print file comment lines
-  if (fp && me == 0) {
+  if (fp && me == 0 && !binary_flag) {
     if (title1) fprintf(fp,"%s\n",title1);
     else fprintf(fp,"# Time-correlated data for fix %s\n",id);
     if (title2) fprintf(fp,"%s\n",title2);
@@ -614,6 +655,49 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
     filepos = ftell(fp);
   }
 
+  // binary file: same columns as the text file, one frame per output
+  if (fp && me == 0 && binary_flag) {
+    int incr_nvalues = 1;
+    if (variable_flag == DIST_DEPENDENED) incr_nvalues = 3;
+    nbinary_cols = 3 + 2*npair;
+    if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED) nbinary_cols++;
+    if (type == AUTOCROSS) nbinary_cols++;
+    if (type == AUTOCROSS || variable_flag == DIST_DEPENDENED) nbinary_cols += 2*npair;
+
+    char **names = new char*[nbinary_cols];
+    for (i = 0; i < nbinary_cols; i++) names[i] = new char[BINARY_FRAME_NAMELEN];
+    int c = 0;
+    strcpy(names[c++],"Index");
+    strcpy(names[c++],"TimeDelta");
+    if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED)
+      strcpy(names[c++],"Distance");
+    strcpy(names[c++],"Ncount");
+    int c_pair = c;
+    for (i = 0; i < nvalues; i += incr_nvalues) {
+      int nvalues_upper = i+1;
+      if (type == AUTOUPPER || type == UPPERCROSS || type == FULL) nvalues_upper = nvalues;
+      int nvalues_lower = i;
+      if (type == FULL) nvalues_lower = 0;
+      for (j = nvalues_lower; j < nvalues_upper; j += incr_nvalues) {
+        snprintf(names[c++],BINARY_FRAME_NAMELEN,"v%d*v%d",i+1,j+1);
+        snprintf(names[c++],BINARY_FRAME_NAMELEN,"v%d*v%d_err",i+1,j+1);
+      }
+    }
+    if (type == AUTOCROSS) strcpy(names[c++],"Ncount_cross");
+    if (type == AUTOCROSS || variable_flag == DIST_DEPENDENED) {
+      const char *suffix = (type == AUTOCROSS) ? "_cross" : "_o";
+      for (j = 0; j < 2*npair; j++) {
+        snprintf(names[c++],BINARY_FRAME_NAMELEN,"%.20s%s",names[c_pair+j],suffix);
+      }
+    }
+
+    binary_frame_header(fp,id,nbinary_cols,names);
+    filepos = ftell(fp);
+    for (i = 0; i < nbinary_cols; i++) delete [] names[i];
+    delete [] names;
+    memory->create(binary_buf,(nrepeat*bins)*nbinary_cols,"ave/correlate/peratom:binary_buf");
+  }
+
   delete [] title1;
   delete [] title2;
   delete [] title3;
@@ -663,12 +747,14 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
     // init memory
     memory->create(mean,nvalues*bins,"ave/correlate/peratom:mean");
     memory->create(mean_count,bins,"ave/correlate/peratom:mean_count");
+    memory->create(mean_loc,nvalues*bins,"ave/correlate/peratom:mean_loc");
+    memory->create(mean_count_loc,bins,"ave/correlate/peratom:mean_count_loc");
 
     for(o = 0; o < bins; o++){
       for (i = 0; i < nvalues; i++) {
-	mean[i+o*nvalues]=0.0;
+	mean[i+o*nvalues]=mean_loc[i+o*nvalues]=0.0;
       }
-      mean_count[o]=0.0;
+      mean_count[o]=mean_count_loc[o]=0.0;
     }
   }
   
@@ -741,11 +827,24 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
 
   array= NULL;
   variable_store=NULL;
+  ndistpair = maxdistpair = maxdistbin = maxdistpos = 0;
+  distpair_a = distpair_b = NULL;
+  distpair_unit = NULL;
+  distbin_head = distbin_next = NULL;
+  nthreads_acc = 0;
+  acc_thr = acc_fabr = NULL;
+  acc_lagbin = NULL;
+  peratom_buf = NULL;
+  maxperatom_buf = 0;
+  indices_buf = NULL;
+  maxindices_buf = 0;
+  rowcounts = NULL;
+  alo = ahi = 0;
   if(nvalues > 0) {
     if(memory_switch == PERATOM){
       // need to grow array size
-      // DEPRECATED: might need to be updated to be used in parallel environment
-      //comm->maxexchange_fix = MAX(comm->maxexchange_fix,(nvalues+variable_nvalues)*nsave);
+      // histories migrate with their atoms, see pack_exchange()
+      maxexchange = (nvalues+variable_nvalues)*nsave;
       grow_arrays(atom->nmax);
       atom->add_callback(0);
       double *group_mass_loc;
@@ -823,6 +922,18 @@ FixAveCorrelatePeratom::FixAveCorrelatePeratom(LAMMPS * lmp, int narg, char **ar
 	memory->create(group_data_loc,ngroup_glo,nvalues,"ave/correlate/peratom:group_data_loc");
 	memory->create(group_data,ngroup_glo,nvalues,"ave/correlate/peratom:group_data");
       }
+
+      // every proc correlates the pairs (a,b) of one block of rows a,
+      // per-pair data is only sent to the proc of its row
+      int work = ngroup_glo/nprocs;
+      int rest = ngroup_glo - nprocs*work;
+      int ncols = nvalues;
+      if (memory_switch != GROUP && memory_switch != ATOM) ncols += variable_nvalues;
+      memory->create(rowcounts,nprocs,"ave/correlate/peratom:rowcounts");
+      for (int p = 0; p < nprocs; p++)
+	rowcounts[p] = (work + (p < rest ? 1 : 0))*ngroup_glo*ncols;
+      alo = work*me + MIN(me,rest);
+      ahi = alo + work + (me < rest ? 1 : 0);
     }
   }
 
@@ -866,11 +977,23 @@ FixAveCorrelatePeratom::~FixAveCorrelatePeratom()
   memory->destroy(global_corr_err);
   memory->destroy(save_corr_err);
   if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED) memory->destroy(variable_store);
+  memory->destroy(corr_values);
+  memory->destroy(acc_thr);
+  memory->destroy(acc_fabr);
+  memory->destroy(acc_lagbin);
+  memory->destroy(peratom_buf);
+  memory->destroy(indices_buf);
+  memory->destroy(distpair_a);
+  memory->destroy(distpair_b);
+  memory->destroy(distpair_unit);
+  memory->destroy(distbin_head);
+  memory->destroy(distbin_next);
 
   if (memory_switch != PERATOM) {
     memory->destroy(group_data_loc);
     memory->destroy(group_data);
   }
+  memory->destroy(rowcounts);
 
   if (memory_switch != GROUP && memory_switch != PERATOM && memory_switch != ATOM) memory->destroy(group_ids);
   memory->destroy(group_mass);
@@ -878,11 +1001,14 @@ FixAveCorrelatePeratom::~FixAveCorrelatePeratom()
   if (mean_flag) {
     memory->destroy(mean);
     memory->destroy(mean_count);
+    memory->destroy(mean_loc);
+    memory->destroy(mean_count_loc);
   }
   
   if (fluc_flag) memory->destroy(mean_fluc_data);
 
   if (fp && me == 0) fclose(fp);
+  memory->destroy(binary_buf);
   
   atom->delete_callback(id,0);
 
@@ -941,6 +1067,35 @@ void FixAveCorrelatePeratom::init()
     modify->addstep_compute_all(nvalid);
   }
 
+  // per-thread accumulators, kept zero between calls of accumulate()
+  // every thread slab starts on a cache line
+
+  if (comm->nthreads != nthreads_acc) {
+    nthreads_acc = comm->nthreads;
+    acc_stride = (1+2*npair)*corr_length;
+    acc_stride = (acc_stride + ACCALIGN-1)/ACCALIGN*ACCALIGN;
+    memory->destroy(acc_thr);
+    memory->destroy(acc_fabr);
+    memory->destroy(acc_lagbin);
+    memory->create(acc_thr,(bigint) nthreads_acc*acc_stride,"ave/correlate/peratom:acc_thr");
+    memory->create(acc_fabr,nthreads_acc*nvalues,"ave/correlate/peratom:acc_fabr");
+    memory->create(acc_lagbin,nthreads_acc*nsave,"ave/correlate/peratom:acc_lagbin");
+    for (bigint n = 0; n < (bigint) nthreads_acc*acc_stride; n++) acc_thr[n] = 0.0;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   scratch buffer for per-atom input values, grown but never freed
+------------------------------------------------------------------------- */
+
+double *FixAveCorrelatePeratom::peratom_buffer(int n)
+{
+  if (n > maxperatom_buf) {
+    maxperatom_buf = n;
+    memory->destroy(peratom_buf);
+    memory->create(peratom_buf,maxperatom_buf,"ave/correlate/peratom:peratom_buf");
+  }
+  return peratom_buf;
 }
 
 /* ----------------------------------------------------------------------
@@ -982,14 +1137,15 @@ void FixAveCorrelatePeratom::end_of_step()
   t1 = MPI_Wtime();
 
   // find relevant particles // find group-member on each processor
+  if (nlocal > maxindices_buf) {
+    maxindices_buf = atom->nmax;
+    memory->destroy(indices_buf);
+    memory->create(indices_buf,maxindices_buf,"ave/correlate/peratom:indices_buf");
+  }
+  indices_group = indices_buf;
   if(memory_switch!=GROUP && memory_switch!=ATOM){
-    memory->create(indices_group,ngroup_loc,"ave/correlate/peratomindices_group");
     for (a= 0; a < nlocal; a++) {
-      if(mask[a] & groupbit) {
-	ngroup_loc++;
-	memory->grow(indices_group,ngroup_loc,"ave/correlate/peratomindices_group");
-	indices_group[ngroup_loc-1]=a;
-      }
+      if(mask[a] & groupbit) indices_group[ngroup_loc++]=a;
     }
   }
 
@@ -1051,16 +1207,16 @@ void FixAveCorrelatePeratom::end_of_step()
 	  if (argindex[i] == 0)
 	    peratom_data= compute->vector_atom;
 	  else{
-	    memory->create(peratom_data, nlocal, "ave/correlation/peratom:peratom_data");
+	    peratom_data = peratom_buffer(nlocal);
 	    for (a= 0; a < nlocal; a++) {
-	      peratom_data[tag[a]-1] = compute->array_atom[a][argindex[i]-1];
+	      peratom_data[a] = compute->array_atom[a][argindex[i]-1];
 	    }
 	  }
 	}
       // access fix fields, guaranteed to be ready
       } else if (which[i] == FIX) {
 	if (memory_switch==PERPAIR) {
-	  memory->create(peratom_data, nlocal*nlocal, "ave/correlation/peratom:peratom_data");
+	  peratom_data = peratom_buffer(nlocal*nlocal);
 	  for (a= 0; a < nlocal; a++) {
 	    for (b= 0; b < nlocal; b++) {
 	      peratom_data[a*nlocal+b] = modify->fix[v2i]->array_atom[a][(argindex[i]-1)*nlocal+b];
@@ -1068,7 +1224,7 @@ void FixAveCorrelatePeratom::end_of_step()
 	    }
 	  }
 	} else if (memory_switch==PERGROUP_PERPAIR) {
-	  memory->create(peratom_data, nlocal*nlocal, "ave/correlation/peratom:peratom_data");
+	  peratom_data = peratom_buffer(nlocal*nlocal);
 	  if (i < nvalues_pg) {
 	    if (argindex[i] == 0) {
 	      for (a= 0; a < nlocal; a++) {
@@ -1091,7 +1247,7 @@ void FixAveCorrelatePeratom::end_of_step()
 	  if (argindex[i] == 0)
 	    peratom_data= modify->fix[v2i]->vector_atom;
 	  else{
-	    memory->create(peratom_data, nlocal, "ave/correlation/peratom:peratom_data");
+	    peratom_data = peratom_buffer(nlocal);
 	    for (a= 0; a < nlocal; a++) {
 	      peratom_data[a] = modify->fix[v2i]->array_atom[a][argindex[i]-1];
 	    }
@@ -1100,8 +1256,8 @@ void FixAveCorrelatePeratom::end_of_step()
       // evaluate equal-style variable
       } else {
 	// variable with perpair not implemented
-	if (memory_switch==PERGROUP_PERPAIR) memory->create(peratom_data, nlocal*nlocal, "ave/correlation/peratom:peratom_data");
-	else memory->create(peratom_data, nlocal, "ave/correlation/peratom:peratom_data");
+	if (memory_switch==PERGROUP_PERPAIR) peratom_data = peratom_buffer(nlocal*nlocal);
+	else peratom_data = peratom_buffer(nlocal);
 	input->variable->compute_atom(v2i, igroup, peratom_data, 1, 0);
 	
       }
@@ -1116,7 +1272,7 @@ void FixAveCorrelatePeratom::end_of_step()
 	      ids_ptr = std::find(group_ids,group_ids+ngroup_glo,tag[indices_group[b]]);
 	      int indb = (ids_ptr - group_ids);
 	      //printf("base %d, id %d ind %d\n",group_ids,ids_ptr,n);
-	      group_data_loc[inda*ngroup_loc+indb][i] = peratom_data[indices_group[a]*ngroup_loc+indices_group[b]];
+	      group_data_loc[inda*ngroup_glo+indb][i] = peratom_data[indices_group[a]*nlocal+indices_group[b]];
 	    }
 	  }
 	  //if (a==0) printf("indices_grop %d, data %f\n",indices_group[a],group_data_loc[inda][i]);
@@ -1136,11 +1292,6 @@ void FixAveCorrelatePeratom::end_of_step()
 	  }
 	}
       }
-      //if this was done by an atom-style variable, we need to free the mem we allocated
-      if (which[i] == VARIABLE || which[i] == FIX ) {
-	//printf("destroy %d\n",i);
-	memory->destroy(peratom_data);
-      }
     }
   } else { //calculate group properties
     //evaluate all variable and compute all computes
@@ -1240,7 +1391,7 @@ void FixAveCorrelatePeratom::end_of_step()
   //update variable dependency
   if(memory_switch!=GROUP && memory_switch!=ATOM){ 
     if (variable_flag == VAR_DEPENDENED){
-      memory->create(peratom_data, nlocal, "ave/correlation/peratom:peratom_data");
+      peratom_data = peratom_buffer(nlocal);
       input->variable->compute_atom(variable_value2index, igroup, peratom_data, 1, 0);
       for (a= 0; a < ngroup_loc; a++) {
 	if(memory_switch==PERATOM){
@@ -1252,7 +1403,6 @@ void FixAveCorrelatePeratom::end_of_step()
 	  group_data_loc[ind][nvalues] = peratom_data[indices_group[a]];
 	}
       }
-      memory->destroy(peratom_data);
     } else if (variable_flag == DIST_DEPENDENED) {
       for (a= 0; a < ngroup_loc; a++) {
 	for (r = 0; r < 3 ; r++) {
@@ -1277,18 +1427,29 @@ void FixAveCorrelatePeratom::end_of_step()
   // include pergroup data into global array
   if( memory_switch==PERGROUP || memory_switch==PERPAIR || memory_switch==PERGROUP_PERPAIR || memory_switch==GROUP || memory_switch ==ATOM){
 
-    if (memory_switch==PERPAIR || memory_switch==PERGROUP_PERPAIR) MPI_Allreduce(&group_data_loc[0][0], &group_data[0][0], ngroup_glo*ngroup_glo*(nvalues+variable_nvalues), MPI_DOUBLE, MPI_SUM, world);
-    else if (memory_switch!= GROUP && memory_switch!= ATOM) MPI_Allreduce(&group_data_loc[0][0], &group_data[0][0], ngroup_glo*(nvalues+variable_nvalues), MPI_DOUBLE, MPI_SUM, world);
+    // per-pair data: every proc receives the rows a it correlates, the
+    // first ngroup_glo rows hold the per-group values and are needed by all
+    // the pair input is only known on the proc owning both atoms, so this
+    // stays a per-sample O(ngroup_glo^2) reduction; only peratom mode keeps
+    // its histories local and reduces just the correlations at output
+    if (memory_switch==PERPAIR || memory_switch==PERGROUP_PERPAIR) {
+      MPI_Reduce_scatter(&group_data_loc[0][0], &group_data[0][0] + (bigint) alo*ngroup_glo*(nvalues+variable_nvalues), rowcounts, MPI_DOUBLE, MPI_SUM, world);
+      MPI_Allreduce(&group_data_loc[0][0], &group_data[0][0], ngroup_glo*(nvalues+variable_nvalues), MPI_DOUBLE, MPI_SUM, world);
+    } else if (memory_switch!= GROUP && memory_switch!= ATOM) MPI_Allreduce(&group_data_loc[0][0], &group_data[0][0], ngroup_glo*(nvalues+variable_nvalues), MPI_DOUBLE, MPI_SUM, world);
     else MPI_Allreduce(&group_data_loc[0][0], &group_data[0][0], ngroup_glo*(nvalues), MPI_DOUBLE, MPI_SUM, world);
     if (memory_switch==GROUP || memory_switch==ATOM) MPI_Allreduce(counter, counter_glo, ngroup_glo, MPI_INT, MPI_SUM, world);
     
     
     for (a= 0; a < ngroup_glo; a++) {
       if (memory_switch==PERPAIR || memory_switch==PERGROUP_PERPAIR) {
-	for (b= 0; b < ngroup_glo; b++) {
-	  for (i=0; i< nvalues;i++) {
-	    int offset = i*nsave + lastindex;
-	    array[a*ngroup_glo+b][offset] = group_data[a*ngroup_glo+b][i];
+	// only the own rows were received, rows 0..ngroup_glo-1 also hold
+	// the per-group values
+	if (a == 0 || (a >= alo && a < ahi)) {
+	  for (b= 0; b < ngroup_glo; b++) {
+	    for (i=0; i< nvalues;i++) {
+	      int offset = i*nsave + lastindex;
+	      array[a*ngroup_glo+b][offset] = group_data[a*ngroup_glo+b][i];
+	    }
 	  }
 	}
       } else {
@@ -1359,9 +1520,7 @@ void FixAveCorrelatePeratom::end_of_step()
 
   if (ntimestep % nfreq || first) {
     first = 0;
-    if(memory_switch!=GROUP && memory_switch!=ATOM) {
-      memory->destroy(indices_group);
-    } else {
+    if(memory_switch==GROUP || memory_switch==ATOM) {
       delete [] counter;
       delete [] counter_glo;
     }
@@ -1372,6 +1531,24 @@ void FixAveCorrelatePeratom::end_of_step()
   MPI_Reduce(local_count, global_count, corr_length, MPI_DOUBLE, MPI_SUM, 0, world);
   MPI_Reduce(&local_corr[0][0], &global_corr[0][0], npair*corr_length, MPI_DOUBLE, MPI_SUM, 0, world);
   MPI_Reduce(&local_corr_err[0][0], &global_corr_err[0][0], npair*corr_length, MPI_DOUBLE, MPI_SUM, 0, world);
+  // the means of all procs are summed on proc 0
+  if (mean_flag) {
+    if (me == 0) {
+      MPI_Reduce(MPI_IN_PLACE, mean_count_loc, bins, MPI_DOUBLE, MPI_SUM, 0, world);
+      MPI_Reduce(MPI_IN_PLACE, mean_loc, nvalues*bins, MPI_DOUBLE, MPI_SUM, 0, world);
+      for (o = 0; o < bins; o++) {
+	mean_count[o] += mean_count_loc[o];
+	for (i = 0; i < nvalues; i++) mean[i+o*nvalues] += mean_loc[i+o*nvalues];
+      }
+    } else {
+      MPI_Reduce(mean_count_loc, NULL, bins, MPI_DOUBLE, MPI_SUM, 0, world);
+      MPI_Reduce(mean_loc, NULL, nvalues*bins, MPI_DOUBLE, MPI_SUM, 0, world);
+    }
+    for (o = 0; o < bins; o++) {
+      mean_count_loc[o] = 0.0;
+      for (i = 0; i < nvalues; i++) mean_loc[i+o*nvalues] = 0.0;
+    }
+  }
   //reset local arrays
   for (i = 0; i < corr_length; i++) {
     save_count[i] += global_count[i];
@@ -1386,7 +1563,43 @@ void FixAveCorrelatePeratom::end_of_step()
 
   if (me == 0) {
     // output result to file
-    if (fp) {
+    if (fp && binary_flag) {
+      if (overwrite) fseek(fp,filepos,SEEK_SET);
+      int nrows = corr_length/factor;
+      for (i = 0; i < nrows; i++) {
+        double *row = &binary_buf[i*nbinary_cols];
+        int c = 0;
+        if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED) {
+          int loc_bin = i%bins;
+          int loc_ind = (i - loc_bin)/bins;
+          row[c++] = loc_ind+1;
+          row[c++] = loc_ind*nevery;
+          row[c++] = range/bins*loc_bin;
+        } else {
+          row[c++] = i+1;
+          row[c++] = i*nevery;
+        }
+        row[c++] = save_count[i];
+        for (j = 0; j < npair; j++) {
+          row[c++] = save_count[i] ? prefactor*save_corr[i][j]/save_count[i] : 0.0;
+          row[c++] = save_count[i] ? prefactor*save_corr_err[i][j]/save_count[i] : 0.0;
+        }
+        if (type == AUTOCROSS || variable_flag == DIST_DEPENDENED) {
+          int offset = i + corr_length/2;
+          if (type == AUTOCROSS) row[c++] = save_count[offset];
+          for (j = 0; j < npair; j++) {
+            row[c++] = save_count[i] ? prefactor*save_corr[offset][j]/save_count[i] : 0.0;
+            row[c++] = save_count[i] ? prefactor*save_corr_err[offset][j]/save_count[i] : 0.0;
+          }
+        }
+      }
+      binary_frame_write(fp,ntimestep,nrows,nbinary_cols,binary_buf);
+      fflush(fp);
+      if (overwrite) {
+	long fileend = ftell(fp);
+	ftruncate(fileno(fp),fileend);
+      }
+    } else if (fp) {
       if (overwrite) fseek(fp,filepos,SEEK_SET);
       fprintf(fp,BIGINT_FORMAT " %d\n",ntimestep,nrepeat);
       for (i = 0; i < corr_length/factor; i++) {
@@ -1474,9 +1687,7 @@ void FixAveCorrelatePeratom::end_of_step()
   lastindex  = 0;
   if(ntimestep != update->nsteps ) accumulate(indices_group, ngroup_loc);
 
-  if(memory_switch!=GROUP && memory_switch!=ATOM) {
-    memory->destroy(indices_group);
-  } else {
+  if(memory_switch==GROUP || memory_switch==ATOM) {
     delete [] counter;
     delete [] counter_glo;
   }
@@ -1494,332 +1705,472 @@ void FixAveCorrelatePeratom::end_of_step()
 
 /* ----------------------------------------------------------------------
    accumulate correlation data using more recently added values
+   the modes are resolved once per call, the kernels below are
+   instantiated per mode combination and only loop over pairs and lags
+   every thread sums into its own slab of acc_thr, transposed to
+   [column][lag], allocated in init()
 ------------------------------------------------------------------------- */
 void FixAveCorrelatePeratom::accumulate(int *indices_group, int ngroup_loc)
 {
-  //printf("test1\n");
-  int a,b,i,j,k,o,m,n,ipair;
-  int ind,offset, ind_t, ind_0;
-  int t = nsample - nsave;
-  int nlocal= atom->nlocal;
-  tagint *tag = atom->tag;
-  
-  double delx, dely, delz, delx_t, dely_t,delz_t, delx_0, dely_0, delz_0;
-  double fabx_t, faby_t, fabz_t,fabx_0, faby_0, fabz_0;
-  double rsq, dist, dist_t, dist_0, fabr_t,fabr_0,fabox_t0,faboy_t0,faboz_t0;
-
-  //calculate work distribution
-  int sample_start = 0,
-      sample_stop = 0;
-  int work = nsample/nprocs;
-  int rest = nsample - nprocs*work;
-  //printf("work: %d, rest: %d\n",work,rest);
-  if (me < rest) {
-    sample_start = (work+1)*me;
-    sample_stop = (work+1)*(me+1);
-  } else {
-    sample_start = (work+1)*rest + work*(me-rest);
-    sample_stop = (work+1)*rest + work*(me-rest+1);
-  }
+  double t1 = MPI_Wtime();
 
-  // accumulate
-  n = lastindex;
-  int incr_nvalues = 1;
-  if (variable_flag == DIST_DEPENDENED){
-    incr_nvalues = 3;
+  // only the group members owned by this proc have a history in peratom mode,
+  // the global data is split into blocks of rows a over the procs
+  int npos = ngroup_glo;
+  int afirst = alo;
+  int alast = ahi;
+  if (memory_switch == PERATOM) {
+    npos = ngroup_loc;
+    afirst = 0;
+    alast = npos;
   }
- 
-  double t1 = MPI_Wtime();
-  #if defined (_OPENMP) 
-  #pragma omp parallel private(a,b,ipair,k,m,ind,offset,i,j,delx,dely,delz,rsq,dist,delx_t,dely_t,delz_t,dist_t,delx_0,dely_0,delz_0,dist_0,fabx_t,faby_t,fabz_t,fabx_0,faby_0,fabz_0,fabr_0,fabr_t,fabox_t0,faboy_t0,faboz_t0,ind_t,ind_0) default(none) shared(n,sample_stop, sample_start,indices_group,incr_nvalues)
+
+  // distance dependence only visits the candidate pairs
+  if (variable_flag == DIST_DEPENDENED) build_dist_pairs(indices_group,npos,afirst,alast);
+
+  #if defined (_OPENMP)
+  #pragma omp parallel default(none) shared(indices_group,npos,afirst,alast)
   #endif
   {
-    ipair = 0;
-#ifdef TIME_PARA
-    int kfrom, kto, tid;
-    loop_setup_thr(kfrom, kto, tid, sample_stop - sample_start,comm->nthreads);
-#else 
-    double *omp_local_count;
-    double **omp_local_corr;
-    double **omp_local_corr_err;
-    memory->create(omp_local_count,corr_length,"ave/correlate/peratom:omp_local_count");
-    memory->create(omp_local_corr,corr_length,npair,"ave/correlate/peratom:omp_local_corr");
-    memory->create(omp_local_corr_err,corr_length,npair,"ave/correlate/peratom:omp_local_corr_err");
-    for (i = 0; i < corr_length; i++) {
-      save_count[i] += global_count[i];
-      omp_local_count[i] = 0.0;
-      for (j = 0; j < npair; j++){
-	omp_local_corr[i][j] = 0.0;
-	omp_local_corr_err[i][j] = 0.0;
+    // only the thread id is used, the kernels distribute the work themselves
+    int i,j,t,ifrom,ito,tid;
+    int nthreads = comm->nthreads;
+    loop_setup_thr(ifrom, ito, tid, npos, nthreads);
+
+    double *thr_count = &acc_thr[(bigint) tid*acc_stride];
+    double *thr_corr = thr_count + corr_length;
+    double *thr_err = thr_corr + npair*corr_length;
+    double *thr_fabr = &acc_fabr[tid*nvalues];
+    int *thr_lagbin = &acc_lagbin[tid*nsave];
+
+    if (variable_flag == DIST_DEPENDENED) {
+      if (cross_flag == CROSSCOR)
+        accumulate_dist<CROSSCOR>(indices_group,tid,nthreads,thr_count,thr_corr,thr_err,thr_fabr);
+      else if (cross_flag == DIFFCOR)
+        accumulate_dist<DIFFCOR>(indices_group,tid,nthreads,thr_count,thr_corr,thr_err,thr_fabr);
+      else
+        accumulate_dist<SELFCOR>(indices_group,tid,nthreads,thr_count,thr_corr,thr_err,thr_fabr);
+    } else if (variable_flag == VAR_DEPENDENED) {
+      if (type == CROSS || type == UPPERCROSS)
+        accumulate_pairs<1,OTHERPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+      else if (type == AUTOCROSS)
+        accumulate_pairs<1,ALLPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+      else
+        accumulate_pairs<1,SELFPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+    } else {
+      if (type == CROSS || type == UPPERCROSS)
+        accumulate_pairs<0,OTHERPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+      else if (type == AUTOCROSS)
+        accumulate_pairs<0,ALLPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+      else
+        accumulate_pairs<0,SELFPAIRS>(indices_group,npos,afirst,alast,tid,nthreads,thr_count,thr_corr,thr_err,thr_lagbin);
+    }
+
+    // parallel section finished. Reduction necessary now
+    // every thread sums its share of the lags over all thread slabs
+    // and clears them for the next call, no locks or atomics needed
+    #if defined (_OPENMP)
+    #pragma omp barrier
+    #endif
+    loop_setup_thr(ifrom, ito, tid, corr_length, nthreads);
+    for (t = 0; t < nthreads; t++) {
+      double *count = &acc_thr[(bigint) t*acc_stride];
+      for (i = ifrom; i < ito; i++) {
+	local_count[i] += count[i];
+	count[i] = 0.0;
+      }
+      for (j = 0; j < npair; j++) {
+	double *corr = count + (1+j)*corr_length;
+	double *err = count + (1+npair+j)*corr_length;
+	for (i = ifrom; i < ito; i++) {
+	  local_corr[i][j] += corr[i];
+	  local_corr_err[i][j] += err[i];
+	  corr[i] = err[i] = 0.0;
+	}
       }
     }
-    int afrom, ato, tid;
-    loop_setup_thr(afrom, ato, tid, ngroup_glo,comm->nthreads);
-#endif
-    for (i = 0; i < nvalues; i+=incr_nvalues) {
-      //determine whether just autocorrelation or also mixed correlation (different observables)
-      double nvalues_upper = i+1;
-      if (type == AUTOUPPER || type == UPPERCROSS || type == FULL) nvalues_upper = nvalues;
-      double nvalues_lower = i;
-      if (type == FULL) nvalues_lower = 0;
-      for (j = nvalues_lower; j < nvalues_upper; j+=incr_nvalues) {
-	//printf("i %d j %d ipair %d\n",i,j,ipair);
-	for (a= afrom; a < ato; a++) {
-	  //determine whether just autocorrelation or also cross correlation (different atoms)
-	  double ngroup_lower = a;
-	  double ngroup_upper = a+1;
-	  if (type == CROSS || type == AUTOCROSS || type == UPPERCROSS){
-	    ngroup_lower = a;
-	    ngroup_upper = ngroup_glo;
+  }
+
+  double t2 = MPI_Wtime();
+  time_total += t2 -t1;
+}
+
+/* ----------------------------------------------------------------------
+   correlation kernel without distance dependence
+   VARDEP = 1: binned by the variable difference
+   PAIRS: SELFPAIRS (a,a), OTHERPAIRS (a,b>a), ALLPAIRS (a,b>=a) with the
+   pairs b != a in the upper half of the table, a runs over the rows
+   afirst..alast-1 of this proc, b over all npos positions
+   threads take every nthreads-th a, this balances the triangular loop
+------------------------------------------------------------------------- */
+
+template <int VARDEP, int PAIRS>
+void FixAveCorrelatePeratom::accumulate_pairs(int *indices_group, int npos,
+                                              int afirst, int alast, int tid, int nthreads,
+                                              double *count, double *corr,
+                                              double *err, int *lagbin)
+{
+  int a,b,k,m,ipair,inda,indb,base,blo,bhi;
+  int n = lastindex;
+  double val0,cor,dV;
+
+  // lags 0..nfirst-1 are stored at n..0, the older ones at nsave-1..
+  int nfirst = MIN(nsample,n+1);
+
+  for (a = afirst+tid; a < alast; a += nthreads) {
+    blo = a;
+    bhi = a+1;
+    if (PAIRS == OTHERPAIRS) blo = a+1;
+    if (PAIRS != SELFPAIRS) bhi = npos;
+
+    for (b = blo; b < bhi; b++) {
+      inda = a;
+      indb = b;
+      if (memory_switch == PERATOM) {
+	inda = indices_group[a];
+	indb = indices_group[b];
+      }
+      base = 0;
+      if (PAIRS == ALLPAIRS && b != a) base = corr_length/2;
+      double *cnt = &count[base];
+
+      if (VARDEP) {
+	// jump if not in range, then bin every lag once for all columns
+	dV = fabs(variable_store[inda][n] - variable_store[indb][n]);
+	if (dV > range) continue;
+	m = n;
+	for (k = 0; k < nsample; k++) {
+	  dV = fabs(variable_store[inda][m] - variable_store[indb][n]);
+	  lagbin[k] = -1;
+	  if (dV < range) {
+	    lagbin[k] = k*bins + static_cast<int> (dV/range*bins);
+	    cnt[lagbin[k]] += 1.0;
 	  }
-	  for (b = ngroup_lower; b < ngroup_upper; b++) {
-	    if ((type == CROSS || type == UPPERCROSS) && a==b) continue;
-
-	    //initialize counter for work distribution
-	    //printf("%d\n",m);
-	    int inda,indb;
-	    if(memory_switch==PERATOM){
-	      inda=indices_group[a];
-	      indb=indices_group[b];
-	    } else {
-	      inda = a;
-	      indb = b;
-	    }
-	    
-	    // jump if not in range
-	    if (variable_flag == VAR_DEPENDENED){
-	      double dV = variable_store[inda][n] - variable_store[indb][n];
-	      dV=fabs(dV);
-	      if(dV>range) continue;
-	    } 
-	    if (variable_flag == DIST_DEPENDENED){
-	      delx = variable_store[inda][n] -variable_store[indb][n];
-	      dely = variable_store[inda][n+nsave]-variable_store[indb][n+nsave]  ;
-	      delz = variable_store[inda][n+2*nsave]- variable_store[indb][n+2*nsave];
-	      domain->minimum_image(delx,dely,delz);
-	      rsq = delx*delx + dely*dely + delz*delz;
-	      if(rsq>range2_cut) continue;
-	    }
-	    
-	    // calc correlation
-#ifdef TIME_PARA
-	    m = lastindex - sample_start - kfrom;
-	    if (m < 0) m = nsave+m;
-	    for (k = sample_start+kfrom; k < sample_start+kto; k++) {
-#else
-	    m = lastindex;
-	    for (k = 0; k < nsample; k++) {  
-#endif
-	      if (variable_flag == VAR_DEPENDENED){
-		double dV = variable_store[inda][m] - variable_store[indb][n];
-		dV=fabs(dV);
-		if(dV<range){
-		  ind = dV/range*bins;
-		  offset= k*bins+ind;
-		  double val0 = array[indb][j * nsave + n];
-		  double valt = array[inda][i * nsave + m];
-		  double cor = val0*valt;
-		  if (type == AUTOCROSS && b!=a) {
-		    if(i==0&&j==0) local_count[offset+corr_length/2]+=1.0;
-		    local_corr[offset+corr_length/2][ipair] += cor;
-		    local_corr_err[offset+corr_length/2][ipair] += cor*cor;
-		  } else {
-		    if(i==0&&j==0) {
-		      local_count[offset]+=1.0;
-		    }
-		    local_corr[offset][ipair]+=cor;
-		    local_corr_err[offset][ipair]+=cor*cor;
-		  }
-		}
-	      } else if (variable_flag == DIST_DEPENDENED) {
-		delx = variable_store[inda][n] -variable_store[indb][n];
-		dely = variable_store[inda][n+nsave]-variable_store[indb][n+nsave]  ;
-		delz = variable_store[inda][n+2*nsave]- variable_store[indb][n+2*nsave];
-		domain->minimum_image(delx,dely,delz);
-		rsq = delx*delx + dely*dely + delz*delz;
-		dist = sqrt (rsq);
-		//if(dist < 6.0) {
-		//  printf("dist %d %d: %f\n",a,b,dist);
-		//}
-		if(dist<range){
-		  double disti = 1.0/dist;
-		  delx_t = variable_store[inda][m] -variable_store[indb][m];
-		  dely_t = variable_store[inda][m+nsave]-variable_store[indb][m+nsave]  ;
-		  delz_t = variable_store[inda][m+2*nsave]- variable_store[indb][m+2*nsave];
-		  domain->minimum_image(delx_t,dely_t,delz_t);
-		  dist_t = sqrt(delx_t*delx_t + dely_t*dely_t + delz_t*delz_t);
-		  double disti_t = 1.0/dist_t;
-		  delx_0 = variable_store[inda][n] -variable_store[indb][n];
-		  dely_0 = variable_store[inda][n+nsave]-variable_store[indb][n+nsave]  ;
-		  delz_0 = variable_store[inda][n+2*nsave]- variable_store[indb][n+2*nsave];
-		  domain->minimum_image(delx_0,dely_0,delz_0);
-		  dist_0 = sqrt(delx_0*delx_0 + dely_0*dely_0 + delz_0*delz_0);
-		  double disti_0 = 1.0/dist_0;
-		  //printf("%f %f %f\n",delx_0,delx_t,delx);
-		  if (cross_flag ==CROSSCOR) {
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && i >= nvalues_pg)) {
-		      fabx_t = array[inda*ngroup_glo+indb][ i*nsave + m];
-		      faby_t = array[inda*ngroup_glo+indb][ i*nsave + nsave + m];
-		      fabz_t = array[inda*ngroup_glo+indb][ i*nsave + 2*nsave + m];
-		    } else {
-		      fabx_t = array[inda][ i*nsave + m];
-		      faby_t = array[inda][ i*nsave + nsave + m];
-		      fabz_t = array[inda][ i*nsave + 2*nsave + m];
-		    }
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && j >= nvalues_pg)) {
-		      fabx_0 = array[inda*ngroup_glo+indb][ j*nsave + n];
-		      faby_0 = array[inda*ngroup_glo+indb][ j*nsave + nsave + n];
-		      fabz_0 = array[inda*ngroup_glo+indb][ j*nsave + 2*nsave + n];
-		    } else {
-		      fabx_0 = array[indb][ j*nsave + n];
-		      faby_0 = array[indb][ j*nsave + nsave + n];
-		      fabz_0 = array[indb][ j*nsave + 2*nsave + n];
-		    }
-		    } else if(cross_flag == DIFFCOR) {
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && i >= nvalues_pg)) {
-		      fabx_t = array[inda*ngroup_glo+indb][ i*nsave + m];
-		      faby_t = array[inda*ngroup_glo+indb][ i*nsave + nsave + m];
-		      fabz_t = array[inda*ngroup_glo+indb][ i*nsave + 2*nsave + m];
-		    } else {
-		      fabx_t = array[inda][ i*nsave + m] - array[indb][ i*nsave + m];
-		      faby_t = array[inda][ i*nsave + nsave + m] - array[indb][ i*nsave + nsave + m];
-		      fabz_t = array[inda][ i*nsave + 2*nsave + m] - array[indb][ i*nsave + 2*nsave + m];
-		    }
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && j >= nvalues_pg)) {
-		      fabx_0 = array[inda*ngroup_glo+indb][ j*nsave + n];
-		      faby_0 = array[inda*ngroup_glo+indb][ j*nsave + nsave + n];
-		      fabz_0 = array[inda*ngroup_glo+indb][ j*nsave + 2*nsave + n];
-		    } else {
-		      fabx_0 = array[inda][ j*nsave + n] - array[indb][ j*nsave + n];
-		      faby_0 = array[inda][ j*nsave + nsave + n] - array[indb][ j*nsave + nsave + n];
-		      fabz_0 = array[inda][ j*nsave + 2*nsave + n] - array[indb][ j*nsave + 2*nsave + n];
-		    }
-		  } else if(cross_flag == SELFCOR) {
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && i >= nvalues_pg)) {
-		      fabx_t = array[inda*ngroup_glo+indb][ i*nsave + m];
-		      faby_t = array[inda*ngroup_glo+indb][ i*nsave + nsave + m];
-		      fabz_t = array[inda*ngroup_glo+indb][ i*nsave + 2*nsave + m];
-		    } else {
-		      fabx_t = array[inda][ i*nsave + m];
-		      faby_t = array[inda][ i*nsave + nsave + m];
-		      fabz_t = array[inda][ i*nsave + 2*nsave + m];
-		    }
-		    if (memory_switch==PERPAIR || (memory_switch == PERGROUP_PERPAIR && j >= nvalues_pg)) {
-		      fabx_0 = array[inda*ngroup_glo+indb][ j*nsave + n];
-		      faby_0 = array[inda*ngroup_glo+indb][ j*nsave + nsave + n];
-		      fabz_0 = array[inda*ngroup_glo+indb][ j*nsave + 2*nsave + n];
-		    } else {
-		      fabx_0 = array[inda][ j*nsave + n];
-		      faby_0 = array[inda][ j*nsave + nsave + n];
-		      fabz_0 = array[inda][ j*nsave + 2*nsave + n];
-		    }
-		  }
-		  
-		  // calculate radial component of the correlated quantity (mapped on the distance vector)
-		  fabr_t = (fabx_t*delx_t + faby_t*dely_t +fabz_t*delz_t) * disti_t;
-		  fabr_0 = (fabx_0*delx_0 + faby_0*dely_0 +fabz_0*delz_0) * disti_0;
-		  // calculate orthogonal component of the correlated quantity (mapped on the distance vector)
-		  //fabox_t0 = (fabx_t-fabr_t*delx_t*disti_t)*(fabx_0-fabr_0*delx_0*disti_0);
-		  //faboy_t0 = (faby_t-fabr_t*dely_t*disti_t)*(faby_0-fabr_0*dely_0*disti_0);
-		  //faboz_t0 = (fabz_t-fabr_t*delz_t*disti_t)*(fabz_0-fabr_0*delz_0*disti_0);
-		  
-		  ind = dist_0/range*bins;
-		  offset= k*bins+ind;
-		  if (fluc_flag) {
-		    //printf ("fluc_lower %d, fluc_upper %d\n",fluc_lower, fluc_upper);
-		    //if ( fluc_lower <= i +1 && i+1 <= fluc_upper && dist_t < range) fabr_t -= mean_fluc_data[ind_t];
-		    //if ( fluc_lower <= j +1 && j+1 <= fluc_upper && dist_0 < range) fabr_0 -= mean_fluc_data[ind_0];
-		  }
-#ifdef TIME_PARA
-		  if(i==0&&j==0) local_count[offset]+=1.0;
-		  // parallel contribution
-		  local_corr[offset][ipair] += fabr_t*fabr_0;
-		  //if (fabr_t*fabr_0*fabr_t*fabr_0 < 0.0000000000001) printf("%d %d,offset %d, local_count[offset] %f,fabr_t %f, fabr_0 %f, delx_t %f,dely_t %f,delz_t %f,delx_0 %f,dely_0 %f,delz_0 %f,delx %f,dely %f,delz %f\n",n,m,offset,local_count[offset],fabr_t, fabr_0,delx_t,dely_t,delz_t,delx_0,dely_0,delz_0,delx,dely,delz);
-		  local_corr_err[offset][ipair] += fabr_t*fabr_0*fabr_t*fabr_0;
-		  // orthogonal contribution
-		  //local_corr[offset+corr_length/2][ipair] += fabox_t0+faboy_t0+faboz_t0;
-		  //if (fabr_t*fabr_0*fabr_t*fabr_0 < 0.0000000000001) printf("%d %d,offset %d, local_count[offset] %f,fabr_t %f, fabr_0 %f, delx_t %f,dely_t %f,delz_t %f,delx_0 %f,dely_0 %f,delz_0 %f,delx %f,dely %f,delz %f\n",n,m,offset,local_count[offset],fabr_t, fabr_0,delx_t,dely_t,delz_t,delx_0,dely_0,delz_0,delx,dely,delz);
-		  //local_corr_err[offset+corr_length/2][ipair] += (fabox_t0+faboy_t0+faboz_t0)*(fabox_t0+faboy_t0+faboz_t0);
-#else
-		  if(i==0&&j==0) omp_local_count[offset]+=1.0;
-		  omp_local_corr[offset][ipair] += fabr_t*fabr_0;
-		  omp_local_corr_err[offset][ipair] += fabr_t*fabr_0*fabr_t*fabr_0;
-#endif
-		}
-	      } else { //no variable dependency
-		// since atoms are renamed, you have to access tag[i]
-		double val0 = array[indb][j * nsave + n];
-		double valt = array[inda][i * nsave + m];
-		//if (a==0) printf("%f %f\n",val0,valt);
-		double cor = val0*valt;
-		//printf("%d %f %f\n",n-m,valt,val0);
-		if (type == AUTOCROSS && b!=a) {
-		  if(i==0&&j==0) local_count[k+corr_length/2]+=1.0;
-		  local_corr[k+corr_length/2][ipair] += cor;
-		  local_corr_err[k+corr_length/2][ipair] += cor*cor;
-		} else {
-		  if(i==0&&j==0) local_count[k]+=1.0;
-		  local_corr[k][ipair]+= cor;
-		  local_corr_err[k][ipair]+= cor*cor;
-		}
-	      }
-	      m--;
-	      if (m < 0) m = nsave-1;
+	  m--;
+	  if (m < 0) m = nsave-1;
+	}
+      } else {
+	for (k = 0; k < nsample; k++) cnt[k] += 1.0;
+      }
+
+      for (ipair = 0; ipair < npair; ipair++) {
+	val0 = array[indb][corr_values[ipair][1]*nsave + n];
+	double *valt = &array[inda][corr_values[ipair][0]*nsave];
+	double *c = &corr[ipair*corr_length + base];
+	double *e = &err[ipair*corr_length + base];
+
+	if (VARDEP) {
+	  m = n;
+	  for (k = 0; k < nsample; k++) {
+	    if (lagbin[k] >= 0) {
+	      cor = val0*valt[m];
+	      c[lagbin[k]] += cor;
+	      e[lagbin[k]] += cor*cor;
 	    }
-	  }	
+	    m--;
+	    if (m < 0) m = nsave-1;
+	  }
+	} else {
+	  // contiguous lag loops over both parts of the ring
+	  for (k = 0; k < nfirst; k++) {
+	    cor = val0*valt[n-k];
+	    c[k] += cor;
+	    e[k] += cor*cor;
+	  }
+	  for (k = nfirst; k < nsample; k++) {
+	    cor = val0*valt[n+nsave-k];
+	    c[k] += cor;
+	    e[k] += cor*cor;
+	  }
 	}
       }
-      ipair++;
     }
-    // parallel section finished. Reduction necessary now
-#ifndef TIME_PARA
-    #pragma omp critical
-    {
-      for (i = 0; i < corr_length; i++) {
-	local_count[i] += omp_local_count[i];
-	for (j = 0; j < npair; j++){
-	  local_corr[i][j] += omp_local_corr[i][j];
-	  local_corr_err[i][j] = omp_local_corr_err[i][j];
-	}
+  }
+}
+
+/* ----------------------------------------------------------------------
+   bin coordinate of a position, periodic dimensions wrap around
+------------------------------------------------------------------------- */
+
+static int dist_coord(double x, double lo, double inv, int nb, int periodic)
+{
+  int c = static_cast<int> (floor((x-lo)*inv));
+  if (periodic) {
+    c %= nb;
+    if (c < 0) c += nb;
+  } else {
+    if (c < 0) c = 0;
+    if (c >= nb) c = nb-1;
+  }
+  return c;
+}
+
+/* ----------------------------------------------------------------------
+   collect the pairs a < b with a in afirst..alast-1 which are closer than
+   range at the newest sample, with their unit distance vector and distance
+   the positions are binned with bins at least range wide, so only the
+   own and the neighboring bins have to be searched
+------------------------------------------------------------------------- */
+
+void FixAveCorrelatePeratom::build_dist_pairs(int *indices_group, int npos,
+                                              int afirst, int alast)
+{
+  int a,b,d,p,q,start,ind;
+  int n = lastindex;
+  int c[3],cc[3],nb[3],lo[3],hi[3];
+  double bininv[3],delx,dely,delz,rsq,dist;
+
+  // a dimension with less than 3 bins (or a tilted box) is one single bin,
+  // so no bin is visited twice, no more bins than positions
+
+  for (d = 0; d < 3; d++) {
+    nb[d] = static_cast<int> (domain->prd[d]/range);
+    if (nb[d] < 1 || domain->triclinic) nb[d] = 1;
+  }
+  while ((bigint) nb[0]*nb[1]*nb[2] > MAX(npos,27)) {
+    d = 0;
+    if (nb[1] > nb[d]) d = 1;
+    if (nb[2] > nb[d]) d = 2;
+    nb[d] /= 2;
+  }
+  for (d = 0; d < 3; d++) {
+    if (nb[d] < 3) nb[d] = 1;
+    bininv[d] = nb[d]/domain->prd[d];
+  }
+
+  int nbins = nb[0]*nb[1]*nb[2];
+  if (nbins > maxdistbin) {
+    maxdistbin = nbins;
+    memory->destroy(distbin_head);
+    memory->create(distbin_head,maxdistbin,"ave/correlate/peratom:distbin_head");
+  }
+  if (npos > maxdistpos) {
+    maxdistpos = npos;
+    memory->destroy(distbin_next);
+    memory->create(distbin_next,maxdistpos,"ave/correlate/peratom:distbin_next");
+  }
+
+  for (p = 0; p < nbins; p++) distbin_head[p] = -1;
+  for (a = npos-1; a >= 0; a--) {
+    ind = a;
+    if (memory_switch == PERATOM) ind = indices_group[a];
+    for (d = 0; d < 3; d++)
+      c[d] = dist_coord(variable_store[ind][n+d*nsave],domain->boxlo[d],
+                        bininv[d],nb[d],domain->periodicity[d]);
+    p = (c[2]*nb[1] + c[1])*nb[0] + c[0];
+    distbin_next[a] = distbin_head[p];
+    distbin_head[p] = a;
+  }
+
+  ndistpair = 0;
+  for (a = afirst; a < alast; a++) {
+    int inda = a;
+    if (memory_switch == PERATOM) inda = indices_group[a];
+    for (d = 0; d < 3; d++) {
+      c[d] = dist_coord(variable_store[inda][n+d*nsave],domain->boxlo[d],
+                        bininv[d],nb[d],domain->periodicity[d]);
+      lo[d] = hi[d] = 0;
+      if (nb[d] > 1) {
+        lo[d] = -1;
+        hi[d] = 1;
       }
     }
-    memory->destroy(omp_local_count);
-    memory->destroy(omp_local_corr);
-    memory->destroy(omp_local_corr_err);
-#endif
+
+    // partners b > a in the surrounding bins
+
+    start = ndistpair;
+    int off[3];
+    for (off[2] = lo[2]; off[2] <= hi[2]; off[2]++)
+      for (off[1] = lo[1]; off[1] <= hi[1]; off[1]++)
+        for (off[0] = lo[0]; off[0] <= hi[0]; off[0]++) {
+          for (d = 0; d < 3; d++) {
+            cc[d] = c[d] + off[d];
+            if (domain->periodicity[d]) {
+              if (cc[d] < 0) cc[d] += nb[d];
+              if (cc[d] >= nb[d]) cc[d] -= nb[d];
+            }
+          }
+          if (cc[0] < 0 || cc[0] >= nb[0] || cc[1] < 0 || cc[1] >= nb[1] ||
+              cc[2] < 0 || cc[2] >= nb[2]) continue;
+          p = (cc[2]*nb[1] + cc[1])*nb[0] + cc[0];
+          for (b = distbin_head[p]; b >= 0; b = distbin_next[b]) {
+            if (b <= a) continue;
+            if (ndistpair == maxdistpair) {
+              maxdistpair += DISTPAIRDELTA;
+              memory->grow(distpair_a,maxdistpair,"ave/correlate/peratom:distpair_a");
+              memory->grow(distpair_b,maxdistpair,"ave/correlate/peratom:distpair_b");
+              memory->grow(distpair_unit,maxdistpair,4,"ave/correlate/peratom:distpair_unit");
+            }
+            distpair_a[ndistpair] = a;
+            distpair_b[ndistpair++] = b;
+          }
+        }
+
+    // same partner order as a loop over all b, then drop the ones out of range
+
+    std::sort(distpair_b+start,distpair_b+ndistpair);
+    q = start;
+    for (p = start; p < ndistpair; p++) {
+      b = distpair_b[p];
+      int indb = b;
+      if (memory_switch == PERATOM) indb = indices_group[b];
+      delx = variable_store[inda][n] - variable_store[indb][n];
+      dely = variable_store[inda][n+nsave] - variable_store[indb][n+nsave];
+      delz = variable_store[inda][n+2*nsave] - variable_store[indb][n+2*nsave];
+      domain->minimum_image(delx,dely,delz);
+      rsq = delx*delx + dely*dely + delz*delz;
+      dist = sqrt(rsq);
+      if (dist >= range) continue;
+      distpair_a[q] = a;
+      distpair_b[q] = b;
+      distpair_unit[q][0] = delx/dist;
+      distpair_unit[q][1] = dely/dist;
+      distpair_unit[q][2] = delz/dist;
+      distpair_unit[q][3] = dist;
+      q++;
+    }
+    ndistpair = q;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   3d value v at sample s seen by the pair (inda,indb), origin selects
+   the value at the time origin for cross correlations
+   values from nvalues_group on are stored per pair
+------------------------------------------------------------------------- */
+
+template <int CFLAG>
+inline void FixAveCorrelatePeratom::dist_vector(double *fab, int v, int s,
+                                                int inda, int indb, int origin)
+{
+  int d;
+  if (v >= nvalues_group) {
+    for (d = 0; d < 3; d++)
+      fab[d] = array[inda*ngroup_glo+indb][(v+d)*nsave + s];
+  } else if (CFLAG == DIFFCOR) {
+    for (d = 0; d < 3; d++)
+      fab[d] = array[inda][(v+d)*nsave + s] - array[indb][(v+d)*nsave + s];
+  } else if (CFLAG == CROSSCOR && origin) {
+    for (d = 0; d < 3; d++) fab[d] = array[indb][(v+d)*nsave + s];
+  } else {
+    for (d = 0; d < 3; d++) fab[d] = array[inda][(v+d)*nsave + s];
   }
-    //printf("test2\n");
-  double t2 = MPI_Wtime();
-  time_total += t2 -t1;
 }
 
 /* ----------------------------------------------------------------------
-   decompose the variables into a parallel and an orthogonal component
+   radial components of value v for a block of nk lags of the pair
+   (inda,indb), ring holds the sample of every lag, e the unit distance
+   vectors, the value at the lag end of the pair is used
 ------------------------------------------------------------------------- */
-void FixAveCorrelatePeratom::decompose(double *res_data, double *dr, double *inp_data) {
-  double proj1 = inp_data[0]*dr[0] + inp_data[1]*dr[1] + inp_data[2]*dr[2];
-  double proj2 = inp_data[3]*dr[0] + inp_data[4]*dr[1] + inp_data[5]*dr[2];
-  double dr2 = dr[0]*dr[0] + dr[1]*dr[1] +dr[2]*dr[2];
-  proj1 /= dr2;
-  proj2 /= dr2;
-  double *F1_p = new double[3];
-  double *F2_p = new double[3];
-  int p;
-  for (p=0; p<3; p++){
-    F1_p[p] = proj1*dr[p];
-    F2_p[p] = proj2*dr[p];
-  }
-  // parallel components
-  res_data[0] = sgn(-proj1)*sqrt( F1_p[0]*F1_p[0] + F1_p[1]*F1_p[1] + F1_p[2]*F1_p[2] );
-  res_data[1] = sgn(proj2)*sqrt( F2_p[0]*F2_p[0] + F2_p[1]*F2_p[1] + F2_p[2]*F2_p[2] );
-  // orthogonal components
-  for (p=0; p<3; p++){
-    res_data[2+p] = inp_data[p] - F1_p[p];
-    res_data[5+p] = inp_data[3+p] - F2_p[p];
-  }
-
-  delete[] F1_p;
-  delete[] F2_p;
+
+template <int CFLAG>
+inline void FixAveCorrelatePeratom::project_block(double *fabr, int v, int nk,
+                                                  int *ring, double **e,
+                                                  int inda, int indb)
+{
+  int kk;
+  double *fx,*fy,*fz;
+  if (v >= nvalues_group) {
+    fx = &array[inda*ngroup_glo+indb][v*nsave];
+  } else {
+    fx = &array[inda][v*nsave];
+  }
+  fy = fx + nsave;
+  fz = fy + nsave;
+
+  for (kk = 0; kk < nk; kk++)
+    fabr[kk] = fx[ring[kk]]*e[0][kk] + fy[ring[kk]]*e[1][kk] + fz[ring[kk]]*e[2][kk];
+
+  if (CFLAG == DIFFCOR && v < nvalues_group) {
+    fx = &array[indb][v*nsave];
+    fy = fx + nsave;
+    fz = fy + nsave;
+    for (kk = 0; kk < nk; kk++)
+      fabr[kk] -= fx[ring[kk]]*e[0][kk] + fy[ring[kk]]*e[1][kk] + fz[ring[kk]]*e[2][kk];
+  }
+}
+
+/* ----------------------------------------------------------------------
+   correlation kernel of the distance dependence, radial components
+   only the candidate pairs of build_dist_pairs() are visited
+   the lags are processed in blocks of LAGBLOCK: the unit distance vectors
+   of a block are computed once and shared by all columns, the
+   projections at the origin once per pair
+------------------------------------------------------------------------- */
+
+template <int CFLAG>
+void FixAveCorrelatePeratom::accumulate_dist(int *indices_group, int tid,
+                                             int nthreads, double *count,
+                                             double *corr, double *err,
+                                             double *fabr_0)
+{
+  int p,a,b,j,k0,kk,nk,m,ind,ipair,inda,indb,icol;
+  int n = lastindex;
+  double delx,dely,delz,rinv,f0,cor;
+  double fab[3];
+  double *unit_0;
+
+  int ring[LAGBLOCK];
+  double ex[LAGBLOCK],ey[LAGBLOCK],ez[LAGBLOCK];
+  double fabr_t[LAGBLOCK];
+  double *e[3] = {ex,ey,ez};
+
+  for (p = tid; p < ndistpair; p += nthreads) {
+    a = distpair_a[p];
+    b = distpair_b[p];
+    if (memory_switch == PERATOM) {
+      inda = indices_group[a];
+      indb = indices_group[b];
+    } else {
+      inda = a;
+      indb = b;
+    }
+    unit_0 = distpair_unit[p];
+    ind = unit_0[3]/range*bins;
+
+    // radial components at the time origin
+    for (j = 0; j < nvalues; j += 3) {
+      dist_vector<CFLAG>(fab,j,n,inda,indb,1);
+      fabr_0[j] = fab[0]*unit_0[0] + fab[1]*unit_0[1] + fab[2]*unit_0[2];
+    }
+
+    m = n;
+    for (k0 = 0; k0 < nsample; k0 += LAGBLOCK) {
+      nk = MIN(LAGBLOCK,nsample-k0);
+
+      // unit distance vectors of the block
+      for (kk = 0; kk < nk; kk++) {
+	ring[kk] = m;
+	delx = variable_store[inda][m] - variable_store[indb][m];
+	dely = variable_store[inda][m+nsave] - variable_store[indb][m+nsave];
+	delz = variable_store[inda][m+2*nsave] - variable_store[indb][m+2*nsave];
+	domain->minimum_image(delx,dely,delz);
+	rinv = 1.0/sqrt(delx*delx + dely*dely + delz*delz);
+	ex[kk] = delx*rinv;
+	ey[kk] = dely*rinv;
+	ez[kk] = delz*rinv;
+	count[(k0+kk)*bins + ind] += 1.0;
+	m--;
+	if (m < 0) m = nsave-1;
+      }
+
+      icol = -1;
+      for (ipair = 0; ipair < npair; ipair++) {
+	if (corr_values[ipair][0] != icol) {
+	  icol = corr_values[ipair][0];
+	  project_block<CFLAG>(fabr_t,icol,nk,ring,e,inda,indb);
+	}
+	f0 = fabr_0[corr_values[ipair][1]];
+	double *c = &corr[ipair*corr_length + k0*bins + ind];
+	double *s = &err[ipair*corr_length + k0*bins + ind];
+	for (kk = 0; kk < nk; kk++) {
+	  cor = fabr_t[kk]*f0;
+	  c[kk*bins] += cor;
+	  s[kk*bins] += cor*cor;
+	}
+      }
+    }
+  }
 }
 
 /* ----------------------------------------------------------------------
@@ -1839,14 +2190,24 @@ void FixAveCorrelatePeratom::calc_mean(int *indices_group, int ngroup_loc){
     incr_nvalues = 3;
   }
 
+  // same split of the pairs as in accumulate()
+  int npos = ngroup_glo;
+  int afirst = alo;
+  int alast = ahi;
+  if (memory_switch == PERATOM) {
+    npos = ngroup_loc;
+    afirst = 0;
+    alast = npos;
+  }
+
   for (i = 0; i < nvalues; i+=incr_nvalues) {
-    for (a= 0; a < ngroup_glo; a++) {
+    for (a= afirst; a < alast; a++) {
       //determine whether just autocorrelation or also cross correlation (different atoms)
       double ngroup_lower = a;
       double ngroup_upper = a+1;
       if (type == CROSS || type == AUTOCROSS || type == UPPERCROSS){
 	ngroup_lower = a;
-	ngroup_upper = ngroup_glo;
+	ngroup_upper = npos;
       }
       for (b = ngroup_lower; b < ngroup_upper; b++) {
 	if (type == CROSS && a==b) continue;
@@ -1863,8 +2224,8 @@ void FixAveCorrelatePeratom::calc_mean(int *indices_group, int ngroup_loc){
 	  dV=fabs(dV);
 	  if(dV<range){
 	    int ind = dV/range*bins;
-	    if (i==0) mean_count[ind] += 2.0;
-	    mean[ind*nvalues+i] += array[inda][i * nsave + lastindex];
+	    if (i==0) mean_count_loc[ind] += 2.0;
+	    mean_loc[ind*nvalues+i] += array[inda][i * nsave + lastindex];
 	  }
 	} else if (variable_flag == DIST_DEPENDENED) {
 	  delx = variable_store[inda][lastindex]-variable_store[indb][lastindex]  ;
@@ -1909,12 +2270,12 @@ void FixAveCorrelatePeratom::calc_mean(int *indices_group, int ngroup_loc){
 	    // calculate correlation
 	    ind = dist/range*bins;
 	    
-	    if(i==0) mean_count[ind]+=1.0;
-	    mean[ind*nvalues+i] += fabr;
+	    if(i==0) mean_count_loc[ind]+=1.0;
+	    mean_loc[ind*nvalues+i] += fabr;
 	  }
 	} else {
-	  if(i==0) mean_count[0] += 1.0;
-	  mean[i] += array[inda][i * nsave + lastindex];
+	  if(i==0) mean_count_loc[0] += 1.0;
+	  mean_loc[i] += array[inda][i * nsave + lastindex];
 	}
       }
     }
@@ -1960,35 +2321,13 @@ void FixAveCorrelatePeratom::reset_timestep(bigint ntimestep)
 
 void FixAveCorrelatePeratom::copy_arrays(int i, int j, int delflag)
 {
-  body[j] = body[i];
-  
-  /*int offset= 0;
-  for (int m= 0; m < nvalues; m++) {
-    for (int k= 0; k < nsample; k++) {
-      array[j][offset] = array[i][offset];
-      offset++;
-    }
-    for (int k= nsample; k < nsave; k++) {
-      array[j][offset++]= 0.0;
-    }
+  if (memory_switch == ATOM) body[j] = body[i];
+  if (memory_switch == PERATOM) {
+    memcpy(array[j],array[i],nvalues*nsave*sizeof(double));
+    if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED)
+      memcpy(variable_store[j],variable_store[i],
+             variable_nvalues*nsave*sizeof(double));
   }
-  if (variable_flag == VAR_DEPENDENED){
-    for (int k= 0; k < nsample; k++) {
-      variable_store[j][k]=variable_store[i][k];
-    }
-    for (int k= nsample; k < nsave; k++) {
-      variable_store[j][k]=0.0;
-    }
-  } else if (variable_flag == DIST_DEPENDENED){
-    for (int r=0; r<3;r++) {
-      for (int k= 0; k < nsample; k++) {
-	variable_store[j][k+r*nsave]=variable_store[i][k+r*nsave];
-      }
-      for (int k= nsample; k < nsave; k++) {
-	variable_store[j][k+r*nsave]=0.0;
-      }
-    }
-  }*/
 }
 
 /* --------------------------------------------------------------------- */
@@ -2094,8 +2433,16 @@ double FixAveCorrelatePeratom::memory_usage() {
 ------------------------------------------------------------------------- */
 
 void FixAveCorrelatePeratom::grow_arrays(int nmax) {
-  memory->create(array,nmax,(nvalues )*nsave,"fix_ave/correlate/peratom:array");
-  if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED) memory->create(variable_store,ngroup_glo,nsave*variable_nvalues,"fix_ave/correlate/peratom:variable_store");
+  // grow, not create: in peratom mode the histories of owned atoms must survive reallocation
+  memory->grow(array,nmax,(nvalues )*nsave,"fix_ave/correlate/peratom:array");
+  // in peratom mode variable_store is indexed by local atom like array,
+  // otherwise by group index and allocated once
+  if (variable_flag == VAR_DEPENDENED || variable_flag == DIST_DEPENDENED) {
+    if (memory_switch == PERATOM)
+      memory->grow(variable_store,nmax,nsave*variable_nvalues,"fix_ave/correlate/peratom:variable_store");
+    else if (variable_store == NULL)
+      memory->create(variable_store,ngroup_glo,nsave*variable_nvalues,"fix_ave/correlate/peratom:variable_store");
+  }
   array_atom = array;
   if (array) vector_atom = array[0];
   else vector_atom = NULL;
@@ -2162,11 +2509,6 @@ void FixAveCorrelatePeratom::restart(char *buf){
   }
 }
 
-/* sign-function */
-template <typename T> int FixAveCorrelatePeratom::sgn(T val) {
-    return (T(0) < val) - (val < T(0));
-}
-
 /* ----------------------------------------------------------------------
    compute the center-of-mass coords of group of atoms, with body_index index
    masstotal = total mass
@@ -83,11 +83,15 @@ class FixAveCorrelatePeratom : public Fix {
   
   char *title1,*title2,*title3;
   long filepos;
+  int binary_flag;     // write binary frames (binary_frame.h) instead of text
+  int nbinary_cols;
+  double *binary_buf;
   
   int mean_flag;
   FILE *mean_file;
   double *mean_count;
   double *mean;
+  double *mean_count_loc,*mean_loc;  // contributions of this proc since the last output
   long mean_filepos;
   
   int fluc_flag;
@@ -100,20 +104,63 @@ class FixAveCorrelatePeratom : public Fix {
   int nsample;         // number of time samples in values ring
 
   int npair;           // number of correlation pairs to calculate
+  int **corr_values;   // values (i,j) correlated in each pair
+  int nthreads_acc;    // threads the accumulators are sized for
+  bigint acc_stride;   // doubles per thread slab, count, corr and err
+  double *acc_thr;     // per-thread slabs, zero outside accumulate()
+  double *acc_fabr;    // per-thread origin projections
+  int *acc_lagbin;     // per-thread bin of every lag
+  int nvalues_group;   // values stored per group/atom, the rest per pair
   double *local_count,*global_count,*save_count;
   double **local_corr,**global_corr,**save_corr;
   double **local_corr_err,**global_corr_err,**save_corr_err;
   int corr_length;
   
+  // candidate pairs for distance dependence, rebuilt every sample
+  int ndistpair,maxdistpair;
+  int *distpair_a,*distpair_b;  // a < b, closer than range at the newest sample
+  double **distpair_unit;       // their unit distance vector and distance
+  int maxdistbin,maxdistpos;
+  int *distbin_head,*distbin_next;
+
   int ngroup_glo;
   tagint *group_ids;
   double *group_mass;
+  double *peratom_buf;  // input values of one sample
+  int maxperatom_buf;
+  int *indices_buf;     // local indices of the group members
+  int maxindices_buf;
   double **group_data_loc,**group_data;
+  int alo,ahi;          // rows a of the pairs (a,b) correlated by this proc
+  int *rowcounts;       // doubles of the per-pair data received by every proc
 
   void accumulate(int *indices_group, int ngroup_loc);
+  template <int VARDEP, int PAIRS>
+  void accumulate_pairs(int *, int, int, int, int, int, double *, double *, double *, int *);
+  template <int CFLAG>
+  void accumulate_dist(int *, int, int, double *, double *, double *, double *);
+  template <int CFLAG>
+  void dist_vector(double *, int, int, int, int, int);
+  template <int CFLAG>
+  void project_block(double *, int, int, int *, double **, int, int);
+  void build_dist_pairs(int *indices_group, int npos, int afirst, int alast);
+  double *peratom_buffer(int);
   bigint nextvalid();
   void calc_mean(int *indices_group, int ngroup_loc);
-  void decompose(double *res_data, double *dr, double *inp_data);
+
+  // parallel and orthogonal components of two 3d values along the unit
+  // vector e: res = -F1.e, F2.e, F1 - (F1.e) e, F2 - (F2.e) e
+  inline void decompose(double *res, const double *e, const double *inp) const {
+    double proj1 = inp[0]*e[0] + inp[1]*e[1] + inp[2]*e[2];
+    double proj2 = inp[3]*e[0] + inp[4]*e[1] + inp[5]*e[2];
+    res[0] = -proj1;
+    res[1] = proj2;
+    for (int p = 0; p < 3; p++) {
+      res[2+p] = inp[p] - proj1*e[p];
+      res[5+p] = inp[3+p] - proj2*e[p];
+    }
+  }
+
   int first;
   
   //timing
@@ -130,7 +177,6 @@ class FixAveCorrelatePeratom : public Fix {
   double time_total; 
   
   void xcm(int, double, double*);
-  template <typename T> int sgn(T val);
   
 };
 
@@ -28,6 +28,7 @@
 #include "variable.h"
 #include "memory.h"
 #include "error.h"
+#include "binary_frame.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -166,6 +167,21 @@ FixAveTime::FixAveTime(LAMMPS *lmp, int narg, char **arg) :
     offcol[offlist[i]-1] = 1;
   }
 
+  // batch mode sweeps all columns at once, off columns are fixed up after
+  // divisor = nrepeat for averaged columns, 1 for off columns
+
+  offcols = NULL;
+  divisor = NULL;
+  noffcols = 0;
+  if (batch) {
+    memory->create(offcols,nvalues,"ave/time:offcols");
+    memory->create(divisor,nvalues,"ave/time:divisor");
+    for (int i = 0; i < nvalues; i++) {
+      if (offcol[i]) offcols[noffcols++] = i;
+      divisor[i] = offcol[i] ? 1.0 : nrepeat;
+    }
+  }
+
   // setup and error check
   // for fix inputs, check that fix frequency is acceptable
   // set variable_length if any compute is variable length
@@ -291,7 +307,31 @@ FixAveTime::FixAveTime(LAMMPS *lmp, int narg, char **arg) :
   // for mode = VECTOR, cannot use arg to print
   // since array args may have been expanded to multiple vectors
 
-  if (fp && me == 0) {
+  // the binary header only holds the column names, titles are dropped
+
+  if (fp && me == 0 && binary_flag) {
+    if (title1 || title2 || title3)
+      error->warning(FLERR,"Fix ave/time titles are not written to binary output");
+    char **names = new char*[nvalues];
+    for (int i = 0; i < nvalues; i++) {
+      names[i] = new char[BINARY_FRAME_NAMELEN];
+      if (mode == SCALAR)
+        snprintf(names[i],BINARY_FRAME_NAMELEN,"%s",arg[6+i]);
+      else {
+        const char *prefix = "c_";
+        if (which[i] == FIX) prefix = "f_";
+        if (argindex[i])
+          snprintf(names[i],BINARY_FRAME_NAMELEN,"%s%s[%d]",
+                   prefix,ids[i],argindex[i]);
+        else snprintf(names[i],BINARY_FRAME_NAMELEN,"%s%s",prefix,ids[i]);
+      }
+    }
+    binary_frame_header(fp,id,nvalues,names);
+    for (int i = 0; i < nvalues; i++) delete [] names[i];
+    delete [] names;
+    filepos = ftell(fp);
+
+  } else if (fp && me == 0) {
     clearerr(fp);
     if (title1) fprintf(fp,"%s\n",title1);
     else fprintf(fp,"# Time-averaged data for fix %s\n",id);
@@ -328,8 +368,12 @@ FixAveTime::FixAveTime(LAMMPS *lmp, int narg, char **arg) :
   vector_list = NULL;
   array = array_total = NULL;
   array_list = NULL;
+  sample = outbuf = NULL;
+  maxoutbuf = 0;
+  iflush = 0;
 
   if (mode == SCALAR) {
+    if (batch) memory->create(sample,nvalues,"ave/time:sample");
     vector = new double[nvalues];
     vector_total = new double[nvalues];
     if (ave == WINDOW)
@@ -493,6 +537,11 @@ FixAveTime::~FixAveTime()
   memory->destroy(array);
   memory->destroy(array_total);
   memory->destroy(array_list);
+
+  memory->destroy(sample);
+  memory->destroy(outbuf);
+  memory->destroy(offcols);
+  memory->destroy(divisor);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -570,7 +619,7 @@ void FixAveTime::end_of_step()
 
 void FixAveTime::invoke_scalar(bigint ntimestep)
 {
-  int i,m;
+  int i;
   double scalar;
 
   // zero if first sample within single Nfreq epoch
@@ -585,7 +634,8 @@ void FixAveTime::invoke_scalar(bigint ntimestep)
       modify->addstep_compute(ntimestep+nevery);
       modify->addstep_compute(ntimestep+nfreq);
     }
-    for (i = 0; i < nvalues; i++) vector[i] = 0.0;
+    if (!batch)
+      for (i = 0; i < nvalues; i++) vector[i] = 0.0;
   }
 
   // accumulate results of computes,fixes,variables to local copy
@@ -593,49 +643,18 @@ void FixAveTime::invoke_scalar(bigint ntimestep)
 
   modify->clearstep_compute();
 
-  for (i = 0; i < nvalues; i++) {
-    m = value2index[i];
-
-    // invoke compute if not previously invoked
-
-    if (which[i] == COMPUTE) {
-      Compute *compute = modify->compute[m];
-
-      if (argindex[i] == 0) {
-        if (!(compute->invoked_flag & INVOKED_SCALAR)) {
-          compute->compute_scalar();
-          compute->invoked_flag |= INVOKED_SCALAR;
-        }
-        scalar = compute->scalar;
-      } else {
-        if (!(compute->invoked_flag & INVOKED_VECTOR)) {
-          compute->compute_vector();
-          compute->invoked_flag |= INVOKED_VECTOR;
-        }
-
-        // insure no out-of-range access to variable-length compute vector
-
-        if (varlen[i] && compute->size_vector < argindex[i]) scalar = 0.0;
-        else scalar = compute->vector[argindex[i]-1];
-      }
-
-    // access fix fields, guaranteed to be ready
-
-    } else if (which[i] == FIX) {
-      if (argindex[i] == 0)
-        scalar = modify->fix[m]->compute_scalar();
-      else
-        scalar = modify->fix[m]->compute_vector(argindex[i]-1);
-
-    // evaluate equal-style variable
-
-    } else if (which[i] == VARIABLE)
-      scalar = input->variable->compute_equal(m);
+  if (batch) {
+    for (i = 0; i < nvalues; i++) sample[i] = value_scalar(i);
+    batch_accumulate(vector,sample,1);
+  } else {
+    for (i = 0; i < nvalues; i++) {
+      scalar = value_scalar(i);
 
-    // add value to vector or just set directly if offcol is set
+      // add value to vector or just set directly if offcol is set
 
-    if (offcol[i]) vector[i] = scalar;
-    else vector[i] += scalar;
+      if (offcol[i]) vector[i] = scalar;
+      else vector[i] += scalar;
+    }
   }
 
   // done if irepeat < nrepeat
@@ -653,61 +672,65 @@ void FixAveTime::invoke_scalar(bigint ntimestep)
   modify->addstep_compute(nvalid);
 
   // average the final result for the Nfreq timestep
+  // and combine it with previous Nfreq timestep values
 
-  double repeat = nrepeat;
-  for (i = 0; i < nvalues; i++)
-    if (offcol[i] == 0) vector[i] /= repeat;
+  if (batch) {
+    double *list = (ave == WINDOW) ? vector_list[iwindow] : NULL;
+    batch_average(vector,vector_total,list,1);
+  } else {
+    double repeat = nrepeat;
+    for (i = 0; i < nvalues; i++)
+      if (offcol[i] == 0) vector[i] /= repeat;
 
-  // if ave = ONE, only single Nfreq timestep value is needed
-  // if ave = RUNNING, combine with all previous Nfreq timestep values
-  // if ave = WINDOW, combine with nwindow most recent Nfreq timestep values
+    // if ave = ONE, only single Nfreq timestep value is needed
+    // if ave = RUNNING, combine with all previous Nfreq timestep values
+    // if ave = WINDOW, combine with nwindow most recent Nfreq timestep values
 
-  if (ave == ONE) {
-    for (i = 0; i < nvalues; i++) vector_total[i] = vector[i];
-    norm = 1;
+    if (ave == ONE) {
+      for (i = 0; i < nvalues; i++) vector_total[i] = vector[i];
+      norm = 1;
 
-  } else if (ave == RUNNING) {
-    for (i = 0; i < nvalues; i++) vector_total[i] += vector[i];
-    norm++;
+    } else if (ave == RUNNING) {
+      for (i = 0; i < nvalues; i++) vector_total[i] += vector[i];
+      norm++;
 
-  } else if (ave == WINDOW) {
-    for (i = 0; i < nvalues; i++) {
-      vector_total[i] += vector[i];
-      if (window_limit) vector_total[i] -= vector_list[iwindow][i];
-      vector_list[iwindow][i] = vector[i];
-    }
+    } else if (ave == WINDOW) {
+      for (i = 0; i < nvalues; i++) {
+        vector_total[i] += vector[i];
+        if (window_limit) vector_total[i] -= vector_list[iwindow][i];
+        vector_list[iwindow][i] = vector[i];
+      }
 
-    iwindow++;
-    if (iwindow == nwindow) {
-      iwindow = 0;
-      window_limit = 1;
+      iwindow++;
+      if (iwindow == nwindow) {
+        iwindow = 0;
+        window_limit = 1;
+      }
+      if (window_limit) norm = nwindow;
+      else norm = iwindow;
     }
-    if (window_limit) norm = nwindow;
-    else norm = iwindow;
-  }
 
-  // insure any columns with offcol set are effectively set to last value
+    // insure any columns with offcol set are effectively set to last value
 
-  for (i = 0; i < nvalues; i++)
-    if (offcol[i]) vector_total[i] = norm*vector[i];
+    for (i = 0; i < nvalues; i++)
+      if (offcol[i]) vector_total[i] = norm*vector[i];
+  }
 
   // output result to file
 
   if (fp && me == 0) {
     clearerr(fp);
     if (overwrite) fseek(fp,filepos,SEEK_SET);
-    fprintf(fp,BIGINT_FORMAT,ntimestep);
-    for (i = 0; i < nvalues; i++) fprintf(fp,format,vector_total[i]/norm);
-    fprintf(fp,"\n");
+    if (binary_flag) write_binary(ntimestep,vector_total,1);
+    else {
+      fprintf(fp,BIGINT_FORMAT,ntimestep);
+      for (i = 0; i < nvalues; i++) fprintf(fp,format,vector_total[i]/norm);
+      fprintf(fp,"\n");
+    }
     if (ferror(fp))
       error->one(FLERR,"Error writing out time averaged data");
 
-    fflush(fp);
-
-    if (overwrite) {
-      long fileend = ftell(fp);
-      if (fileend > 0) ftruncate(fileno(fp),fileend);
-    }
+    flush_output();
   }
 }
 
@@ -715,7 +738,7 @@ void FixAveTime::invoke_scalar(bigint ntimestep)
 
 void FixAveTime::invoke_vector(bigint ntimestep)
 {
-  int i,j,m;
+  int i,j;
 
   // first sample within single Nfreq epoch
   // zero out arrays that accumulate over many samples, but not across epochs
@@ -761,8 +784,9 @@ void FixAveTime::invoke_vector(bigint ntimestep)
       if (lockforever_flag) lockforever = 1;
     }
 
-    for (i = 0; i < nrows; i++)
-      for (j = 0; j < nvalues; j++) array[i][j] = 0.0;
+    if (!batch)
+      for (i = 0; i < nrows; i++)
+        for (j = 0; j < nvalues; j++) array[i][j] = 0.0;
   }
 
   // accumulate results of computes,fixes,variables to local copy
@@ -770,57 +794,23 @@ void FixAveTime::invoke_vector(bigint ntimestep)
 
   modify->clearstep_compute();
 
-  for (j = 0; j < nvalues; j++) {
-    m = value2index[j];
-
-    // invoke compute if not previously invoked
+  if (batch) {
+    for (j = 0; j < nvalues; j++) value_column(j,&sample[j],nvalues);
+    batch_accumulate(array[0],sample,nrows);
+  } else {
+    for (j = 0; j < nvalues; j++) {
+      value_column(j,column,1);
 
-    if (which[j] == COMPUTE) {
-      Compute *compute = modify->compute[m];
+      // add columns of values to array or just set directly if offcol is set
 
-      if (argindex[j] == 0) {
-        if (!(compute->invoked_flag & INVOKED_VECTOR)) {
-          compute->compute_vector();
-          compute->invoked_flag |= INVOKED_VECTOR;
-        }
-        double *cvector = compute->vector;
+      if (offcol[j]) {
         for (i = 0; i < nrows; i++)
-          column[i] = cvector[i];
-
+          array[i][j] = column[i];
       } else {
-        if (!(compute->invoked_flag & INVOKED_ARRAY)) {
-          compute->compute_array();
-          compute->invoked_flag |= INVOKED_ARRAY;
-        }
-        double **carray = compute->array;
-        int icol = argindex[j]-1;
-        for (i = 0; i < nrows; i++)
-          column[i] = carray[i][icol];
-      }
-
-    // access fix fields, guaranteed to be ready
-
-    } else if (which[j] == FIX) {
-      Fix *fix = modify->fix[m];
-      if (argindex[j] == 0)
-        for (i = 0; i < nrows; i++)
-          column[i] = fix->compute_vector(i);
-      else {
-        int icol = argindex[j]-1;
         for (i = 0; i < nrows; i++)
-          column[i] = fix->compute_array(i,icol);
+          array[i][j] += column[i];
       }
     }
-
-    // add columns of values to array or just set directly if offcol is set
-
-    if (offcol[j]) {
-      for (i = 0; i < nrows; i++)
-        array[i][j] = column[i];
-    } else {
-      for (i = 0; i < nrows; i++)
-        array[i][j] += column[i];
-    }
   }
 
   // done if irepeat < nrepeat
@@ -849,33 +839,253 @@ void FixAveTime::invoke_vector(bigint ntimestep)
   }
 
   // average the final result for the Nfreq timestep
+  // and combine it with previous Nfreq timestep values
 
-  double repeat = nrepeat;
-  for (i = 0; i < nrows; i++)
-    for (j = 0; j < nvalues; j++)
-      if (offcol[j] == 0) array[i][j] /= repeat;
+  if (batch) {
+    double *list = (ave == WINDOW) ? array_list[iwindow][0] : NULL;
+    batch_average(array[0],array_total[0],list,nrows);
+  } else {
+    double repeat = nrepeat;
+    for (i = 0; i < nrows; i++)
+      for (j = 0; j < nvalues; j++)
+        if (offcol[j] == 0) array[i][j] /= repeat;
 
-  // if ave = ONE, only single Nfreq timestep value is needed
-  // if ave = RUNNING, combine with all previous Nfreq timestep values
-  // if ave = WINDOW, combine with nwindow most recent Nfreq timestep values
+    // if ave = ONE, only single Nfreq timestep value is needed
+    // if ave = RUNNING, combine with all previous Nfreq timestep values
+    // if ave = WINDOW, combine with nwindow most recent Nfreq timestep values
+
+    if (ave == ONE) {
+      for (i = 0; i < nrows; i++)
+        for (j = 0; j < nvalues; j++) array_total[i][j] = array[i][j];
+      norm = 1;
+
+    } else if (ave == RUNNING) {
+      for (i = 0; i < nrows; i++)
+        for (j = 0; j < nvalues; j++) array_total[i][j] += array[i][j];
+      norm++;
+
+    } else if (ave == WINDOW) {
+      for (i = 0; i < nrows; i++)
+        for (j = 0; j < nvalues; j++) {
+          array_total[i][j] += array[i][j];
+          if (window_limit) array_total[i][j] -= array_list[iwindow][i][j];
+          array_list[iwindow][i][j] = array[i][j];
+        }
+
+      iwindow++;
+      if (iwindow == nwindow) {
+        iwindow = 0;
+        window_limit = 1;
+      }
+      if (window_limit) norm = nwindow;
+      else norm = iwindow;
+    }
+
+    // insure any columns with offcol set are effectively set to last value
 
-  if (ave == ONE) {
     for (i = 0; i < nrows; i++)
-      for (j = 0; j < nvalues; j++) array_total[i][j] = array[i][j];
+      for (j = 0; j < nvalues; j++)
+        if (offcol[j]) array_total[i][j] = norm*array[i][j];
+  }
+
+  // output result to file
+
+  if (fp && me == 0) {
+    if (overwrite) fseek(fp,filepos,SEEK_SET);
+    if (binary_flag) write_binary(ntimestep,array_total[0],nrows);
+    else {
+      fprintf(fp,BIGINT_FORMAT " %d\n",ntimestep,nrows);
+      for (i = 0; i < nrows; i++) {
+        fprintf(fp,"%d",i+1);
+        for (j = 0; j < nvalues; j++)
+          fprintf(fp,format,array_total[i][j]/norm);
+        fprintf(fp,"\n");
+      }
+    }
+    flush_output();
+  }
+}
+
+/* ----------------------------------------------------------------------
+   value I of mode = SCALAR from its compute, fix or variable
+   compute/fix/variable may invoke computes, caller wraps with clear/add
+------------------------------------------------------------------------- */
+
+double FixAveTime::value_scalar(int i)
+{
+  double scalar;
+  int m = value2index[i];
+
+  // invoke compute if not previously invoked
+
+  if (which[i] == COMPUTE) {
+    Compute *compute = modify->compute[m];
+
+    if (argindex[i] == 0) {
+      if (!(compute->invoked_flag & INVOKED_SCALAR)) {
+        compute->compute_scalar();
+        compute->invoked_flag |= INVOKED_SCALAR;
+      }
+      scalar = compute->scalar;
+    } else {
+      if (!(compute->invoked_flag & INVOKED_VECTOR)) {
+        compute->compute_vector();
+        compute->invoked_flag |= INVOKED_VECTOR;
+      }
+
+      // insure no out-of-range access to variable-length compute vector
+
+      if (varlen[i] && compute->size_vector < argindex[i]) scalar = 0.0;
+      else scalar = compute->vector[argindex[i]-1];
+    }
+
+  // access fix fields, guaranteed to be ready
+
+  } else if (which[i] == FIX) {
+    if (argindex[i] == 0)
+      scalar = modify->fix[m]->compute_scalar();
+    else
+      scalar = modify->fix[m]->compute_vector(argindex[i]-1);
+
+  // evaluate equal-style variable
+
+  } else if (which[i] == VARIABLE)
+    scalar = input->variable->compute_equal(m);
+
+  return scalar;
+}
+
+/* ----------------------------------------------------------------------
+   column J of mode = VECTOR into buf, consecutive rows stride apart
+------------------------------------------------------------------------- */
+
+void FixAveTime::value_column(int j, double *buf, int stride)
+{
+  int i;
+  int m = value2index[j];
+
+  // invoke compute if not previously invoked
+
+  if (which[j] == COMPUTE) {
+    Compute *compute = modify->compute[m];
+
+    if (argindex[j] == 0) {
+      if (!(compute->invoked_flag & INVOKED_VECTOR)) {
+        compute->compute_vector();
+        compute->invoked_flag |= INVOKED_VECTOR;
+      }
+      double *cvector = compute->vector;
+      for (i = 0; i < nrows; i++)
+        buf[i*stride] = cvector[i];
+
+    } else {
+      if (!(compute->invoked_flag & INVOKED_ARRAY)) {
+        compute->compute_array();
+        compute->invoked_flag |= INVOKED_ARRAY;
+      }
+      double **carray = compute->array;
+      int icol = argindex[j]-1;
+      for (i = 0; i < nrows; i++)
+        buf[i*stride] = carray[i][icol];
+    }
+
+  // access fix fields, guaranteed to be ready
+
+  } else if (which[j] == FIX) {
+    Fix *fix = modify->fix[m];
+    if (argindex[j] == 0)
+      for (i = 0; i < nrows; i++)
+        buf[i*stride] = fix->compute_vector(i);
+    else {
+      int icol = argindex[j]-1;
+      for (i = 0; i < nrows; i++)
+        buf[i*stride] = fix->compute_array(i,icol);
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   batch mode: add one sample of n rows x nvalues, gathered row by row
+   into buf, to acc in a single sweep, first sample of an epoch is copied
+   columns with offcol set keep the last sample
+------------------------------------------------------------------------- */
+
+void FixAveTime::batch_accumulate(double *acc, const double *buf, int n)
+{
+  int i,k;
+  int ntotal = n*nvalues;
+
+  if (irepeat == 0) {
+    memcpy(acc,buf,ntotal*sizeof(double));
+    return;
+  }
+
+#if defined(_OPENMP)
+#pragma omp simd
+#endif
+  for (k = 0; k < ntotal; k++) acc[k] += buf[k];
+
+  for (k = 0; k < noffcols; k++)
+    for (i = 0; i < n; i++) {
+      int ind = i*nvalues + offcols[k];
+      acc[ind] = buf[ind];
+    }
+}
+
+/* ----------------------------------------------------------------------
+   batch mode: divide acc by nrepeat and fold it into total, and into the
+   window list for ave = WINDOW, in one sweep over n rows x nvalues
+------------------------------------------------------------------------- */
+
+void FixAveTime::batch_average(double *acc, double *total, double *list, int n)
+{
+  int i,j,k;
+
+  if (ave == ONE) {
+    for (i = 0, k = 0; i < n; i++, k += nvalues)
+#if defined(_OPENMP)
+#pragma omp simd
+#endif
+      for (j = 0; j < nvalues; j++) {
+        acc[k+j] /= divisor[j];
+        total[k+j] = acc[k+j];
+      }
     norm = 1;
 
   } else if (ave == RUNNING) {
-    for (i = 0; i < nrows; i++)
-      for (j = 0; j < nvalues; j++) array_total[i][j] += array[i][j];
+    for (i = 0, k = 0; i < n; i++, k += nvalues)
+#if defined(_OPENMP)
+#pragma omp simd
+#endif
+      for (j = 0; j < nvalues; j++) {
+        acc[k+j] /= divisor[j];
+        total[k+j] += acc[k+j];
+      }
     norm++;
 
   } else if (ave == WINDOW) {
-    for (i = 0; i < nrows; i++)
-      for (j = 0; j < nvalues; j++) {
-        array_total[i][j] += array[i][j];
-        if (window_limit) array_total[i][j] -= array_list[iwindow][i][j];
-        array_list[iwindow][i][j] = array[i][j];
-      }
+    if (window_limit) {
+      for (i = 0, k = 0; i < n; i++, k += nvalues)
+#if defined(_OPENMP)
+#pragma omp simd
+#endif
+        for (j = 0; j < nvalues; j++) {
+          acc[k+j] /= divisor[j];
+          total[k+j] += acc[k+j];
+          total[k+j] -= list[k+j];
+          list[k+j] = acc[k+j];
+        }
+    } else {
+      for (i = 0, k = 0; i < n; i++, k += nvalues)
+#if defined(_OPENMP)
+#pragma omp simd
+#endif
+        for (j = 0; j < nvalues; j++) {
+          acc[k+j] /= divisor[j];
+          total[k+j] += acc[k+j];
+          list[k+j] = acc[k+j];
+        }
+    }
 
     iwindow++;
     if (iwindow == nwindow) {
@@ -888,25 +1098,43 @@ void FixAveTime::invoke_vector(bigint ntimestep)
 
   // insure any columns with offcol set are effectively set to last value
 
-  for (i = 0; i < nrows; i++)
-    for (j = 0; j < nvalues; j++)
-      if (offcol[j]) array_total[i][j] = norm*array[i][j];
+  for (k = 0; k < noffcols; k++)
+    for (i = 0; i < n; i++) {
+      int ind = i*nvalues + offcols[k];
+      total[ind] = norm*acc[ind];
+    }
+}
 
-  // output result to file
+/* ----------------------------------------------------------------------
+   write n rows x nvalues of total/norm as one binary frame
+------------------------------------------------------------------------- */
 
-  if (fp && me == 0) {
-    if (overwrite) fseek(fp,filepos,SEEK_SET);
-    fprintf(fp,BIGINT_FORMAT " %d\n",ntimestep,nrows);
-    for (i = 0; i < nrows; i++) {
-      fprintf(fp,"%d",i+1);
-      for (j = 0; j < nvalues; j++) fprintf(fp,format,array_total[i][j]/norm);
-      fprintf(fp,"\n");
-    }
-    fflush(fp);
-    if (overwrite) {
-      long fileend = ftell(fp);
-      if (fileend > 0) ftruncate(fileno(fp),fileend);
-    }
+void FixAveTime::write_binary(bigint ntimestep, const double *total, int n)
+{
+  int ntotal = n*nvalues;
+  if (ntotal > maxoutbuf) {
+    maxoutbuf = ntotal;
+    memory->destroy(outbuf);
+    memory->create(outbuf,maxoutbuf,"ave/time:outbuf");
+  }
+
+  for (int k = 0; k < ntotal; k++) outbuf[k] = total[k]/norm;
+  binary_frame_write(fp,ntimestep,n,nvalues,outbuf);
+}
+
+/* ----------------------------------------------------------------------
+   flush the file every nflush outputs, always if overwrite is set
+   since the file is truncated behind the last output
+------------------------------------------------------------------------- */
+
+void FixAveTime::flush_output()
+{
+  if (!overwrite && ++iflush < nflush) return;
+  iflush = 0;
+  fflush(fp);
+  if (overwrite) {
+    long fileend = ftell(fp);
+    if (fileend > 0) ftruncate(fileno(fp),fileend);
   }
 }
 
@@ -1022,6 +1250,9 @@ void FixAveTime::options(int narg, char **arg)
   title1 = NULL;
   title2 = NULL;
   title3 = NULL;
+  batch = 0;
+  binary_flag = 0;
+  nflush = 1;
 
   // optional args
 
@@ -1069,6 +1300,12 @@ void FixAveTime::options(int narg, char **arg)
     } else if (strcmp(arg[iarg],"overwrite") == 0) {
       overwrite = 1;
       iarg += 1;
+    } else if (strcmp(arg[iarg],"output") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/time command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix ave/time command");
+      iarg += 2;
     } else if (strcmp(arg[iarg],"format") == 0) {
       if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/time command");
       delete [] format_user;
@@ -1077,6 +1314,17 @@ void FixAveTime::options(int narg, char **arg)
       sprintf(format_user," %s",arg[iarg+1]);
       format = format_user;
       iarg += 2;
+    } else if (strcmp(arg[iarg],"batch") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/time command");
+      if (strcmp(arg[iarg+1],"yes") == 0) batch = 1;
+      else if (strcmp(arg[iarg+1],"no") == 0) batch = 0;
+      else error->all(FLERR,"Illegal fix ave/time command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"flush") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/time command");
+      nflush = force->inumeric(FLERR,arg[iarg+1]);
+      if (nflush <= 0) error->all(FLERR,"Illegal fix ave/time command");
+      iarg += 2;
     } else if (strcmp(arg[iarg],"title1") == 0) {
       if (iarg+2 > narg) error->all(FLERR,"Illegal fix ave/spatial command");
       delete [] title1;
@@ -1130,6 +1378,10 @@ void FixAveTime::allocate_arrays()
     memory->destroy(array_list);
     memory->create(array_list,nwindow,nrows,nvalues,"ave/time:array_list");
   }
+  if (batch) {
+    memory->destroy(sample);
+    memory->create(sample,nrows*nvalues,"ave/time:sample");
+  }
 
   // reinitialize regrown array_total since it accumulates
 
@@ -66,9 +66,28 @@ class FixAveTime : public Fix {
   double **array_total;
   double ***array_list;
 
+  // batch mode: one sample of all columns gathered row by row into sample,
+  // then folded into the averages by single sweeps over all columns
+  int batch;
+  double *sample;
+  int *offcols;              // indices of columns with offcol set
+  int noffcols;
+  double *divisor;           // nrepeat, or 1 for off columns
+
+  int binary_flag;           // write binary frames instead of text
+  int nflush,iflush;         // flush file every nflush outputs
+  double *outbuf;
+  int maxoutbuf;
+
   int column_length(int);
   void invoke_scalar(bigint);
   void invoke_vector(bigint);
+  double value_scalar(int);
+  void value_column(int, double *, int);
+  void batch_accumulate(double *, const double *, int);
+  void batch_average(double *, double *, double *, int);
+  void write_binary(bigint, const double *, int);
+  void flush_output();
   void options(int, char **);
   void allocate_values(int);
   void allocate_arrays();
@@ -197,4 +216,9 @@ E: Cannot open fix ave/time file %s
 The specified file cannot be opened.  Check that the path and name are
 correct.
 
+W: Fix ave/time titles are not written to binary output
+
+With output binary the file header only holds the column names, the
+title1, title2 and title3 keywords have no effect.
+
 */
@@ -21,29 +21,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include "fix_brownian.h"
-#include "math_extra.h"
 #include "atom.h"
 #include "force.h"
 #include "update.h"
-#include "modify.h"
-#include "compute.h"
-#include "domain.h"
-#include "region.h"
-#include "respa.h"
 #include "comm.h"
-#include "input.h"
-#include "variable.h"
-#include "random_correlater.h"
-#include "random_mars.h"
+#include "random_counter.h"
 #include "memory.h"
 #include "error.h"
-#include "group.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
+using namespace RandomCounter;
 
-enum{NOBIAS,BIAS};
-enum{CONSTANT,EQUAL,ATOM};
+enum{EULER,BAOAB};
 
 /* ---------------------------------------------------------------------- */
 
@@ -54,10 +44,8 @@ FixBrownian::FixBrownian(LAMMPS *lmp, int narg, char **arg) :
 
   // set fix properties
   
-  global_freq = 1;
+  time_integrate = 1;
   nevery = 1;
-  peratom_freq = 1;
-  peratom_flag = 1;
   
   // read input parameter
   D = force->numeric(FLERR,arg[3]);
@@ -66,21 +54,44 @@ FixBrownian::FixBrownian(LAMMPS *lmp, int narg, char **arg) :
   
   seed = force->inumeric(FLERR,arg[5]);
   
-  // optional parameter
-  
+  if (D <= 0.0 || temp <= 0.0) error->all(FLERR,"Illegal fix brownian command");
   if (seed <= 0) error->all(FLERR,"Illegal fix brownian command");
-  
-  // initialize correlated RNG with processor-unique seed
-  random = new RanMars(lmp,seed + comm->me);
 
+  memory->create(dscale,atom->ntypes+1,"brownian:dscale");
+  memory->create(drift,atom->ntypes+1,"brownian:drift");
+  memory->create(diffuse,atom->ntypes+1,"brownian:diffuse");
+  for (int i = 1; i <= atom->ntypes; i++) dscale[i] = 1.0;
+
+  // optional parameter
+
+  integrator = EULER;
+  int iarg = 6;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"integrator") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix brownian command");
+      if (strcmp(arg[iarg+1],"euler") == 0) integrator = EULER;
+      else if (strcmp(arg[iarg+1],"baoab") == 0) integrator = BAOAB;
+      else error->all(FLERR,"Illegal fix brownian command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"scale") == 0) {
+      if (iarg+3 > narg) error->all(FLERR,"Illegal fix brownian command");
+      int itype = force->inumeric(FLERR,arg[iarg+1]);
+      double scale = force->numeric(FLERR,arg[iarg+2]);
+      if (itype <= 0 || itype > atom->ntypes || scale <= 0.0)
+        error->all(FLERR,"Illegal fix brownian command");
+      dscale[itype] = scale;
+      iarg += 3;
+    } else error->all(FLERR,"Illegal fix brownian command");
+  }
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixBrownian::~FixBrownian()
 {
-
-
+  memory->destroy(dscale);
+  memory->destroy(drift);
+  memory->destroy(diffuse);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -89,19 +100,14 @@ int FixBrownian::setmask()
 {
   int mask = 0;
   mask |= INITIAL_INTEGRATE;
-  mask |= FINAL_INTEGRATE;
   return mask;
 }
 
-/* ---------------------------------------------------------------------- */
-
-
 /* ---------------------------------------------------------------------- */
 
 void FixBrownian::init()
 {
-
-  
+  compute_prefactors();
 }
 
 /* ---------------------------------------------------------------------- */
@@ -111,53 +117,74 @@ void FixBrownian::setup(int vflag)
 
 }
 
-/* ---------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------
+   per-type prefactors of the overdamped Langevin equation
+   dx = D/kT F dt + sqrt(2 D dt) xi
+   the BAOAB limit averages the noise of two steps, (xi_n + xi_n+1)/2
+------------------------------------------------------------------------- */
 
-void FixBrownian::initial_integrate(int vflag)
+void FixBrownian::compute_prefactors()
 {
-  int n,d,m;
-  double **v = atom->v;
-  double **x = atom->x;
-  double **f = atom->f;
-  int *type = atom->type;
-  double *mass = atom->mass;
-  int *mask = atom->mask;
-  int nlocal = atom->nlocal;
-  tagint *tag = atom->tag;
-  
-
-
-  for ( n = 0; n < nlocal; n++) {
-    int itag = tag[n]-1;
-    if (mask[n] & groupbit) {
-      
-    }
+  double dt = update->dt;
+  double kT = force->boltz*temp;
+  for (int i = 1; i <= atom->ntypes; i++) {
+    double Dt = D*dscale[i];
+    drift[i] = Dt/kT*dt;
+    diffuse[i] = sqrt(2.0*Dt*dt);
+    if (integrator == BAOAB) diffuse[i] *= 0.5;
   }
-
-  
 }
 
 /* ---------------------------------------------------------------------- */
 
-void FixBrownian::final_integrate()
+void FixBrownian::reset_dt()
+{
+  compute_prefactors();
+}
+
+/* ----------------------------------------------------------------------
+   position update from the forces of the last step, v = dx/dt for output
+   the noise of step n is regenerated from its counter for BAOAB,
+   so no per-atom state has to be stored and migrated
+------------------------------------------------------------------------- */
+
+void FixBrownian::initial_integrate(int vflag)
 {
-  int n,d,m;
   double **v = atom->v;
   double **x = atom->x;
   double **f = atom->f;
   int *type = atom->type;
-  double *mass = atom->mass;
   int *mask = atom->mask;
   int nlocal = atom->nlocal;
   tagint *tag = atom->tag;
-  int itag;
 
-  for ( n = 0; n < nlocal; n++) {
-   itag = tag[n]-1;
-    if (mask[n] & groupbit) {
+  double dtinv = 1.0/update->dt;
+  uint64_t key_new = step_key(stream_key(id),seed,update->ntimestep);
+  uint64_t key_old = step_key(stream_key(id),seed,update->ntimestep-1);
+  int baoab = (integrator == BAOAB);
+
+  int n;
+#if defined(_OPENMP)
+#pragma omp parallel for private(n) default(none) shared(v,x,f,type,mask,nlocal,tag,dtinv,key_new,key_old,baoab) schedule(static)
+#endif
+  for (n = 0; n < nlocal; n++) {
+    if (!(mask[n] & groupbit)) continue;
+
+    double xi[3],xi_old[3];
+    gaussian3(atom_key(key_new,tag[n]),xi);
+    if (baoab) {
+      gaussian3(atom_key(key_old,tag[n]),xi_old);
+      xi[0] += xi_old[0];
+      xi[1] += xi_old[1];
+      xi[2] += xi_old[2];
+    }
 
+    const double a = drift[type[n]];
+    const double b = diffuse[type[n]];
+    for (int d = 0; d < 3; d++) {
+      double dx = a*f[n][d] + b*xi[d];
+      x[n][d] += dx;
+      v[n][d] = dx*dtinv;
     }
   }
-  
-  
-}
\ No newline at end of file
+}
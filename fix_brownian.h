@@ -32,20 +32,32 @@ class FixBrownian : public Fix {
   void init();
   void setup(int);
   virtual void initial_integrate(int);
-  virtual void final_integrate();
+  void reset_dt();
   
 
  protected:
   double D;
   double temp;
-
-  class RanMars *random;
-  class RanCor *random_correlator;
   int seed;
 
-};
+  int integrator;     // EULER: Euler-Maruyama, BAOAB: overdamped limit of BAOAB
+  double *dscale;     // per-type scaling of D
+  double *drift;      // per-type D/kT*dt
+  double *diffuse;    // per-type noise amplitude
 
+  void compute_prefactors();
+};
 }
 
 #endif
 #endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal ... command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.  You can use -echo screen as a
+command-line option when running LAMMPS to see the offending line.
+
+*/
@@ -13,98 +13,155 @@
 
 #include "fix_cdf.h"
 #include "string.h"
+#include "math.h"
 #include "update.h"
 #include "group.h"
 #include "error.h"
 #include "force.h"
+#include "pair.h"
 #include "memory.h"
 #include "modify.h"
+#include "compute.h"
 #include "atom.h"
 #include "domain.h"
 #include "input.h"
 #include "comm.h"
+#include "thr_omp.h"
+#include "binary_frame.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
+#define NQ 6          // per bin: count, vx, |v_perp|, v_radial, pxx, pyz
+#define NCOLS 8       // output columns: x, r and the NQ averages
+
+#define INVOKED_PERATOM 8
+
 /* ---------------------------------------------------------------------- */
 
 FixCDF::FixCDF(LAMMPS *lmp, int narg, char **arg) :
   Fix(lmp, narg, arg)
 {
-  
-  if (narg < 9) error->all(FLERR,"Illegal compute cdf command");
-  
+
+  if (narg < 9) error->all(FLERR,"Illegal fix cdf command");
+
   MPI_Comm_rank(world,&me);
   MPI_Comm_size(world,&nprocs);
-  
+
   nevery = force->inumeric(FLERR,arg[3]);
-  
+
   nbin_x = force->inumeric(FLERR,arg[4]);
   range_x = force->numeric(FLERR,arg[5]);
   nbin_r = force->inumeric(FLERR,arg[6]);
   range_r = force->numeric(FLERR,arg[7]);
-  
+  if (nevery <= 0 || nbin_x <= 0 || nbin_r <= 0 ||
+      range_x <= 0.0 || range_r <= 0.0)
+    error->all(FLERR,"Illegal fix cdf command");
+
   jgroup = group->find(arg[8]);
+  if (jgroup == -1) error->all(FLERR,"Could not find fix cdf group ID");
   jgroupbit = group->bitmask[jgroup];
-  
+
   print = 0;
-  
-  //printf("out: %s\n",arg[9]);
-  
-  if (strcmp(arg[9],"file") == 0) {
-    if (11 > narg) error->all(FLERR,"Illegal compute cdf/file command");
-    print = 1;
-    //printf("me: %d\n",me);
-    if (me == 0) {
-      //printf("Fix cdf, option file\n");
-      out = fopen(arg[10],"w");
-      if (out == NULL) {
-        char str[128];
-        sprintf(str,"Cannot open compute cdf/file file %s",arg[10]);
-        error->one(FLERR,str);
-      }
-    } 
+  binary_flag = 0;
+  nave = 1;
+  out = NULL;
+  char *filename = NULL;
+
+  // optional keywords
+
+  int iarg = 9;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"file") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      print = 1;
+      filename = arg[iarg+1];
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"ave") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      nave = force->inumeric(FLERR,arg[iarg+1]);
+      if (nave <= 0) error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix cdf command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix cdf command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix cdf command");
+  }
+
+  if (print && me == 0) {
+    out = fopen(filename,binary_flag ? "wb" : "w");
+    if (out == NULL) {
+      char str[128];
+      snprintf(str,128,"Cannot open fix cdf file %s",filename);
+      error->one(FLERR,str);
+    }
   }
-  
+
   // allocate memory
-  size_vector = nbin_x*nbin_r;
-  memory->create(data_histo,size_vector,"cdf/data_histo");
-  memory->create(data_histo_loc,size_vector,"cdf/data_histo_loc");
-  memory->create(data_velx,size_vector,"cdf/data_velx");
-  memory->create(data_vely,size_vector,"cdf/data_vely");
-  memory->create(data_velz,size_vector,"cdf/data_velz");
-  memory->create(data_vel_locx,size_vector,"cdf/data_vel_locx");
-  memory->create(data_vel_locy,size_vector,"cdf/data_vel_locy");
-  memory->create(data_vel_locz,size_vector,"cdf/data_vel_locz");
-  
-    memory->create(data_pressx,size_vector,"cdf/data_pressx");
-    memory->create(data_pressyz,size_vector,"cdf/data_pressyz");
-    
-    memory->create(data_press_locx,size_vector,"cdf/data_press_locx");
-    memory->create(data_press_locyz,size_vector,"cdf/data_press_locyz");
-  
+  // all NQ quantities of a bin are adjacent, so one atom touches one
+  // cache line and the procs are summed with a single reduction
+
+  nbins = nbin_x*nbin_r;
+  memory->create(accum,NQ*nbins,"cdf:accum");
+  memory->create(accum_all,NQ*nbins,"cdf:accum_all");
+  nthreads = comm->nthreads;
+  memory->create(accum_thr,nthreads*NQ*nbins,"cdf:accum_thr");
+  for (int n = 0; n < NQ*nbins; n++) accum[n] = 0.0;
+  nsample = 0;
+
+  frame = NULL;
+  if (print && binary_flag && me == 0) {
+    memory->create(frame,NCOLS*nbins,"cdf:frame");
+    char **names = new char*[NCOLS];
+    const char *labels[NCOLS] = {"x","r","count","vx","vperp","vrad",
+                                 "pxx","pyz"};
+    for (int j = 0; j < NCOLS; j++) {
+      names[j] = new char[BINARY_FRAME_NAMELEN];
+      strncpy(names[j],labels[j],BINARY_FRAME_NAMELEN);
+    }
+    binary_frame_header(out,id,NCOLS,names);
+    for (int j = 0; j < NCOLS; j++) delete [] names[j];
+    delete [] names;
+  }
+
   count = nevery;
+
+  // per-atom virial of the solvent by an internal compute stress/atom,
+  // it is only tallied on the steps requested by sample()
+
+  int n = strlen(id) + strlen("_stress") + 1;
+  id_stress = new char[n];
+  strcpy(id_stress,id);
+  strcat(id_stress,"_stress");
+
+  char **newarg = new char*[5];
+  newarg[0] = id_stress;
+  newarg[1] = group->names[jgroup];
+  newarg[2] = (char *) "stress/atom";
+  newarg[3] = (char *) "NULL";
+  newarg[4] = (char *) "virial";
+  modify->add_compute(5,newarg);
+  delete [] newarg;
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixCDF::~FixCDF()
 {
-  memory->destroy(data_histo);
-  memory->destroy(data_histo_loc);
-  memory->destroy(data_velx);
-  memory->destroy(data_vely);
-  memory->destroy(data_velz);
-  memory->destroy(data_vel_locx);
-  memory->destroy(data_vel_locy);
-  memory->destroy(data_vel_locz);
-      memory->destroy(data_pressx);
-    memory->destroy(data_pressyz);
-    
-    memory->destroy(data_press_locx);
-    memory->destroy(data_press_locyz);
-  if (me==0) fclose(out);
+  memory->destroy(accum);
+  memory->destroy(accum_all);
+  memory->destroy(accum_thr);
+  memory->destroy(frame);
+  if (out) fclose(out);
+
+  // delete the compute if it still exists, it may already be gone when
+  // LAMMPS shuts down
+
+  if (modify->find_compute(id_stress) >= 0) modify->delete_compute(id_stress);
+  delete [] id_stress;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -120,113 +177,175 @@ int FixCDF::setmask()
 
 void FixCDF::init()
 {
+  // the colloid mass does not change, so only its center is reduced
+  // per sample
+
+  masstotal = group->mass(igroup);
 
+  int icompute = modify->find_compute(id_stress);
+  if (icompute < 0)
+    error->all(FLERR,"Stress ID for fix cdf does not exist");
+  stress = modify->compute[icompute];
+
+  if (comm->nthreads != nthreads) {
+    nthreads = comm->nthreads;
+    memory->destroy(accum_thr);
+    memory->create(accum_thr,nthreads*NQ*nbins,"cdf:accum_thr");
+  }
+}
+
+/* ----------------------------------------------------------------------
+   request the per-atom virial on the first sampling step of the run
+------------------------------------------------------------------------- */
+
+void FixCDF::setup(int vflag)
+{
+  modify->addstep_compute(update->ntimestep + nevery - count + 1);
 }
 
 /* ---------------------------------------------------------------------- */
 
-void FixCDF::end_of_step() 
+void FixCDF::end_of_step()
 {
   if (count == nevery) {
-    // determine com of the colloid
-    int n;
-    double xcm[3];
-    double masstotal = group->mass(igroup);
-    group->xcm(igroup,masstotal,xcm);
-    
-    for (n=0; n<nbin_x*nbin_r; n++) {
-      data_histo[n] = 0;
-      data_histo_loc[n] = 0;
-      data_velx[n] = 0.0;
-      data_vel_locx[n] = 0.0;
-      data_vely[n] = 0.0;
-      data_vel_locy[n] = 0.0;
-      data_velz[n] = 0.0;
-      data_vel_locz[n] = 0.0;
-      
-      data_pressx[n] = 0.0;
-      data_press_locx[n] = 0.0;
-      
-            data_pressyz[n] = 0.0;
-      data_press_locyz[n] = 0.0;
-    }
-    
-    double delx, dely, delz;
-    int i;
-    double **x = atom->x;
-    double **v = atom->v;
-    int nlocal = atom->nlocal;
-    int * mask = atom->mask;
-    double **vatom = force->pair->vatom;
-    for (i=0; i<nlocal; i++) {
-      if(mask[i] & jgroupbit) {
-        delx = x[i][0] -xcm[0];
-        dely = x[i][1] -  xcm[1];
-        delz =  x[i][2] - xcm[2];  
-        
-        domain->minimum_image(delx,dely,delz);
-    
-        double data_x = delx + range_x;
-        double data_r = sqrt(dely*dely + delz*delz);
-        int bin_x=-1;
-        if (data_x > 0.0)
-          bin_x = data_x*((double) nbin_x)/(2.0*range_x);
-        int bin_r = data_r*((double) nbin_r)/(range_r);
-        if (bin_x >= 0 && bin_x <nbin_x && bin_r >= 0 && bin_r <nbin_r) {
-          data_histo_loc[bin_x*nbin_r + bin_r]++;
-          data_vel_locx[bin_x*nbin_r + bin_r]+=v[i][0];
-          data_vel_locy[bin_x*nbin_r + bin_r]+=sqrt(v[i][1]*v[i][1]+v[i][2]*v[i][2]);
-          double sign = v[i][1]*dely+v[i][2]*delz;
-          double dx = dely*dely + delz*delz;
-          data_vel_locz[bin_x*nbin_r + bin_r]=sign/sqrt(dx);
-	  
-	  data_vel_locx[bin_x*nbin_r + bin_r]+=vatom[i][0];
-	  data_vel_locx[bin_x*nbin_r + bin_r]+=v[i][0]*v[i][0];
-          data_vel_locyz[bin_x*nbin_r + bin_r]+=(vatom[i][1]+vatom[i][2])/2.0;
-	  data_vel_locyz[bin_x*nbin_r + bin_r]+=(v[i][1]*v[i][1]+v[i][2]*v[i][2])/2.0;
-        }
-      }
+    sample();
+    nsample++;
+    if (nsample == nave) output();
+    count = 0;
+  }
+  count ++;
+}
+
+/* ----------------------------------------------------------------------
+   bin the solvent atoms around the colloid center into this proc's sums
+   every thread fills its own histogram, no MPI communication besides xcm
+------------------------------------------------------------------------- */
+
+void FixCDF::sample()
+{
+  // determine com of the colloid
+  double xcm[3];
+  group->xcm(igroup,masstotal,xcm);
+
+  double **x = atom->x;
+  double **v = atom->v;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+
+  // per-atom virial, compute stress/atom errors out if it was not
+  // tallied on this step, it returns -virial*nktv2p
+
+  modify->clearstep_compute();
+  if (!(stress->invoked_flag & INVOKED_PERATOM)) {
+    stress->compute_peratom();
+    stress->invoked_flag |= INVOKED_PERATOM;
+  }
+  double **vatom = stress->array_atom;
+  double vscale = -1.0/force->nktv2p;
+  modify->addstep_compute(update->ntimestep + nevery);
+
+  double xscale = ((double) nbin_x)/(2.0*range_x);
+  double rscale = ((double) nbin_r)/range_r;
+
+#if defined(_OPENMP)
+#pragma omp parallel default(none) shared(x,v,mask,nlocal,vatom,vscale,xcm,xscale,rscale)
+#endif
+  {
+    int i,n,ifrom,ito,tid;
+    loop_setup_thr(ifrom,ito,tid,nlocal,nthreads);
+    double *hist = &accum_thr[tid*NQ*nbins];
+    for (n = 0; n < NQ*nbins; n++) hist[n] = 0.0;
+
+    for (i = ifrom; i < ito; i++) {
+      if (!(mask[i] & jgroupbit)) continue;
+      double delx = x[i][0] - xcm[0];
+      double dely = x[i][1] - xcm[1];
+      double delz = x[i][2] - xcm[2];
+      domain->minimum_image(delx,dely,delz);
+
+      double data_x = delx + range_x;
+      double dr2 = dely*dely + delz*delz;
+      double data_r = sqrt(dr2);
+      int bin_x = -1;
+      if (data_x > 0.0) bin_x = data_x*xscale;
+      int bin_r = data_r*rscale;
+      if (bin_x < 0 || bin_x >= nbin_x || bin_r < 0 || bin_r >= nbin_r)
+        continue;
+
+      double *b = &hist[NQ*(bin_x*nbin_r + bin_r)];
+      double vperp2 = v[i][1]*v[i][1] + v[i][2]*v[i][2];
+      b[0] += 1.0;
+      b[1] += v[i][0];
+      b[2] += sqrt(vperp2);
+      if (dr2 > 0.0) b[3] += (v[i][1]*dely + v[i][2]*delz)/data_r;
+      b[4] += v[i][0]*v[i][0];
+      b[5] += 0.5*vperp2;
+      b[4] += vscale*vatom[i][0];
+      b[5] += 0.5*vscale*(vatom[i][1] + vatom[i][2]);
     }
-    
-    //printf("test1\n");
-    
-    MPI_Allreduce(data_histo_loc, data_histo, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locx, data_velx, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locy, data_vely, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    MPI_Allreduce(data_vel_locz, data_velz, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    
-        MPI_Allreduce(data_press_locx, data_pressx, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-	 MPI_Allreduce(data_press_locyz, data_pressyz, nbin_x*nbin_r, MPI_DOUBLE, MPI_SUM, world);
-    
-    //printf("test2\n");
-    
-    int r,xloc;
-    for (xloc=0; xloc<nbin_x; xloc++) {
-      for (r=0; r<nbin_r; r++) {
-        if ( data_histo[xloc*nbin_r + r] != 0 ) {
-          data_velx[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-          data_vely[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-          data_velz[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-	  
-	  data_pressx[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-	  data_pressyz[xloc*nbin_r + r] /= data_histo[xloc*nbin_r + r];
-        }
+  }
+
+  // sum the thread histograms into the running sums
+
+  int ntotal = NQ*nbins;
+#if defined(_OPENMP)
+#pragma omp parallel for default(none) shared(ntotal) schedule(static)
+#endif
+  for (int n = 0; n < ntotal; n++) {
+    double sum = 0.0;
+    for (int t = 0; t < nthreads; t++) sum += accum_thr[t*ntotal + n];
+    accum[n] += sum;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   reduce the accumulated sums in one message and write a frame
+   count is the mean number of atoms per sample, the other quantities
+   are averaged over all atoms that visited the bin
+------------------------------------------------------------------------- */
+
+void FixCDF::output()
+{
+  if (print) {
+    MPI_Reduce(accum,accum_all,NQ*nbins,MPI_DOUBLE,MPI_SUM,0,world);
+
+    if (me == 0) {
+      int xloc,r,n,q;
+      for (n = 0; n < nbins; n++) {
+        double *b = &accum_all[NQ*n];
+        if (b[0] != 0.0)
+          for (q = 1; q < NQ; q++) b[q] /= b[0];
+        b[0] /= nsample;
       }
-    }
-    
-    //printf("test3\n");
-
-    if (print && (me == 0) ) {
-      fprintf(out,"t=%d\n",update->ntimestep);
-      for (xloc=0; xloc<nbin_x; xloc++) {
-        for (r=0; r<nbin_r; r++) {
-          fprintf(out,"%f %f %f %f %f %f %f %f\n",xloc/((double) nbin_x)*(2.0*range_x)-range_x,r/((double) nbin_r)*(range_r),data_histo[xloc*nbin_r + r],data_velx[xloc*nbin_r + r],data_vely[xloc*nbin_r + r],data_velz[xloc*nbin_r + r],data_pressx[xloc*nbin_r + r],data_pressyz[xloc*nbin_r + r]);
+
+      if (binary_flag) {
+        for (xloc = 0; xloc < nbin_x; xloc++)
+          for (r = 0; r < nbin_r; r++) {
+            n = xloc*nbin_r + r;
+            double *row = &frame[NCOLS*n];
+            row[0] = xloc/((double) nbin_x)*(2.0*range_x)-range_x;
+            row[1] = r/((double) nbin_r)*(range_r);
+            for (q = 0; q < NQ; q++) row[2+q] = accum_all[NQ*n+q];
+          }
+        binary_frame_write(out,update->ntimestep,nbins,NCOLS,frame);
+      } else {
+        fprintf(out,"t=" BIGINT_FORMAT "\n",update->ntimestep);
+        for (xloc = 0; xloc < nbin_x; xloc++) {
+          for (r = 0; r < nbin_r; r++) {
+            double *b = &accum_all[NQ*(xloc*nbin_r + r)];
+            fprintf(out,"%f %f %f %f %f %f %f %f\n",
+                    xloc/((double) nbin_x)*(2.0*range_x)-range_x,
+                    r/((double) nbin_r)*(range_r),
+                    b[0],b[1],b[2],b[3],b[4],b[5]);
+          }
+          fprintf(out,"\n");
         }
-        fprintf(out,"\n");
+        fprintf(out,"\n\n");
       }
-      fprintf(out,"\n\n");
+      fflush(out);
     }
-    count = 0;
-  } 
-  count ++;
+  }
+
+  for (int n = 0; n < NQ*nbins; n++) accum[n] = 0.0;
+  nsample = 0;
 }
@@ -30,6 +30,7 @@ class FixCDF : public Fix {
   ~FixCDF();
   int setmask();
   void init();
+  void setup(int);
   void end_of_step();
 
  private:
@@ -39,25 +40,27 @@ class FixCDF : public Fix {
   double range_x;
   int nbin_r;
   double range_r;
-  
-  double * data_histo;
-  double * data_histo_loc;
-  double * data_velx;
-  double * data_vel_locx;
-    double * data_vely;
-  double * data_vel_locy;
-    double * data_velz;
-  double * data_vel_locz;
-  
-    double * data_press_locx;
-    double * data_pressx;
-    
-        double * data_press_locyz;
-    double * data_pressyz;
-  
+  int nbins;
+
+  int nave,nsample;         // samples per output frame, samples so far
+  double masstotal;         // colloid mass, constant during a run
+
+  // packed sums, per bin: count, vx, |v_perp|, v_radial, pxx, pyz
+  double *accum;            // this proc, accumulated over the samples
+  double *accum_all;        // summed over procs at output
+  double *accum_thr;        // one histogram per thread, one sample
+  int nthreads;
+
+  void sample();
+  void output();
+
   int jgroup,jgroupbit;
-  
-  int print;
+
+  char *id_stress;          // internal compute stress/atom
+  class Compute *stress;
+
+  int print,binary_flag;
+  double *frame;            // binary output rows
   FILE * out;
 };
 
@@ -65,3 +68,25 @@ class FixCDF : public Fix {
 
 #endif
 #endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal fix cdf command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.
+
+E: Could not find fix cdf group ID
+
+Self-explanatory.
+
+E: Cannot open fix cdf file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+E: Stress ID for fix cdf does not exist
+
+The internal compute stress/atom of the fix was deleted.
+
+*/
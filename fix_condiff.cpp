@@ -14,6 +14,7 @@
 #include "error.h"
 #include "group.h"
 #include "update.h"
+#include "comm.h"
 #include "random_mars.h"
 #include "math_const.h"
 #include "math_special.h"
@@ -24,6 +25,7 @@ using namespace MathConst;
 using namespace MathSpecial;
 
 #define OFFSET 16384
+#define NCOMP 7        // grid components: velocity x,y,z, counter, force x,y,z
 #ifdef FFT_SINGLE
 #define ZEROF 0.0f
 #define ONEF 1.0f
@@ -41,20 +43,21 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
     if (narg < 4)
         error->all(FLERR, "Illegal fix condiff command"); //4 mandatory arguments
 
-    density_brick_velocity_x = NULL;
-    density_brick_velocity_y = NULL;
-    density_brick_velocity_z = NULL;
-
-    density_brick_force_x = NULL;
-    density_brick_force_y = NULL;
-    density_brick_force_z = NULL;
-
-    density_brick_counter_x = NULL;
+    density_brick = NULL;
+    slab_start = slab_atom = NULL;
+    nslab = maxslab_atom = 0;
 
     rand = NULL;
 
+    grid_allocated = 0;
+    ncalls_grid = 0;
+    gc_buf1 = gc_buf2 = NULL;
+    ngc_buf = 0;
+
     rho1d = rho_coeff = drho1d = drho_coeff = NULL;
     order = force->kspace->order;
+    if (order > ORDER_MAX)
+        error->all(FLERR, "Fix condiff does not support PPPM order > 7");
     minorder = 2;
     order_allocated = order;
 
@@ -118,13 +121,9 @@ FixCondiff::FixCondiff(LAMMPS* lmp, int narg, char** arg)
 FixCondiff::~FixCondiff()
 {
     deallocate();
-    memory->destroy(density_brick_velocity_x);
-    memory->destroy(density_brick_velocity_y);
-    memory->destroy(density_brick_velocity_z);
-    memory->destroy(density_brick_counter_x);
-    memory->destroy(density_brick_force_x);
-    memory->destroy(density_brick_force_y);
-    memory->destroy(density_brick_force_z);
+    memory->destroy(slab_atom);
+    memory->destroy(gc_buf1);
+    memory->destroy(gc_buf2);
     
     delete random;
 }
@@ -141,8 +140,14 @@ int FixCondiff::setmask()
 void FixCondiff::post_force(int vspace)
 {
     setup();
-    setup_grid();
+    if (grid_changed())
+        setup_grid();
     assign_vf();
+
+    // sum ghost contributions into owned cells, then refresh the ghosts
+    reverse_comm_grid();
+    forward_comm_grid();
+    invert_counter();
     reassign_vf();
 }
 
@@ -186,31 +191,221 @@ void FixCondiff::setup_grid()
     set_grid_local();
     allocate();
     compute_rho_coeff();
+    setup_ghost();
+
+    grid_allocated = 1;
+    ncalls_grid = neighbor->ncalls;
+    nx_grid = nx_pppm;
+    ny_grid = ny_pppm;
+    nz_grid = nz_pppm;
+    for (int d = 0; d < 3; d++) {
+        prd_grid[d] = domain->prd[d];
+        sublo_grid[d] = domain->sublo[d];
+        subhi_grid[d] = domain->subhi[d];
+    }
+}
+
+//check if the grid has to be rebuilt (first call, box or subdomain change)
+//the PPPM grid is the same on all procs, the box and the subdomains only
+//change with a changing box or when reneighboring (load balancing), so
+//only then the procs have to agree
+int FixCondiff::grid_changed()
+{
+    if (!grid_allocated)
+        return 1;
+    if (nx_grid != nx_pppm || ny_grid != ny_pppm || nz_grid != nz_pppm)
+        return 1;
+    if (!domain->box_change && neighbor->ncalls == ncalls_grid)
+        return 0;
+    ncalls_grid = neighbor->ncalls;
+
+    int flag = 0;
+    for (int d = 0; d < 3; d++)
+        if (prd_grid[d] != domain->prd[d] || sublo_grid[d] != domain->sublo[d]
+            || subhi_grid[d] != domain->subhi[d])
+            flag = 1;
+
+    // all procs have to rebuild together, setup_ghost() communicates
+    int flag_all;
+    MPI_Allreduce(&flag, &flag_all, 1, MPI_INT, MPI_MAX, world);
+    return flag_all;
+}
+
+//setup_ghost() exchanges the ghost extents with the neighbor procs
+//ghost planes of the lower/upper neighbor must lie in my owned brick
+void FixCondiff::setup_ghost()
+{
+    int lo_in[3] = { nxlo_in, nylo_in, nzlo_in };
+    int hi_in[3] = { nxhi_in, nyhi_in, nzhi_in };
+    int lo_out[3] = { nxlo_out, nylo_out, nzlo_out };
+    int hi_out[3] = { nxhi_out, nyhi_out, nzhi_out };
+
+    int flag = 0;
+    int maxghost = 0;
+    for (int d = 0; d < 3; d++) {
+        nghost_lo[d] = lo_in[d] - lo_out[d];
+        nghost_hi[d] = hi_out[d] - hi_in[d];
+        MPI_Sendrecv(&nghost_lo[d], 1, MPI_INT, comm->procneigh[d][0], 0,
+            &nghost_lo_up[d], 1, MPI_INT, comm->procneigh[d][1], 0, world, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(&nghost_hi[d], 1, MPI_INT, comm->procneigh[d][1], 0,
+            &nghost_hi_down[d], 1, MPI_INT, comm->procneigh[d][0], 0, world, MPI_STATUS_IGNORE);
+        if (nghost_lo_up[d] > hi_in[d] - lo_in[d] + 1 || nghost_hi_down[d] > hi_in[d] - lo_in[d] + 1)
+            flag = 1;
+        maxghost = MAX(maxghost, MAX(nghost_lo[d], nghost_hi[d]));
+        maxghost = MAX(maxghost, MAX(nghost_lo_up[d], nghost_hi_down[d]));
+    }
+
+    int flag_all;
+    MPI_Allreduce(&flag, &flag_all, 1, MPI_INT, MPI_MAX, world);
+    if (flag_all)
+        error->all(FLERR, "Fix condiff grid stencil extends beyond nearest neighbor processor");
+
+    // largest slab of one swap, for all NCOMP components
+    int nx = hi_out[0] - lo_out[0] + 1;
+    int ny = hi_out[1] - lo_out[1] + 1;
+    int nz = hi_out[2] - lo_out[2] + 1;
+    int nplane = MAX(nx * ny, MAX(ny * nz, nx * nz));
+    int n = NCOMP * maxghost * nplane;
+    if (n > ngc_buf) {
+        ngc_buf = n;
+        memory->destroy(gc_buf1);
+        memory->destroy(gc_buf2);
+        memory->create(gc_buf1, ngc_buf, "condiff:gc_buf1");
+        memory->create(gc_buf2, ngc_buf, "condiff:gc_buf2");
+    }
+}
+
+//pack a sub-brick of all grid quantities into buf
+int FixCondiff::pack_grid(FFT_SCALAR* buf, int xlo, int xhi, int ylo, int yhi,
+    int zlo, int zhi)
+{
+    int n = 0;
+    for (int iz = zlo; iz <= zhi; iz++)
+        for (int iy = ylo; iy <= yhi; iy++)
+            for (int ix = NCOMP * xlo; ix < NCOMP * (xhi + 1); ix++)
+                buf[n++] = density_brick[iz][iy][ix];
+    return n;
+}
+
+//unpack a sub-brick of all grid quantities, either add (reverse) or copy (forward)
+void FixCondiff::unpack_grid(FFT_SCALAR* buf, int xlo, int xhi, int ylo, int yhi,
+    int zlo, int zhi, int sumflag)
+{
+    int n = 0;
+    for (int iz = zlo; iz <= zhi; iz++)
+        for (int iy = ylo; iy <= yhi; iy++)
+            for (int ix = NCOMP * xlo; ix < NCOMP * (xhi + 1); ix++) {
+                if (sumflag)
+                    density_brick[iz][iy][ix] += buf[n++];
+                else
+                    density_brick[iz][iy][ix] = buf[n++];
+            }
+}
+
+//forward_comm_grid() copies owned cells into the ghost cells of the neighbors
+//swaps in x,y,z: dims already swapped include their ghosts, later dims do not
+void FixCondiff::forward_comm_grid()
+{
+    int lo_in[3] = { nxlo_in, nylo_in, nzlo_in };
+    int hi_in[3] = { nxhi_in, nyhi_in, nzhi_in };
+    int lo_out[3] = { nxlo_out, nylo_out, nzlo_out };
+    int hi_out[3] = { nxhi_out, nyhi_out, nzhi_out };
+    int slo[3], shi[3], rlo[3], rhi[3];
+
+    for (int d = 0; d < 3; d++) {
+        for (int dir = 0; dir < 2; dir++) {
+            for (int e = 0; e < 3; e++) {
+                slo[e] = rlo[e] = (e < d) ? lo_out[e] : lo_in[e];
+                shi[e] = rhi[e] = (e < d) ? hi_out[e] : hi_in[e];
+            }
+            int procsend, procrecv;
+            if (dir == 0) {
+                // my upper owned planes fill the lower ghosts of the upper proc
+                procsend = comm->procneigh[d][1];
+                procrecv = comm->procneigh[d][0];
+                slo[d] = hi_in[d] - nghost_lo_up[d] + 1;
+                shi[d] = hi_in[d];
+                rlo[d] = lo_out[d];
+                rhi[d] = lo_in[d] - 1;
+            }
+            else {
+                procsend = comm->procneigh[d][0];
+                procrecv = comm->procneigh[d][1];
+                slo[d] = lo_in[d];
+                shi[d] = lo_in[d] + nghost_hi_down[d] - 1;
+                rlo[d] = hi_in[d] + 1;
+                rhi[d] = hi_out[d];
+            }
+
+            int nsend = pack_grid(gc_buf1, slo[0], shi[0], slo[1], shi[1], slo[2], shi[2]);
+            int nrecv = NCOMP * (rhi[0] - rlo[0] + 1) * (rhi[1] - rlo[1] + 1) * (rhi[2] - rlo[2] + 1);
+            if (procsend != me)
+                MPI_Sendrecv(gc_buf1, nsend, MPI_FFT_SCALAR, procsend, 0,
+                    gc_buf2, nrecv, MPI_FFT_SCALAR, procrecv, 0, world, MPI_STATUS_IGNORE);
+            else
+                memcpy(gc_buf2, gc_buf1, nsend * sizeof(FFT_SCALAR));
+            unpack_grid(gc_buf2, rlo[0], rhi[0], rlo[1], rhi[1], rlo[2], rhi[2], 0);
+        }
+    }
+}
+
+//reverse_comm_grid() sums the ghost cells into the owned cells of the neighbors
+//swaps in z,y,x, the reverse of forward_comm_grid()
+void FixCondiff::reverse_comm_grid()
+{
+    int lo_in[3] = { nxlo_in, nylo_in, nzlo_in };
+    int hi_in[3] = { nxhi_in, nyhi_in, nzhi_in };
+    int lo_out[3] = { nxlo_out, nylo_out, nzlo_out };
+    int hi_out[3] = { nxhi_out, nyhi_out, nzhi_out };
+    int slo[3], shi[3], rlo[3], rhi[3];
+
+    for (int d = 2; d >= 0; d--) {
+        for (int dir = 0; dir < 2; dir++) {
+            for (int e = 0; e < 3; e++) {
+                slo[e] = rlo[e] = (e < d) ? lo_out[e] : lo_in[e];
+                shi[e] = rhi[e] = (e < d) ? hi_out[e] : hi_in[e];
+            }
+            int procsend, procrecv;
+            if (dir == 0) {
+                // my lower ghosts are added to the upper owned planes of the lower proc
+                procsend = comm->procneigh[d][0];
+                procrecv = comm->procneigh[d][1];
+                slo[d] = lo_out[d];
+                shi[d] = lo_in[d] - 1;
+                rlo[d] = hi_in[d] - nghost_lo_up[d] + 1;
+                rhi[d] = hi_in[d];
+            }
+            else {
+                procsend = comm->procneigh[d][1];
+                procrecv = comm->procneigh[d][0];
+                slo[d] = hi_in[d] + 1;
+                shi[d] = hi_out[d];
+                rlo[d] = lo_in[d];
+                rhi[d] = lo_in[d] + nghost_hi_down[d] - 1;
+            }
+
+            int nsend = pack_grid(gc_buf1, slo[0], shi[0], slo[1], shi[1], slo[2], shi[2]);
+            int nrecv = NCOMP * (rhi[0] - rlo[0] + 1) * (rhi[1] - rlo[1] + 1) * (rhi[2] - rlo[2] + 1);
+            if (procsend != me)
+                MPI_Sendrecv(gc_buf1, nsend, MPI_FFT_SCALAR, procsend, 0,
+                    gc_buf2, nrecv, MPI_FFT_SCALAR, procrecv, 0, world, MPI_STATUS_IGNORE);
+            else
+                memcpy(gc_buf2, gc_buf1, nsend * sizeof(FFT_SCALAR));
+            unpack_grid(gc_buf2, rlo[0], rhi[0], rlo[1], rhi[1], rlo[2], rhi[2], 1);
+        }
+    }
 }
 
 void FixCondiff::assign_vf()
 {
-    int l, m, n, nx, ny, nz, mx, my, mz;
-    FFT_SCALAR dx, dy, dz, x0, y0, z0;
+    int i, l, m, n, nx, ny, nz, my, mz;
 
     //Clear 3d density array
 
-    memset(&(density_brick_velocity_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_velocity_y[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_velocity_z[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_y[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_force_z[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-    memset(&(density_brick_counter_x[nzlo_out][nylo_out][nxlo_out]), 0,
-        ngrid * sizeof(FFT_SCALAR));
-
-    //Loop over my velocities, add their contribution to nearby grid points
+    memset(&(density_brick[nzlo_out][nylo_out][NCOMP * nxlo_out]), 0,
+        NCOMP * ngrid * sizeof(FFT_SCALAR));
+
+    //Loop over my velocities and forces, add their contribution to nearby grid points
     //(nx,ny,nz) = global coords of grid pt to "lower left" of charge
     //(dx,dy,dz) = distance to "lower left" grid pt
     //(mx,my,mz) = global coords of moving stencil pt
@@ -220,187 +415,173 @@ void FixCondiff::assign_vf()
     double** f = atom->f;
     int nlocal = atom->nlocal;
     int* mask = atom->mask;
-        int* tag = atom->tag;
-
-
-	double *force_tot = new double[3];
-	force_tot[0] = 0.0;
-	force_tot[1] = 0.0;
-	force_tot[2] = 0.0;
-	
-	double *force_tot2 = new double[3];
-	force_tot2[0] = 0.0;
-	force_tot2[1] = 0.0;
-	force_tot2[2] = 0.0;
-	
-    for (int i = 0; i < nlocal; i++) {
+    int bits = groupbit | groupbit_condiff;
 
-        //Take velocity of dpd-particles and map them on grid
-        if (mask[i] & groupbit) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
+    //Sort the mapped particles into z-slabs of order grid planes
+    //stencils of particles in slabs of the same parity never overlap,
+    //so each color is scattered by the threads without atomics
+
+    if (atom->nmax > maxslab_atom) {
+        maxslab_atom = atom->nmax;
+        memory->destroy(slab_atom);
+        memory->create(slab_atom, maxslab_atom, "condiff:slab_atom");
+    }
+    for (i = 0; i <= nslab; i++)
+        slab_start[i] = 0;
+    for (i = 0; i < nlocal; i++) {
+        if (mask[i] & bits) {
             nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            z0 = delvolinv;
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                y0 = z0 * rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    x0 = y0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        density_brick_velocity_x[mz][my][mx] += x0 * rho1d[0][l] * v[i][0];
-                        density_brick_velocity_y[mz][my][mx] += x0 * rho1d[0][l] * v[i][1];
-                        density_brick_velocity_z[mz][my][mx] += x0 * rho1d[0][l] * v[i][2];
-                        density_brick_counter_x[mz][my][mx] += x0 * rho1d[0][l];
-                    }
-                }
-            }
+            slab_start[(nz - nzlo_out) / order + 1]++;
         }
-
-        //Take force of condiff-particles and map them on grid
-        if (mask[i] & groupbit_condiff) {
-	  force_tot[0] += f[i][0];
-	  force_tot[1] += f[i][1];
-	  force_tot[2] += f[i][2];
-	  //printf("force_tot_q %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
+    }
+    for (i = 0; i < nslab; i++)
+        slab_start[i + 1] += slab_start[i];
+    for (i = 0; i < nlocal; i++) {
+        if (mask[i] & bits) {
             nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            z0 = delvolinv;
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                y0 = z0 * rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    x0 = y0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        density_brick_force_x[mz][my][mx] += x0 * rho1d[0][l] * f[i][0];
-                        density_brick_force_y[mz][my][mx] += x0 * rho1d[0][l] * f[i][1];
-                        density_brick_force_z[mz][my][mx] += x0 * rho1d[0][l] * f[i][2];
-			force_tot2[0] +=  x0 * rho1d[0][l] * f[i][0];
-			force_tot2[1] += x0 * rho1d[0][l] * f[i][1];
-			force_tot2[2] += x0 * rho1d[0][l] * f[i][2];
+            slab_atom[slab_start[(nz - nzlo_out) / order]++] = i;
+        }
+    }
+    for (i = nslab; i > 0; i--)
+        slab_start[i] = slab_start[i - 1];
+    slab_start[0] = 0;
+
+    for (int color = 0; color < 2; color++) {
+#if defined(_OPENMP)
+#pragma omp parallel for private(i, l, m, n, nx, ny, nz, my, mz) default(none) shared(v, x, f, mask, color) schedule(dynamic)
+#endif
+        for (int islab = color; islab < nslab; islab += 2) {
+            FFT_SCALAR r1d[3][ORDER_MAX];
+            FFT_SCALAR dx, dy, dz, x0, y0, z0, w;
+            for (int ii = slab_start[islab]; ii < slab_start[islab + 1]; ii++) {
+                i = slab_atom[ii];
+                nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
+                ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
+                nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
+                dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
+                dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
+                dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
+
+                compute_rho1d_thr(r1d, dx, dy, dz);
+
+                //Take velocity of dpd-particles and force of condiff-particles in one sweep
+                FFT_SCALAR val[NCOMP];
+                for (int c = 0; c < NCOMP; c++)
+                    val[c] = ZEROF;
+                if (mask[i] & groupbit) {
+                    val[0] = v[i][0];
+                    val[1] = v[i][1];
+                    val[2] = v[i][2];
+                    val[3] = ONEF;
+                }
+                if (mask[i] & groupbit_condiff) {
+                    val[4] = f[i][0];
+                    val[5] = f[i][1];
+                    val[6] = f[i][2];
+                }
+
+                z0 = delvolinv;
+                for (n = 0; n < order; n++) {
+                    mz = n + nlower + nz;
+                    y0 = z0 * r1d[2][n];
+                    for (m = 0; m < order; m++) {
+                        my = m + nlower + ny;
+                        x0 = y0 * r1d[1][m];
+                        FFT_SCALAR* g = &density_brick[mz][my][NCOMP * (nlower + nx)];
+                        for (l = 0; l < order; l++) {
+                            w = x0 * r1d[0][l];
+                            for (int c = 0; c < NCOMP; c++)
+                                g[NCOMP * l + c] += w * val[c];
+                        }
                     }
                 }
             }
         }
     }
+}
 
-    //printf("force_tot_q %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-    //printf("force_tot_m %f %f %f \n",force_tot2[0],force_tot2[1],force_tot2[2]);
-    
-    delete [] force_tot;
-    delete [] force_tot2;
+//replace the counter of all grid points (incl. ghosts) by its inverse
+//cutoff to prohibit float errors in the normalization, empty points get 0
+void FixCondiff::invert_counter()
+{
+    FFT_SCALAR* g = &density_brick[nzlo_out][nylo_out][NCOMP * nxlo_out];
+    for (int i = 0; i < ngrid; i++) {
+        FFT_SCALAR c = g[NCOMP * i + 3];
+        if (c * c >= 0.0000000000000001)
+            g[NCOMP * i + 3] = ONEF / c;
+        else
+            g[NCOMP * i + 3] = ZEROF;
+    }
 }
 
 void FixCondiff::reassign_vf()
 {
-  double *force_tot = new double[3];
-	force_tot[0] = 0.0;
-	force_tot[1] = 0.0;
-	force_tot[2] = 0.0;
-
-    int l, m, n, nx, ny, nz, mx, my, mz;
-    FFT_SCALAR dx, dy, dz, x0, y0, z0;
+    int i, l, m, n, nx, ny, nz, my, mz;
 
     double** v = atom->v;
     double** x = atom->x;
     double** f = atom->f;
     int nlocal = atom->nlocal;
     int* mask = atom->mask;
-    int* tag = atom->tag;
+    int bits = groupbit | groupbit_condiff;
 
-    for (int i = 0; i < nlocal; i++) {
+    //Remap velocities on condiff-particles (pseudo-ions) and
+    //assign (normalized) force of pseudo-ions to dpd-particles
+    //grid is only read, so particles are split over the threads directly
 
-        //Remap velocities on condiff-particles (pseudo-ions)
-        if (mask[i] & groupbit_condiff) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            v[i][0] = 0;
-            v[i][1] = 0;
-            v[i][2] = 0;
-
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                z0 = rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    y0 = z0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        x0 = y0 * rho1d[0][l];
-			// cutoff to prohibit float errors in the normalization
-                        if (density_brick_counter_x[mz][my][mx]*density_brick_counter_x[mz][my][mx]>=0.0000000000000001) { 
-                          v[i][0] += (density_brick_velocity_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                          v[i][1] += (density_brick_velocity_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                          v[i][2] += (density_brick_velocity_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx]);
-                        } else {
-			  if (density_brick_force_x[mz][my][mx]*density_brick_force_x[mz][my][mx] >= 0.000001 || density_brick_force_y[mz][my][mx]*density_brick_force_y[mz][my][mx] >= 0.000001 || density_brick_force_z[mz][my][mx]*density_brick_force_z[mz][my][mx] >= 0.000001) {
-			    //printf("Empty grid-point (%d %d %d) lost force (%f %f %f) in fix/condiff -> will break momentum conservation\n",mz,my,mx,density_brick_force_x[mz][my][mx] ,density_brick_force_y[mz][my][mx] ,density_brick_force_z[mz][my][mx]);
-			  }
-			}
-                    }
+#if defined(_OPENMP)
+#pragma omp parallel for private(i, l, m, n, nx, ny, nz, my, mz) default(none) shared(v, x, f, mask, nlocal, bits) schedule(static)
+#endif
+    for (i = 0; i < nlocal; i++) {
+        if (!(mask[i] & bits))
+            continue;
+
+        FFT_SCALAR r1d[3][ORDER_MAX];
+        FFT_SCALAR dx, dy, dz, y0, z0;
+        nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
+        ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
+        nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
+        dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
+        dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
+        dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
+
+        compute_rho1d_thr(r1d, dx, dy, dz);
+
+        FFT_SCALAR vsum0 = ZEROF, vsum1 = ZEROF, vsum2 = ZEROF;
+        FFT_SCALAR fsum0 = ZEROF, fsum1 = ZEROF, fsum2 = ZEROF;
+        for (n = 0; n < order; n++) {
+            mz = n + nlower + nz;
+            z0 = r1d[2][n];
+            for (m = 0; m < order; m++) {
+                my = m + nlower + ny;
+                y0 = z0 * r1d[1][m];
+                const FFT_SCALAR* g = &density_brick[mz][my][NCOMP * (nlower + nx)];
+#if defined(_OPENMP)
+#pragma omp simd reduction(+ : vsum0, vsum1, vsum2, fsum0, fsum1, fsum2)
+#endif
+                for (l = 0; l < order; l++) {
+                    const FFT_SCALAR x0 = y0 * r1d[0][l] * g[NCOMP * l + 3];
+                    vsum0 += g[NCOMP * l] * x0;
+                    vsum1 += g[NCOMP * l + 1] * x0;
+                    vsum2 += g[NCOMP * l + 2] * x0;
+                    fsum0 += g[NCOMP * l + 4] * x0;
+                    fsum1 += g[NCOMP * l + 5] * x0;
+                    fsum2 += g[NCOMP * l + 6] * x0;
                 }
             }
         }
 
-        //Assign (normalized) force of pseudo-ions to dpd-particles
+        if (mask[i] & groupbit_condiff) {
+            v[i][0] = vsum0;
+            v[i][1] = vsum1;
+            v[i][2] = vsum2;
+        }
         if (mask[i] & groupbit) {
-            nx = static_cast<int>((x[i][0] - boxlo[0]) * delxinv + shift) - OFFSET;
-            ny = static_cast<int>((x[i][1] - boxlo[1]) * delyinv + shift) - OFFSET;
-            nz = static_cast<int>((x[i][2] - boxlo[2]) * delzinv + shift) - OFFSET;
-            dx = nx + shiftone - (x[i][0] - boxlo[0]) * delxinv;
-            dy = ny + shiftone - (x[i][1] - boxlo[1]) * delyinv;
-            dz = nz + shiftone - (x[i][2] - boxlo[2]) * delzinv;
-
-            compute_rho1d(dx, dy, dz);
-
-            for (n = nlower; n <= nupper; n++) {
-                mz = n + nz;
-                z0 = rho1d[2][n];
-                for (m = nlower; m <= nupper; m++) {
-                    my = m + ny;
-                    y0 = z0 * rho1d[1][m];
-                    for (l = nlower; l <= nupper; l++) {
-                        mx = l + nx;
-                        x0 = y0 * rho1d[0][l];
-                        if (density_brick_counter_x[mz][my][mx]*density_brick_counter_x[mz][my][mx]>=0.0000000000000001) { 
-                            f[i][0] += density_brick_force_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-                            f[i][1] += density_brick_force_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-                            f[i][2] += density_brick_force_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[0] += density_brick_force_x[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[1] += density_brick_force_y[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    force_tot[2] += density_brick_force_z[mz][my][mx] * x0 / density_brick_counter_x[mz][my][mx];
-			    //printf("force_tot_s %d %f %f %f %f\n",i,force_tot[0],force_tot[1],force_tot[2],density_brick_counter_x[mz][my][mx]);
-			}
-                    }
-                }
-            }
+            f[i][0] += fsum0;
+            f[i][1] += fsum1;
+            f[i][2] += fsum2;
         }
     }
-        //printf("force_tot_s %f %f %f \n",force_tot[0],force_tot[1],force_tot[2]);
-        delete [] force_tot;
 }
 
 void FixCondiff::euler_step()
@@ -449,6 +630,27 @@ void FixCondiff::compute_rho1d(const FFT_SCALAR& dx, const FFT_SCALAR& dy,
     }
 }
 
+//same as compute_rho1d() but into a caller owned array, index k-nlower
+void FixCondiff::compute_rho1d_thr(FFT_SCALAR (*r1d)[ORDER_MAX], const FFT_SCALAR& dx,
+    const FFT_SCALAR& dy, const FFT_SCALAR& dz) const
+{
+    int k, l;
+    FFT_SCALAR r1, r2, r3;
+
+    for (k = (1 - order) / 2; k <= order / 2; k++) {
+        r1 = r2 = r3 = ZEROF;
+
+        for (l = order - 1; l >= 0; l--) {
+            r1 = rho_coeff[l][k] + r1 * dx;
+            r2 = rho_coeff[l][k] + r2 * dy;
+            r3 = rho_coeff[l][k] + r3 * dz;
+        }
+        r1d[0][k - nlower] = r1;
+        r1d[1][k - nlower] = r2;
+        r1d[2][k - nlower] = r3;
+    }
+}
+
 //compute_rho_coeff framework taken from pppm.cpp
 void FixCondiff::compute_rho_coeff()
 {
@@ -604,15 +806,8 @@ void FixCondiff::set_grid_local()
 //deallocate() framework taken from pppm.cpp
 void FixCondiff::deallocate()
 {
-    memory->destroy3d_offset(density_brick_velocity_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_counter_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_force_x, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_velocity_y, nzlo_out, nylo_out, nxlo_out);
-
-    memory->destroy3d_offset(density_brick_force_y, nzlo_out, nylo_out, nxlo_out);
-    memory->destroy3d_offset(density_brick_velocity_z, nzlo_out, nylo_out, nxlo_out);
-
-    memory->destroy3d_offset(density_brick_force_z, nzlo_out, nylo_out, nxlo_out);
+    memory->destroy3d_offset(density_brick, nzlo_out, nylo_out, NCOMP * nxlo_out);
+    memory->destroy(slab_start);
 
     memory->destroy2d_offset(rho1d, -order_allocated / 2);
     memory->destroy2d_offset(drho1d, -order_allocated / 2);
@@ -625,22 +820,14 @@ void FixCondiff::deallocate()
 //allocate() framework taken from pppm.cpp
 void FixCondiff::allocate()
 {
-    memory->create3d_offset(density_brick_velocity_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_x");
-    memory->create3d_offset(density_brick_counter_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_counter_x");
-    memory->create3d_offset(density_brick_force_x, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_x");
-    memory->create3d_offset(density_brick_velocity_y, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_y");
-
-    memory->create3d_offset(density_brick_force_y, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_y");
-    memory->create3d_offset(density_brick_velocity_z, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_velocity_z");
-
-    memory->create3d_offset(density_brick_force_z, nzlo_out, nzhi_out, nylo_out, nyhi_out,
-        nxlo_out, nxhi_out, "condiff:density_brick_force_z");
+    // one interleaved brick, grid point (iz,iy,ix) holds its NCOMP values
+    // at density_brick[iz][iy][NCOMP*ix+c]
+    memory->create3d_offset(density_brick, nzlo_out, nzhi_out, nylo_out, nyhi_out,
+        NCOMP * nxlo_out, NCOMP * nxhi_out + NCOMP - 1, "condiff:density_brick");
+
+    // z-slabs of order planes for the colored particle-to-grid assignment
+    nslab = (nzhi_out - nzlo_out + 1 + order - 1) / order;
+    memory->create(slab_start, nslab + 1, "condiff:slab_start");
 
     order_allocated = order;
     memory->create2d_offset(rho1d, 3, -order / 2, order / 2, "condiff:rho1d");
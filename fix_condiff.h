@@ -27,6 +27,8 @@ typedef double FFT_SCALAR;
 
 #include "fix.h"
 
+#define ORDER_MAX 7    // largest PPPM order, size of the per-thread stencil weights
+
 namespace LAMMPS_NS {
 
 class FixCondiff : public Fix {
@@ -49,19 +51,27 @@ protected:
     void allocate();
     void compute_rho1d(const FFT_SCALAR&, const FFT_SCALAR&,
         const FFT_SCALAR&);
+    void compute_rho1d_thr(FFT_SCALAR (*)[ORDER_MAX], const FFT_SCALAR&,
+        const FFT_SCALAR&, const FFT_SCALAR&) const;
+    void invert_counter();
     void compute_rho_coeff();
     void compute_drho1d(const FFT_SCALAR&, const FFT_SCALAR&, const FFT_SCALAR&);
     void set_grid_local();
     void setup_grid();
+    int grid_changed();
+    void setup_ghost();
+    void forward_comm_grid();
+    void reverse_comm_grid();
+    int pack_grid(FFT_SCALAR*, int, int, int, int, int, int);
+    void unpack_grid(FFT_SCALAR*, int, int, int, int, int, int, int);
 
-    FFT_SCALAR*** density_brick_velocity_x;
-    FFT_SCALAR*** density_brick_velocity_y;
-    FFT_SCALAR*** density_brick_velocity_z;
-    FFT_SCALAR*** density_brick_counter_x;
+    // velocity x,y,z, counter (inverse after invert_counter()), force x,y,z
+    // interleaved per grid point
+    FFT_SCALAR*** density_brick;
 
-    FFT_SCALAR*** density_brick_force_x;
-    FFT_SCALAR*** density_brick_force_y;
-    FFT_SCALAR*** density_brick_force_z;
+    // particles sorted into z-slabs for the colored threaded assignment
+    int nslab, maxslab_atom;
+    int *slab_start, *slab_atom;
 
     double* rand;
 
@@ -95,6 +105,18 @@ protected:
     int nxlo_out, nylo_out, nzlo_out, nxhi_out, nyhi_out, nzhi_out;
     int ngrid;
 
+    // grid is only rebuilt if box, subdomain or PPPM grid changes
+    int grid_allocated;
+    int nx_grid, ny_grid, nz_grid;
+    double prd_grid[3], sublo_grid[3], subhi_grid[3];
+    int ncalls_grid; // neighbor list builds when the grid was last checked
+
+    // halo exchange, ghost planes of this proc and of its neighbors per dim
+    int nghost_lo[3], nghost_hi[3];
+    int nghost_lo_up[3], nghost_hi_down[3];
+    FFT_SCALAR *gc_buf1, *gc_buf2;
+    int ngc_buf;
+
     class RanMars* random;
 
     int nmax;
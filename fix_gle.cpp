@@ -39,12 +39,14 @@
 #include "memory.h"
 #include "error.h"
 #include "group.h"
+#include "compute_memory_volterra.h"
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
 enum{NOBIAS,BIAS};
 enum{CONSTANT,EQUAL,ATOM};
+enum{FULL,COMPACT};
 
 /* ---------------------------------------------------------------------- */
 
@@ -72,23 +74,32 @@ FixGLE::FixGLE(LAMMPS *lmp, int narg, char **arg) :
   mem_file = fopen(arg[5],"r");
   mem_kernel = new double[mem_count];
   read_mem_file();
-  mem_kernel[0]/=2;
-  for (int i=0; i<mem_count; i++) {
-    mem_kernel[i]*=update->dt;
-  }
   
   seed = utils::inumeric(FLERR,arg[7],false,lmp);
   
   // optional parameter
-  int restart = 0;
+  restart_flag = 0;
+  checkpoint = FULL;
   int iarg = 8;
   force_flag = 1;
   while (iarg < narg) {
     if (strcmp(arg[iarg],"restart") == 0) {
-      restart = 1;
+      restart_flag = 1;
       iarg += 1;
-    }
+    } else if (strcmp(arg[iarg],"checkpoint") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix gle command");
+      if (strcmp(arg[iarg+1],"full") == 0) checkpoint = FULL;
+      else if (strcmp(arg[iarg+1],"compact") == 0) checkpoint = COMPACT;
+      else error->all(FLERR,"Illegal fix gle command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix gle command");
   }
+
+  // position and noise histories go into restart files
+
+  restart_global = 1;
+  restart_peratom = 1;
+  history_flag = 0;
   
   if (seed <= 0) error->all(FLERR,"Illegal fix langevin command");
   
@@ -96,34 +107,34 @@ FixGLE::FixGLE(LAMMPS *lmp, int narg, char **arg) :
   random = new RanMars(lmp,seed + comm->me);
   precision = 0.000002;
   
-  mem_kernel[0]*=2;
-  for (int i=0; i<mem_count; i++) {
-    mem_kernel[i]*=update->dt;
-  }
-  random_correlator = new RanCor(lmp,mem_count, mem_kernel, precision);
-  mem_kernel[0]/=2;
-  for (int i=0; i<mem_count; i++) {
-    mem_kernel[i]/=update->dt;
-  }
+  random_correlator = NULL;
+  init_kernel();
+
+  // no online kernel update until requested by fix_modify
+  id_kernel = NULL;
+  kernel_compute = NULL;
+  kernel_every = 0;
+  kernel_mix = 1.0;
     
   // allocate and init per-atom arrays (velocity and normal random number)
   
+  // all per-atom arrays are indexed by local atom and migrate with it
+
   save_position = NULL;
   save_random = NULL;
-  //DEPRECATED: Might need to be updated
-  //comm->maxexchange_fix += 9*mem_count;
+  array = NULL;
+  save_full = NULL;
+  save_update = NULL;
   grow_arrays(atom->nmax);
-  //atom->add_callback(0);
+  atom->add_callback(0);
+  atom->add_callback(1);
+  maxexchange = 9*mem_count + 12;
   
   
   lastindex_p = firstindex_r  = 0;
   int nlocal= atom->nlocal, n,d,m;
   nmax = atom->nmax;
 
-  //memory for force save
-  memory->create(array,nmax,12,"fix_gle:array");
-  array_atom = array;
-  
   // initialize array to zero
   for (int i = 0; i < nlocal; i++)
     for (int k = 0; k < 12; k++) array[i][k] = 0.0;
@@ -132,17 +143,10 @@ FixGLE::FixGLE(LAMMPS *lmp, int narg, char **arg) :
   for (int i = 0; i < nlocal; i++)
     for (int k = 0; k < 3; k++) fran_old[i][k] = 0.0;
     
-  int *type = atom->type;
-  double *mass = atom->mass;
-  gjffac = 1.0/(1.0+mem_kernel[0]*update->dt/2.0/mass[type[0]]);
-  gjffac2 = (1.0-mem_kernel[0]*update->dt/2.0/mass[type[0]])*gjffac; 
-  
   printf("integration: int_a %f, int_b %f mem %f\n",gjffac2,gjffac,mem_kernel[0]);
   
   updates_full = 0;
-  memory->create(save_full,nmax,3,"fix/gle:save_full");
   updates_update = 0;
-  memory->create(save_update,nmax,3,"fix/gle:save_update");
 
 }
 
@@ -153,14 +157,18 @@ FixGLE::~FixGLE()
   printf("updates_full: %d\n",updates_full);
   printf("updates_update: %d\n",updates_update);
 
-  //atom->delete_callback(id,0);
+  atom->delete_callback(id,0);
+  atom->delete_callback(id,1);
   delete random;
   delete random_correlator;
   delete [] mem_kernel;
+  delete [] id_kernel;
   delete [] fran_old;
   memory->destroy(save_random);
   memory->destroy(save_position);
   memory->destroy(array);
+  memory->destroy(save_full);
+  memory->destroy(save_update);
 
 }
 
@@ -171,6 +179,7 @@ int FixGLE::setmask()
   int mask = 0;
   mask |= INITIAL_INTEGRATE;
   mask |= FINAL_INTEGRATE;
+  mask |= END_OF_STEP;
   return mask;
 }
 
@@ -203,12 +212,76 @@ void FixGLE::read_mem_file()
   }
 }
 
+/* ----------------------------------------------------------------------
+   mem_kernel holds the kernel in units of the mem_file
+   correlate the noise with it, the RanCor corrects mem_kernel in place to
+   fullfill the FDT, afterwards it is stored as used by the integrator
+------------------------------------------------------------------------- */
+
+void FixGLE::init_kernel()
+{
+  for (int i=0; i<mem_count; i++) {
+    mem_kernel[i]*=update->dt;
+    mem_kernel[i]*=update->dt;
+  }
+  delete random_correlator;
+  random_correlator = new RanCor(lmp,mem_count, mem_kernel, precision);
+  mem_kernel[0]/=2;
+  for (int i=0; i<mem_count; i++) {
+    mem_kernel[i]/=update->dt;
+  }
+
+  int *type = atom->type;
+  double *mass = atom->mass;
+  gjffac = 1.0/(1.0+mem_kernel[0]*update->dt/2.0/mass[type[0]]);
+  gjffac2 = (1.0-mem_kernel[0]*update->dt/2.0/mass[type[0]])*gjffac; 
+}
+
+/* ----------------------------------------------------------------------
+   pull a new kernel from compute memory/volterra and mix it into the
+   current FDT-corrected kernel: K = (1-mix)*K_old + mix*K_new
+   the isotropic part (xx,yy,zz = columns 0,3,5 of the symmetric
+   xx,xy,xz,yy,yz,zz layout) is interpolated onto the timestep
+------------------------------------------------------------------------- */
+
+void FixGLE::update_kernel()
+{
+  int i,m,dim;
+  double t,frac,knew,kold;
+
+  kernel_compute->compute_array();
+  double **karray = kernel_compute->array;
+  int nrows = kernel_compute->size_array_rows;
+  int nevery_k = *((int *) kernel_compute->extract("nevery",dim));
+
+  for (m=0; m<mem_count; m++) {
+    t = (double) m/nevery_k;
+    i = static_cast<int> (t);
+    frac = t - i;
+    knew = 0.0;
+    if (i < nrows)
+      knew = (1.0-frac)*(karray[i][0]+karray[i][3]+karray[i][5])/3.0;
+    if (i+1 < nrows)
+      knew += frac*(karray[i+1][0]+karray[i+1][3]+karray[i+1][5])/3.0;
+
+    kold = mem_kernel[m]/update->dt;
+    if (m == 0) kold *= 2;
+    mem_kernel[m] = (1.0-kernel_mix)*kold + kernel_mix*knew;
+  }
+
+  init_kernel();
+}
+
 /* ---------------------------------------------------------------------- */
 
 void FixGLE::init()
 {
-
-  
+  if (id_kernel) {
+    int icompute = modify->find_compute(id_kernel);
+    if (icompute < 0)
+      error->all(FLERR,"Could not find fix_modify kernel compute ID");
+    kernel_compute = (ComputeMemoryVolterra *) modify->compute[icompute];
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -220,36 +293,38 @@ void FixGLE::setup(int vflag)
 
   int nlocal= atom->nlocal, n,d,m;
   double **x = atom->x;
-      int itag;
   int *mask = atom->mask;
-   tagint *tag = atom->tag;
    
     imageint *image = atom->image;
   double unwrap[3];
 
-   
+
+  // start the histories at rest, unless they were read from a restart
+  // file or are left from a previous run
+
   for ( n=0; n<nlocal; n++ ){
-    int itag = tag[n]-1;
     domain->unmap(x[n],image[n],unwrap);
     for ( d=0; d<3; d++ ) {
-      for ( m=0; m<=mem_count; m++ ) {
-	save_position[itag][d*(mem_count+1)+m] = unwrap[d];
+      if (!history_flag) {
+        for ( m=0; m<=mem_count; m++ ) {
+	  save_position[n][d*(mem_count+1)+m] = unwrap[d];
+        }
+        for ( m=0; m<2*mem_count-1; m++ ) {
+	  save_random[n][d*(2*mem_count-1)+m] = random->gaussian();
+        }
       }
-      for ( m=0; m<2*mem_count-1; m++ ) {
-	save_random[itag][d*(2*mem_count-1)+m] = random->gaussian();
-      }
-      
-      array[itag][d]=f[n][d];
+
+      array[n][d]=f[n][d];
     }
   }
+  history_flag = 1;
       
 
   for ( n = 0; n < nlocal; n++) {
-    int itag = tag[n]-1;
     if (mask[n] & groupbit) {
       for (d = 0; d<3;d++) {
-	save_full[itag][d] = x[n][d];
-	save_update[itag][d] = x[n][d];
+	save_full[n][d] = x[n][d];
+	save_update[n][d] = x[n][d];
       }
     }
   }
@@ -268,25 +343,21 @@ void FixGLE::initial_integrate(int vflag)
   int *mask = atom->mask;
   int nlocal = atom->nlocal;
   double fdrag[3],fran[3];
-      tagint *tag = atom->tag;
-    int itag;
   
   // update random numbers
   for ( n=0; n<nlocal; n++ ) {
-    int itag = tag[n]-1;
     for ( d=0; d<3; d++ ) {
-      save_random[itag][d*(2*mem_count-1)+firstindex_r] = random->gaussian();
+      save_random[n][d*(2*mem_count-1)+firstindex_r] = random->gaussian();
     }
   }
 
   for ( n = 0; n < nlocal; n++) {
-    int itag = tag[n]-1;
     if (mask[n] & groupbit) {
 
       // calculate correlated noise 
-      fran[0] = array[itag][6] = random_correlator->gaussian(&save_random[itag][0],firstindex_r);
-      fran[1] = array[itag][7] = random_correlator->gaussian(&save_random[itag][2*mem_count-1],firstindex_r);
-      fran[2] = array[itag][8] = random_correlator->gaussian(&save_random[itag][4*mem_count-2],firstindex_r);
+      fran[0] = array[n][6] = random_correlator->gaussian(&save_random[n][0],firstindex_r);
+      fran[1] = array[n][7] = random_correlator->gaussian(&save_random[n][2*mem_count-1],firstindex_r);
+      fran[2] = array[n][8] = random_correlator->gaussian(&save_random[n][4*mem_count-2],firstindex_r);
       
       for (d = 0; d<3;d++) {
 	
@@ -296,19 +367,19 @@ void FixGLE::initial_integrate(int vflag)
 	if (tn < 0) tn = mem_count;
 	
 	for (m = 1; m<mem_count;m++) {
-	  fdrag[d]+=(save_position[itag][d*(mem_count+1)+tn1]-save_position[itag][d*(mem_count+1)+tn])*mem_kernel[m];
+	  fdrag[d]+=(save_position[n][d*(mem_count+1)+tn1]-save_position[n][d*(mem_count+1)+tn])*mem_kernel[m];
 	  tn1--;
 	  tn--;
 	  if (tn1 < 0) tn1 = mem_count;
 	  if (tn < 0) tn = mem_count;
 	}
 	
-	array[itag][3+d]=fdrag[d];
+	array[n][3+d]=fdrag[d];
 
 	x[n][d] += gjffac*update->dt*v[n][d] 
-	+ gjffac*update->dt*update->dt/2.0/mass[type[0]]*array[itag][d]
-	- gjffac*update->dt/2.0/mass[type[0]]*array[itag][d+3]
-	+ gjffac*update->dt/2.0/mass[type[0]]*array[itag][d+6];
+	+ gjffac*update->dt*update->dt/2.0/mass[type[0]]*array[n][d]
+	- gjffac*update->dt/2.0/mass[type[0]]*array[n][d+3]
+	+ gjffac*update->dt/2.0/mass[type[0]]*array[n][d+6];
 	
       }
       
@@ -384,22 +455,18 @@ void FixGLE::final_integrate()
   double *mass = atom->mass;
   int *mask = atom->mask;
   int nlocal = atom->nlocal;
-    tagint *tag = atom->tag;
-    int itag;
   
   // update positions numbers
     imageint *image = atom->image;
   double unwrap[3];
   for ( n=0; n<nlocal; n++ ) {
-    itag = tag[n]-1;
     domain->unmap(x[n],image[n],unwrap);
     for ( d=0; d<3; d++ ) {
-      save_position[itag][d*(mem_count+1)+lastindex_p] = unwrap[d]; 
+      save_position[n][d*(mem_count+1)+lastindex_p] = unwrap[d]; 
     }
   }
 
   for ( n = 0; n < nlocal; n++) {
-     itag = tag[n]-1;
     if (mask[n] & groupbit) {
       for (d = 0; d<3;d++) {
 	int tn = lastindex_p-1;
@@ -408,13 +475,13 @@ void FixGLE::final_integrate()
 	//printf("%d %f %f\n",n,v[n][d],f[n][d]);
 	
 	v[n][d] =  gjffac2*v[n][d] 
-	+ update->dt/2.0/mass[type[0]]*(gjffac2*array[itag][d]+f[n][d])
-	- gjffac/mass[type[0]]*array[itag][d+3]
-	+ gjffac/mass[type[0]]*array[itag][d+6];
+	+ update->dt/2.0/mass[type[0]]*(gjffac2*array[n][d]+f[n][d])
+	- gjffac/mass[type[0]]*array[n][d+3]
+	+ gjffac/mass[type[0]]*array[n][d+6];
 	
-	//	printf("%d %f %f %f\n",n,v[n][d],f[n][d],array[itag][d]);
+	//	printf("%d %f %f %f\n",n,v[n][d],f[n][d],array[n][d]);
 	
-	array[itag][d]=f[n][d];
+	array[n][d]=f[n][d];
 	//fran_old[n][d]=array[n][d+6];
 	
 	
@@ -436,6 +503,15 @@ void FixGLE::final_integrate()
   
 }
 
+/* ---------------------------------------------------------------------- */
+
+void FixGLE::end_of_step()
+{
+  if (kernel_compute == NULL) return;
+  if (update->ntimestep % kernel_every) return;
+  update_kernel();
+}
+
 /* ----------------------------------------------------------------------
    set current t_target and t_sqrt
 ------------------------------------------------------------------------- */
@@ -497,6 +573,31 @@ int FixGLE::modify_param(int narg, char **arg)
       error->warning(FLERR,"Group for fix_modify temp != fix group");
     return 2;
   }
+  if (strcmp(arg[0],"kernel") == 0) {
+    if (narg < 2) error->all(FLERR,"Illegal fix_modify command");
+    delete [] id_kernel;
+    id_kernel = NULL;
+    kernel_compute = NULL;
+    if (strcmp(arg[1],"none") == 0) return 2;
+
+    if (narg < 4 || strncmp(arg[1],"c_",2) != 0)
+      error->all(FLERR,"Illegal fix_modify command");
+    int n = strlen(&arg[1][2]) + 1;
+    id_kernel = new char[n];
+    strcpy(id_kernel,&arg[1][2]);
+    kernel_every = utils::inumeric(FLERR,arg[2],false,lmp);
+    kernel_mix = utils::numeric(FLERR,arg[3],false,lmp);
+    if (kernel_every <= 0 || kernel_mix <= 0.0 || kernel_mix > 1.0)
+      error->all(FLERR,"Illegal fix_modify command");
+
+    int icompute = modify->find_compute(id_kernel);
+    if (icompute < 0)
+      error->all(FLERR,"Could not find fix_modify kernel compute ID");
+    if (strcmp(modify->compute[icompute]->style,"memory/volterra") != 0)
+      error->all(FLERR,"Fix_modify kernel compute is not memory/volterra");
+    kernel_compute = (ComputeMemoryVolterra *) modify->compute[icompute];
+    return 4;
+  }
   return 0;
 }
 
@@ -517,6 +618,13 @@ void *FixGLE::extract(const char *str, int &dim)
   if (strcmp(str,"t_target") == 0) {
     return &t_target;
   }
+  if (strcmp(str,"mem_count") == 0) {
+    return &mem_count;
+  }
+  if (strcmp(str,"mem_kernel") == 0) {
+    dim = 1;
+    return mem_kernel;
+  }
   return NULL;
 }
 
@@ -525,7 +633,7 @@ void *FixGLE::extract(const char *str, int &dim)
 ------------------------------------------------------------------------- */
 
 double FixGLE::memory_usage() {
-  double bytes = atom->nmax * 6 * mem_count * sizeof(double);
+  double bytes = atom->nmax * (9*mem_count + 18) * sizeof(double);
   return bytes;
 }
 
@@ -537,6 +645,10 @@ void FixGLE::grow_arrays(int nmax) {
   
   memory->grow(save_position,nmax,3*(mem_count+1),"fix/gle:save_position");
   memory->grow(save_random,nmax,6*mem_count-3,"fix/gle:save_random");
+  memory->grow(array,nmax,12,"fix_gle:array");
+  memory->grow(save_full,nmax,3,"fix/gle:save_full");
+  memory->grow(save_update,nmax,3,"fix/gle:save_update");
+  array_atom = array;
 
 }
 
@@ -546,7 +658,11 @@ void FixGLE::grow_arrays(int nmax) {
 
 void FixGLE::copy_arrays(int i, int j, int delflag)
 {
-  
+  memcpy(save_position[j],save_position[i],3*(mem_count+1)*sizeof(double));
+  memcpy(save_random[j],save_random[i],(6*mem_count-3)*sizeof(double));
+  memcpy(array[j],array[i],12*sizeof(double));
+  memcpy(save_full[j],save_full[i],3*sizeof(double));
+  memcpy(save_update[j],save_update[i],3*sizeof(double));
 }
 
 /* ----------------------------------------------------------------------
@@ -557,22 +673,23 @@ int FixGLE::pack_exchange(int i, double *buf)
 {
   int offset = 0;
   int d,m;
-      tagint *tag = atom->tag;
-            int itag = tag[i]-1;
-  // pack velocity
+  // pack positions
   for ( d=0; d<3; d++ ) { 
     for ( m=0; m<mem_count+1; m++ ) {
 
-      buf[offset++] = save_position[itag][d*(mem_count+1)+m];
+      buf[offset++] = save_position[i][d*(mem_count+1)+m];
     }
   }
   
   // pack random number
   for ( d=0; d<3; d++ ) { 
     for ( m=0; m<2*mem_count-1; m++ ) {
-      buf[offset++] = save_random[itag][d*(2*mem_count-1)+m];
+      buf[offset++] = save_random[i][d*(2*mem_count-1)+m];
     }
   }
+
+  // pack last force, drag and noise
+  for ( m=0; m<12; m++ ) buf[offset++] = array[i][m];
   
   return offset;
 }
@@ -585,21 +702,175 @@ int FixGLE::unpack_exchange(int nlocal, double *buf)
 {
   int offset = 0;
   int d,m;
-  tagint *tag = atom->tag;
-           int  itag = tag[nlocal]-1;
-  // pack velocity
+  // unpack positions
   for ( d=0; d<3; d++ ) { 
-    for ( m=0; m<mem_count; m++ ) {
-      save_position[itag][d*(mem_count+1)+m] = buf[offset++];
+    for ( m=0; m<mem_count+1; m++ ) {
+      save_position[nlocal][d*(mem_count+1)+m] = buf[offset++];
     }
   }
   
-  // pack normal random number
+  // unpack normal random number
   for ( d=0; d<3; d++ ) { 
     for ( m=0; m<2*mem_count-1; m++ ) {
-      save_random[itag][d*(2*mem_count-1)+m] = buf[offset++];
+      save_random[nlocal][d*(2*mem_count-1)+m] = buf[offset++];
     }
   }
+
+  // unpack last force, drag and noise
+  for ( m=0; m<12; m++ ) array[nlocal][m] = buf[offset++];
   
   return offset;
 }
+
+/* ----------------------------------------------------------------------
+   pack ring buffer positions and kernel length into restart file
+------------------------------------------------------------------------- */
+
+void FixGLE::write_restart(FILE *fp)
+{
+  int n = 0;
+  double list[4];
+  list[n++] = mem_count;
+  list[n++] = lastindex_p;
+  list[n++] = firstindex_r;
+  list[n++] = checkpoint;
+
+  if (comm->me == 0) {
+    int size = n * sizeof(double);
+    fwrite(&size,sizeof(int),1,fp);
+    fwrite(list,sizeof(double),n,fp);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   use state info from restart file to restart the fix
+------------------------------------------------------------------------- */
+
+void FixGLE::restart(char *buf)
+{
+  double *list = (double *) buf;
+
+  if (static_cast<int> (list[0]) != mem_count)
+    error->all(FLERR,"Fix gle kernel length differs from restart file");
+  lastindex_p = static_cast<int> (list[1]);
+  firstindex_r = static_cast<int> (list[2]);
+}
+
+/* ----------------------------------------------------------------------
+   per-atom history layout in restart files, after the size entry:
+   full:    encoding, positions 3*(mem_count+1), noise 3*(2*mem_count-1)
+   compact: encoding, newest unwrapped position per dim as double, then
+            floats packed two per double: per dim the mem_count position
+            differences going back in time from the newest one, then the
+            noise ring
+   differences of consecutive positions keep their relative precision
+   in float, and the drag only sees such differences
+------------------------------------------------------------------------- */
+
+int FixGLE::history_size()
+{
+  if (checkpoint == FULL) return 2 + 9*mem_count;
+  int nfloat = 3*mem_count + 3*(2*mem_count-1);
+  return 2 + 3 + (nfloat+1)/2;
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based arrays for restart file
+------------------------------------------------------------------------- */
+
+int FixGLE::pack_restart(int i, double *buf)
+{
+  int d,m,k;
+  int np = mem_count+1;
+  int nr = 2*mem_count-1;
+  int n = 1;
+
+  buf[n++] = checkpoint;
+
+  if (checkpoint == FULL) {
+    for (m = 0; m < 3*np; m++) buf[n++] = save_position[i][m];
+    for (m = 0; m < 3*nr; m++) buf[n++] = save_random[i][m];
+  } else {
+    int newest = lastindex_p;
+    for (d = 0; d < 3; d++) buf[n++] = save_position[i][d*np+newest];
+
+    float *fbuf = (float *) &buf[n];
+    int nf = 0;
+    for (d = 0; d < 3; d++) {
+      double *pos = &save_position[i][d*np];
+      for (k = 0, m = newest; k < mem_count; k++) {
+        int mprev = (m == 0) ? mem_count : m-1;
+        fbuf[nf++] = pos[m] - pos[mprev];
+        m = mprev;
+      }
+    }
+    for (m = 0; m < 3*nr; m++) fbuf[nf++] = save_random[i][m];
+    if (nf % 2) fbuf[nf++] = 0.0f;
+    n += nf/2;
+  }
+
+  buf[0] = n;
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values from atom->extra array to restart the fix
+------------------------------------------------------------------------- */
+
+void FixGLE::unpack_restart(int nlocal, int nth)
+{
+  double **extra = atom->extra;
+  int d,m,k;
+
+  // skip to Nth set of extra values
+
+  int n = 0;
+  for (int i = 0; i < nth; i++) n += static_cast<int> (extra[nlocal][n]);
+  n++;
+
+  int np = mem_count+1;
+  int nr = 2*mem_count-1;
+  int encoding = static_cast<int> (extra[nlocal][n++]);
+
+  if (encoding == FULL) {
+    for (m = 0; m < 3*np; m++) save_position[nlocal][m] = extra[nlocal][n++];
+    for (m = 0; m < 3*nr; m++) save_random[nlocal][m] = extra[nlocal][n++];
+  } else {
+    int newest = lastindex_p;
+    double ref[3];
+    for (d = 0; d < 3; d++) ref[d] = extra[nlocal][n++];
+
+    float *fbuf = (float *) &extra[nlocal][n];
+    int nf = 0;
+    for (d = 0; d < 3; d++) {
+      double *pos = &save_position[nlocal][d*np];
+      pos[newest] = ref[d];
+      for (k = 0, m = newest; k < mem_count; k++) {
+        int mprev = (m == 0) ? mem_count : m-1;
+        pos[mprev] = pos[m] - fbuf[nf++];
+        m = mprev;
+      }
+    }
+    for (m = 0; m < 3*nr; m++) save_random[nlocal][m] = fbuf[nf++];
+  }
+
+  history_flag = 1;
+}
+
+/* ----------------------------------------------------------------------
+   maxsize of any atom's restart data
+------------------------------------------------------------------------- */
+
+int FixGLE::maxsize_restart()
+{
+  return history_size();
+}
+
+/* ----------------------------------------------------------------------
+   size of atom nlocal's restart data
+------------------------------------------------------------------------- */
+
+int FixGLE::size_restart(int nlocal)
+{
+  return history_size();
+}
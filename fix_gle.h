@@ -33,6 +33,7 @@ class FixGLE : public Fix {
   void setup(int);
   virtual void initial_integrate(int);
   virtual void final_integrate();
+  void end_of_step();
   void reset_target(double);
   void reset_dt();
   int modify_param(int, char **);
@@ -43,6 +44,12 @@ class FixGLE : public Fix {
   void copy_arrays(int, int, int);
   int pack_exchange(int, double *);
   int unpack_exchange(int, double *);
+  void write_restart(FILE *);
+  void restart(char *);
+  int pack_restart(int, double *);
+  void unpack_restart(int, int);
+  int size_restart(int);
+  int maxsize_restart();
 
  protected:
   double **save_position; //used to save peratom positions
@@ -50,7 +57,9 @@ class FixGLE : public Fix {
   double **array; //used to save peratom friction/noise (to not calculate it twice) and to access it from lammps
   int lastindex_p, firstindex_r;
   int nmax;
-  int restart;
+  int restart_flag;
+  int checkpoint;         // FULL or COMPACT history in restart files
+  int history_flag;       // 1 once the histories hold valid data
   double norm;
   
   int flangevin_allocated;
@@ -83,6 +92,15 @@ class FixGLE : public Fix {
 
   void compute_target();
   void read_mem_file();
+  void init_kernel();
+  int history_size();
+
+  // online kernel update from compute memory/volterra
+  char *id_kernel;
+  class ComputeMemoryVolterra *kernel_compute;
+  int kernel_every;
+  double kernel_mix;
+  void update_kernel();
   
   int updates_full;
   double** save_full;
@@ -103,6 +121,11 @@ Self-explanatory.  Check the input script syntax and compare to the
 documentation for the command.  You can use -echo screen as a
 command-line option when running LAMMPS to see the offending line.
 
+E: Fix gle kernel length differs from restart file
+
+The histories in the restart file were written for a different number
+of kernel entries, they cannot be continued.
+
 E: Fix langevin period must be > 0.0
 
 The time window for temperature relaxation must be > 0
@@ -146,6 +169,14 @@ E: Fix langevin variable returned negative temperature
 
 Self-explanatory.
 
+E: Could not find fix_modify kernel compute ID
+
+The compute ID given to fix_modify kernel does not exist.
+
+E: Fix_modify kernel compute is not memory/volterra
+
+The kernel can only be pulled from a compute memory/volterra.
+
 E: Could not find fix_modify temperature ID
 
 The compute ID for computing temperature does not exist.
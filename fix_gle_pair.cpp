@@ -75,6 +75,7 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
   //peratom_freq = 1;
   //peratom_flag = 1;
   restart_global = 1;
+  restart_peratom = 1;
   
   MPI_Comm_rank(world,&me);
 
@@ -111,6 +112,12 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
   
   // set number of dimensions
   d=3;
+
+  // the noise is correlated by one Lanczos iteration over all atoms and
+  // the memory term reads the histories of neighbors by atom ID, so all
+  // histories are indexed by ID and have to be on one proc
+  if (comm->nprocs > 1)
+    error->all(FLERR,"Fix gle/pair requires a single MPI task");
   
   // Timing
   time_read = 0.0;
@@ -150,8 +157,13 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
   double **f = atom->f;
   int k,i,j,n,t;
   int N = 2*Nt-2;
-  memory->create(x_save, 3*atom->nlocal, Nt,  "gle/pair:x_save");
-  memory->create(ran, N, atom->nlocal*d, "gle/pair:ran");
+  tagint *tag = atom->tag;
+  natoms_hist = nlocal;
+  for (i = 0; i < nlocal; i++)
+    if (tag[i] < 1 || tag[i] > nlocal)
+      error->all(FLERR,"Fix gle/pair requires consecutive atom IDs");
+  memory->create(x_save, d*natoms_hist, Nt,  "gle/pair:x_save");
+  memory->create(ran, N, d*natoms_hist, "gle/pair:ran");
   memory->create(fd, atom->nlocal,3, "gle/pair:fd");
   memory->create(fc, atom->nlocal,3, "gle/pair:fc");
   memory->create(fr, atom->nlocal,3, "gle/pair:fr");
@@ -175,15 +187,14 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
   
   // initiliaze position storage (necesarry for memory calculation, see integrator)
   imageint *image = atom->image;
-  tagint *tag = atom->tag;
   int itag;
   double unwrap[3];
   for (int i = 0; i < nlocal; i++) {
     itag = tag[i] - 1;
-    domain->unmap(x[itag],image[itag],unwrap);
+    domain->unmap(x[i],image[i],unwrap);
     for (int dim1=0; dim1<d; dim1++) { 
       for (int t = 0; t < Nt; t++) {
-        x_save[3*itag+dim1][t] = unwrap[dim1];
+        x_save[d*itag+dim1][t] = unwrap[dim1];
       }
     }
   }
@@ -200,6 +211,9 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
   t2 = MPI_Wtime();
   time_init += t2 -t1;
 
+  // histories travel with the atoms through per-atom restart data
+  atom->add_callback(1);
+
 }
 
 
@@ -210,6 +224,7 @@ FixGLEPair::FixGLEPair(LAMMPS *lmp, int narg, char **arg) :
 FixGLEPair::~FixGLEPair()
 {
 
+  atom->delete_callback(id,1);
   delete random;
   memory->destroy(ran);
   memory->destroy(x_save);
@@ -250,6 +265,10 @@ int FixGLEPair::setmask()
 
 void FixGLEPair::init()
 {
+  if (comm->nprocs > 1)
+    error->all(FLERR,"Fix gle/pair requires a single MPI task");
+  if (atom->nlocal != natoms_hist)
+    error->all(FLERR,"Fix gle/pair does not allow the number of atoms to change");
   
   // need a full neighbor list, built whenever re-neighboring occurs
   irequest = neighbor->request(this);
@@ -374,7 +393,7 @@ void FixGLEPair::initial_integrate(int vflag)
   const int inum = list->inum;
   
   #if defined(_OPENMP)
-  #pragma omp parallel private (dim1,t,n,m) default(none) shared(x,v)
+  #pragma omp parallel private (dim1,t,n,m) default(none) shared(x,v,nthreads,inum,tag)
   #endif
   {
     const int * _noalias const type = atom->type;
@@ -410,7 +429,7 @@ void FixGLEPair::initial_integrate(int vflag)
         m = lastindexn-1;
         if (m==-1) m=Nt-1;
         for (t = 1; t < Nt; t++) {
-          fd[itag][dim1] += self_data[t]*(x_save[3*itag+dim1][n]-x_save[3*itag+dim1][m]);
+          fd[itag][dim1] += self_data[t]*(x_save[d*itag+dim1][n]-x_save[d*itag+dim1][m]);
           n--;
           m--;
           if (n==-1) n=Nt-1;
@@ -449,8 +468,8 @@ void FixGLEPair::initial_integrate(int vflag)
           m = lastindexn-1;
           if (m==-1) m=Nt-1;
           for (t = 1; t < Nt; t++) {
-            dot = (dr[0]*(x_save[3*jtag][n]-x_save[3*jtag][m]) + dr[1]*(x_save[3*jtag+1][n]-x_save[3*jtag+1][m])+dr[2]*(x_save[3*jtag+2][n]-x_save[3*jtag+2][m]))*rsqi;
-            double dot_self = (dr[0]*(x_save[3*itag][n]-x_save[3*itag][m]) + dr[1]*(x_save[3*itag+1][n]-x_save[3*itag+1][m])+dr[2]*(x_save[3*itag+2][n]-x_save[3*itag+2][m]))*rsqi;
+            dot = (dr[0]*(x_save[d*jtag][n]-x_save[d*jtag][m]) + dr[1]*(x_save[d*jtag+1][n]-x_save[d*jtag+1][m])+dr[2]*(x_save[d*jtag+2][n]-x_save[d*jtag+2][m]))*rsqi;
+            double dot_self = (dr[0]*(x_save[d*itag][n]-x_save[d*itag][m]) + dr[1]*(x_save[d*itag+1][n]-x_save[d*itag+1][m])+dr[2]*(x_save[d*itag+2][n]-x_save[d*itag+2][m]))*rsqi;
             for (dim1=0; dim1<d; dim1++) {
               fd[itag][dim1] += cross_data[dist*Nt+t]*dot*dr[dim1];
               // distance-dependent contribution of the self-correlation
@@ -498,9 +517,9 @@ void FixGLEPair::initial_integrate(int vflag)
   for (i = 0; i < nlocal; i++) {
     itag = tag[i]-1;
     domain->unmap(x[i],image[i],unwrap);
-    x_save[3*itag][lastindexn] = unwrap[0];
-    x_save[3*itag+1][lastindexn] = unwrap[1];
-    x_save[3*itag+2][lastindexn] = unwrap[2];
+    x_save[d*itag][lastindexn] = unwrap[0];
+    x_save[d*itag+1][lastindexn] = unwrap[1];
+    x_save[d*itag+2][lastindexn] = unwrap[2];
   }
   t2 = MPI_Wtime();
   time_dist_update += t2 -t1;
@@ -598,53 +617,52 @@ double FixGLEPair::memory_usage()
 {
   // array to store the velocities
   int N = 2*Nt-2;
-  double bytes = (3*atom->nlocal*Nt+3*atom->nlocal*N)*sizeof(double);
+  double bytes = ((double) d*natoms_hist*Nt + (double) d*natoms_hist*N)*sizeof(double);
   return bytes;
 }
 
 
-/* ----------------------------------------------------------------------
-   allocate local atom-based arrays
-------------------------------------------------------------------------- */
-
-void FixGLEPair::grow_arrays(int nmax)
-{
-  
-}
-
 /* ----------------------------------------------------------------------
    write data into restart file:
-   - correlation
+   - ring buffer indices, the histories are written per atom
+   layout of the global entry: -1 (marks per-atom histories), lastindexn,
+   lastindexN, Nt
+   older files hold lastindexn >= 0 first, followed by the histories of
+   all atoms of rank 0 in tag order, they are still read
 ------------------------------------------------------------------------- */
 void FixGLEPair::write_restart(FILE *fp){
-  // calculate size of array
-  int N = 2*Nt-2;
-  int n = 3*atom->nlocal*Nt+3*atom->nlocal*N+2;
-  double lastindexn_d = lastindexn;
-  double lastindexN_d = lastindexN;
+  int n = 0;
+  double list[4];
+  list[n++] = -1.0;
+  list[n++] = lastindexn;
+  list[n++] = lastindexN;
+  list[n++] = Nt;
 
-  //write data
   if (comm->me == 0) {
     int size = n * sizeof(double);
     fwrite(&size,sizeof(int),1,fp);
-    fwrite(&lastindexn_d,sizeof(double),1,fp);
-    fwrite(&lastindexN_d,sizeof(double),1,fp);
-    fwrite(&x_save[0][0],sizeof(double),3*atom->nlocal*Nt,fp);
-    fwrite(&ran[0][0],sizeof(double),3*atom->nlocal*N,fp);
+    fwrite(list,sizeof(double),n,fp);
   }
 }
 
 
 /* ----------------------------------------------------------------------
    read data from restart file:
-   - correlation
+   - ring buffer indices, or the full histories of an older file
 ------------------------------------------------------------------------- */
 void FixGLEPair::restart(char *buf){
-  printf("restart\n");
   double *dbuf = (double *) buf;
   int dcount = 0;
   int N = 2*Nt-2;
   int i,dim1,t;
+
+  if (dbuf[0] < 0.0) {
+    lastindexn = static_cast<int> (dbuf[1]);
+    lastindexN = static_cast<int> (dbuf[2]);
+    if (static_cast<int> (dbuf[3]) != Nt)
+      error->all(FLERR,"Fix gle/pair kernel length differs from restart file");
+    return;
+  }
   
   lastindexn = (int) dbuf[dcount++];
   lastindexN = (int) dbuf[dcount++];
@@ -652,20 +670,81 @@ void FixGLEPair::restart(char *buf){
   for (i = 0; i < atom->nlocal; i++) {
     for (dim1 = 0; dim1< d; dim1++) {
       for (t = 0; t < Nt; t++) {
-        x_save[3*i+dim1][t] = dbuf[dcount++];
+        x_save[d*i+dim1][t] = dbuf[dcount++];
       }
     }
   }
 
   for (t = 0; t < N; t++)
     for (i = 0; i < atom->nlocal; i++) {
-      ran[t][3*i] = dbuf[dcount++];
-      ran[t][3*i+1] = dbuf[dcount++];
-      ran[t][3*i+2] = dbuf[dcount++];
+      for (dim1 = 0; dim1 < d; dim1++)
+        ran[t][d*i+dim1] = dbuf[dcount++];
     }
 }
 
 
+/* ----------------------------------------------------------------------
+   pack the histories of atom i for the restart file:
+   size, positions x_save[d*itag+dim][0..Nt-1] for dim = x,y,z,
+   noise ran[0..2Nt-3][d*itag+dim] for dim = x,y,z
+------------------------------------------------------------------------- */
+
+int FixGLEPair::pack_restart(int i, double *buf)
+{
+  int N = 2*Nt-2;
+  int itag = atom->tag[i]-1;
+  int n = 1;
+  int dim1,t;
+
+  for (dim1 = 0; dim1 < d; dim1++)
+    for (t = 0; t < Nt; t++) buf[n++] = x_save[d*itag+dim1][t];
+  for (dim1 = 0; dim1 < d; dim1++)
+    for (t = 0; t < N; t++) buf[n++] = ran[t][d*itag+dim1];
+
+  buf[0] = n;
+  return n;
+}
+
+
+/* ----------------------------------------------------------------------
+   unpack the histories of atom nlocal from atom->extra
+------------------------------------------------------------------------- */
+
+void FixGLEPair::unpack_restart(int nlocal, int nth)
+{
+  double **extra = atom->extra;
+  int N = 2*Nt-2;
+  int dim1,t;
+
+  // skip to Nth set of extra values
+
+  int n = 0;
+  for (int i = 0; i < nth; i++) n += static_cast<int> (extra[nlocal][n]);
+  n++;
+
+  int itag = atom->tag[nlocal]-1;
+  for (dim1 = 0; dim1 < d; dim1++)
+    for (t = 0; t < Nt; t++) x_save[d*itag+dim1][t] = extra[nlocal][n++];
+  for (dim1 = 0; dim1 < d; dim1++)
+    for (t = 0; t < N; t++) ran[t][d*itag+dim1] = extra[nlocal][n++];
+}
+
+
+/* ----------------------------------------------------------------------
+   size of an atom's restart data
+------------------------------------------------------------------------- */
+
+int FixGLEPair::maxsize_restart()
+{
+  return 1 + d*Nt + d*(2*Nt-2);
+}
+
+int FixGLEPair::size_restart(int nlocal)
+{
+  return 1 + d*Nt + d*(2*Nt-2);
+}
+
+
 /* ----------------------------------------------------------------------
    read input coefficients
 ------------------------------------------------------------------------- */
@@ -885,7 +964,7 @@ void FixGLEPair::update_noise()
   
   t1 = MPI_Wtime();
   #if defined (_OPENMP)
-  #pragma omp parallel private(i) default(none) shared(buf,bufout) 
+  #pragma omp parallel private(i) default(none) shared(buf,bufout,size,N)
   #endif
   {
     int ifrom, ito, tid;
@@ -914,7 +993,7 @@ void FixGLEPair::update_noise()
   //  work[i]=0;
   //}
 #if defined (_OPENMP)
-#pragma omp parallel for private(t,i,j) default(none) shared(bufout,dr_pair_list,dist_pair_list,FT_w) schedule(dynamic)
+#pragma omp parallel for private(t,i,j) default(none) shared(bufout,dr_pair_list,dist_pair_list,FT_w,size,N) schedule(dynamic)
 #endif
   for (t=0; t<Nt; t++) {
     std::vector<double *> Vn;
@@ -1117,7 +1196,7 @@ void FixGLEPair::update_noise()
   t1 = MPI_Wtime();
 
   #if defined (_OPENMP)
-  #pragma omp parallel private(i,t,itag) default(none) shared(tag,FT_w)
+  #pragma omp parallel private(i,t,itag) default(none) shared(tag,FT_w,nlocal,N)
   #endif
   {
     int ifrom, ito, tid;
@@ -1126,13 +1205,13 @@ void FixGLEPair::update_noise()
       itag = tag[i]-1;
       for (int t = 0; t < Nt; t++) {
         if (t==0 || t==Nt-1) {
-          fr[itag][0]+= FT_w[t][3*itag+0]/N*sqrt(update->dt);
-          fr[itag][1]+= FT_w[t][3*itag+1]/N*sqrt(update->dt);
-          fr[itag][2]+= FT_w[t][3*itag+2]/N*sqrt(update->dt);
+          fr[itag][0]+= FT_w[t][d*itag+0]/N*sqrt(update->dt);
+          fr[itag][1]+= FT_w[t][d*itag+1]/N*sqrt(update->dt);
+          fr[itag][2]+= FT_w[t][d*itag+2]/N*sqrt(update->dt);
         } else {
-          fr[itag][0]+= 2*FT_w[t][3*itag+0]/N*sqrt(update->dt);
-          fr[itag][1]+= 2*FT_w[t][3*itag+1]/N*sqrt(update->dt);
-          fr[itag][2]+= 2*FT_w[t][3*itag+2]/N*sqrt(update->dt);
+          fr[itag][0]+= 2*FT_w[t][d*itag+0]/N*sqrt(update->dt);
+          fr[itag][1]+= 2*FT_w[t][d*itag+1]/N*sqrt(update->dt);
+          fr[itag][2]+= 2*FT_w[t][d*itag+2]/N*sqrt(update->dt);
         }
       }
       //printf(" fr : itag %d  %f %f %f \n",itag,fr[itag][0],fr[itag][1],fr[itag][2]);
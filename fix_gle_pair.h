@@ -38,9 +38,12 @@ class FixGLEPair : public Fix {
   virtual double compute_vector(int);
 
   double memory_usage();
-  void grow_arrays(int);
   void write_restart(FILE *fp);
   void restart(char *buf);
+  int pack_restart(int, double *);
+  void unpack_restart(int, int);
+  int size_restart(int);
+  int maxsize_restart();
 
  protected:
   int me;
@@ -67,6 +70,7 @@ class FixGLEPair : public Fix {
   double **fd;
   double **fr;
   double **x_save;
+  int natoms_hist;      // atoms the histories are indexed for, by ID
   int lastindexN,lastindexn;
   double **fc;
   double **array;
@@ -108,6 +112,11 @@ class FixGLEPair : public Fix {
 
 /* ERROR/WARNING messages:
 
+E: Fix gle/pair kernel length differs from restart file
+
+The histories in the restart file were written for a different number
+of kernel entries, they cannot be continued.
+
 E: Illegal ... command
 
 Self-explanatory.  Check the input script syntax and compare to the
@@ -146,4 +155,19 @@ E: Cannot zero gld force for zero atoms
 
 There are no atoms currently in the group.
 
+E: Fix gle/pair requires a single MPI task
+
+The correlated noise couples all atoms and the histories are indexed
+by atom ID, so the fix runs on one MPI task with OpenMP threads.
+
+E: Fix gle/pair requires consecutive atom IDs
+
+The histories are indexed by atom ID, which must run from 1 to the
+number of atoms.
+
+E: Fix gle/pair does not allow the number of atoms to change
+
+The histories were allocated for the atoms present when the fix was
+defined.
+
 */
@@ -0,0 +1,467 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   Mean square displacement, non-Gaussian parameter and self-intermediate
+   scattering function on logarithmically spaced lags.  Every atom keeps
+   rings of unwrapped positions, level k is sampled every m^k samples and
+   holds p positions, so the lags j*m^k span many decades with
+   3*p*levels doubles per atom.
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fix_msd_log.h"
+#include "atom.h"
+#include "update.h"
+#include "domain.h"
+#include "memory.h"
+#include "error.h"
+#include "force.h"
+#include "binary_frame.h"
+
+using namespace LAMMPS_NS;
+using namespace FixConst;
+
+#define NFIX 5    // count, dx^2, dy^2, dz^2, r^4
+
+/* ---------------------------------------------------------------------- */
+
+FixMSDLog::FixMSDLog(LAMMPS * lmp, int narg, char **arg):
+  Fix (lmp, narg, arg)
+{
+  if (narg < 5) error->all(FLERR,"Illegal fix msd/log command");
+
+  MPI_Comm_rank(world,&me);
+
+  nevery = force->inumeric(FLERR,arg[3]);
+  nfreq = force->inumeric(FLERR,arg[4]);
+  global_freq = nfreq;
+
+  // optional args
+
+  numlevels = 20;
+  p = 16;
+  m = 2;
+  nq = 0;
+  dq = 0.0;
+  fp = NULL;
+  overwrite = 0;
+  binary_flag = 0;
+  frame = NULL;
+
+  int iarg = 5;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"ncorr") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      int n = force->inumeric(FLERR,arg[iarg+1]);
+      if (n < 1) error->all(FLERR,"Illegal fix msd/log command");
+      numlevels = n;
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"nlen") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      int n = force->inumeric(FLERR,arg[iarg+1]);
+      if (n < 2) error->all(FLERR,"Illegal fix msd/log command");
+      p = n;
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"ncount") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      int n = force->inumeric(FLERR,arg[iarg+1]);
+      if (n < 2) error->all(FLERR,"Illegal fix msd/log command");
+      m = n;
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"q") == 0) {
+      if (iarg+3 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      nq = force->inumeric(FLERR,arg[iarg+1]);
+      dq = force->numeric(FLERR,arg[iarg+2]);
+      if (nq < 0 || dq <= 0.0) error->all(FLERR,"Illegal fix msd/log command");
+      iarg += 3;
+    } else if (strcmp(arg[iarg],"file") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      if (me == 0) {
+        fp = fopen(arg[iarg+1],"w");
+        if (fp == NULL) {
+          char str[128];
+          sprintf(str,"Cannot open fix msd/log file %s",arg[iarg+1]);
+          error->one(FLERR,str);
+        }
+      }
+      iarg += 2;
+    } else if (strcmp(arg[iarg],"overwrite") == 0) {
+      overwrite = 1;
+      iarg += 1;
+    } else if (strcmp(arg[iarg],"format") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix msd/log command");
+      if (strcmp(arg[iarg+1],"text") == 0) binary_flag = 0;
+      else if (strcmp(arg[iarg+1],"binary") == 0) binary_flag = 1;
+      else error->all(FLERR,"Illegal fix msd/log command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix msd/log command");
+  }
+
+  if (nevery <= 0 || nfreq <= 0 || nfreq % nevery)
+    error->all(FLERR,"Illegal fix msd/log command");
+  if (p % m != 0) error->all(FLERR,"Illegal fix msd/log command");
+  dmin = p/m;
+
+  // output columns: Time, MSD, its three components, NGP, Fs(q_n)
+
+  ncols = 6 + nq;
+  if (fp && me == 0) {
+    char **names = new char*[ncols];
+    for (int i = 0; i < ncols; i++) names[i] = new char[BINARY_FRAME_NAMELEN];
+    strcpy(names[0],"Time");
+    strcpy(names[1],"MSD");
+    strcpy(names[2],"MSDx");
+    strcpy(names[3],"MSDy");
+    strcpy(names[4],"MSDz");
+    strcpy(names[5],"NGP");
+    for (int n = 0; n < nq; n++)
+      snprintf(names[6+n],BINARY_FRAME_NAMELEN,"Fs(%g)",(n+1)*dq);
+
+    if (binary_flag) {
+      binary_frame_header(fp,id,ncols,names);
+      memory->create(frame,numlevels*p*ncols,"msd/log:frame");
+    } else {
+      fprintf(fp,"# Logarithmic-time MSD for fix %s\n",id);
+      fprintf(fp,"#");
+      for (int i = 0; i < ncols; i++) fprintf(fp," %s",names[i]);
+      fprintf(fp,"\n");
+    }
+    filepos = ftell(fp);
+    for (int i = 0; i < ncols; i++) delete [] names[i];
+    delete [] names;
+  }
+
+  // counters of the levels and the sums per [level][lag]
+
+  nquant = NFIX + nq;
+  memory->create(insertindex,numlevels,"msd/log:insertindex");
+  memory->create(nfill,numlevels,"msd/log:nfill");
+  memory->create(nsub,numlevels,"msd/log:nsub");
+  memory->create(sums,numlevels*p*nquant,"msd/log:sums");
+  memory->create(sums_all,numlevels*p*nquant,"msd/log:sums_all");
+  for (unsigned int k = 0; k < numlevels; k++)
+    insertindex[k] = nfill[k] = nsub[k] = 0;
+  for (unsigned int i = 0; i < numlevels*p*nquant; i++) sums[i] = 0.0;
+  nsample = 0;
+
+  // per-atom rings migrate with the atoms, atoms are not in the group
+  // until their first sample
+
+  nring = 3*numlevels*p;
+  ring = NULL;
+  joined = NULL;
+  grow_arrays(atom->nmax);
+  atom->add_callback(0);
+  maxexchange = nring + 1;
+  create_attribute = 1;
+  int nlocal = atom->nlocal;
+  for (int i = 0; i < nlocal; i++) joined[i] = 0.0;
+
+  // nvalid = next step on which end_of_step samples
+
+  nvalid_last = -1;
+  nvalid = nextvalid();
+}
+
+/* ---------------------------------------------------------------------- */
+
+FixMSDLog::~FixMSDLog()
+{
+  atom->delete_callback(id,0);
+
+  memory->destroy(ring);
+  memory->destroy(joined);
+  memory->destroy(insertindex);
+  memory->destroy(nfill);
+  memory->destroy(nsub);
+  memory->destroy(sums);
+  memory->destroy(sums_all);
+  memory->destroy(frame);
+
+  if (fp && me == 0) fclose(fp);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int FixMSDLog::setmask()
+{
+  int mask = 0;
+  mask |= END_OF_STEP;
+  return mask;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixMSDLog::init()
+{
+  if (nfreq % nevery)
+    error->all(FLERR,"Illegal fix msd/log command");
+
+  // need to reset nvalid if nvalid < ntimestep b/c minimize was performed
+
+  if (nvalid < update->ntimestep) nvalid = nextvalid();
+}
+
+/* ----------------------------------------------------------------------
+   only does something if nvalid = current timestep, a second run does
+   not sample the step the previous run ended on again
+------------------------------------------------------------------------- */
+
+void FixMSDLog::setup(int vflag)
+{
+  end_of_step();
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixMSDLog::end_of_step()
+{
+  // skip if not step which requires doing something
+  // error check if timestep was reset in an invalid manner
+
+  bigint ntimestep = update->ntimestep;
+  if (ntimestep < nvalid_last || ntimestep > nvalid)
+    error->all(FLERR,"Invalid timestep reset for fix msd/log");
+  if (ntimestep != nvalid) return;
+  nvalid_last = nvalid;
+  nvalid += nevery;
+
+  sample();
+  if (ntimestep % nfreq == 0) output();
+}
+
+/* ----------------------------------------------------------------------
+   nvalid = next step on which end_of_step does something
+   this step if multiple of nevery, else next multiple
+------------------------------------------------------------------------- */
+
+bigint FixMSDLog::nextvalid()
+{
+  bigint nvalid = update->ntimestep;
+  if (nvalid % nevery) nvalid = (nvalid/nevery)*nevery + nevery;
+  return nvalid;
+}
+
+/* ----------------------------------------------------------------------
+   store the unwrapped positions in every level due at this sample and
+   accumulate the displacements to the valid older positions
+------------------------------------------------------------------------- */
+
+void FixMSDLog::sample()
+{
+  unsigned int k,j;
+
+  // level 0 takes every sample, level k+1 every m-th sample of level k
+
+  nsample++;
+  unsigned int nup = 0;
+  for (k = 0; k < numlevels; k++) {
+    nup++;
+    if (nfill[k] < p) nfill[k]++;
+    if (++nsub[k] < m) break;
+    nsub[k] = 0;
+  }
+
+  double **x = atom->x;
+  imageint *image = atom->image;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+  double u[3];
+
+  for (int i = 0; i < nlocal; i++) {
+    if (!(mask[i] & groupbit)) {
+      joined[i] = 0.0;
+      continue;
+    }
+    if (joined[i] == 0.0) joined[i] = nsample;
+    domain->unmap(x[i],image[i],u);
+
+    // level k was filled on the samples which are multiples of m^k, an atom
+    // which joined the group later only has the ones since its first sample
+    bigint nnow = nsample;
+    bigint nbefore = static_cast<bigint> (joined[i]) - 1;
+
+    for (k = 0; k < nup; k++) {
+      double *r = &ring[i][3*k*p];
+      unsigned int ind1 = insertindex[k];
+      r[3*ind1] = u[0];
+      r[3*ind1+1] = u[1];
+      r[3*ind1+2] = u[2];
+
+      unsigned int nvalid_k = nfill[k];
+      if (nnow - nbefore < nvalid_k) nvalid_k = nnow - nbefore;
+      nnow /= m;
+      nbefore /= m;
+
+      // lag 0 is trivial, levels k>0 continue after the lags of level k-1
+      unsigned int jlo = (k == 0) ? 1 : dmin;
+      for (j = jlo; j < nvalid_k; j++) {
+        unsigned int ind2 = (ind1 + p - j) % p;
+        double dx = u[0] - r[3*ind2];
+        double dy = u[1] - r[3*ind2+1];
+        double dz = u[2] - r[3*ind2+2];
+        double dx2 = dx*dx, dy2 = dy*dy, dz2 = dz*dz;
+        double r2 = dx2 + dy2 + dz2;
+
+        double *acc = &sums[(k*p+j)*nquant];
+        acc[0] += 1.0;
+        acc[1] += dx2;
+        acc[2] += dy2;
+        acc[3] += dz2;
+        acc[4] += r2*r2;
+
+        // self-ISF, cos(n dq dx) by the Chebyshev recurrence
+        if (nq) {
+          double c0x = cos(dq*dx), c0y = cos(dq*dy), c0z = cos(dq*dz);
+          double cx = c0x, cy = c0y, cz = c0z;
+          double c1x = 1.0, c1y = 1.0, c1z = 1.0;
+          for (int n = 0; n < nq; n++) {
+            if (n > 0) {
+              double cnx = 2.0*c0x*cx - c1x;
+              double cny = 2.0*c0y*cy - c1y;
+              double cnz = 2.0*c0z*cz - c1z;
+              c1x = cx; c1y = cy; c1z = cz;
+              cx = cnx; cy = cny; cz = cnz;
+            }
+            acc[NFIX+n] += (cx + cy + cz)/3.0;
+          }
+        }
+      }
+    }
+  }
+
+  for (k = 0; k < nup; k++) {
+    ++insertindex[k];
+    if (insertindex[k] == p) insertindex[k] = 0;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   sum the accumulations of all procs and write the averages per lag
+------------------------------------------------------------------------- */
+
+void FixMSDLog::output()
+{
+  int n = numlevels*p*nquant;
+  MPI_Reduce(sums,sums_all,n,MPI_DOUBLE,MPI_SUM,0,world);
+  if (me || !fp) return;
+
+  const double dt = nevery*update->dt;
+  int nrows = 0;
+
+  if (overwrite) fseek(fp,filepos,SEEK_SET);
+  if (!binary_flag)
+    fprintf(fp,"# Timestep: " BIGINT_FORMAT "\n",update->ntimestep);
+
+  for (unsigned int k = 0; k < numlevels; k++) {
+    unsigned int jlo = (k == 0) ? 1 : dmin;
+    double stride = pow((double) m,(double) k);
+    for (unsigned int j = jlo; j < p; j++) {
+      const double *a = &sums_all[(k*p+j)*nquant];
+      if (a[0] <= 0.0) continue;
+      double row[6];
+      row[0] = j*stride*dt;
+      row[2] = a[1]/a[0];
+      row[3] = a[2]/a[0];
+      row[4] = a[3]/a[0];
+      row[1] = row[2] + row[3] + row[4];
+      row[5] = 0.0;
+      if (row[1] > 0.0) row[5] = 3.0*(a[4]/a[0])/(5.0*row[1]*row[1]) - 1.0;
+
+      if (binary_flag) {
+        double *f = &frame[nrows*ncols];
+        for (int c = 0; c < 6; c++) f[c] = row[c];
+        for (int q = 0; q < nq; q++) f[6+q] = a[NFIX+q]/a[0];
+      } else {
+        fprintf(fp,"%lg %.15lg %lg %lg %lg %lg",
+                row[0],row[1],row[2],row[3],row[4],row[5]);
+        for (int q = 0; q < nq; q++) fprintf(fp," %lg",a[NFIX+q]/a[0]);
+        fprintf(fp,"\n");
+      }
+      nrows++;
+    }
+  }
+
+  if (binary_flag) binary_frame_write(fp,update->ntimestep,nrows,ncols,frame);
+  fflush(fp);
+  if (overwrite) {
+    long fileend = ftell(fp);
+    if (fileend > 0) ftruncate(fileno(fp),fileend);
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+double FixMSDLog::memory_usage()
+{
+  double bytes = (double) atom->nmax * (nring+1) * sizeof(double);
+  bytes += 2.0 * numlevels*p*nquant * sizeof(double);
+  bytes += 3.0 * numlevels * sizeof(unsigned int);
+  if (frame) bytes += (double) numlevels*p*ncols * sizeof(double);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixMSDLog::grow_arrays(int nmax)
+{
+  memory->grow(ring,nmax,nring,"msd/log:ring");
+  memory->grow(joined,nmax,"msd/log:joined");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixMSDLog::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(ring[j],ring[i],nring*sizeof(double));
+  joined[j] = joined[i];
+}
+
+/* ----------------------------------------------------------------------
+   initialize one atom's array values, called when atom is created
+------------------------------------------------------------------------- */
+
+void FixMSDLog::set_arrays(int i)
+{
+  joined[i] = 0.0;
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixMSDLog::pack_exchange(int i, double *buf)
+{
+  for (int n = 0; n < nring; n++) buf[n] = ring[i][n];
+  buf[nring] = joined[i];
+  return nring + 1;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixMSDLog::unpack_exchange(int nlocal, double *buf)
+{
+  for (int n = 0; n < nring; n++) ring[nlocal][n] = buf[n];
+  joined[nlocal] = buf[nring];
+  return nring + 1;
+}
@@ -0,0 +1,106 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+#ifdef FIX_CLASS
+
+FixStyle(msd/log,FixMSDLog)
+
+#else
+
+#ifndef LMP_FIX_MSD_LOG_H
+#define LMP_FIX_MSD_LOG_H
+
+#include <stdio.h>
+#include "fix.h"
+
+namespace LAMMPS_NS {
+
+class FixMSDLog : public Fix {
+ public:
+  FixMSDLog(class LAMMPS *, int, char **);
+  ~FixMSDLog();
+  int setmask();
+  void init();
+  void setup(int);
+  void end_of_step();
+  double memory_usage();
+
+  void grow_arrays(int);
+  void copy_arrays(int, int, int);
+  void set_arrays(int);
+  int pack_exchange(int, double *);
+  int unpack_exchange(int, double *);
+
+ private:
+  int me;
+  int nfreq;
+  unsigned int numlevels; // Number of levels, lag spacing m^k on level k
+  unsigned int p;         // Positions kept per level
+  unsigned int m;         // Samples of level k per sample of level k+1
+  unsigned int dmin;      // First lag of levels k>0, dmin = p/m
+  int nq;                 // Number of wavenumbers of the self-ISF
+  double dq;              // q_n = n*dq
+
+  // per-atom rings of unwrapped positions, level k holds the last p
+  // positions sampled every m^k samples, [level][slot][dim] per atom
+  double **ring;
+  int nring;
+  double *joined;         // sample count of the first sample in the group, 0 if not in it
+  bigint nsample;         // samples taken so far
+  bigint nvalid;          // next step on which a sample is taken
+  bigint nvalid_last;     // last step on which a sample was taken
+
+  unsigned int *insertindex;
+  unsigned int *nfill;    // valid slots per level
+  unsigned int *nsub;     // samples of level k since its last pass to k+1
+
+  // sums of this proc per [level][lag]: count, dx^2, dy^2, dz^2, r^4
+  // and the self-ISF of every q, reduced in one message at output
+  int nquant;
+  double *sums;
+  double *sums_all;
+
+  FILE *fp;
+  int overwrite,binary_flag;
+  long filepos;
+  double *frame;
+  int ncols;
+
+  void sample();
+  void output();
+  bigint nextvalid();
+};
+
+}
+
+#endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal fix msd/log command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.
+
+E: Cannot open fix msd/log file %s
+
+The specified file cannot be opened.  Check that the path and name are
+correct.
+
+E: Invalid timestep reset for fix msd/log
+
+Resetting the timestep has invalidated the sequence of timesteps this
+fix needs.
+
+*/
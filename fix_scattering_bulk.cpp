@@ -33,10 +33,14 @@
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
+// atoms per block in the vectorized mode recurrence
+#define SCATTER_CHUNK 64
+
 FixScatteringBulk::FixScatteringBulk(LAMMPS * lmp, int narg, char **arg):
   Fix (lmp, narg, arg)
 {
-  if (narg < 10) error->all(FLERR,"Illegal fix scattering/bulk command");
+  if (narg < 11) error->all(FLERR,"Illegal fix scattering/bulk command");
+  MPI_Comm_rank(world,&me);
   nevery = force->inumeric(FLERR,arg[3]);
   nrelax = force->inumeric(FLERR,arg[4]);
   N_blocks = force->inumeric(FLERR,arg[5]);
@@ -45,13 +49,61 @@ FixScatteringBulk::FixScatteringBulk(LAMMPS * lmp, int narg, char **arg):
   N_levels_msd = force->inumeric(FLERR,arg[8]);
    N_cor = force->inumeric(FLERR,arg[9]);
     nFunCorr = force->inumeric(FLERR,arg[10]);
+
+  // optional keyword: kshell width, 0 < width <= 1
+  // all wavevectors with |k| within width/2 of (m+1)*2pi/Lx instead of
+  // the harmonics along the three axes
+
+  shellflag = 0;
+  shellwidth = 1.0;
+  int iarg = 11;
+  while (iarg < narg) {
+    if (strcmp(arg[iarg],"kshell") == 0) {
+      if (iarg+2 > narg) error->all(FLERR,"Illegal fix scattering/bulk command");
+      shellflag = 1;
+      shellwidth = force->numeric(FLERR,arg[iarg+1]);
+      if (shellwidth <= 0.0 || shellwidth > 1.0)
+        error->all(FLERR,"Illegal fix scattering/bulk command");
+      iarg += 2;
+    } else error->all(FLERR,"Illegal fix scattering/bulk command");
+  }
+
+  xsoa = NULL;
+  maxsoa = 0;
+  incoh_buf = NULL;
+  kvec = NULL;
+  modeshell = NULL;
+  modeweight = NULL;
+  tab_thr = NULL;
+
+  // per-atom history, migrates with the atoms: last unwrapped position,
+  // blocked displacements, VACF shift and accumulator of every level and
+  // the ring of the last N_cor positions, velocities and forces
+
+  offblock = 3;
+  offshiftv = offblock + 3*N_blocks*N_levels_msd;
+  offaccv = offshiftv + 3*N_blocks*N_levels;
+  offring = offaccv + 3*N_levels;
+  nhist = offring + 9*N_cor;
+  hist = NULL;
+  grow_arrays(atom->nmax);
+  atom->add_callback(0);
+  maxexchange = nhist;
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixScatteringBulk::~FixScatteringBulk()
 {
-  
+  atom->delete_callback(id,0);
+
+  memory->destroy(hist);
+  memory->destroy(xsoa);
+  memory->destroy(incoh_buf);
+  memory->destroy(kvec);
+  memory->destroy(modeshell);
+  memory->destroy(modeweight);
+  memory->destroy(tab_thr);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -110,17 +162,14 @@ void FixScatteringBulk::end_of_step() {
   
 /* Help functions to calculate Structure factor and coherent scattering function */
 void FixScatteringBulk::AllocArrays(){
-  // has to be adapted for parallelization
-  int N=atom->nlocal;
-
-  int nb,k;
-  AllocMem (valST, 6 * nFunCorr, real);
-  
-  AllocMem (valVEL, 3 * N, real);
+  // the per-atom parts live in hist, these are the sums and counters
+  int k;
+  SetupModes();
+  AllocMem (valST, nST, real);
+  AllocMem (valST_thr, nST * comm->nthreads, real);
   
   AllocMem (strucFac, nFunCorr, real);
   
-  AllocMem2 (blocking_sum, N_blocks*N_levels_msd, 3*N, real);
   AllocMem2 (correlationIn, N_blocks*N_levels_msd, nFunCorr, real);
   AllocMem2 (MSD, N_blocks*N_levels_msd,3,real);
     AllocMem2 (NGP, N_blocks*N_levels_msd,4,real);
@@ -128,25 +177,28 @@ void FixScatteringBulk::AllocArrays(){
   AllocMem (countMSD, N_blocks*N_levels_msd, int);
     AllocMem (countNGP, N_blocks*N_levels_msd, int);
   
-  AllocMem2 (shift, N_blocks*N_levels, 6 *  nFunCorr, real);
-  AllocMem2 (accumulator, N_levels, 6  * nFunCorr, real);
+  AllocMem2 (shift, N_blocks*N_levels, nST, real);
+  AllocMem2 (accumulator, N_levels, nST, real);
   AllocMem (naccumulator, N_levels, int);
   AllocMem2 (correlation, N_blocks*N_levels, nFunCorr, real);
   AllocMem (countcor, N_blocks*N_levels,int);
   AllocMem (insertindex, N_levels,int);
   
-  AllocMem2 (shiftVACF, N_blocks*N_levels, 3 *N, real);
-  AllocMem2 (accumulatorVACF, N_levels, 3*N, real);
   AllocMem (naccumulatorVACF, N_levels, int);
+  AllocMem (nfillVACF, N_levels, int);
   AllocMem2 (correlationVACF, N_blocks*N_levels, 3, real);
   AllocMem (countcorVACF, N_blocks*N_levels,int);
   AllocMem (insertindexVACF, N_levels,int);
   
-  AllocMem (pos_save, 3*N,real);
-  AllocMem2 (pos_save2, 9*N,N_cor,real);
-  
   AllocMem2 (correlationIn2, N_cor, 9*nFunCorr, real);
   AllocMem (countIn2, N_cor, int);
+
+  // incoherent, MSD/NGP and VACF sums of all procs are reduced in one message
+  int nslot = N_blocks*N_levels_msd;
+  nincoh = nslot*(2*nFunCorr + 3 + 4 + 2) + N_cor*(9*nFunCorr + 1)
+    + N_blocks*N_levels*4;
+  memory->destroy(incoh_buf);
+  memory->create(incoh_buf,nincoh,"scattering/bulk:incoh_buf");
   
   lastindex = 0;
 }
@@ -156,29 +208,87 @@ void FixScatteringBulk::AllocArrays(){
   void FixScatteringBulk::EvalSpacetimeCorr (){
     real b, c, c0, c1, c2, kVal, s, s1, s2;
     real cc, sc, QVal;
-    int j,  k, m, nb,  nv;
+    int j,  k, m;
     
-    int N=atom->nlocal;
     int nlocal = atom->nlocal;
     int *mask= atom->mask;
     double **x = atom->x;
     double **v = atom->v;
     double **f = atom->f;
 
-    for (j = 0; j < 6 * nFunCorr; j ++) valST[j] = 0.;
-    for (j = 0; j < 3*N; j ++) valVEL[j] = 0.;
+    for (j = 0; j < nST; j ++) valST[j] = 0.;
     count++;
     
     // calculate FT for coherent scattering fct
     kVal = 2. * M_PI / domain->xprd;
+    if (shellflag) EvalShellModes ();
+    else EvalCoherentModes (kVal);
+
+    // acumualte and calculate logarithmic correlation function
+    if (me == 0) add(valST,0);
+    
+    
+    // acumualte and calculate logarithmic velocity correlation function
+    addVACF();
+	
+    // calc structure factor, the global modes only exist on proc 0
+    // every mode enters the mean of its shell
+    if (me == 0) {
+      for (int q = 0; q < nmode; q ++) {
+        double c = valST[2*q];
+        double s = valST[2*q+1];
+
+        strucFac[modeshell[q]] += modeweight[q]*(c*c + s*s);
+      }
+    }
+    
+    // calculate \Delta r in blocking algorithm for self-intermediate scattering function
+    // level k is updated every N_blocks^k samples, its block j0 holds the
+    // displacement over j0+1 blocks of the level below
+    int t = t_loc;
+    int max_levels = (t > 0) ? (int) (log(t)/log(N_blocks)) : -1;
+    if (max_levels >= N_levels_msd) max_levels = N_levels_msd-1;
+    
+    imageint *image = atom->image;
+    double unwrap[3],del[3];
     for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        j = 0;
-        for (k = 0; k < 3; k ++) {
+      if (!(mask[i] & groupbit)) continue;
+      double *h = hist[i];
+      domain->unmap(x[i],image[i],unwrap);
+      if (t==0) {
+        h[0] = unwrap[0];
+        h[1] = unwrap[1];
+        h[2] = unwrap[2];
+      }
+      for (k=0; k<(max_levels+1); k++) {
+        if (k==0) {
+          for (int d = 0; d < 3; d++) {
+            del[d] = unwrap[d]-h[d];
+            h[d] = unwrap[d];
+          }
+        } else {
+          const double *last = &h[offblock + 3*(N_blocks-1+(k-1)*N_blocks)];
+          for (int d = 0; d < 3; d++) del[d] = last[d];
+        }
+
+        int nblocks_to_k = 1;
+        for (int kk=0; kk<k; kk++) nblocks_to_k *= N_blocks;
+        if (t % nblocks_to_k) continue;
+
+        int j0 = ((t) / nblocks_to_k-1) % N_blocks;
+        int slot = j0+k*N_blocks;
+        double *bs = &h[offblock + 3*slot];
+        if (j0==0) {
+          for (int d = 0; d < 3; d++) bs[d] = del[d];
+        } else {
+          for (int d = 0; d < 3; d++) bs[d] = bs[d-3] + del[d];
+        }
+
+        // now calculate incoherent scattering functions
+        for (int km = 0; km < 3; km ++) {
           for (m = 0; m < nFunCorr; m ++) {
             if (m == 0) {
-              b = kVal * x[i][k];
-
+              b = kVal * bs[km];
               c = cos (b);
               s = sin (b);
               c0 = c;
@@ -195,143 +305,27 @@ void FixScatteringBulk::AllocArrays(){
               c = 2. * c0 * c1 - c2;
               s = 2. * c0 * s1 - s2;
             }
-            valST[j ++] += c; //second element of SF -real part
-            valST[j ++] += s; //imaginary 
+
+            correlationIn[slot][m] += c;
+            countIn[slot][m] += 1;
           }
         }
-      }
-    }
-    // acumualte and calculate logarithmic correlation function
-    add(valST,0);
-    
-    
-    // add values to VACF
-    j = 0;
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        for (k = 0; k < 3; k ++) {
-          valVEL[j ++] = v[i][k];
-        }
-      }
-      //if (i==1) printf("input v[i][0]=%f\n",v[i][0]);
-    }
-    // acumualte and calculate logarithmic velocity correlation function
-    addVACF(valVEL,0,N);
-	
-    // calc structure factor
-    for (k = 0; k < 3; k ++) {
-      for (m = 0; m < nFunCorr; m ++) {
-        int ind_j = 2*k*nFunCorr + 2*m;
-        double c = valST[ind_j];
-        double s = valST[ind_j+1];
-
-        strucFac[m] += c*c + s*s;
-      }
-    }
-    
-    // calculate \Delta r in blocking algorithm for self-intermediate scattering function
-    int t = t_loc;
-    int np=0;
-    int max_levels = (int) (log(t)/log(N_blocks));
-    if (max_levels >= N_levels) max_levels = N_levels-1;
-    
-    tagint *tag = atom->tag;
-      imageint *image = atom->image;
-    int itag;
-    double unwrap[3];
-    //printf("max_l %d\n",max_levels);
-    for (int i = 0; i < nlocal; i++) {
-      if (mask[i] & groupbit) {
-        double delx,dely,delz;
-        int j0; // = i % N_blocks;
-        //if (np==0) printf("checkin0\n");
-        if (t==0) {
-          itag = tag[i] - 1;
-          domain->unmap(x[i],image[i],unwrap);
-          pos_save[3*itag] = unwrap[0];
-          pos_save[3*itag+1] = unwrap[1];
-          pos_save[3*itag+2] = unwrap[2];
-        }
-        for (int k=0; k<(max_levels+1); k++) {
-            
-          if (k==0) {
-            itag = tag[i] - 1;
-            domain->unmap(x[i],image[i],unwrap);
-            delx = unwrap[0]-pos_save[3*itag];
-            dely = unwrap[1]-pos_save[3*itag+1];
-            delz = unwrap[2]-pos_save[3*itag+2];
-            pos_save[3*itag] = unwrap[0];
-            pos_save[3*itag+1] = unwrap[1];
-            pos_save[3*itag+2] = unwrap[2];
-          } else {
-            delx = blocking_sum[N_blocks-1+(k-1)*N_blocks][np];
-            dely = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+N];
-            delz = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+2*N];
-          }
-            
-          int nblocks_to_k = 1 ; // (int) round(pow(N_blocks,k));
 
-          for (int kk=0; kk<k; kk++) nblocks_to_k *= N_blocks;
-          //if (np==0) printf("checkin1\n");
-          if (t % nblocks_to_k == 0) {
-              
-            j0 =  ((t) / nblocks_to_k-1) % N_blocks;  // was -1
+        // calc MSD and NGP
+        double dx2 = bs[0]*bs[0];
+        double dy2 = bs[1]*bs[1];
+        double dz2 = bs[2]*bs[2];
+        double r2 = dx2 + dy2 + dz2;
+        MSD[slot][0] += dx2;
+        MSD[slot][1] += dy2;
+        MSD[slot][2] += dz2;
+        countMSD[slot] += 1;
 
-            if (j0==0) {
-              blocking_sum[j0+k*N_blocks][np] = delx; //blocking_sum[N_blocks-1][k-1][n] ;
-              blocking_sum[j0+k*N_blocks][np+N] = dely; //blocking_sum[N_blocks-1][k-1][n] ;
-              blocking_sum[j0+k*N_blocks][np+2*N] = delz; //blocking_sum[N_blocks-1][k-1][n] ;
-            }
-            else {
-              blocking_sum[j0+k*N_blocks][np] = blocking_sum[j0-1+k*N_blocks][np] + delx; 
-              blocking_sum[j0+k*N_blocks][np+N] = blocking_sum[j0-1+k*N_blocks][np+N] + dely; 
-              blocking_sum[j0+k*N_blocks][np+2*N] = blocking_sum[j0-1+k*N_blocks][np+2*N] + delz; 
-            }
-            
-            
-            // now calculate incoherent scattering functions
-            for (int km = 0; km < 3; km ++) {
-              for (m = 0; m < nFunCorr; m ++) {
-                if (m == 0) {
-                  b = kVal * blocking_sum[j0+k*N_blocks][km*N+np] ;
-                  //if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
-                  c = cos (b);
-                  s = sin (b);
-                  c0 = c;
-                } else if (m == 1) {
-                  c1 = c;
-                  s1 = s;
-                  c = 2. * c0 * c1 - 1.;
-                  s = 2. * c0 * s1;
-                } else {
-                  c2 = c1;
-                  s2 = s1;
-                  c1 = c;
-                  s1 = s;
-                  c = 2. * c0 * c1 - c2;
-                  s = 2. * c0 * s1 - s2;
-                }
-            
-                correlationIn[j0+k*N_blocks][m] += c;
-                countIn[j0+k*N_blocks][m] += 1;
-              }
-            }
-            
-            
-            // calc MSD
-            MSD[j0+k*N_blocks][0]+=blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np];
-            MSD[j0+k*N_blocks][1]+=blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N];
-            MSD[j0+k*N_blocks][2]+=blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N];
-            countMSD[j0+k*N_blocks] += 1;
-            
-            NGP[j0+k*N_blocks][0]+=blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np];
-            NGP[j0+k*N_blocks][1]+=blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N];
-            NGP[j0+k*N_blocks][2]+=blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N];
-            NGP[j0+k*N_blocks][3]+=(blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np] + blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N] + blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N])*(blocking_sum[j0+k*N_blocks][np]*blocking_sum[j0+k*N_blocks][np] + blocking_sum[j0+k*N_blocks][np+N]*blocking_sum[j0+k*N_blocks][np+N] + blocking_sum[j0+k*N_blocks][np+2*N]*blocking_sum[j0+k*N_blocks][np+2*N]);
-            countNGP[j0+k*N_blocks] += 1;
-          }
-        }
-        np++;
+        NGP[slot][0] += dx2*dx2;
+        NGP[slot][1] += dy2*dy2;
+        NGP[slot][2] += dz2*dz2;
+        NGP[slot][3] += r2*r2;
+        countNGP[slot] += 1;
       }
     }
     
@@ -343,47 +337,46 @@ void FixScatteringBulk::AllocArrays(){
     if (t_loc<N_cor) tcor_max=t_loc;
     for (int i = 0; i < nlocal; i++) {
       if (mask[i] & groupbit) {
-        // save new positions and velocities
-        itag = tag[i] - 1;
+        // save new positions, velocities and forces
+        double *r = &hist[i][offring + 9*lastindex];
         domain->unmap(x[i],image[i],unwrap);
-        pos_save2[9*itag][lastindex] = unwrap[0];
-        pos_save2[9*itag+1][lastindex] = unwrap[1];
-        pos_save2[9*itag+2][lastindex] = unwrap[2];
-        pos_save2[9*itag+3][lastindex] = v[i][0];
-        pos_save2[9*itag+4][lastindex] = v[i][1];
-        pos_save2[9*itag+5][lastindex] = v[i][2];
-        pos_save2[9*itag+6][lastindex] = f[i][0];
-        pos_save2[9*itag+7][lastindex] = f[i][1];
-        pos_save2[9*itag+8][lastindex] = f[i][2];
+        r[0] = unwrap[0];
+        r[1] = unwrap[1];
+        r[2] = unwrap[2];
+        r[3] = v[i][0];
+        r[4] = v[i][1];
+        r[5] = v[i][2];
+        r[6] = f[i][0];
+        r[7] = f[i][1];
+        r[8] = f[i][2];
       }
     }
     
     if (update->ntimestep % nrelax == 0) {
       for (int i = 0; i < nlocal; i++) {
         if (mask[i] & groupbit) {
-          // save new positions and velocities
-          itag = tag[i] - 1;
+          const double *ring = &hist[i][offring];
           // calculate correlation function
           int ind1 = lastindex;
           int ind2 = ind1;
           for (int tcor=0; tcor < tcor_max; tcor++) {
-            double dx = pos_save2[9*itag][ind2]-pos_save2[9*itag][ind1];
-            double dy = pos_save2[9*itag+1][ind2]-pos_save2[9*itag+1][ind1];
-            double dz = pos_save2[9*itag+2][ind2]-pos_save2[9*itag+2][ind1];
+            double dx = ring[9*ind2]-ring[9*ind1];
+            double dy = ring[9*ind2+1]-ring[9*ind1+1];
+            double dz = ring[9*ind2+2]-ring[9*ind1+2];
             
-            double vx0 = pos_save2[9*itag+3][ind1];
-            double vy0 = pos_save2[9*itag+4][ind1];
-            double vz0 = pos_save2[9*itag+5][ind1];
-            double vxt = pos_save2[9*itag+3][ind2];
-            double vyt = pos_save2[9*itag+4][ind2];
-            double vzt = pos_save2[9*itag+5][ind2];
+            double vx0 = ring[9*ind1+3];
+            double vy0 = ring[9*ind1+4];
+            double vz0 = ring[9*ind1+5];
+            double vxt = ring[9*ind2+3];
+            double vyt = ring[9*ind2+4];
+            double vzt = ring[9*ind2+5];
             
-            double Fx0 = pos_save2[9*itag+6][ind1];
-            double Fy0 = pos_save2[9*itag+7][ind1];
-            double Fz0 = pos_save2[9*itag+8][ind1];
-            double Fxt = pos_save2[9*itag+6][ind2];
-            double Fyt = pos_save2[9*itag+7][ind2];
-            double Fzt = pos_save2[9*itag+8][ind2];
+            double Fx0 = ring[9*ind1+6];
+            double Fy0 = ring[9*ind1+7];
+            double Fz0 = ring[9*ind1+8];
+            double Fxt = ring[9*ind2+6];
+            double Fyt = ring[9*ind2+7];
+            double Fzt = ring[9*ind2+8];
             
             for (m = 0; m < nFunCorr; m ++) {
               if (m == 0) {
@@ -478,6 +471,280 @@ void FixScatteringBulk::AllocArrays(){
     } else t_loc++;
   }
   
+  /***************************************************************************************/
+
+  /* Fourier modes of the density along the three axes, summed over all group atoms
+     of all procs. The Chebyshev recurrence cos((m+1)b), sin((m+1)b) runs over blocks
+     of atoms so the inner loops vectorize; threads accumulate into private sums */
+  void FixScatteringBulk::EvalCoherentModes (real kVal){
+    int i, j, k;
+    int nthreads = comm->nthreads;
+
+    int ngroup = GatherGroup ();
+
+    for (j = 0; j < nST * nthreads; j ++) valST_thr[j] = 0.;
+
+#if defined (_OPENMP)
+#pragma omp parallel private(i,j,k) default(none) shared(ngroup,kVal)
+#endif
+    {
+      int ifrom, ito, tid;
+      loop_setup_thr(ifrom, ito, tid, ngroup, comm->nthreads);
+      real *acc = &valST_thr[nST * tid];
+      real c0[SCATTER_CHUNK], c[SCATTER_CHUNK], s[SCATTER_CHUNK];
+      real c1[SCATTER_CHUNK], s1[SCATTER_CHUNK];
+
+      for (k = 0; k < 3; k ++) {
+        const real *xk = &xsoa[k*maxsoa];
+        for (int ilo = ifrom; ilo < ito; ilo += SCATTER_CHUNK) {
+          int n = ito - ilo;
+          if (n > SCATTER_CHUNK) n = SCATTER_CHUNK;
+
+          // m = 0, the previous harmonic is cos(0)=1, sin(0)=0
+          for (i = 0; i < n; i ++) {
+            real b = kVal * xk[ilo+i];
+            c[i] = cos (b);
+            s[i] = sin (b);
+            c0[i] = c[i];
+            c1[i] = 1.;
+            s1[i] = 0.;
+          }
+
+          for (int m = 0; m < nFunCorr; m ++) {
+            if (m > 0) {
+              for (i = 0; i < n; i ++) {
+                real cn = 2. * c0[i] * c[i] - c1[i];
+                real sn = 2. * c0[i] * s[i] - s1[i];
+                c1[i] = c[i];
+                s1[i] = s[i];
+                c[i] = cn;
+                s[i] = sn;
+              }
+            }
+            real sumc = 0., sums = 0.;
+#if defined (_OPENMP)
+#pragma omp simd reduction(+:sumc,sums)
+#endif
+            for (i = 0; i < n; i ++) {
+              sumc += c[i];
+              sums += s[i];
+            }
+            j = 2*k*nFunCorr + 2*m;
+            acc[j] += sumc; //second element of SF -real part
+            acc[j+1] += sums; //imaginary
+          }
+        }
+      }
+    }
+
+    ReduceModes ();
+  }
+
+  /***************************************************************************************/
+
+  /* gather group coordinates, one contiguous array per axis */
+  int FixScatteringBulk::GatherGroup (){
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    double **x = atom->x;
+
+    if (atom->nmax > maxsoa) {
+      maxsoa = atom->nmax;
+      memory->destroy(xsoa);
+      memory->create(xsoa,3*maxsoa,"scattering/bulk:xsoa");
+    }
+    int ngroup = 0;
+    for (int i = 0; i < nlocal; i++) {
+      if (mask[i] & groupbit) {
+        xsoa[ngroup] = x[i][0];
+        xsoa[maxsoa+ngroup] = x[i][1];
+        xsoa[2*maxsoa+ngroup] = x[i][2];
+        ngroup++;
+      }
+    }
+    return ngroup;
+  }
+
+  /***************************************************************************************/
+
+  /* Mode list of the correlator. Axis mode: harmonic m along axis k is mode
+     k*nFunCorr+m. Shell mode: every wavevector of the half space (-k gives
+     the complex conjugate) with |k| within shellwidth/2 of (m+1)*2pi/Lx, in
+     units of the reciprocal lattice of the current box. Each mode enters the
+     mean of its shell with weight 1/(modes in the shell). */
+  void FixScatteringBulk::SetupModes (){
+    int q, m;
+
+    memory->destroy(kvec);
+    memory->destroy(modeshell);
+    memory->destroy(modeweight);
+    memory->destroy(tab_thr);
+
+    if (!shellflag) {
+      nmode = 3*nFunCorr;
+      nST = 2*nmode;
+      memory->create(modeshell,nmode,"scattering/bulk:modeshell");
+      memory->create(modeweight,nmode,"scattering/bulk:modeweight");
+      for (int k = 0; k < 3; k ++)
+        for (m = 0; m < nFunCorr; m ++) {
+          q = k*nFunCorr + m;
+          modeshell[q] = m;
+          modeweight[q] = 1.0/3.0;
+        }
+      return;
+    }
+
+    double scale[3];
+    int nmax[3];
+    double rhi = nFunCorr + 0.5*shellwidth;
+    scale[0] = 1.0;
+    scale[1] = domain->xprd/domain->yprd;
+    scale[2] = domain->xprd/domain->zprd;
+    nkmax = 0;
+    for (int a = 0; a < 3; a ++) {
+      nmax[a] = (int) (rhi/scale[a]) + 1;
+      if (nmax[a] > nkmax) nkmax = nmax[a];
+    }
+
+    // two passes: count the modes, then store them
+    int *nshell = new int[nFunCorr];
+    for (int pass = 0; pass < 2; pass ++) {
+      for (m = 0; m < nFunCorr; m ++) nshell[m] = 0;
+      q = 0;
+      for (int nx = 0; nx <= nmax[0]; nx ++)
+        for (int ny = -nmax[1]; ny <= nmax[1]; ny ++)
+          for (int nz = -nmax[2]; nz <= nmax[2]; nz ++) {
+            if (nx == 0 && (ny < 0 || (ny == 0 && nz <= 0))) continue;
+            double r = sqrt(Sqr(nx*scale[0]) + Sqr(ny*scale[1]) + Sqr(nz*scale[2]));
+            m = (int) floor(r + 0.5) - 1;
+            if (m < 0 || m >= nFunCorr) continue;
+            if (fabs(r - (m+1)) >= 0.5*shellwidth) continue;
+            if (pass == 1) {
+              kvec[q][0] = nx;
+              kvec[q][1] = ny;
+              kvec[q][2] = nz;
+              modeshell[q] = m;
+            }
+            nshell[m]++;
+            q++;
+          }
+      if (pass == 0) {
+        nmode = q;
+        memory->create(kvec,nmode,3,"scattering/bulk:kvec");
+        memory->create(modeshell,nmode,"scattering/bulk:modeshell");
+        memory->create(modeweight,nmode,"scattering/bulk:modeweight");
+      }
+    }
+    for (m = 0; m < nFunCorr; m ++)
+      if (nshell[m] == 0)
+        error->all(FLERR,"Fix scattering/bulk k-shell contains no wavevectors");
+    for (q = 0; q < nmode; q ++) modeweight[q] = 1.0/nshell[modeshell[q]];
+    delete [] nshell;
+
+    nST = 2*nmode;
+    memory->create(tab_thr,comm->nthreads*6*(nkmax+1)*SCATTER_CHUNK,
+                   "scattering/bulk:tab_thr");
+  }
+
+  /***************************************************************************************/
+
+  /* Density modes of all wavevectors of the shells. Per block of atoms the
+     tables cos/sin(n k_a x_a) are built once per axis with the Chebyshev
+     recurrence, every wavevector then costs two complex products per atom
+     in a unit stride loop over the block. */
+  void FixScatteringBulk::EvalShellModes (){
+    int i, j;
+    int nthreads = comm->nthreads;
+
+    int ngroup = GatherGroup ();
+    real kax[3];
+    kax[0] = 2. * M_PI / domain->xprd;
+    kax[1] = 2. * M_PI / domain->yprd;
+    kax[2] = 2. * M_PI / domain->zprd;
+
+    for (j = 0; j < nST * nthreads; j ++) valST_thr[j] = 0.;
+
+#if defined (_OPENMP)
+#pragma omp parallel private(i,j) default(none) shared(ngroup,kax)
+#endif
+    {
+      int ifrom, ito, tid;
+      loop_setup_thr(ifrom, ito, tid, ngroup, comm->nthreads);
+      real *acc = &valST_thr[nST * tid];
+      const int ntab = (nkmax+1)*SCATTER_CHUNK;
+      real *tab = &tab_thr[6 * ntab * tid];
+
+      for (int ilo = ifrom; ilo < ito; ilo += SCATTER_CHUNK) {
+        int n = ito - ilo;
+        if (n > SCATTER_CHUNK) n = SCATTER_CHUNK;
+
+        // row l of axis a: cos and sin of l*k_a*x_a for the atoms of the block
+        for (int a = 0; a < 3; a ++) {
+          const real *xa = &xsoa[a*maxsoa + ilo];
+          real *ct = &tab[2*a*ntab];
+          real *st = &tab[(2*a+1)*ntab];
+          for (i = 0; i < n; i ++) {
+            ct[i] = 1.;
+            st[i] = 0.;
+            real b = kax[a] * xa[i];
+            ct[SCATTER_CHUNK+i] = cos (b);
+            st[SCATTER_CHUNK+i] = sin (b);
+          }
+          const real *c1 = &ct[SCATTER_CHUNK];
+          for (int l = 2; l <= nkmax; l ++) {
+            real *cl = &ct[l*SCATTER_CHUNK];
+            real *sl = &st[l*SCATTER_CHUNK];
+            for (i = 0; i < n; i ++) {
+              cl[i] = 2. * c1[i] * cl[i-SCATTER_CHUNK] - cl[i-2*SCATTER_CHUNK];
+              sl[i] = 2. * c1[i] * sl[i-SCATTER_CHUNK] - sl[i-2*SCATTER_CHUNK];
+            }
+          }
+        }
+
+        for (int q = 0; q < nmode; q ++) {
+          int ny = kvec[q][1], nz = kvec[q][2];
+          const real sgy = (ny < 0) ? -1. : 1.;
+          const real sgz = (nz < 0) ? -1. : 1.;
+          const real *cx = &tab[kvec[q][0]*SCATTER_CHUNK];
+          const real *sx = &tab[ntab + kvec[q][0]*SCATTER_CHUNK];
+          const real *cy = &tab[2*ntab + abs(ny)*SCATTER_CHUNK];
+          const real *sy = &tab[3*ntab + abs(ny)*SCATTER_CHUNK];
+          const real *cz = &tab[4*ntab + abs(nz)*SCATTER_CHUNK];
+          const real *sz = &tab[5*ntab + abs(nz)*SCATTER_CHUNK];
+          real sumc = 0., sums = 0.;
+#if defined (_OPENMP)
+#pragma omp simd reduction(+:sumc,sums)
+#endif
+          for (i = 0; i < n; i ++) {
+            real re = cx[i]*cy[i] - sgy*sx[i]*sy[i];
+            real im = sx[i]*cy[i] + sgy*cx[i]*sy[i];
+            sumc += re*cz[i] - sgz*im*sz[i];
+            sums += im*cz[i] + sgz*re*sz[i];
+          }
+          acc[2*q] += sumc;
+          acc[2*q+1] += sums;
+        }
+      }
+    }
+
+    ReduceModes ();
+  }
+
+  /***************************************************************************************/
+
+  /* reduce threads, then procs: proc 0 correlates the global modes */
+  void FixScatteringBulk::ReduceModes (){
+    int nthreads = comm->nthreads;
+    for (int j = 0; j < nST; j ++) {
+      valST[j] = 0.;
+      for (int t = 0; t < nthreads; t ++) valST[j] += valST_thr[nST * t + j];
+    }
+    if (me == 0)
+      MPI_Reduce(MPI_IN_PLACE,valST,nST,MPI_DOUBLE,MPI_SUM,0,world);
+    else
+      MPI_Reduce(valST,NULL,nST,MPI_DOUBLE,MPI_SUM,0,world);
+  }
+
   /***************************************************************************************/
   
   void FixScatteringBulk::add(real * val, int k){
@@ -486,68 +753,37 @@ void FixScatteringBulk::AllocArrays(){
     if (k > kmax) kmax=k;
 
     // Insert new value in shift array
-    for (int i = 0; i < 6 * nFunCorr; i ++)
+    for (int i = 0; i < nST; i ++)
       shift[k*N_blocks+insertindex[k]][i] = val[i];
 
     // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 6 * nFunCorr ; i ++)
+    for (int i = 0; i < nST ; i ++)
       accumulator[k][i] += val[i];
     ++naccumulator[k];
     if (naccumulator[k]==N_count) {
-      for (int i = 0; i < 6 * nFunCorr ; i ++) accumulator[k][i] /= N_count;
+      for (int i = 0; i < nST ; i ++) accumulator[k][i] /= N_count;
       add(&accumulator[k][0], k+1);
-      for (int i = 0; i < 6 * nFunCorr ; i ++) accumulator[k][i]=0.0;
+      for (int i = 0; i < nST ; i ++) accumulator[k][i]=0.0;
       naccumulator[k]=0;
     }
 
     // Calculate correlation function
-    unsigned int ind1=insertindex[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int kp = 0; kp < 3; kp ++) {
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m;
-	    int ind_j = kp*2*nFunCorr + 2*m;
-	    double c = shift[k*N_blocks+ind2][ind_j];
-	    double s = shift[k*N_blocks+ind2][ind_j+1];
-	    double c2 = shift[k*N_blocks+ind1][ind_j];
-	    double s2 = shift[k*N_blocks+ind1][ind_j+1];
-	    
-	    if (c > -1e10) {
-
-	      correlation[k*N_blocks+j][nv]  += c*c2 + s*s2;
-
-	      if (nv==0) ++countcor[k*N_blocks+j];
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-dmin;
-      for (int j=dmin;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
-	for (int kp = 0; kp < 3; kp ++) {
-	  for (int m = 0; m < nFunCorr; m ++) {
-	    int nv = m ;
-	    int ind_j = kp*2*nFunCorr + 2*m;
-	    double c = shift[k*N_blocks+ind2][ind_j];
-	    double s = shift[k*N_blocks+ind2][ind_j+1];
-	    double c2 = shift[k*N_blocks+ind1][ind_j];
-	    double s2 = shift[k*N_blocks+ind1][ind_j+1];
-	    
-	    if (c > -1e10) {
-	      correlation[k*N_blocks+j][nv]  += c*c2 + s*s2;
-
-	      if (nv==0) ++countcor[k*N_blocks+j];
-	    }
-
-	  }
-	}
-	--ind2;
+    // First correlator is different, the others start at dmin
+    // Re(rho(t) rho*(t')) of every mode is added to the mean of its shell
+    int ind1=insertindex[k];
+    int jlo = (k==0) ? 0 : dmin;
+    int ind2=ind1-jlo;
+    for (int j=jlo;j<N_blocks;++j) {
+      if (ind2<0) ind2+=N_blocks;
+      const real *a = shift[k*N_blocks+ind2];
+      const real *a2 = shift[k*N_blocks+ind1];
+      if (a[0] > -1e10) {
+	real *corr = correlation[k*N_blocks+j];
+	for (int q = 0; q < nmode; q ++)
+	  corr[modeshell[q]] += modeweight[q]*(a[2*q]*a2[2*q] + a[2*q+1]*a2[2*q+1]);
+	++countcor[k*N_blocks+j];
       }
+      --ind2;
     }
 
     ++insertindex[k];
@@ -558,81 +794,77 @@ void FixScatteringBulk::AllocArrays(){
   
    /***************************************************************************************/
   
-  void FixScatteringBulk::addVACF(real * val, int k, int N){
-    // If we exceed the correlator side, the value is discarded
-    if (k == N_levels) return;
-    if (k > kmax) kmax=k;
-
-    // Insert new value in shift array
-    for (int i = 0; i < 3 * N; i ++)
-      shiftVACF[k*N_blocks+insertindexVACF[k]][i] = val[i];
+  /* Multi-tau VACF of every group atom. The level schedule is the same for
+     all atoms, so it is set once per sample; shift and accumulator of each
+     level are part of the per-atom history and migrate with the atom. */
+  void FixScatteringBulk::addVACF(){
+    int i, j, k, kp;
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    double **v = atom->v;
 
-    // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 3 * N ; i ++)
-      accumulatorVACF[k][i] += val[i];
-    ++naccumulatorVACF[k];
-    if (naccumulatorVACF[k]==N_count) {
-      for (int i = 0; i < 3 * N ; i ++) accumulatorVACF[k][i] /= N_count;
-      addVACF(&accumulatorVACF[k][0], k+1,N);
-      for (int i = 0; i < 3 * N ; i ++) accumulatorVACF[k][i]=0.0;
-      naccumulatorVACF[k]=0;
+    // level 0 takes every sample, level k+1 the mean of every N_count
+    // samples of level k, values beyond the last level are discarded
+    int nup = 0, nfull = 0;
+    for (k = 0; k < N_levels; k++) {
+      nup++;
+      if (k > kmax) kmax = k;
+      if (nfillVACF[k] < N_blocks) nfillVACF[k]++;
+      if (++naccumulatorVACF[k] < N_count) break;
+      naccumulatorVACF[k] = 0;
+      nfull++;
     }
 
-    // Calculate correlation function
-    unsigned int ind1=insertindexVACF[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int m = 0; m < N; m ++) {
-      
-	  for (int kp = 0; kp < 3; kp ++) {
-	    int ind_j = 3*m+kp;
-	    double t0 = shiftVACF[k*N_blocks+ind2][ind_j];
-	    double t1 = shiftVACF[k*N_blocks+ind1][ind_j];
-	    
-	    if (t0 > -1e10) {
+    for (i = 0; i < nlocal; i++) {
+      if (!(mask[i] & groupbit)) continue;
+      double *h = hist[i];
+      double val[3];
+      for (kp = 0; kp < 3; kp ++) val[kp] = v[i][kp];
 
-	      correlationVACF[k*N_blocks+j][kp]  += t0*t1;
-	      
-	      if (kp==0) ++countcorVACF[k*N_blocks+j];
+      for (k = 0; k < nup; k++) {
+        double *sh = &h[offshiftv + 3*k*N_blocks];
+        double *acc = &h[offaccv + 3*k];
+        int ind1 = insertindexVACF[k];
 
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-dmin;
-      for (int j=dmin;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
-	for (int m = 0; m < N; m ++) {
-
-	  for (int kp = 0; kp < 3; kp ++) {
-	    int ind_j = 3*m+kp;
-	    double t0 = shiftVACF[k*N_blocks+ind2][ind_j];
-	    double t1 = shiftVACF[k*N_blocks+ind1][ind_j];
-	    
-	    if (t0 > -1e10) {
-	      correlationVACF[k*N_blocks+j][kp]  += t0*t1;
-	      if (kp==0) ++countcorVACF[k*N_blocks+j];
-	    }
+        // Insert new value in shift array and add to accumulator
+        for (kp = 0; kp < 3; kp ++) {
+          sh[3*ind1+kp] = val[kp];
+          acc[kp] += val[kp];
+        }
+        if (k < nfull) {
+          for (kp = 0; kp < 3; kp ++) {
+            val[kp] = acc[kp] / N_count;
+            acc[kp] = 0.0;
+          }
+        }
 
-	  }
-	}
-	--ind2;
+        // Calculate correlation function
+        // First correlator is different, the others start at dmin
+        int jlo = (k==0) ? 0 : dmin;
+        for (j = jlo; j < nfillVACF[k]; j++) {
+          int ind2 = ind1 - j;
+          if (ind2 < 0) ind2 += N_blocks;
+          real *corr = correlationVACF[k*N_blocks+j];
+          for (kp = 0; kp < 3; kp ++)
+            corr[kp] += sh[3*ind2+kp]*sh[3*ind1+kp];
+          ++countcorVACF[k*N_blocks+j];
+        }
       }
     }
 
-    ++insertindexVACF[k];
-    if (insertindexVACF[k]==N_blocks) insertindexVACF[k]=0;
-
+    for (k = 0; k < nup; k++) {
+      ++insertindexVACF[k];
+      if (insertindexVACF[k]==N_blocks) insertindexVACF[k]=0;
+    }
   }
   
 /***************************************************************************************/
 
   void FixScatteringBulk::AccumSpacetimeCorr (){
-    
+
+    ReduceSpacetimeCorrIn ();
+
+    if (me == 0) {
     // print coherent
         long double sysTime = update->ntimestep*nevery*update->dt;;
     //printf("systemTime %Lf\n",sysTime);
@@ -670,7 +902,7 @@ void FixScatteringBulk::AllocArrays(){
     out = fopen(out_string3.c_str(),"w");
     PrintStrucFac (out);
     fclose(out);
-    
+    }
 
     
     count = 0;
@@ -684,14 +916,56 @@ void FixScatteringBulk::AllocArrays(){
     ZeroSpacetimeCorrIn2 ();
   }
   
+/***************************************************************************************/
+
+  /* Sum the per-atom accumulations of all procs into the arrays of proc 0,
+     packed into a single message. The coherent correlator and the structure
+     factor are already global on proc 0. */
+  void FixScatteringBulk::ReduceSpacetimeCorrIn ()
+  {
+    int nslot = N_blocks*N_levels_msd;
+    int nvacf = N_blocks*N_levels;
+    int i, n = 0;
+
+    for (i = 0; i < nslot*nFunCorr; i ++) incoh_buf[n++] = correlationIn[0][i];
+    for (i = 0; i < nslot*nFunCorr; i ++) incoh_buf[n++] = countIn[0][i];
+    for (i = 0; i < nslot*3; i ++) incoh_buf[n++] = MSD[0][i];
+    for (i = 0; i < nslot*4; i ++) incoh_buf[n++] = NGP[0][i];
+    for (i = 0; i < nslot; i ++) incoh_buf[n++] = countMSD[i];
+    for (i = 0; i < nslot; i ++) incoh_buf[n++] = countNGP[i];
+    for (i = 0; i < N_cor*9*nFunCorr; i ++) incoh_buf[n++] = correlationIn2[0][i];
+    for (i = 0; i < N_cor; i ++) incoh_buf[n++] = countIn2[i];
+    for (i = 0; i < nvacf*3; i ++) incoh_buf[n++] = correlationVACF[0][i];
+    for (i = 0; i < nvacf; i ++) incoh_buf[n++] = countcorVACF[i];
+
+    if (me == 0)
+      MPI_Reduce(MPI_IN_PLACE,incoh_buf,nincoh,MPI_DOUBLE,MPI_SUM,0,world);
+    else {
+      MPI_Reduce(incoh_buf,NULL,nincoh,MPI_DOUBLE,MPI_SUM,0,world);
+      return;
+    }
+
+    n = 0;
+    for (i = 0; i < nslot*nFunCorr; i ++) correlationIn[0][i] = incoh_buf[n++];
+    for (i = 0; i < nslot*nFunCorr; i ++) countIn[0][i] = (int) incoh_buf[n++];
+    for (i = 0; i < nslot*3; i ++) MSD[0][i] = incoh_buf[n++];
+    for (i = 0; i < nslot*4; i ++) NGP[0][i] = incoh_buf[n++];
+    for (i = 0; i < nslot; i ++) countMSD[i] = (int) incoh_buf[n++];
+    for (i = 0; i < nslot; i ++) countNGP[i] = (int) incoh_buf[n++];
+    for (i = 0; i < N_cor*9*nFunCorr; i ++) correlationIn2[0][i] = incoh_buf[n++];
+    for (i = 0; i < N_cor; i ++) countIn2[i] = (int) incoh_buf[n++];
+    for (i = 0; i < nvacf*3; i ++) correlationVACF[0][i] = incoh_buf[n++];
+    for (i = 0; i < nvacf; i ++) countcorVACF[i] = (int) incoh_buf[n++];
+  }
+
 /***************************************************************************************/
 
   void FixScatteringBulk::ZeroSpacetimeCorr () 
   {
-    int N=atom->nlocal;
+    int nlocal = atom->nlocal;
     
     for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 6* nFunCorr; j ++) { 
+      for (int j = 0; j < nST; j ++) { 
 	shift[kp][j] = -2E10;
       }
       for (int j = 0; j < nFunCorr; j ++) { 
@@ -700,43 +974,39 @@ void FixScatteringBulk::AllocArrays(){
       countcor[kp] = 0;
     }
     for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 6 * nFunCorr; j ++) { 
+      for (int j = 0; j < nST; j ++) { 
 	accumulator[k][j] = 0.;
       }
       naccumulator[k] = 0;
       insertindex[k] = 0;
     }
     
-        for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 3*N; j ++) { 
-	shiftVACF[kp][j] = -2E10;
-      }
+    for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
       for (int j = 0; j < 3; j ++) { 
 	correlationVACF[kp][j] = 0.;
       }
       countcorVACF[kp] = 0;
     }
     for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 3*N; j ++) { 
-	accumulatorVACF[k][j] = 0.;
-      }
       naccumulatorVACF[k] = 0;
       insertindexVACF[k] = 0;
+      nfillVACF[k] = 0;
     }
+    for (int i = 0; i < nlocal; i ++)
+      for (int j = 0; j < 3*N_levels; j ++) hist[i][offaccv+j] = 0.;
   }
 
 /***************************************************************************************/
   
   void FixScatteringBulk::ZeroSpacetimeCorrIn () 
   {
-    int N=atom->nlocal;
+    int nlocal = atom->nlocal;
     
+    for (int i = 0; i < nlocal; i ++)
+      for (int j = 0; j < 3*N_blocks*N_levels_msd; j ++)
+	hist[i][offblock+j] = 0.;
+
     for (int kp = 0; kp < N_blocks*N_levels_msd; kp ++) {
-      for (int i = 0; i < N; i ++) { 
-	blocking_sum[kp][i] = 0.;
-	blocking_sum[kp][i+N] = 0.;
-	blocking_sum[kp][i+2*N] = 0.;
-      }
       for (int j = 0; j < nFunCorr; j ++) { 
 	correlationIn[kp][j] = 0.;
 	countIn[kp][j] = 0;
@@ -773,7 +1043,8 @@ void FixScatteringBulk::AllocArrays(){
   
   void FixScatteringBulk::PrintStrucFac  (FILE *fp){
 
-        int N=atom->nlocal;
+    // the modes are summed over all procs
+    double N = atom->natoms;
     
     fprintf(fp,"#qval S(q)\n");
   
@@ -781,7 +1052,7 @@ void FixScatteringBulk::AllocArrays(){
     double kval = 2. * M_PI / domain->xprd;
     for (int m = 0; m < nFunCorr; m ++) {
       fprintf(fp,"%f ",(m+1)*kval);
-	fprintf(fp,"%f ",strucFac[m]/((double) count)/3. / ((double) N));
+	fprintf(fp,"%f ",strucFac[m]/((double) count) / ((double) N));
       
       fprintf(fp,"\n");
     }
@@ -790,10 +1061,7 @@ void FixScatteringBulk::AllocArrays(){
 /***************************************************************************************/
 
   void FixScatteringBulk::PrintSpacetimeCorr (FILE *fp){
-    real tVal;
-    int j, n;
-    
-    int N=atom->nlocal;
+    double Nall = atom->natoms;
     const double dt = nevery*update->dt;
 
     double kVal = 2. * M_PI / domain->xprd;
@@ -812,7 +1080,7 @@ void FixScatteringBulk::AllocArrays(){
 	  fprintf (fp, "%8.4f", t);
 	  for (int m = 0; m < nFunCorr; m ++) {
 	    int nv = m ;
-	    fprintf (fp, " %8.4f", correlation[j][nv]/countcor[j]/N);
+	    fprintf (fp, " %8.4f", correlation[j][nv]/countcor[j]/Nall);
 	  }
 	  	  if (countcorVACF[j]>0) {
 	   fprintf (fp, " %10.6f %10.6f %10.6f", correlationVACF[j][0]/countcorVACF[j], correlationVACF[j][1]/countcorVACF[j], correlationVACF[j][2]/countcorVACF[j]);
@@ -828,7 +1096,7 @@ void FixScatteringBulk::AllocArrays(){
 	    fprintf (fp, "%8.4f", t);
 	    for (int m = 0; m < nFunCorr; m ++) {
 	      int nv = m ;
-	      fprintf (fp, " %8.4f", correlation[k*N_blocks+j][nv]/countcor[k*N_blocks+j]/N);
+	      fprintf (fp, " %8.4f", correlation[k*N_blocks+j][nv]/countcor[k*N_blocks+j]/Nall);
 	    }
 	    	  if (countcorVACF[k*N_blocks+j]>0) {
 	   fprintf (fp, " %10.6f %10.6f %10.6f", correlationVACF[k*N_blocks+j][0]/countcorVACF[k*N_blocks+j], correlationVACF[k*N_blocks+j][1]/countcorVACF[k*N_blocks+j], correlationVACF[k*N_blocks+j][2]/countcorVACF[k*N_blocks+j]);
@@ -914,3 +1182,50 @@ void FixScatteringBulk::AllocArrays(){
  
   }
  
+
+/* ----------------------------------------------------------------------
+   memory usage of local atom-based arrays
+------------------------------------------------------------------------- */
+
+double FixScatteringBulk::memory_usage()
+{
+  return (double) atom->nmax * nhist * sizeof(double);
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::grow_arrays(int nmax)
+{
+  memory->grow(hist,nmax,nhist,"scattering/bulk:hist");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringBulk::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(hist[j],hist[i],nhist*sizeof(double));
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::pack_exchange(int i, double *buf)
+{
+  for (int m = 0; m < nhist; m++) buf[m] = hist[i][m];
+  return nhist;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringBulk::unpack_exchange(int nlocal, double *buf)
+{
+  for (int m = 0; m < nhist; m++) hist[nlocal][m] = buf[m];
+  return nhist;
+}
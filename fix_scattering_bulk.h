@@ -21,6 +21,7 @@ FixStyle(scattering/bulk,FixScatteringBulk)
 #define LMP_FIX_SCATTERING_BULK_H
 
 #include "fix.h"
+#include "thr_omp.h"
 #include <vector>
 
 
@@ -48,19 +49,47 @@ class FixScatteringBulk : public Fix {
     void setup(int);
     void end_of_step();
 
+    double memory_usage();
+    void grow_arrays(int);
+    void copy_arrays(int, int, int);
+    int pack_exchange(int, double *);
+    int unpack_exchange(int, double *);
+
   protected:
+    int me;
 
     real *valST;
-    real *valVEL;
     int nFunCorr;
     
     real *strucFac;
 
+    // structure of arrays copy of the group coordinates and per-thread mode sums
+    real *xsoa;
+    int maxsoa;
+    real *valST_thr;
+    int GatherGroup ();
+    void EvalCoherentModes (real kVal);
+    void ReduceModes ();
+
+    // correlated density modes: 3 axes x nFunCorr harmonics, or all
+    // wavevectors of nFunCorr shells (kshell keyword), nST = 2*nmode
+    int shellflag;
+    real shellwidth;
+    int nmode,nST;
+    int **kvec;           // shell mode: reciprocal lattice indices
+    int *modeshell;       // shell (harmonic) of each mode
+    real *modeweight;     // 1/(modes in the shell)
+    int nkmax;            // largest lattice index along any axis
+    real *tab_thr;        // per-thread cos/sin tables of a block of atoms
+    void SetupModes ();
+    void EvalShellModes ();
+
     void AllocArrays();
     void EvalSpacetimeCorr ();
     void add (real * val, int k);
-    void addVACF (real * val, int k, int N);
+    void addVACF ();
     void AccumSpacetimeCorr ();
+    void ReduceSpacetimeCorrIn ();
     void ZeroSpacetimeCorr ();
     void ZeroSpacetimeCorrIn ();
     void ZeroSpacetimeCorrIn2 ();
@@ -75,8 +104,15 @@ class FixScatteringBulk : public Fix {
     int N_levels_msd;
     int N_cor;
     int dmin;
-    real ** blocking_sum;
-    real * pos_save;
+
+    // per-atom history, migrates with the atoms: last unwrapped position
+    // (3), blocked displacements (3 per slot from offblock), VACF shift
+    // (3 per slot from offshiftv) and accumulator (3 per level from
+    // offaccv), ring of positions, velocities and forces (9 per entry
+    // from offring)
+    double **hist;
+    int nhist;
+    int offblock,offshiftv,offaccv,offring;
     
     int nrelax;
 
@@ -100,17 +136,18 @@ class FixScatteringBulk : public Fix {
     int * insertindex;
     int * countcor;
     
-    real ** shiftVACF;
-    real ** accumulatorVACF;
     int * naccumulatorVACF;
+    int * nfillVACF;      // valid slots of every VACF level
     real ** correlationVACF;
     int * insertindexVACF;
     int * countcorVACF;
 
-    real ** pos_save2;
     real ** correlationIn2;
     int * countIn2;
     int lastindex;
+
+    real * incoh_buf;   // packed per-proc sums for the reduction at output
+    int nincoh;
   };
 }
 
@@ -13,38 +13,97 @@
 
 #include "stdlib.h"
 #include "string.h"
-#include "unistd.h"
+#include "math.h"
 #include "fix_scattering_log.h"
 #include "update.h"
-#include "modify.h"
-#include "compute.h"
 #include "group.h"
-#include "fix_store.h"
-#include "input.h"
-#include "variable.h"
 #include "domain.h"
 #include "memory.h"
 #include "error.h"
 #include "force.h"
 #include "atom.h"
 #include "comm.h"
+#include <sstream>
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
 
+/* ----------------------------------------------------------------------
+   coherent and incoherent scattering functions in a slit along z,
+   periodic modes along x and y times standing modes across the channel
+   fix ID group scattering/log Nevery Nblocks Nlevels Nfuncorr Nmodes width Nbins
+------------------------------------------------------------------------- */
+
 FixScatteringLog::FixScatteringLog(LAMMPS * lmp, int narg, char **arg):
   Fix (lmp, narg, arg)
 {
-  if (narg < 7) error->all(FLERR,"Illegal fix scattering/log command");
-
-  
+  if (narg != 10) error->all(FLERR,"Illegal fix scattering/log command");
+
+  MPI_Comm_rank(world,&me);
+
+  nevery = force->inumeric(FLERR,arg[3]);
+  N_blocks = force->inumeric(FLERR,arg[4]);
+  N_levels = force->inumeric(FLERR,arg[5]);
+  nFunCorr = force->inumeric(FLERR,arg[6]);
+  nModes = force->inumeric(FLERR,arg[7]);
+  channel_w = force->numeric(FLERR,arg[8]);
+  profileBins = force->inumeric(FLERR,arg[9]);
+  if (nevery <= 0 || N_blocks < 2 || N_levels <= 0 || nFunCorr <= 0 ||
+      nModes <= 0 || channel_w <= 0.0 || profileBins <= 0)
+    error->all(FLERR,"Illegal fix scattering/log command");
+
+  // coherent modes: per mode n, axis k, harmonic m the products
+  // c*cc, c*sc, s*cc, s*sc
+
+  nST = 8 * nModes * nFunCorr;
+  memory->create(valST,nST,"scattering/log:valST");
+  memory->create(valST_all,nST,"scattering/log:valST_all");
+  memory->create(strucFac,nFunCorr,(2*nModes-1)*(2*nModes-1),
+                 "scattering/log:strucFac");
+
+  int nslot = N_blocks*N_levels;
+  int nm = nModes*nFunCorr;
+  memory->create(shift,nslot,nST,"scattering/log:shift");
+  memory->create(accumulator,N_levels,nST,"scattering/log:accumulator");
+  memory->create(naccumulator,N_levels,"scattering/log:naccumulator");
+  memory->create(correlation,nslot,nm,"scattering/log:correlation");
+  memory->create(countcor,nslot,"scattering/log:countcor");
+  memory->create(insertindex,N_levels,"scattering/log:insertindex");
+
+  nincoh = 2*nslot*nm + profileBins;
+  memory->create(incoh_buf,nincoh,"scattering/log:incoh_buf");
+  memory->create(incoh_all,nincoh,"scattering/log:incoh_all");
+  correlationIn = incoh_buf;
+  countIn = incoh_buf + nslot*nm;
+  densityProfile = countIn + nslot*nm;
+
+  // per-atom displacement history
+
+  nhist = 3 + 3*nslot;
+  hist = NULL;
+  grow_arrays(atom->nmax);
+  atom->add_callback(0);
+  maxexchange = nhist;
 }
 
 /* ---------------------------------------------------------------------- */
 
 FixScatteringLog::~FixScatteringLog()
 {
-  
+  atom->delete_callback(id,0);
+
+  memory->destroy(valST);
+  memory->destroy(valST_all);
+  memory->destroy(strucFac);
+  memory->destroy(shift);
+  memory->destroy(accumulator);
+  memory->destroy(naccumulator);
+  memory->destroy(correlation);
+  memory->destroy(countcor);
+  memory->destroy(insertindex);
+  memory->destroy(incoh_buf);
+  memory->destroy(incoh_all);
+  memory->destroy(hist);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -60,8 +119,6 @@ int FixScatteringLog::setmask()
 
 void FixScatteringLog::init() {
     profileCount = 0;
-    AllocArrays();
-    //printf("pb %d\n",profileBins);
     for (int i=0; i<profileBins; i++) {
       densityProfile[i]=0.0;
     }
@@ -70,7 +127,7 @@ void FixScatteringLog::init() {
 	strucFac[j][n]=0.0;
       }
     }
-    
+
     t_loc = 0;
     kmax = 0;
     ZeroSpacetimeCorr ();
@@ -78,7 +135,7 @@ void FixScatteringLog::init() {
 }
 
 /* ---------------------------------------------------------------------- */
-  
+
 void FixScatteringLog::setup(int vflag) {
   end_of_step();
 }
@@ -86,11 +143,10 @@ void FixScatteringLog::setup(int vflag) {
 /* ---------------------------------------------------------------------- */
 
 void FixScatteringLog::end_of_step() {
-  // Do every timestep (or every tickerstep)
-  //printf("Ticker, EvalSlit\n");
+  if (update->ntimestep % nevery) return;
   EvalSpacetimeCorr ();
-  
-  if (timestep == update->ntimestep) {
+
+  if (update->ntimestep == update->laststep) {
     output();
   }
 }
@@ -98,119 +154,206 @@ void FixScatteringLog::end_of_step() {
 /* ---------------------------------------------------------------------- */
 
 void FixScatteringLog::output() {
-    long double sysTime = Sim->systemTime/Sim->units.unitTime();
-    std::stringstream ss2;
-    ss2 << "density_profile_t" << sysTime << ".dat";
-    printf("EvalSlit: Density-Profile output written to %s \n",(ss2.str()).c_str());
-    std::string out_string2 = ss2.str();
-    FILE * out = fopen(out_string2.c_str(),"w");
-    PrintDensityProfile (out);
-    fclose(out);
-    
-    std::stringstream ss3;
-    ss3 << "Struc_Fac_t" << sysTime << ".dat";
-    printf("EvalSlit: Structure factor output written to %s \n",(ss3.str()).c_str());
-    std::string out_string3 = ss3.str();
-    out = fopen(out_string3.c_str(),"w");
-    PrintStrucFac (out);
-    fclose(out);
-    
+    ReduceSpacetimeCorrIn ();
+
+    // group->count() is collective, so every proc calls it
+    double N = group->count(igroup);
+
+    if (me == 0) {
+      double sysTime = update->ntimestep*update->dt;
+      std::stringstream ss2;
+      ss2 << "density_profile_t" << sysTime << ".dat";
+      printf("EvalSlit: Density-Profile output written to %s \n",(ss2.str()).c_str());
+      FILE * out = fopen(ss2.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintDensityProfile (out);
+      fclose(out);
+
+      std::stringstream ss3;
+      ss3 << "Struc_Fac_t" << sysTime << ".dat";
+      printf("EvalSlit: Structure factor output written to %s \n",(ss3.str()).c_str());
+      out = fopen(ss3.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintStrucFac (out,N);
+      fclose(out);
+
+      std::stringstream ss;
+      ss << "S_t" << sysTime << ".dat";
+      printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
+      out = fopen(ss.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintSpacetimeCorr (out,N);
+      fclose(out);
+
+      std::stringstream ss4;
+      ss4 << "SIn_t" << sysTime << ".dat";
+      printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss4.str()).c_str());
+      out = fopen(ss4.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintSpacetimeCorrIn (out);
+      fclose(out);
+    }
+
+    for (int i=0; i<profileBins; i++) densityProfile[i] = 0.0;
+    for (int j=0; j<nFunCorr; j++)
+      for (int n=0; n<(2*nModes-1)*(2*nModes-1); n++) strucFac[j][n]=0.0;
     profileCount = 0;
-    
-    std::string out_string;
-    std::stringstream ss;
-    ss << "S_t" << sysTime << ".dat";
-    out_string = ss.str();
-    printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
-    out = fopen(out_string.c_str(),"w");
-    PrintSpacetimeCorr (out);
     ZeroSpacetimeCorr ();
-    fclose(out);
-    
-    std::string out_string4;
-    std::stringstream ss4;
-    ss4 << "SIn_t" << sysTime << ".dat";
-    out_string4 = ss4.str();
-    printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss4.str()).c_str());
-    out = fopen(out_string4.c_str(),"w");
-    PrintSpacetimeCorrIn (out);
     ZeroSpacetimeCorrIn ();
-    fclose(out);
 }
-  
-  /* Help functions to calculate Structure factor and coherent scattering function */
-  void FixScatteringLog::AllocArrays(){
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
-    //printf("particles %d\n",N);
-    int nb,k;
-    AllocMem (valST, 8 * nModes * nFunCorr, real);
-   
-    AllocMem (densityProfile, profileBins, real);
-    AllocMem2 (strucFac, nFunCorr, (2*nModes-1)*(2*nModes-1), real);
-    
-    AllocMem2 (blocking_sum, N_blocks*N_levels, 2*N, real);
-    AllocMem2 (blocking_sumz, N_blocks*N_levels, N, real);
-    AllocMem2 (correlationIn, N_blocks*N_levels,nModes * nFunCorr, real);
-    AllocMem2 (countIn, N_blocks*N_levels,nModes * nFunCorr, int);
-    AllocMem2 (shift, N_blocks*N_levels, 8 * nModes * nFunCorr, real);
-    AllocMem2 (accumulator, N_levels, 8 * nModes * nFunCorr, real);
-    AllocMem (naccumulator, N_levels, int);
-    AllocMem2 (correlation, N_blocks*N_levels,nModes * nFunCorr, real);
-    AllocMem (countcor, N_blocks*N_levels,int);
-    AllocMem (insertindex, N_levels,int);
-    AllocMem (pos_save, 3*N,real);
-  }
-  
+
 /***************************************************************************************/
-  
+
+  /* One sample: the Fourier modes of the local group atoms are reduced to
+     proc 0, which runs the multi-tau correlator and the structure factor.
+     The incoherent part only needs the history of each atom, it is summed
+     per proc and reduced at output. */
   void FixScatteringLog::EvalSpacetimeCorr (){
     real b, c, c0, c1, c2, kVal, s, s1, s2;
     real cc, sc, QVal;
-    int j,  k, m, nb,  nv;
-    
-    const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
-    
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
-    for (j = 0; j < 8 * nModes * nFunCorr; j ++) valST[j] = 0.;
-    
+    int i, j, k, m, n, nv;
+
+    int nlocal = atom->nlocal;
+    int *mask = atom->mask;
+    double **x = atom->x;
+    imageint *image = atom->image;
+    double zlo = domain->boxlo[2];
+
+    for (j = 0; j < nST; j ++) valST[j] = 0.;
+
     // calculate the density profile
     profileCount++;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	double pos = Sim->particles[p1].getPosition()[2];
-	pos /= channel_w;
-	if (pos < 1) densityProfile[int(pos*profileBins)]++;
-      }
-    }
-    kVal = 2. * M_PI / Sim->primaryCellSize[1];
+    kVal = 2. * M_PI / domain->yprd;
     QVal = 2. * M_PI /(channel_w-1.0);
-    
-    //printf("check00\n");
-    
+
     // calculate FT for coherent scattering fct
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	j = 0;
-	//printf("pos %f\n",(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
-	for (int n=0; n<nModes; n++) {
-	  cc = cos (n*QVal*(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
-	  sc = sin (n*QVal*(Sim->particles[p1].getPosition()[2]-channel_w/2.0));
+    for (i = 0; i < nlocal; i++) {
+      if (!(mask[i] & groupbit)) continue;
+      double zrel = x[i][2] - zlo;
+      double pos = zrel/channel_w;
+      if (pos >= 0.0 && pos < 1.0) densityProfile[int(pos*profileBins)] += 1.0;
 
+      j = 0;
+      for (n=0; n<nModes; n++) {
+	cc = cos (n*QVal*(zrel-channel_w/2.0));
+	sc = sin (n*QVal*(zrel-channel_w/2.0));
+
+	for (k = 0; k < 2; k ++) {
+	  for (m = 0; m < nFunCorr; m ++) {
+	    if (m == 0) {
+	      b = kVal * x[i][k];
+	      c = cos (b);
+	      s = sin (b);
+	      c0 = c;
+	    } else if (m == 1) {
+	      c1 = c;
+	      s1 = s;
+	      c = 2. * c0 * c1 - 1.;
+	      s = 2. * c0 * s1;
+	    } else {
+	      c2 = c1;
+	      s2 = s1;
+	      c1 = c;
+	      s1 = s;
+	      c = 2. * c0 * c1 - c2;
+	      s = 2. * c0 * s1 - s2;
+	    }
+	    valST[j ++] += c*cc; //second element of SF -real part
+	    valST[j ++] += c*sc; //imaginary
+	    valST[j ++] += s*cc; //second element of SF -real part
+	    valST[j ++] += s*sc; //imaginary
+	  }
+	}
+      }
+    }
+
+    // all modes of all procs in one message
+    MPI_Reduce(valST,valST_all,nST,MPI_DOUBLE,MPI_SUM,0,world);
+
+    if (me == 0) {
+      // acumualte and calculate logarithmic correlation function
+      add(valST_all,0);
+
+      // calc structure factor
+      for (n=-nModes+1; n<nModes; n++) {
+	for (int n2=-nModes+1; n2<nModes; n2++) {
 	  for (k = 0; k < 2; k ++) {
+	    for (m = 0; m < nFunCorr; m ++) {
+	      int ind_j = abs(n)*8*nFunCorr + k*4*nFunCorr + 4*m;
+	      int ind_j2 = abs(n2)*8*nFunCorr + k*4*nFunCorr + 4*m;
+	      double c_cc = valST_all[ind_j];
+	      double c_sc = valST_all[ind_j+1];
+	      double s_cc = valST_all[ind_j+2];
+	      double s_sc = -valST_all[ind_j+3];
+	      double c_cc2 = valST_all[ind_j2];
+	      double c_sc2 = valST_all[ind_j2+1];
+	      double s_cc2 = valST_all[ind_j2+2];
+	      double s_sc2 = -valST_all[ind_j2+3];
+	      if (n<0) {
+		s_sc = - s_sc;
+		c_sc = - c_sc;
+	      }
+	      if (n2<0) {
+		s_sc2 = - s_sc2;
+		c_sc2 = - c_sc2;
+	      }
+	      strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1] += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
+	    }
+	  }
+	}
+      }
+    }
+
+    // calculate \Delta r in blocking algorithm for self-intermediate scattering function
+    // level k is updated every N_blocks^k samples, its block j0 holds the
+    // displacement over j0+1 blocks of the level below
+    int t = t_loc;
+    int nm = nModes*nFunCorr;
+    double unwrap[3],del[3];
+    for (i = 0; i < nlocal; i++) {
+      if (!(mask[i] & groupbit)) continue;
+      double *h = hist[i];
+      domain->unmap(x[i],image[i],unwrap);
+      if (t == 0) {
+	h[0] = unwrap[0];
+	h[1] = unwrap[1];
+	h[2] = unwrap[2];
+	continue;
+      }
+
+      int nblocks_to_k = 1;
+      for (k=0; k<N_levels; k++) {
+	if (k > 0) nblocks_to_k *= N_blocks;
+	if (t % nblocks_to_k) break;
+
+	if (k==0) {
+	  for (int d = 0; d < 3; d++) {
+	    del[d] = unwrap[d]-h[d];
+	    h[d] = unwrap[d];
+	  }
+	} else {
+	  double *last = &h[3 + 3*(N_blocks-1+(k-1)*N_blocks)];
+	  for (int d = 0; d < 3; d++) del[d] = last[d];
+	}
+
+	int j0 = (t / nblocks_to_k - 1) % N_blocks;
+	int slot = j0 + k*N_blocks;
+	double *bs = &h[3 + 3*slot];
+	if (j0==0) {
+	  for (int d = 0; d < 3; d++) bs[d] = del[d];
+	} else {
+	  for (int d = 0; d < 3; d++) bs[d] = bs[d-3] + del[d];
+	}
+
+	// now calculate incoherent scattering functions
+	for (n=0; n<nModes; n++) {
+	  cc = cos (n*QVal*bs[2]);
+	  sc = sin (n*QVal*bs[2]);
+
+	  for (int km = 0; km < 2; km ++) {
 	    for (m = 0; m < nFunCorr; m ++) {
 	      if (m == 0) {
-		b = kVal * Sim->particles[p1].getPosition()[k];
-		//if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
+		b = kVal * bs[km];
 		c = cos (b);
 		s = sin (b);
 		c0 = c;
@@ -227,146 +370,16 @@ void FixScatteringLog::output() {
 		c = 2. * c0 * c1 - c2;
 		s = 2. * c0 * s1 - s2;
 	      }
-	      valST[j ++] += c*cc; //second element of SF -real part
-	      valST[j ++] += c*sc; //imaginary 
-	      valST[j ++] += s*cc; //second element of SF -real part
-	      valST[j ++] += s*sc; //imaginary 
-	    }
-	  }
-	}
-      }
-    }
-    // acumualte and calculate logarithmic correlation function
-    add(valST,0);
-    
-    //printf("check0\n");
-    
-    // calc structure factor
-    for (int n=-nModes+1; n<nModes; n++) {
-      for (int n2=-nModes+1; n2<nModes; n2++) {
-	for (k = 0; k < 2; k ++) {
-	  for (m = 0; m < nFunCorr; m ++) {
-	    int ind_j = abs(n)*8*nFunCorr + k*4*nFunCorr + 4*m;
-	    int ind_j2 = abs(n2)*8*nFunCorr + k*4*nFunCorr + 4*m;
-	    double c_cc = valST[ind_j];
-	    double c_sc = valST[ind_j+1];
-	    double s_cc = valST[ind_j+2];
-	    double s_sc = -valST[ind_j+3];
-	    double c_cc2 = valST[ind_j2];
-	    double c_sc2 = valST[ind_j2+1];
-	    double s_cc2 = valST[ind_j2+2];
-	    double s_sc2 = -valST[ind_j2+3];
-	    if (n<0) {
-	      s_sc = - s_sc;
-	      c_sc = - c_sc;
-	    }
-	    if (n2<0) {
-	      s_sc2 = - s_sc2;
-	      c_sc2 = - c_sc2;
-	    }
-	    strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1] += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-	    //strucFac[m][n*(2*nModes-1)+n2] += 1.0;
-	  }
-	}
-      }
-    }
-    
-    //printf("check1\n");
-    
-    // calculate \Delta r in blocking algorithm for self-intermediate scattering function
-    int i = t_loc;
-    int np=0;
-    int max_levels = (int) (log(i)/log(N_blocks));
-    if (max_levels >= N_levels) max_levels = N_levels-1;
-    //printf("max_l %d\n",max_levels);
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	double delx,dely,delz;
-	int j0; // = i % N_blocks;
-	//if (np==0) printf("checkin0\n");
-	if (i==0) {
-	  pos_save[3*np] = Sim->particles[p1].getPosition()[0];
-	  pos_save[3*np+1] = Sim->particles[p1].getPosition()[1];
-	  pos_save[3*np+2] = Sim->particles[p1].getPosition()[2];
-	}
-	for (int k=0; k<(max_levels+1); k++) {
-	    
-	  if (k==0) {
-	    delx = Sim->particles[p1].getPosition()[0]-pos_save[3*np];
-	    dely = Sim->particles[p1].getPosition()[1]-pos_save[3*np+1];
-	    delz = Sim->particles[p1].getPosition()[2]-pos_save[3*np+2];
-	    pos_save[3*np] = Sim->particles[p1].getPosition()[0];
-	    pos_save[3*np+1] = Sim->particles[p1].getPosition()[1];
-	    pos_save[3*np+2] = Sim->particles[p1].getPosition()[2];
-	  } else {
-	    delx = blocking_sum[N_blocks-1+(k-1)*N_blocks][np];
-	    dely = blocking_sum[N_blocks-1+(k-1)*N_blocks][np+N];
-	    delz = blocking_sumz[N_blocks-1+(k-1)*N_blocks][np];
-	  }
-	    
-	  int nblocks_to_k = 1 ; // (int) round(pow(N_blocks,k));
-
-	  for (int kk=0; kk<k; kk++) nblocks_to_k *= N_blocks;
-	  //if (np==0) printf("checkin1\n");
-	  if (i % nblocks_to_k == 0) {
-	      
-	    j0 =  ((i) / nblocks_to_k-1) % N_blocks;  // was -1
-
-	    if (j0==0) {
-	      blocking_sum[j0+k*N_blocks][np] = delx; //blocking_sum[N_blocks-1][k-1][n] ;
-	      blocking_sum[j0+k*N_blocks][np+N] = dely; //blocking_sum[N_blocks-1][k-1][n] ;
-	      blocking_sumz[j0+k*N_blocks][np] = delz; //blocking_sum[N_blocks-1][k-1][n] ;
-	    }
-	    else {
-	      blocking_sum[j0+k*N_blocks][np] = blocking_sum[j0-1+k*N_blocks][np] + delx; 
-	      blocking_sum[j0+k*N_blocks][np+N] = blocking_sum[j0-1+k*N_blocks][np+N] + dely; 
-	      blocking_sumz[j0+k*N_blocks][np] = blocking_sumz[j0-1+k*N_blocks][np] + delz; 
-	    }
-	    
-	    //if (np==0) printf("checkin2\n");
-
-	    // now calculate incoherent scattering functions
-	    for (int n=0; n<nModes; n++) {
-	      cc = cos (n*QVal*blocking_sumz[j0+k*N_blocks][np]);
-	      sc = sin (n*QVal*blocking_sumz[j0+k*N_blocks][np]);
-
-	      for (int km = 0; km < 2; km ++) {
-		for (m = 0; m < nFunCorr; m ++) {
-		  if (m == 0) {
-		    b = kVal * blocking_sum[j0+k*N_blocks][km*N+np] ;
-		    //if (k==0) printf("x coord %f\n",Sim->particles[p1].getPosition()[k]);
-		    c = cos (b);
-		    s = sin (b);
-		    c0 = c;
-		  } else if (m == 1) {
-		    c1 = c;
-		    s1 = s;
-		    c = 2. * c0 * c1 - 1.;
-		    s = 2. * c0 * s1;
-		  } else {
-		    c2 = c1;
-		    s2 = s1;
-		    c1 = c;
-		    s1 = s;
-		    c = 2. * c0 * c1 - c2;
-		    s = 2. * c0 * s1 - s2;
-		  }
-		  
-		  nv = m + n*nFunCorr;
-		  correlationIn[j0+k*N_blocks][nv] += c*cc-s*sc;
-		  countIn[j0+k*N_blocks][nv] += 1;
-		}
-	      }
+
+	      nv = m + n*nFunCorr;
+	      correlationIn[slot*nm+nv] += c*cc-s*sc;
+	      countIn[slot*nm+nv] += 1.0;
 	    }
-	    //if (np==0) printf("checkin3\n");
 	  }
 	}
-	np++;
       }
     }
-    
-    //printf("check2\n");
-    
+
     int t_tot = (int) pow(N_blocks,N_levels);
     if (t_loc == t_tot) {
       AccumSpacetimeCorr ();
@@ -374,146 +387,124 @@ void FixScatteringLog::output() {
       kmax = 0;
     } else t_loc++;
   }
-  
+
   /***************************************************************************************/
-  
+
   void FixScatteringLog::add(real * val, int k){
     // If we exceed the correlator side, the value is discarded
     if (k == N_levels) return;
     if (k > kmax) kmax=k;
 
     // Insert new value in shift array
-    for (int i = 0; i < 8 * nFunCorr * nModes; i ++)
+    for (int i = 0; i < nST; i ++)
       shift[k*N_blocks+insertindex[k]][i] = val[i];
 
     // Add to accumulator and, if needed, add to next correlator
-    for (int i = 0; i < 8 * nFunCorr * nModes; i ++)
+    for (int i = 0; i < nST; i ++)
       accumulator[k][i] += val[i];
     ++naccumulator[k];
     if (naccumulator[k]==N_blocks) {
-      for (int i = 0; i < 8 * nFunCorr * nModes; i ++) accumulator[k][i] /= N_blocks;
+      for (int i = 0; i < nST; i ++) accumulator[k][i] /= N_blocks;
       add(&accumulator[k][0], k+1);
-      for (int i = 0; i < 8 * nFunCorr * nModes; i ++) accumulator[k][i]=0.0;
+      for (int i = 0; i < nST; i ++) accumulator[k][i]=0.0;
       naccumulator[k]=0;
     }
 
     // Calculate correlation function
-    unsigned int ind1=insertindex[k];
-    if (k==0) { // First correlator is different
-      int ind2=ind1;
-      for (int j=0;j<N_blocks;++j) {
-	for (int n=0; n<nModes; n++) {
-	  for (int kp = 0; kp < 2; kp ++) {
-	    for (int m = 0; m < nFunCorr; m ++) {
-	      int nv = m + n*nFunCorr;
-	      int ind_j = n*8*nFunCorr + kp*4*nFunCorr + 4*m;
-	      double c_cc = shift[k*N_blocks+ind2][ind_j];
-	      double c_sc = shift[k*N_blocks+ind2][ind_j+1];
-	      double s_cc = shift[k*N_blocks+ind2][ind_j+2];
-	      double s_sc = -shift[k*N_blocks+ind2][ind_j+3];
-	      double c_cc2 = shift[k*N_blocks+ind1][ind_j];
-	      double c_sc2 = shift[k*N_blocks+ind1][ind_j+1];
-	      double s_cc2 = shift[k*N_blocks+ind1][ind_j+2];
-	      double s_sc2 = -shift[k*N_blocks+ind1][ind_j+3];
-	      //printf("befor calc\n");
-	      if (c_cc > -1e10) {
-		correlation[k*N_blocks+j][nv]  += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-	      //printf("after calc\n");
-	      //if (n==1) printf("%f \n",tBuf[nb].acfST[nv][tBuf[nb].count]);
-		if (nv==0) ++countcor[k*N_blocks+j];
-	      }
-	    }
-	  }
-	}
-	--ind2;
-	if (ind2<0) ind2+=N_blocks;
-      }
-    } else {
-      int ind2=ind1-1;
-      for (int j=1;j<N_blocks;++j) {
-	if (ind2<0) ind2+=N_blocks;
+    // First correlator is different, the others start at lag 1
+    int ind1=insertindex[k];
+    int jlo = (k==0) ? 0 : 1;
+    int ind2=ind1-jlo;
+    for (int j=jlo;j<N_blocks;++j) {
+      if (ind2<0) ind2+=N_blocks;
+      const real *a = shift[k*N_blocks+ind2];
+      const real *a2 = shift[k*N_blocks+ind1];
+      if (a[0] > -1e10) {
 	for (int n=0; n<nModes; n++) {
 	  for (int kp = 0; kp < 2; kp ++) {
 	    for (int m = 0; m < nFunCorr; m ++) {
 	      int nv = m + n*nFunCorr;
 	      int ind_j = n*8*nFunCorr + kp*4*nFunCorr + 4*m;
-	      double c_cc = shift[k*N_blocks+ind2][ind_j];
-	      double c_sc = shift[k*N_blocks+ind2][ind_j+1];
-	      double s_cc = shift[k*N_blocks+ind2][ind_j+2];
-	      double s_sc = -shift[k*N_blocks+ind2][ind_j+3];
-	      double c_cc2 = shift[k*N_blocks+ind1][ind_j];
-	      double c_sc2 = shift[k*N_blocks+ind1][ind_j+1];
-	      double s_cc2 = shift[k*N_blocks+ind1][ind_j+2];
-	      double s_sc2 = -shift[k*N_blocks+ind1][ind_j+3];
-	      //printf("befor calc\n");
-	      if (c_cc > -1e10) {
-		correlation[k*N_blocks+j][nv]  += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
-		//printf("after calc\n");
-		//if (n==1) printf("%f \n",tBuf[nb].acfST[nv][tBuf[nb].count]);
-		if (nv==0) ++countcor[k*N_blocks+j];
-	      }
+	      double c_cc = a[ind_j];
+	      double c_sc = a[ind_j+1];
+	      double s_cc = a[ind_j+2];
+	      double s_sc = -a[ind_j+3];
+	      double c_cc2 = a2[ind_j];
+	      double c_sc2 = a2[ind_j+1];
+	      double s_cc2 = a2[ind_j+2];
+	      double s_sc2 = -a2[ind_j+3];
+	      correlation[k*N_blocks+j][nv]  += (c_cc + s_sc)*(c_cc2 + s_sc2) + (s_cc+c_sc)*(s_cc2+c_sc2);
 	    }
 	  }
 	}
-	--ind2;
+	// one count per axis, the output is the mean over x and y
+	countcor[k*N_blocks+j] += 2;
       }
+      --ind2;
     }
 
     ++insertindex[k];
     if (insertindex[k]==N_blocks) insertindex[k]=0;
 
   }
-  
+
 /***************************************************************************************/
 
   void FixScatteringLog::AccumSpacetimeCorr (){
-    
-    printf("accum1\n");
-
-    // print coherent
-    long double sysTime = Sim->systemTime/Sim->units.unitTime();
-    //printf("systemTime %Lf\n",sysTime);
-    std::string out_string;
-    std::stringstream ss;
-    ss << "S_t" << sysTime << ".dat";
-    out_string = ss.str();
-    printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
-    FILE * out = fopen(out_string.c_str(),"w");
-    PrintSpacetimeCorr (out);
+
+    ReduceSpacetimeCorrIn ();
+
+    // group->count() is collective, so every proc calls it
+    double N = group->count(igroup);
+
+    if (me == 0) {
+      // print coherent
+      double sysTime = update->ntimestep*update->dt;
+      std::stringstream ss;
+      ss << "S_t" << sysTime << ".dat";
+      printf("EvalSlit: Coherent scattering function output written to %s \n",(ss.str()).c_str());
+      FILE * out = fopen(ss.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintSpacetimeCorr (out,N);
+      fclose(out);
+
+      // incoherent scattering fct
+      std::stringstream ss2;
+      ss2 << "SIn_t" << sysTime << ".dat";
+      printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss2.str()).c_str());
+      out = fopen(ss2.str().c_str(),"w");
+      if (out == NULL) error->one(FLERR,"Cannot open fix scattering/log file");
+      PrintSpacetimeCorrIn (out);
+      fclose(out);
+    }
+
     ZeroSpacetimeCorr ();
-    fclose(out);
-    
-    printf("accum2\n");
-    
-    // incoherent scattering fct
-    std::string out_string2;
-    std::stringstream ss2;
-    ss2 << "SIn_t" << sysTime << ".dat";
-    out_string2 = ss2.str();
-    printf("EvalSlit: Incoherent scattering function output written to %s \n",(ss2.str()).c_str());
-    out = fopen(out_string2.c_str(),"w");
-    PrintSpacetimeCorrIn (out);
     ZeroSpacetimeCorrIn ();
-    fclose(out);
-    
-    printf("accum3\n");
   }
-  
+
 /***************************************************************************************/
 
-  void FixScatteringLog::ZeroSpacetimeCorr () 
+  /* incoherent sums and density profile of all procs, one message */
+  void FixScatteringLog::ReduceSpacetimeCorrIn ()
+  {
+    MPI_Reduce(incoh_buf,incoh_all,nincoh,MPI_DOUBLE,MPI_SUM,0,world);
+  }
+
+/***************************************************************************************/
+
+  void FixScatteringLog::ZeroSpacetimeCorr ()
   {
     for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int j = 0; j < 8*nModes * nFunCorr; j ++) { 
+      for (int j = 0; j < nST; j ++) {
 	shift[kp][j] = -2E10;
       }
-      for (int j = 0; j < nModes * nFunCorr; j ++) { 
+      for (int j = 0; j < nModes * nFunCorr; j ++) {
 	correlation[kp][j] = 0.;
       }
       countcor[kp] = 0;
     }
     for (int k = 0; k < N_levels; k ++) {
-      for (int j = 0; j < 8*nModes * nFunCorr; j ++) { 
+      for (int j = 0; j < nST; j ++) {
 	accumulator[k][j] = 0.;
       }
       naccumulator[k] = 0;
@@ -522,53 +513,37 @@ void FixScatteringLog::output() {
   }
 
 /***************************************************************************************/
-  
-  void FixScatteringLog::ZeroSpacetimeCorrIn () 
+
+  void FixScatteringLog::ZeroSpacetimeCorrIn ()
   {
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
-    
-    for (int kp = 0; kp < N_blocks*N_levels; kp ++) {
-      for (int i = 0; i < N; i ++) { 
-	blocking_sumz[kp][i] = 0.;
-	blocking_sum[kp][i] = 0.;
-	blocking_sum[kp][i+N] = 0.;
-      }
-      for (int j = 0; j < nModes * nFunCorr; j ++) { 
-	correlationIn[kp][j] = 0.;
-	countIn[kp][j] = 0;
-      }
-      
-    }
- 
+    // the per-atom history restarts with t_loc = 0
+    int n = 2*N_blocks*N_levels*nModes*nFunCorr;
+    for (int j = 0; j < n; j ++) incoh_buf[j] = 0.;
   }
-  
+
 /***************************************************************************************/
-  
+
   void FixScatteringLog::PrintDensityProfile (FILE *fp){
     real binsize = channel_w/((double) profileBins);
-    real vol = Sim->primaryCellSize[0]*Sim->primaryCellSize[1]*binsize;
-  
+    real vol = domain->xprd*domain->yprd*binsize;
+    const real *profile = incoh_all + 2*N_blocks*N_levels*nModes*nFunCorr;
+
     double n0 = 0.0;
-    int N=0;
-    
+    double N = 0.0;
+
     for (int i=0; i<profileBins; i++) {
-      fprintf(fp,"%f %f\n",i*binsize-channel_w/2.0,densityProfile[i]/((double) profileCount)/vol);
-      n0 += densityProfile[i]/((double) profileCount)/vol*binsize;
-      N += densityProfile[i];
-      densityProfile[i] = 0;
+      fprintf(fp,"%f %f\n",i*binsize-channel_w/2.0,profile[i]/((double) profileCount)/vol);
+      n0 += profile[i]/((double) profileCount)/vol*binsize;
+      N += profile[i];
     }
-    
-    printf("EvalSlit: n=%f, n0=%f, N=%d\n",n0,n0*Sim->primaryCellSize[2]/4.0,N/profileCount);
+
+    printf("EvalSlit: n=%f, n0=%f, N=%d\n",n0,n0*domain->zprd/4.0,
+           (int) (N/profileCount));
   }
-  
+
 /***************************************************************************************/
-  
-  void FixScatteringLog::PrintStrucFac  (FILE *fp){
+
+  void FixScatteringLog::PrintStrucFac  (FILE *fp, double N){
 
     fprintf(fp,"#qval ");
     for (int n=-nModes+1; n<nModes; n++) {
@@ -578,40 +553,29 @@ void FixScatteringLog::output() {
       }
     }
     fprintf(fp,"\n");
-    
+
     // print structure factor
-    real kval = 2. * M_PI / Sim->primaryCellSize[1];
+    real kval = 2. * M_PI / domain->yprd;
     for (int m = 0; m < nFunCorr; m ++) {
       fprintf(fp,"%f ",(m+1)*kval);
       for (int n=-nModes+1; n<nModes; n++) {
 	for (int n2=-nModes+1; n2<nModes; n2++) {
-	  for (const shared_ptr<Species>& sp1 : Sim->species) {
-	    fprintf(fp,"%f ",strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1]/((double) profileCount)/2. / sp1->getCount());
-	  }
+	  fprintf(fp,"%f ",strucFac[m][(n+nModes-1)*(2*nModes-1)+n2+nModes-1]/((double) profileCount)/2. / N);
 	}
       }
       fprintf(fp,"\n");
     }
   }
-  
+
 /***************************************************************************************/
 
-  void FixScatteringLog::PrintSpacetimeCorr (FILE *fp){
-    real tVal;
-    int j, n;
-    
-    int N=0;
-    for (const shared_ptr<Species>& sp1 : Sim->species) {
-      for (const size_t& p1 : *sp1->getRange()) {
-	N++;
-      }
-    }
+  void FixScatteringLog::PrintSpacetimeCorr (FILE *fp, double N){
+    int n;
+    const double dt = nevery*update->dt;
 
     for (n=0; n<nModes; n++) {
       fprintf (fp, "n=%d\n",n);
-      
-      const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
-      
+
       for (int j=0;j<N_blocks;++j) {
 	if (countcor[j] > 0) {
 	  double t = j*dt;
@@ -623,7 +587,7 @@ void FixScatteringLog::output() {
 	  fprintf (fp, "\n");
 	}
       }
-      
+
       for (int k=1;k<=kmax;++k) {
 	for (int j=1;j<N_blocks;++j) {
 	  if (countcor[k*N_blocks+j]>0) {
@@ -637,35 +601,87 @@ void FixScatteringLog::output() {
 	  }
 	}
       }
-      
+
       fprintf (fp, "\n\n");
     }
   }
-  
+
 /***************************************************************************************/
 
   void FixScatteringLog::PrintSpacetimeCorrIn (FILE *fp){
-    real tVal;
-    int j, n;
+    int n;
+    int nm = nModes*nFunCorr;
+    const real *corr = incoh_all;
+    const real *cnt = incoh_all + N_blocks*N_levels*nm;
+    const double dt = nevery*update->dt;
 
     for (n=0; n<nModes; n++) {
       fprintf (fp, "n=%d\n",n);
-      
-      const double dt = dynamic_cast<const SysTicker&>(*Sim->systems["SystemTicker"]).getPeriod() / Sim->units.unitTime();
-    
+
       for (int k=0; k<N_levels; k++)
 	for (int j=0; j<N_blocks; j++) {
+	  int slot = k*N_blocks+j;
 	  double time_here = (j+1) * (pow(N_blocks,k))*dt;
 	  fprintf (fp, "%8.4f", time_here);
 	  for (int m = 0; m < nFunCorr; m ++) {
 	    int nv = m + n*nFunCorr;
-	    if (countIn[k*N_blocks+j][nv] > 0) fprintf (fp, " %8.4f", correlationIn[k*N_blocks+j][nv]/countIn[k*N_blocks+j][nv]);
+	    if (cnt[slot*nm+nv] > 0) fprintf (fp, " %8.4f", corr[slot*nm+nv]/cnt[slot*nm+nv]);
 	  }
 	  fprintf (fp, "\n");
 	}
-      
+
       fprintf (fp, "\n\n");
     }
   }
- 
-}
\ No newline at end of file
+
+/* ----------------------------------------------------------------------
+   memory usage of local atom-based arrays and the correlators
+------------------------------------------------------------------------- */
+
+double FixScatteringLog::memory_usage()
+{
+  int nslot = N_blocks*N_levels;
+  double bytes = (double) atom->nmax * nhist * sizeof(double);
+  bytes += (double) (nslot + N_levels + 2) * nST * sizeof(real);
+  bytes += (double) (nslot*nModes*nFunCorr + 2*nincoh) * sizeof(real);
+  bytes += (double) nFunCorr*(2*nModes-1)*(2*nModes-1) * sizeof(real);
+  return bytes;
+}
+
+/* ----------------------------------------------------------------------
+   allocate atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::grow_arrays(int nmax)
+{
+  memory->grow(hist,nmax,nhist,"scattering/log:hist");
+}
+
+/* ----------------------------------------------------------------------
+   copy values within local atom-based array
+------------------------------------------------------------------------- */
+
+void FixScatteringLog::copy_arrays(int i, int j, int delflag)
+{
+  memcpy(hist[j],hist[i],nhist*sizeof(double));
+}
+
+/* ----------------------------------------------------------------------
+   pack values in local atom-based array for exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringLog::pack_exchange(int i, double *buf)
+{
+  for (int m = 0; m < nhist; m++) buf[m] = hist[i][m];
+  return nhist;
+}
+
+/* ----------------------------------------------------------------------
+   unpack values in local atom-based array from exchange with another proc
+------------------------------------------------------------------------- */
+
+int FixScatteringLog::unpack_exchange(int nlocal, double *buf)
+{
+  for (int m = 0; m < nhist; m++) hist[nlocal][m] = buf[m];
+  return nhist;
+}
@@ -21,19 +21,7 @@ FixStyle(scattering/log,FixScatteringLog)
 #define LMP_FIX_SCATTERING_LOG_H
 
 #include "fix.h"
-#include <vector>
-
-
-#define AllocMem(a, n, t) a = (t *) malloc ((n) * sizeof (t))
-
-#define AllocMem2(a, n1, n2, t)\
-	  AllocMem (a, n1, t *);\
-	  AllocMem (a[0], n1 * n2, t);\
-	  for (k = 1; k < n1; k ++) a[k] = a[k - 1] + n2;
-	  
-#define Sqr(x) ((x) * (x))
-
-
+#include <stdio.h>
 
 typedef double real;
 
@@ -47,53 +35,84 @@ class FixScatteringLog : public Fix {
     void init();
     void setup(int);
     void end_of_step();
-    
+
+    double memory_usage();
+    void grow_arrays(int);
+    void copy_arrays(int, int, int);
+    int pack_exchange(int, double *);
+    int unpack_exchange(int, double *);
 
   protected:
+    int me;
 
+    // Fourier modes of this proc, reduced to proc 0 in one message per sample
     real *valST;
+    real *valST_all;
+    int nST;
     int nFunCorr;
     int nModes;
     real channel_w;
-    
-    real *densityProfile;
+
+    real *densityProfile;     // view into incoh_buf
     int profileBins;
     int profileCount;
-    
+
     real **strucFac;
 
-    void AllocArrays();
     void EvalSpacetimeCorr ();
     void add (real * val, int k);
     void AccumSpacetimeCorr ();
+    void ReduceSpacetimeCorrIn ();
     void ZeroSpacetimeCorr ();
     void ZeroSpacetimeCorrIn ();
-    void PrintSpacetimeCorr (FILE *fp);
+    void PrintSpacetimeCorr (FILE *fp, double N);
     void PrintSpacetimeCorrIn (FILE *fp);
     void PrintDensityProfile (FILE *fp);
-    void PrintStrucFac (FILE *fp);
+    void PrintStrucFac (FILE *fp, double N);
     void output();
-    
+
     int N_blocks;
     int N_levels;
-    real ** blocking_sum;
-    real * pos_save;
-    real ** blocking_sumz;
-    real ** correlationIn;
-    int ** countIn;
-    int * insertindex;
-    
+
+    // per-atom history, migrates with the atoms: the last unwrapped
+    // position, then the blocked displacement of every (level,block)
+    double **hist;
+    int nhist;
+
+    // incoherent sums of this proc and the density profile, all views
+    // into incoh_buf so the output needs a single reduction
+    real * correlationIn;
+    real * countIn;
+    real * incoh_buf;
+    real * incoh_all;
+    int nincoh;
+
     int kmax;
     int t_loc;
-    
+
+    // multi-tau correlator of the coherent modes, only used on proc 0
     real ** shift;
     real ** accumulator;
     int * naccumulator;
     real ** correlation;
     int * countcor;
-
+    int * insertindex;
   };
 }
 
-#endif 
 #endif
+#endif
+
+/* ERROR/WARNING messages:
+
+E: Illegal fix scattering/log command
+
+Self-explanatory.  Check the input script syntax and compare to the
+documentation for the command.
+
+E: Cannot open fix scattering/log file
+
+One of the output files cannot be opened.  Check that the path and name are
+correct.
+
+*/
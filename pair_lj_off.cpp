@@ -35,11 +35,17 @@
 using namespace LAMMPS_NS;
 using namespace MathConst;
 
+// tables start at r_offset + TABINNER*sigma, where the force is ~900 epsilon/sigma
+
+#define TABINNER 0.8
+
 /* ---------------------------------------------------------------------- */
 
 PairLJOff::PairLJOff(LAMMPS *lmp) : Pair(lmp)
 {
   writedata = 1;
+  ntable = 0;
+  ftab = dftab = etab = detab = NULL;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -59,16 +65,24 @@ PairLJOff::~PairLJOff()
     memory->destroy(lj3);
     memory->destroy(lj4);
     memory->destroy(offset);
+    memory->destroy(offsq);
+    memory->destroy(tabrow);
+    memory->destroy(tabinnersq);
+    memory->destroy(tabinvdelta);
   }
+  memory->destroy(ftab);
+  memory->destroy(dftab);
+  memory->destroy(etab);
+  memory->destroy(detab);
 }
 
 /* ---------------------------------------------------------------------- */
 
 void PairLJOff::compute(int eflag, int vflag)
 {
-  int i,j,ii,jj,inum,jnum,itype,jtype;
+  int i,j,ii,jj,inum,jnum,itype,jtype,k,noverlap;
   double xtmp,ytmp,ztmp,delx,dely,delz,evdwl,fpair;
-  double rsq,r,rinv,rinv_norm,r2inv,r6inv,forcelj,factor_lj;
+  double rsq,r,rinv,rinv_norm,r2inv,r6inv,forcelj,factor_lj,p,frac;
   int *ilist,*jlist,*numneigh,**firstneigh;
 
   evdwl = 0.0;
@@ -87,6 +101,11 @@ void PairLJOff::compute(int eflag, int vflag)
   numneigh = list->numneigh;
   firstneigh = list->firstneigh;
 
+  // overlapping pairs are only counted here, the error is raised
+  // after the loop so the inner loop has no I/O
+
+  noverlap = 0;
+
   // loop over neighbors of my atoms
 
   for (ii = 0; ii < inum; ii++) {
@@ -110,48 +129,51 @@ void PairLJOff::compute(int eflag, int vflag)
       jtype = type[j];
 
       if (rsq < cutsq[itype][jtype]) {
-	r = sqrt(rsq);
-	
-
-	
-	rinv_norm = 1.0/r;
-	rinv = 1.0/(r-r_offset[itype][jtype]);
-        r2inv = rinv*rinv;
-        r6inv = r2inv*r2inv*r2inv;
-        forcelj = r6inv * (lj1[itype][jtype]*r6inv - lj2[itype][jtype]);
-        fpair = factor_lj*forcelj*rinv*rinv_norm;
-//	printf("dist = %f, eff.dist = %f, fpair = %f\n",r,r-r_offset[itype][jtype],fpair);
-	if (!eflag) if(r<r_offset[itype][jtype]){
-	  printf("distance = %f < offset = %f !\n",r,r_offset[itype][jtype]);
-	  error->all(FLERR,"Distance between particles too small");
-	}
-	
+        if (rsq < offsq[itype][jtype]) {
+          noverlap++;
+          continue;
+        }
+
+        if (rsq >= tabinnersq[itype][jtype]) {
+          const int row = tabrow[itype][jtype];
+          p = (rsq - tabinnersq[itype][jtype]) * tabinvdelta[itype][jtype];
+          k = static_cast<int> (p);
+          frac = p - k;
+          fpair = factor_lj*(ftab[row][k] + frac*dftab[row][k]);
+          if (eflag) evdwl = factor_lj*(etab[row][k] + frac*detab[row][k]);
+        } else {
+          r = sqrt(rsq);
+          rinv_norm = 1.0/r;
+          rinv = 1.0/(r-r_offset[itype][jtype]);
+          r2inv = rinv*rinv;
+          r6inv = r2inv*r2inv*r2inv;
+          forcelj = r6inv * (lj1[itype][jtype]*r6inv - lj2[itype][jtype]);
+          fpair = factor_lj*forcelj*rinv*rinv_norm;
+          if (eflag) {
+            evdwl = r6inv*(lj3[itype][jtype]*r6inv-lj4[itype][jtype]) -
+              offset[itype][jtype];
+            evdwl *= factor_lj;
+          }
+        }
+
         f[i][0] += delx*fpair;
         f[i][1] += dely*fpair;
         f[i][2] += delz*fpair;
-	
-	//printf ("neigh: %f %f %f\n",delx*fpair,dely*fpair,delz*fpair);
-	
+
         if (newton_pair || j < nlocal) {
           f[j][0] -= delx*fpair;
           f[j][1] -= dely*fpair;
           f[j][2] -= delz*fpair;
         }
 
-        if (eflag) {
-          evdwl = r6inv*(lj3[itype][jtype]*r6inv-lj4[itype][jtype]) -
-            offset[itype][jtype];
-          evdwl *= factor_lj;
-        }
-
         if (evflag) ev_tally(i,j,nlocal,newton_pair,
                              evdwl,0.0,fpair,delx,dely,delz);
-	
-	//printf("neighbor: %d %d %f %f %f\n",i,j,r,fpair,evdwl);
       }
     }
   }
 
+  if (noverlap) error->one(FLERR,"Distance between particles too small");
+
   if (vflag_fdotr) virial_fdotr_compute();
 }
 
@@ -180,6 +202,10 @@ void PairLJOff::allocate()
   memory->create(lj3,n+1,n+1,"pair:lj3");
   memory->create(lj4,n+1,n+1,"pair:lj4");
   memory->create(offset,n+1,n+1,"pair:offset");
+  memory->create(offsq,n+1,n+1,"pair:offsq");
+  memory->create(tabrow,n+1,n+1,"pair:tabrow");
+  memory->create(tabinnersq,n+1,n+1,"pair:tabinnersq");
+  memory->create(tabinvdelta,n+1,n+1,"pair:tabinvdelta");
 }
 
 /* ----------------------------------------------------------------------
@@ -188,10 +214,18 @@ void PairLJOff::allocate()
 
 void PairLJOff::settings(int narg, char **arg)
 {
-  if (narg != 1) error->all(FLERR,"Illegal pair_style command");
+  if (narg != 1 && narg != 3) error->all(FLERR,"Illegal pair_style command");
 
   cut_global = force->numeric(FLERR,arg[0]);
 
+  ntable = 0;
+  if (narg == 3) {
+    if (strcmp(arg[1],"table") != 0)
+      error->all(FLERR,"Illegal pair_style command");
+    ntable = force->inumeric(FLERR,arg[2]);
+    if (ntable < 2) error->all(FLERR,"Illegal pair_style command");
+  }
+
   // reset cutoffs that have been explicitly set
 
   if (allocated) {
@@ -239,6 +273,30 @@ void PairLJOff::coeff(int narg, char **arg)
 }
 
 
+/* ----------------------------------------------------------------------
+   init specific to this pair style
+------------------------------------------------------------------------- */
+
+void PairLJOff::init_style()
+{
+  Pair::init_style();
+
+  // one table row per type pair i <= j
+
+  memory->destroy(ftab);
+  memory->destroy(dftab);
+  memory->destroy(etab);
+  memory->destroy(detab);
+  if (ntable) {
+    int n = atom->ntypes;
+    int npair = n*(n+1)/2;
+    memory->create(ftab,npair,ntable+1,"pair:ftab");
+    memory->create(dftab,npair,ntable+1,"pair:dftab");
+    memory->create(etab,npair,ntable+1,"pair:etab");
+    memory->create(detab,npair,ntable+1,"pair:detab");
+  }
+}
+
 /* ----------------------------------------------------------------------
    init for one type pair i,j and corresponding j,i
 ------------------------------------------------------------------------- */
@@ -270,9 +328,54 @@ double PairLJOff::init_one(int i, int j)
   r_offset[j][i] = r_offset[i][j];
   offset[j][i] = offset[i][j];
 
+  if (r_offset[i][j] > 0.0) offsq[i][j] = r_offset[i][j]*r_offset[i][j];
+  else offsq[i][j] = -1.0;
+  offsq[j][i] = offsq[i][j];
+
+  build_table(i,j);
+
   return cut[i][j];
 }
 
+/* ----------------------------------------------------------------------
+   tabulate fpair and energy of type pair i,j on a grid linear in r^2
+   a pair without table gets tabinnersq = cut^2, which no pair reaches
+------------------------------------------------------------------------- */
+
+void PairLJOff::build_table(int i, int j)
+{
+  double cutsq_one = cut[i][j]*cut[i][j];
+  double rinner = MAX(r_offset[i][j],0.0) + TABINNER*sigma[i][j];
+
+  tabinnersq[i][j] = tabinnersq[j][i] = cutsq_one;
+  tabinvdelta[i][j] = tabinvdelta[j][i] = 0.0;
+  tabrow[i][j] = tabrow[j][i] = 0;
+  if (ntable == 0 || rinner*rinner >= cutsq_one) return;
+
+  int n = atom->ntypes;
+  int row = (i-1)*n - (i-1)*(i-2)/2 + (j-i);
+  double innersq = rinner*rinner;
+  double delta = (cutsq_one - innersq)/ntable;
+
+  tabrow[i][j] = tabrow[j][i] = row;
+  tabinnersq[i][j] = tabinnersq[j][i] = innersq;
+  tabinvdelta[i][j] = tabinvdelta[j][i] = 1.0/delta;
+
+  double r,rinv,r6inv;
+  for (int k = 0; k <= ntable; k++) {
+    r = sqrt(innersq + k*delta);
+    rinv = 1.0/(r-r_offset[i][j]);
+    r6inv = rinv*rinv*rinv*rinv*rinv*rinv;
+    ftab[row][k] = r6inv * (lj1[i][j]*r6inv - lj2[i][j]) * rinv/r;
+    etab[row][k] = r6inv*(lj3[i][j]*r6inv-lj4[i][j]) - offset[i][j];
+  }
+  for (int k = 0; k < ntable; k++) {
+    dftab[row][k] = ftab[row][k+1] - ftab[row][k];
+    detab[row][k] = etab[row][k+1] - etab[row][k];
+  }
+  dftab[row][ntable] = detab[row][ntable] = 0.0;
+}
+
 /* ----------------------------------------------------------------------
    proc 0 writes to restart file
 ------------------------------------------------------------------------- */
@@ -394,3 +497,17 @@ double PairLJOff::single(int i, int j, int itype, int jtype, double rsq,
     offset[itype][jtype];
   return factor_lj*philj;
 }
+
+/* ----------------------------------------------------------------------
+   memory usage of the tables on top of the per-atom arrays
+------------------------------------------------------------------------- */
+
+double PairLJOff::memory_usage()
+{
+  double bytes = Pair::memory_usage();
+  if (ntable) {
+    int n = atom->ntypes;
+    bytes += 4.0 * n*(n+1)/2 * (ntable+1) * sizeof(double);
+  }
+  return bytes;
+}
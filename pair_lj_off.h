@@ -31,6 +31,7 @@ class PairLJOff : public Pair {
   virtual void compute(int, int);
   void settings(int, char **);
   void coeff(int, char **);
+  void init_style();
   double init_one(int, int);
   void write_restart(FILE *);
   void read_restart(FILE *);
@@ -39,6 +40,7 @@ class PairLJOff : public Pair {
   void write_data(FILE *);
   void write_data_all(FILE *);
   double single(int, int, int, int, double, double, double, double &);
+  virtual double memory_usage();
 
  protected:
   double cut_global;
@@ -47,8 +49,18 @@ class PairLJOff : public Pair {
 // remark 2: cutoff includes the offset that means included are interactions with distance > cutoff
   double **epsilon,**sigma,**r_offset;
   double **lj1,**lj2,**lj3,**lj4,**offset;
+  double **offsq;                 // r_offset^2, closer pairs overlap
+
+  // optional tables linear in r^2 between (r_offset + TABINNER*sigma)^2
+  // and cut^2, closer pairs are computed analytically
+  // not stored in restart files to keep their format, re-issue pair_style
+  int ntable;                     // points per type pair, 0 = no tables
+  int **tabrow;                   // row of type pair in the tables
+  double **tabinnersq,**tabinvdelta;
+  double **ftab,**dftab,**etab,**detab;
 
   virtual void allocate();
+  void build_table(int, int);
 };
 
 }
@@ -68,4 +80,9 @@ E: Incorrect args for pair coefficients
 
 Self-explanatory.  Check the input script or data file.
 
+E: Distance between particles too small
+
+Two atoms are closer than the offset r_offset of their pair, where the
+potential diverges.
+
 */
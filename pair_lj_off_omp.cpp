@@ -0,0 +1,197 @@
+/* ----------------------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+/* ----------------------------------------------------------------------
+   OpenMP version of pair lj/off, threading as in pair lj/cut/omp
+------------------------------------------------------------------------- */
+
+#include <math.h>
+#include "pair_lj_off_omp.h"
+#include "atom.h"
+#include "comm.h"
+#include "force.h"
+#include "neighbor.h"
+#include "neigh_list.h"
+#include "error.h"
+#include "timer.h"
+#include "suffix.h"
+
+using namespace LAMMPS_NS;
+
+/* ---------------------------------------------------------------------- */
+
+PairLJOffOMP::PairLJOffOMP(LAMMPS *lmp) :
+  PairLJOff(lmp), ThrOMP(lmp, THR_PAIR)
+{
+  suffix_flag |= Suffix::OMP;
+  respa_enable = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+void PairLJOffOMP::compute(int eflag, int vflag)
+{
+  if (eflag || vflag) {
+    ev_setup(eflag,vflag);
+  } else evflag = vflag_fdotr = 0;
+
+  const int nall = atom->nlocal + atom->nghost;
+  const int nthreads = comm->nthreads;
+  const int inum = list->inum;
+  int noverlap = 0;
+
+#if defined(_OPENMP)
+#pragma omp parallel default(none) shared(eflag,vflag,nall,nthreads,inum) reduction(+:noverlap)
+#endif
+  {
+    int ifrom, ito, tid;
+
+    loop_setup_thr(ifrom, ito, tid, inum, nthreads);
+    ThrData *thr = fix->get_thr(tid);
+    thr->timer(Timer::START);
+    ev_setup_thr(eflag, vflag, nall, eatom, vatom, thr);
+
+    if (evflag) {
+      if (eflag) {
+        if (force->newton_pair) noverlap += eval<1,1,1>(ifrom, ito, thr);
+        else noverlap += eval<1,1,0>(ifrom, ito, thr);
+      } else {
+        if (force->newton_pair) noverlap += eval<1,0,1>(ifrom, ito, thr);
+        else noverlap += eval<1,0,0>(ifrom, ito, thr);
+      }
+    } else {
+      if (force->newton_pair) noverlap += eval<0,0,1>(ifrom, ito, thr);
+      else noverlap += eval<0,0,0>(ifrom, ito, thr);
+    }
+    thr->timer(Timer::PAIR);
+    reduce_thr(this, eflag, vflag, thr);
+  } // end of omp parallel region
+
+  if (noverlap) error->one(FLERR,"Distance between particles too small");
+}
+
+/* ----------------------------------------------------------------------
+   returns the number of pairs closer than r_offset
+------------------------------------------------------------------------- */
+
+template <int EVFLAG, int EFLAG, int NEWTON_PAIR>
+int PairLJOffOMP::eval(int iifrom, int iito, ThrData * const thr)
+{
+  const dbl3_t * _noalias const x = (dbl3_t *) atom->x[0];
+  dbl3_t * _noalias const f = (dbl3_t *) thr->get_f()[0];
+  const int * _noalias const type = atom->type;
+  const double * _noalias const special_lj = force->special_lj;
+  const int * _noalias const ilist = list->ilist;
+  const int * _noalias const numneigh = list->numneigh;
+  const int * const * const firstneigh = list->firstneigh;
+
+  double xtmp,ytmp,ztmp,delx,dely,delz,fxtmp,fytmp,fztmp;
+  double rsq,r,rinv,rinv_norm,r2inv,r6inv,forcelj,factor_lj,evdwl,fpair,p,frac;
+
+  const int nlocal = atom->nlocal;
+  int j,jj,jnum,jtype,k;
+  int noverlap = 0;
+
+  evdwl = 0.0;
+
+  // loop over neighbors of my atoms
+
+  for (int ii = iifrom; ii < iito; ++ii) {
+    const int i = ilist[ii];
+    const int itype = type[i];
+    const int    * _noalias const jlist = firstneigh[i];
+    const double * _noalias const cutsqi = cutsq[itype];
+    const double * _noalias const offsqi = offsq[itype];
+    const double * _noalias const tabinnersqi = tabinnersq[itype];
+    const double * _noalias const tabinvdeltai = tabinvdelta[itype];
+    const int    * _noalias const tabrowi = tabrow[itype];
+    const double * _noalias const r_offseti = r_offset[itype];
+    const double * _noalias const lj1i = lj1[itype];
+    const double * _noalias const lj2i = lj2[itype];
+    const double * _noalias const lj3i = lj3[itype];
+    const double * _noalias const lj4i = lj4[itype];
+    const double * _noalias const offseti = offset[itype];
+
+    xtmp = x[i].x;
+    ytmp = x[i].y;
+    ztmp = x[i].z;
+    jnum = numneigh[i];
+    fxtmp=fytmp=fztmp=0.0;
+
+    for (jj = 0; jj < jnum; jj++) {
+      j = jlist[jj];
+      factor_lj = special_lj[sbmask(j)];
+      j &= NEIGHMASK;
+
+      delx = xtmp - x[j].x;
+      dely = ytmp - x[j].y;
+      delz = ztmp - x[j].z;
+      rsq = delx*delx + dely*dely + delz*delz;
+      jtype = type[j];
+
+      if (rsq < cutsqi[jtype]) {
+        if (rsq < offsqi[jtype]) {
+          noverlap++;
+          continue;
+        }
+
+        if (rsq >= tabinnersqi[jtype]) {
+          const int row = tabrowi[jtype];
+          p = (rsq - tabinnersqi[jtype]) * tabinvdeltai[jtype];
+          k = static_cast<int> (p);
+          frac = p - k;
+          fpair = factor_lj*(ftab[row][k] + frac*dftab[row][k]);
+          if (EFLAG) evdwl = factor_lj*(etab[row][k] + frac*detab[row][k]);
+        } else {
+          r = sqrt(rsq);
+          rinv_norm = 1.0/r;
+          rinv = 1.0/(r-r_offseti[jtype]);
+          r2inv = rinv*rinv;
+          r6inv = r2inv*r2inv*r2inv;
+          forcelj = r6inv * (lj1i[jtype]*r6inv - lj2i[jtype]);
+          fpair = factor_lj*forcelj*rinv*rinv_norm;
+          if (EFLAG) {
+            evdwl = r6inv*(lj3i[jtype]*r6inv-lj4i[jtype]) - offseti[jtype];
+            evdwl *= factor_lj;
+          }
+        }
+
+        fxtmp += delx*fpair;
+        fytmp += dely*fpair;
+        fztmp += delz*fpair;
+        if (NEWTON_PAIR || j < nlocal) {
+          f[j].x -= delx*fpair;
+          f[j].y -= dely*fpair;
+          f[j].z -= delz*fpair;
+        }
+
+        if (EVFLAG) ev_tally_thr(this,i,j,nlocal,NEWTON_PAIR,
+                                 evdwl,0.0,fpair,delx,dely,delz,thr);
+      }
+    }
+    f[i].x += fxtmp;
+    f[i].y += fytmp;
+    f[i].z += fztmp;
+  }
+  return noverlap;
+}
+
+/* ---------------------------------------------------------------------- */
+
+double PairLJOffOMP::memory_usage()
+{
+  double bytes = memory_usage_thr();
+  bytes += PairLJOff::memory_usage();
+
+  return bytes;
+}
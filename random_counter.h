@@ -0,0 +1,83 @@
+/* -*- c++ -*- ----------------------------------------------------------
+   LAMMPS - Large-scale Atomic/Molecular Massively Parallel Simulator
+   http://lammps.sandia.gov, Sandia National Laboratories
+   Steve Plimpton, sjplimp@sandia.gov
+
+   Copyright (2003) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the GNU General Public License.
+
+   See the README file in the top-level LAMMPS directory.
+------------------------------------------------------------------------- */
+
+// Counter-based random numbers: the deviates depend only on a key built
+// from (fix ID,seed,timestep,tag), not on the order of the atoms, the thread or
+// the proc that draws them. Hash is splitmix64, normals by Box-Muller.
+
+#ifndef LMP_RANDOM_COUNTER_H
+#define LMP_RANDOM_COUNTER_H
+
+#include <math.h>
+#include <stdint.h>
+#include "lmptype.h"
+
+namespace LAMMPS_NS {
+
+namespace RandomCounter {
+
+  inline uint64_t mix64(uint64_t z)
+  {
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // stream of one fix: FNV-1a hash of its ID, so fixes with the same
+  // seed still draw independent numbers
+
+  inline uint64_t stream_key(const char *id)
+  {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *id; id++) h = (h ^ (unsigned char) *id) * 0x100000001b3ULL;
+    return h;
+  }
+
+  // key of one atom at one timestep, leaves room for 4 draws per key
+
+  inline uint64_t step_key(uint64_t stream, int seed, bigint ntimestep)
+  {
+    return mix64(stream ^ mix64((uint64_t) seed ^ mix64((uint64_t) ntimestep)));
+  }
+
+  inline uint64_t atom_key(uint64_t stepkey, tagint tag)
+  {
+    return mix64(stepkey ^ (uint64_t) tag) << 2;
+  }
+
+  // uniform in the open interval (0,1)
+
+  inline double uniform_open(uint64_t z)
+  {
+    return ((z >> 11) + 0.5) * (1.0/9007199254740992.0);
+  }
+
+  // three normal deviates from four uniforms
+
+  inline void gaussian3(uint64_t key, double *g)
+  {
+    const double twopi = 6.28318530717958647692;
+    double r = sqrt(-2.0*log(uniform_open(mix64(key))));
+    double phi = twopi*uniform_open(mix64(key+1));
+    g[0] = r*cos(phi);
+    g[1] = r*sin(phi);
+    r = sqrt(-2.0*log(uniform_open(mix64(key+2))));
+    phi = twopi*uniform_open(mix64(key+3));
+    g[2] = r*cos(phi);
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+"""Reader for the binary frame files written with "format binary" by
+the correlation fixes, fix cdf and fix msd/log, and with "output binary"
+by fix ave/time (see binary_frame.h).
+
+The file is memory mapped, every frame is returned as a numpy view into
+the mapping, so no data is copied.
+
+  python binary_frame.py corr.bin            # print header and frame list
+
+  from binary_frame import BinaryFrameFile
+  f = BinaryFrameFile("corr.bin")
+  step, data = f.frames[-1]                  # data[nrows][ncols]
+  vacf = data[:, f.column("v1*v1")]
+"""
+
+import sys
+import numpy as np
+
+MAGIC = b"GLEFRAME"
+NAMELEN = 32
+
+
+class BinaryFrameFile(object):
+
+    def __init__(self, filename):
+        self.raw = np.memmap(filename, dtype=np.uint8, mode="r")
+        if self.raw[:8].tobytes() != MAGIC:
+            raise ValueError("%s is not a binary frame file" % filename)
+
+        # detect byte order from the endian field
+        order = "<"
+        if np.frombuffer(self.raw, dtype="<i4", count=1, offset=12)[0] != 0x01020304:
+            order = ">"
+        head = np.frombuffer(self.raw, dtype=order + "i4", count=4, offset=8)
+        self.version, self.ncols, header_size = int(head[0]), int(head[2]), int(head[3])
+        self.id = self._string(24)
+        self.names = [self._string(64 + NAMELEN*i) for i in range(self.ncols)]
+
+        # scan the frames, a truncated last frame is ignored
+        self.frames = []
+        offset = header_size
+        while offset + 16 <= len(self.raw):
+            step, nrows = np.frombuffer(self.raw, dtype=order + "i8", count=2, offset=offset)
+            nbytes = 8*int(nrows)*self.ncols
+            if offset + 16 + nbytes > len(self.raw):
+                break
+            data = np.frombuffer(self.raw, dtype=order + "f8", count=int(nrows)*self.ncols,
+                                 offset=offset + 16).reshape(int(nrows), self.ncols)
+            self.frames.append((int(step), data))
+            offset += 16 + nbytes
+
+    def _string(self, offset):
+        return self.raw[offset:offset + NAMELEN].tobytes().split(b"\0")[0].decode()
+
+    def column(self, name):
+        return self.names.index(name)
+
+
+if __name__ == "__main__":
+    for filename in sys.argv[1:]:
+        f = BinaryFrameFile(filename)
+        print("# %s: fix %s, %d columns, %d frames" % (filename, f.id, f.ncols, len(f.frames)))
+        print("# " + " ".join(f.names))
+        for step, data in f.frames:
+            print("%d %d" % (step, data.shape[0]))